@@ -1,7 +1,14 @@
 #include "inst.hpp"
+#include "inst_arena.hpp"
 #include "arch_state.hpp"
+#include "csr_file.hpp"
+#include "fast_arch_state.hpp"
+#include "sparse_mem.hpp"
 #include "system.hpp"
+#include "vec_kernels.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -37,7 +44,7 @@ namespace rvfun
 {
 
 /// (Compressed) Load Immediate (add rd = r0 + i)
-class CompLI : public Inst
+class CompLI final : public InstBase<CompLI>
 {
 public:
 	CompLI(uint8_t rd = 0, int8_t imm = 0)
@@ -46,13 +53,14 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
 	// no sources
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
 	uint32_t opSize() const override { return 1; } // one byte immediate
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		state.setReg(rd_, imm());
 		state.incPc(2);
@@ -68,6 +76,12 @@ public:
 
 	OpType opType() const override { return OT_MOVI; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::LI, rd_, 0, imm(), false, 2);
+		return true;
+	}
+
 private: // methods
 	int64_t imm() const
 	{
@@ -80,7 +94,7 @@ private: // data
 };
 
 /// Compressed ALU functions (C.SUB through C.AND)
-class CompAlu : public Inst
+class CompAlu final : public InstBase<CompAlu>
 {
 public:
 	CompAlu(uint8_t fun = 0, uint8_t r2 = 0, uint8_t rsd = 0)
@@ -90,12 +104,13 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rsd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rsd_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rsd_)}; }
+	RegDeps srcs() const override { return {RegNum(rsd_), RegNum(r2_)}; }
 
 	uint32_t opSize() const override { return 8; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t rs = state.getReg(rsd_);
 		const uint64_t r2 = state.getReg(r2_);
@@ -132,6 +147,13 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		static const MicroOp::Op ops[] = {MicroOp::SUB, MicroOp::XOR, MicroOp::OR, MicroOp::AND};
+		uop = MicroOp::alu(ops[fun_ & 3], rsd_, rsd_, r2_, false, 2);
+		return true;
+	}
+
 private:
 	uint8_t fun_;
 	uint8_t r2_;
@@ -139,7 +161,7 @@ private:
 };
 
 /// Compressed ALU Word functions (C.SUBW and C.ADDW)
-class CompAluW : public Inst
+class CompAluW final : public InstBase<CompAluW>
 {
 public:
 	CompAluW(uint8_t fun = 0, uint8_t r2 = 0, uint8_t rsd = 0)
@@ -149,12 +171,13 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rsd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rsd_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rsd_)}; }
+	RegDeps srcs() const override { return {RegNum(rsd_), RegNum(r2_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t rs = state.getReg(rsd_);
 		const uint32_t r2 = state.getReg(r2_);
@@ -193,6 +216,14 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		if (fun_ > 1)
+			return false; // reserved
+		uop = MicroOp::alu(fun_ ? MicroOp::ADD : MicroOp::SUB, rsd_, rsd_, r2_, true, 2);
+		return true;
+	}
+
 private:
 	uint8_t fun_;
 	uint8_t r2_;
@@ -200,7 +231,7 @@ private:
 };
 
 /// Compressed Jump to register
-class CompJr : public Inst
+class CompJr final : public InstBase<CompJr>
 {
 public:
 	CompJr(uint8_t rd)
@@ -209,10 +240,11 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {RegNum(rd_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t new_pc = state.getReg(rd_);
 		state.setPc(new_pc);
@@ -239,12 +271,18 @@ public:
 
 	OpType opType() const override { return OT_BRANCH; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::jump(MicroOp::JR, 0, rd_, 0, 2);
+		return true;
+	}
+
 private:
 	uint8_t rd_;
 };
 
 /// Compressed Move (Reg to Reg)
-class CompMv : public Inst
+class CompMv final : public InstBase<CompMv>
 {
 public:
 	CompMv(uint8_t rs, uint8_t rd)
@@ -253,10 +291,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rs_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rs_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		state.setReg(rd_, state.getReg(rs_));
 		state.incPc(2);
@@ -272,13 +311,19 @@ public:
 
 	OpType opType() const override { return OT_MOV; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::alu(MicroOp::ADD, rd_, rs_, 0, false, 2);
+		return true;
+	}
+
 private:
 	uint8_t rs_;
 	uint8_t rd_;
 };
 
 /// Compressed Load (D)Word from Stack Pointer
-class CompLdwSp : public Inst
+class CompLdwSp final : public InstBase<CompLdwSp>
 {
 public:
 	CompLdwSp(uint64_t imm, uint8_t rd, uint8_t sz)
@@ -288,15 +333,18 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(Reg::SP)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(Reg::SP)}; }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(Reg::SP) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(Reg::SP) + imm_; }
 	uint32_t opSize() const override { return sz_; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
-		const uint64_t ea = calcEa(state);
+		const uint64_t ea = effAddr(state);
 
 		// sign-extend from word
 		uint64_t val = 0;
@@ -326,6 +374,12 @@ public:
 
 	OpType opType() const override { return OT_LOAD; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::load(rd_, Reg::SP, imm_, sz_, sz_ == 4, 2);
+		return true;
+	}
+
 private:
 	uint64_t imm_;
 	uint8_t rd_;
@@ -333,7 +387,7 @@ private:
 };
 
 /// Compressed Add Scaled Immediate to SP
-class CompAddI4SpN : public Inst
+class CompAddI4SpN final : public InstBase<CompAddI4SpN>
 {
 public:
 	CompAddI4SpN(uint64_t imm, uint8_t rd)
@@ -342,10 +396,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(Reg::SP)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(Reg::SP)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t sp = state.getReg(Reg::SP);
 		state.setReg(rd_, sp + imm_);
@@ -362,13 +417,19 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::ADD, rd_, Reg::SP, imm_, false, 2);
+		return true;
+	}
+
 private:
 	uint64_t imm_;
 	uint8_t rd_;
 };
 
 /// Compressed Add Scaled Immediate to SP
-class CompAddI16Sp : public Inst
+class CompAddI16Sp final : public InstBase<CompAddI16Sp>
 {
 public:
 	CompAddI16Sp(int64_t imm)
@@ -376,10 +437,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(Reg::SP)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(Reg::SP)}; }
+	RegDeps dsts() const override { return {RegNum(Reg::SP)}; }
+	RegDeps srcs() const override { return {RegNum(Reg::SP)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t sp = state.getReg(Reg::SP);
 		state.setReg(Reg::SP, sp + imm_);
@@ -395,12 +457,18 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::ADD, Reg::SP, Reg::SP, imm_, false, 2);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 };
 
 /// Compressed Store (D)Word to Stack Pointer
-class CompSdwSp : public Inst
+class CompSdwSp final : public InstBase<CompSdwSp>
 {
 public:
 	CompSdwSp(uint32_t imm, uint8_t rs, uint8_t sz)
@@ -411,20 +479,23 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
 
 	// sources are EA and store data
-	std::vector<RegDep> srcs() const override { return {RegNum(Reg::SP), RegNum(rs_)}; }
+	RegDeps srcs() const override { return {RegNum(Reg::SP), RegNum(rs_)}; }
 	// help consumers figure out which is store data
 	RegDep stdSrc() const override { return RegNum(rs_); }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(Reg::SP) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(Reg::SP) + imm_; }
 	uint32_t opSize() const override { return sz_; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(rs_);
-		state.writeMem(calcEa(state), sz_, val);
+		state.writeMem(effAddr(state), sz_, val);
 		state.incPc(2);
 	}
 
@@ -439,6 +510,12 @@ public:
 
 	OpType opType() const override { return OT_STORE; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::store(rs_, Reg::SP, imm_, sz_, 2);
+		return true;
+	}
+
 private:
 	uint32_t imm_;
 	uint8_t rs_;
@@ -446,7 +523,7 @@ private:
 };
 
 /// Compressed Shift Left Immediate
-class CompSllI : public Inst
+class CompSllI final : public InstBase<CompSllI>
 {
 public:
 	CompSllI(uint8_t sft, uint8_t rd)
@@ -456,10 +533,11 @@ public:
 	}
 
 	// read-modify-write
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rd_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(rd_);
 		state.setReg(rd_, val << sft_);
@@ -476,13 +554,19 @@ public:
 
 	OpType opType() const override { return OT_SHIFT; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::SLL, rd_, rd_, sft_, false, 2);
+		return true;
+	}
+
 private:
 	uint8_t sft_;
 	uint8_t rd_;
 };
 
 /// Compressed Add (reg to reg)
-class CompAdd : public Inst
+class CompAdd final : public InstBase<CompAdd>
 {
 public:
 	CompAdd(uint8_t rs, uint8_t rd)
@@ -492,10 +576,11 @@ public:
 	}
 
 	// reg += reg
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rd_), RegNum(rs_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rd_), RegNum(rs_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t vrd = state.getReg(rd_);
 		const uint64_t vrs = state.getReg(rs_);
@@ -515,13 +600,19 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::alu(MicroOp::ADD, rd_, rd_, rs_, false, 2);
+		return true;
+	}
+
 private:
 	uint8_t rs_;
 	uint8_t rd_;
 };
 
 /// Compressed Add Immediate
-class CompAddI : public Inst
+class CompAddI final : public InstBase<CompAddI>
 {
 public:
 	CompAddI(int64_t imm, uint8_t rd)
@@ -531,10 +622,11 @@ public:
 	}
 
 	// reg += imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rd_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t vrd = state.getReg(rd_);
 
@@ -553,13 +645,19 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::ADD, rd_, rd_, imm_, false, 2);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 	uint8_t rd_;
 };
 
 /// Compressed Add Immediate Word
-class CompAddIw : public Inst
+class CompAddIw final : public InstBase<CompAddIw>
 {
 public:
 	CompAddIw(int64_t imm, uint8_t rd)
@@ -569,12 +667,13 @@ public:
 	}
 
 	// reg += imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rd_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t vrd = state.getReg(rd_) + imm_;
 		const int64_t svrd = int32_t(vrd);
@@ -594,13 +693,19 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::ADD, rd_, rd_, imm_, true, 2);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 	uint8_t rd_;
 };
 
 /// Compressed Branch if (Not) Equal to Zero
-class CompBz : public Inst
+class CompBz final : public InstBase<CompBz>
 {
 public:
 	CompBz(bool eq, int64_t imm, uint8_t rs)
@@ -611,11 +716,12 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
 
-	std::vector<RegDep> srcs() const override { return {RegNum(rs_)}; }
+	RegDeps srcs() const override { return {RegNum(rs_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(rs_);
 		const bool taken = (eq_ && val == 0) || (!eq_ && val != 0);
@@ -640,6 +746,12 @@ public:
 
 	OpType opType() const override { return OT_BCC; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::bcc(eq_ ? 0 : 1, rs_, 0, imm_, 2);
+		return true;
+	}
+
 private:
 	bool eq_;
 	int64_t imm_;
@@ -647,7 +759,7 @@ private:
 };
 
 /// Compressed Load DWord
-class CompLd : public Inst
+class CompLd final : public InstBase<CompLd>
 {
 public:
 	CompLd(uint64_t imm, uint8_t rs, uint8_t rd)
@@ -657,15 +769,18 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rs_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rs_)}; }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(rs_) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(rs_) + imm_; }
 	uint32_t opSize() const override { return 8; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
-		state.setReg(rd_, state.readMem(calcEa(state), 8));
+		state.setReg(rd_, state.readMem(effAddr(state), 8));
 		state.incPc(2);
 	}
 
@@ -679,6 +794,12 @@ public:
 
 	OpType opType() const override { return OT_LOAD; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::load(rd_, rs_, imm_, 8, false, 2);
+		return true;
+	}
+
 private:
 	uint64_t imm_;
 	uint8_t rs_;
@@ -686,7 +807,7 @@ private:
 };
 
 /// Compressed Jump
-class CompJ : public Inst
+class CompJ final : public InstBase<CompJ>
 {
 public:
 	explicit CompJ(int64_t imm)
@@ -695,10 +816,11 @@ public:
 	}
 
 	// no regs
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// unconditional
 		state.setPc(state.getPc() + imm_);
@@ -713,12 +835,18 @@ public:
 
 	OpType opType() const override { return OT_BRANCH; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::jump(MicroOp::JAL, 0, 0, imm_, 2);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 };
 
 /// Compressed Store (D)Word
-class CompSdw : public Inst
+class CompSdw final : public InstBase<CompSdw>
 {
 public:
 	CompSdw(uint8_t imm, uint8_t rbase, uint8_t rsrc, uint8_t sz)
@@ -730,20 +858,23 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
 
-	std::vector<RegDep> srcs() const override { return {RegNum(rbase_), RegNum(rsrc_)}; }
+	RegDeps srcs() const override { return {RegNum(rbase_), RegNum(rsrc_)}; }
 
 	// help consumers figure out which is store data
 	RegDep stdSrc() const override { return RegNum(rsrc_); }
 
-	virtual uint64_t calcEa(ArchState &state) const { return state.getReg(rbase_) + imm_; }
-	virtual uint32_t opSize() const { return sz_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(rbase_) + imm_; }
+	uint32_t opSize() const override { return sz_; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(rsrc_);
-		state.writeMem(calcEa(state), sz_, val);
+		state.writeMem(effAddr(state), sz_, val);
 		state.incPc(2);
 	}
 
@@ -759,6 +890,12 @@ public:
 
 	OpType opType() const override { return OT_STORE; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::store(rsrc_, rbase_, imm_, sz_, 2);
+		return true;
+	}
+
 private:
 	uint8_t imm_;
 	uint8_t rbase_;
@@ -767,7 +904,7 @@ private:
 };
 
 /// Compressed Load Upper Immediate
-class CompLui : public Inst
+class CompLui final : public InstBase<CompLui>
 {
 public:
 	CompLui(int32_t imm, uint8_t rd)
@@ -776,11 +913,12 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
 	// no src
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		state.setReg(rd_, int64_t(imm_));
 		state.incPc(2);
@@ -796,13 +934,19 @@ public:
 
 	OpType opType() const override { return OT_MOVI; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::LI, rd_, 0, imm_, false, 2);
+		return true;
+	}
+
 private:
 	int32_t imm_;
 	uint8_t rd_;
 };
 
 /// Compressed Load Word
-class CompLw : public Inst
+class CompLw final : public InstBase<CompLw>
 {
 public:
 	CompLw(uint8_t imm, uint8_t rs, uint8_t rd)
@@ -812,15 +956,18 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rbase_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(rbase_)}; }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(rbase_) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(rbase_) + imm_; }
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
-		const uint64_t ea = calcEa(state);
+		const uint64_t ea = effAddr(state);
 		const int32_t mval = state.readMem(ea, 4);
 		state.setReg(rd_, int64_t(mval));
 		state.incPc(2);
@@ -836,6 +983,12 @@ public:
 
 	OpType opType() const override { return OT_LOAD; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::load(rd_, rbase_, imm_, 4, true, 2);
+		return true;
+	}
+
 private:
 	uint8_t imm_;
 	uint8_t rbase_;
@@ -843,7 +996,7 @@ private:
 };
 
 /// Compressed And Immediate
-class Candi : public Inst
+class Candi final : public InstBase<Candi>
 {
 public:
 	Candi(int32_t imm, uint8_t rsd)
@@ -853,10 +1006,11 @@ public:
 	}
 
 	/// reg &= imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rsd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rsd_)}; }
+	RegDeps dsts() const override { return {RegNum(rsd_)}; }
+	RegDeps srcs() const override { return {RegNum(rsd_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(rsd_) & int64_t(imm_);
 		state.setReg(rsd_, val);
@@ -873,13 +1027,19 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::AND, rsd_, rsd_, imm_, false, 2);
+		return true;
+	}
+
 private:
 	int32_t imm_;
 	uint8_t rsd_;
 };
 
 /// Compressed Jump and Link to Register target
-class CompJalr : public Inst
+class CompJalr final : public InstBase<CompJalr>
 {
 public:
 	CompJalr(uint8_t rs)
@@ -887,10 +1047,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(Reg::RA)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rs_)}; }
+	RegDeps dsts() const override { return {RegNum(Reg::RA)}; }
+	RegDeps srcs() const override { return {RegNum(rs_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t pc = state.getPc();
 		state.setReg(Reg::RA, pc + 2); // Link Reg
@@ -913,12 +1074,18 @@ public:
 
 	OpType opType() const override { return OT_BRANCH; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::jump(MicroOp::JALR, Reg::RA, rs_, 0, 2);
+		return true;
+	}
+
 private:
 	uint8_t rs_;
 };
 
 /// Compressed Shift Right (Logical and Arithmetic)
-class CompShiftRight : public Inst
+class CompShiftRight final : public InstBase<CompShiftRight>
 {
 public:
 	CompShiftRight(uint8_t imm, uint8_t rsd, bool arith)
@@ -929,10 +1096,11 @@ public:
 	}
 
 	// reg >>= imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rsd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rsd_)}; }
+	RegDeps dsts() const override { return {RegNum(rsd_)}; }
+	RegDeps srcs() const override { return {RegNum(rsd_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(rsd_);
 		if (arith_)
@@ -959,6 +1127,12 @@ public:
 
 	OpType opType() const override { return OT_SHIFT; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(arith_ ? MicroOp::SRA : MicroOp::SRL, rsd_, rsd_, imm_, false, 2);
+		return true;
+	}
+
 private:
 	uint8_t imm_;
 	uint8_t rsd_;
@@ -966,7 +1140,7 @@ private:
 };
 
 /// Compressed Float Store Double
-class CompFsd : public Inst
+class CompFsd final : public InstBase<CompFsd>
 {
 public:
 	CompFsd(uint8_t imm, uint8_t rbase, uint8_t rsrc)
@@ -977,14 +1151,15 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
 
-	std::vector<RegDep> srcs() const override { return {RegNum(rbase_), stdSrc()}; }
+	RegDeps srcs() const override { return {RegNum(rbase_), stdSrc()}; }
 
 	// help consumers figure out which is store data
 	RegDep stdSrc() const override { return RegDep(RegNum(rsrc_), RegFile::FLOAT); }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t base = state.getReg(rbase_);
 		state.writeMem(base + imm_, 8, state.getFpRaw(rsrc_));
@@ -1009,7 +1184,7 @@ private:
 };
 
 /// Compressed Float Load Double
-class CompFpLd : public Inst
+class CompFpLd final : public InstBase<CompFpLd>
 {
 public:
 	CompFpLd(uint32_t imm, uint8_t rs, uint8_t rd)
@@ -1019,16 +1194,19 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rs_)}; }
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(rs_) + imm_; }
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override { return {RegNum(rs_)}; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(rs_) + imm_; }
 	uint32_t opSize() const override { return 8; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// pull 8 bytes as-is
 		IntFloat tmp;
-		tmp.dw = state.readMem(calcEa(state), 8);
+		tmp.dw = state.readMem(effAddr(state), 8);
 
 		state.setDouble(rd_, tmp.d);
 		state.incPc(2);
@@ -1052,7 +1230,7 @@ private:
 };
 
 /// Float Store Double to Stack Pointer
-class CompFsdSp : public Inst
+class CompFsdSp final : public InstBase<CompFsdSp>
 {
 public:
 	CompFsdSp(uint32_t imm, uint8_t rs)
@@ -1062,19 +1240,22 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
 
-	std::vector<RegDep> srcs() const override { return {RegNum(Reg::SP), stdSrc()}; }
+	RegDeps srcs() const override { return {RegNum(Reg::SP), stdSrc()}; }
 
 	// help consumers figure out which is store data
 	RegDep stdSrc() const override { return RegDep(RegNum(rs_), RegFile::FLOAT); }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(Reg::SP) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(Reg::SP) + imm_; }
 	uint32_t opSize() const override { return 8; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
-		const uint64_t ea = calcEa(state);
+		const uint64_t ea = effAddr(state);
 		state.writeMem(ea, 8, state.getFpRaw(rs_));
 
 		state.incPc(2);
@@ -1097,7 +1278,7 @@ private:
 };
 
 /// Compressed Float Load Double from Stack Pointer
-class CompFldSp : public Inst
+class CompFldSp final : public InstBase<CompFldSp>
 {
 public:
 	CompFldSp(uint32_t imm, uint32_t rd)
@@ -1106,15 +1287,18 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(Reg::SP)}; }
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override { return {RegNum(Reg::SP)}; }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(Reg::SP) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(Reg::SP) + imm_; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// pull 8 bytes as-is
-		const uint64_t dw = state.readMem(calcEa(state), 8);
+		const uint64_t dw = state.readMem(effAddr(state), 8);
 
 		state.setFpRaw(rd_, dw);
 
@@ -1137,301 +1321,295 @@ private:
 	uint32_t rd_;
 };
 
-Inst* decode16(uint32_t opc)
+// 16 bit encoding fields
+inline uint8_t cRd(uint32_t opc) { return (opc >> 7) & 0x1f; } // opc[11:7]
+inline uint8_t cRs(uint32_t opc) { return (opc >> 2) & 0x1f; } // opc[6:2]
+inline uint8_t cR1p(uint32_t opc) { return ((opc >> 7) & 7) + 8; } // opc[9:7]
+inline uint8_t cR2p(uint32_t opc) { return ((opc >> 2) & 7) + 8; } // opc[4:2]
+
+/// opc[12] | opc[6:2] as a sign extended 6 bit immediate
+inline int8_t cImm6(uint32_t opc)
 {
-	const uint8_t o10 = opc & 3; // opc[1:0]
-	const uint8_t rd = (opc >> 7) & 0x1f; // opc[11:7]
-	const uint8_t rs = (opc >> 2) & 0x1f; // opc[6:2]
-	const uint8_t rsd = ((opc >> 7) & 7) + 8; // opc[9:7]
-	const uint16_t o15_13 = opc & 0xe000; // opc[15:13]
-	const uint8_t r1p = ((opc >> 7) & 7) + 8; // opc[9:7]
-	const uint8_t r2p = ((opc >> 2) & 7) + 8; // opc[4:2]
+	uint8_t raw_bits = (opc >> 2) & 0x1f; // opc[6:2] -> imm[4:0]
+	if (opc & 0x1000) // opc[12] -> imm[31:5] (sign ex)
+		raw_bits |= 0xe0;
+	return raw_bits;
+}
 
-	if (o10 == 0) // Memory
-	{
-		if (o15_13 == 0) // C.ADDI4SPN
-		{
-			const uint8_t rd = ((opc >> 2) & 7) + 8; // opc[4:2]
-			uint64_t imm = (opc & 0x780) >> 1; // opc[10:7] -> imm[9:6]
-			imm |= (opc & 0x1800) >> 7; // opc[12:11] -> imm[5:4]
-			imm |= (opc & 0x40) ? 4 : 0; // opc[6] -> imm[2]
-			imm |= (opc & 0x20) ? 8 : 0; // opc[5] -> imm[3]
-			return new CompAddI4SpN(imm, rd);
-		}
-		if (o15_13 == 0x2000) // C.FLD
-		{
-			// zero extended imm
-			uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
-			imm |= (opc << (6 - 5)) & (3 << 6); // opc[6:5] -> imm[7:6]
+// Quadrant 0, memory
 
-			const uint8_t rsp = r1p; // opc[9:7]
-			const uint8_t rdp = r2p; // opc[4:2]
-			return new CompFpLd(imm, rsp, rdp);
-		}
-		if (o15_13 == 0x4000) // C.LW
-		{
-			// zero extended imm
-			uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
-			imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
-			imm |= (opc & 0x40) ?    4 : 0; // opc[6] -> imm[2]
-
-			const uint8_t rsp = ((opc >> 7) & 7) + 8; // opc[9:7]
-			const uint8_t rdp = ((opc >> 2) & 7) + 8; // opc[4:2]
-			return new CompLw(imm, rsp, rdp);
-		}
-		if (o15_13 == 0x6000) // C.LD
-		{
-			// zero extended imm
-			uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
-			imm |= (opc << (6 - 5)) & (3 << 6); // opc[6:5] -> imm[7:6]
+template<class Alloc>
+Inst* decodeCAddI4SpN(uint32_t opc, Alloc &alloc)
+{
+	uint64_t imm = (opc & 0x780) >> 1; // opc[10:7] -> imm[9:6]
+	imm |= (opc & 0x1800) >> 7; // opc[12:11] -> imm[5:4]
+	imm |= (opc & 0x40) ? 4 : 0; // opc[6] -> imm[2]
+	imm |= (opc & 0x20) ? 8 : 0; // opc[5] -> imm[3]
+	return alloc.template make<CompAddI4SpN>(imm, cR2p(opc));
+}
 
-			const uint8_t rsp = ((opc >> 7) & 7) + 8; // opc[9:7]
-			const uint8_t rdp = ((opc >> 2) & 7) + 8; // opc[4:2]
-			return new CompLd(imm, rsp, rdp);
-		}
-		// 0x8000 is rsvd
-		if (o15_13 == 0xa000) // C.FSD
-		{
-			// zero extended imm
-			uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
-			imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
-			imm |= (opc & 0x40) ? 0x80 : 0; // opc[6] -> imm[7]
-
-			const uint8_t rbase = r1p;
-			const uint8_t rsrc = r2p;
-			return new CompFsd(imm, rbase, rsrc);
-		}
-		if (o15_13 == 0xc000) // C.SW
-		{
-			// zero extended imm
-			uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
-			imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
-			imm |= (opc & 0x40) ?    4 : 0; // opc[6] -> imm[2]
-
-			const uint8_t rbase = ((opc >> 7) & 7) + 8; // opc[9:7]
-			const uint8_t rsrc  = ((opc >> 2) & 7) + 8; // opc[4:2]
-			return new CompSdw(imm, rbase, rsrc, 4);
-		}
-		if (o15_13 == 0xe000) // C.SD
-		{
-			// zero extended imm
-			uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
-			imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
-			imm |= (opc & 0x40) ? 0x80 : 0; // opc[6] -> imm[7]
-
-			const uint8_t rbase = ((opc >> 7) & 7) + 8; // opc[9:7]
-			const uint8_t rsrc = ((opc >> 2) & 7) + 8; // opc[4:2]
-			return new CompSdw(imm, rbase, rsrc, 8);
-		}
-		return nullptr;
-	}
+template<class Alloc>
+Inst* decodeCFld(uint32_t opc, Alloc &alloc)
+{
+	// zero extended imm
+	uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
+	imm |= (opc << (6 - 5)) & (3 << 6); // opc[6:5] -> imm[7:6]
+	return alloc.template make<CompFpLd>(imm, cR1p(opc), cR2p(opc));
+}
 
-	if (o10 == 1) // common compressed ops
-	{
-		if (o15_13 == 0x0000) // C.ADDI (and C.NOP)
-		{
-			uint8_t raw_bits = (opc >> 2) & 0x1f; // opc[6:2] -> imm[4:0]
-			if (opc & 0x1000) // opc[12] -> imm[31:5] (sign ex)
-				raw_bits |= 0xe0;
+template<class Alloc>
+Inst* decodeCLw(uint32_t opc, Alloc &alloc)
+{
+	// zero extended imm
+	uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
+	imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
+	imm |= (opc & 0x40) ?    4 : 0; // opc[6] -> imm[2]
+	return alloc.template make<CompLw>(imm, cR1p(opc), cR2p(opc));
+}
 
-			const int8_t imm = raw_bits;
-			return new CompAddI(imm, rd);
-		}
-		if (o15_13 == 0x2000) // C.ADDIW
-		{
-			uint8_t raw_bits = (opc >> 2) & 0x1f; // opc[6:2] -> imm[4:0]
-			if (opc & 0x1000) // opc[12] -> imm[31:5] (sign ex)
-				raw_bits |= 0xe0;
+template<class Alloc>
+Inst* decodeCLd(uint32_t opc, Alloc &alloc)
+{
+	// zero extended imm
+	uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
+	imm |= (opc << (6 - 5)) & (3 << 6); // opc[6:5] -> imm[7:6]
+	return alloc.template make<CompLd>(imm, cR1p(opc), cR2p(opc));
+}
 
-			const int8_t imm = raw_bits;
-			return new CompAddIw(imm, rd);
-		}
-		if (o15_13 == 0x4000)
-		{
-			// TODO check for hint
+template<class Alloc>
+Inst* decodeCFsd(uint32_t opc, Alloc &alloc)
+{
+	// zero extended imm
+	uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
+	imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
+	imm |= (opc & 0x40) ? 0x80 : 0; // opc[6] -> imm[7]
+	return alloc.template make<CompFsd>(imm, cR1p(opc), cR2p(opc));
+}
 
-			uint8_t raw_bits = (opc >> 2) & 0x1f; // imm[4:0] = opc[6:2]
-			if (opc & 0x1000)
-				raw_bits |= 0xe0;
+template<class Alloc>
+Inst* decodeCSw(uint32_t opc, Alloc &alloc)
+{
+	// zero extended imm
+	uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
+	imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
+	imm |= (opc & 0x40) ?    4 : 0; // opc[6] -> imm[2]
+	return alloc.template make<CompSdw>(imm, cR1p(opc), cR2p(opc), 4);
+}
 
-			const int8_t imm = raw_bits;
-			return new CompLI(rd, imm);
-		}
-		else if (o15_13 == 0x6000) // C.LUI, C.ADDI16SP
-		{
-			if (rd == 2)
-			{
-				uint16_t imm = (opc & 0x18) << 4; // opc[4:3] -> imm[8:7]
-				imm |= (opc & 0x40) ? 0x10 : 0; // opc[6] -> imm[4]
-				imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
-				imm |= (opc &    4) ? 0x20 : 0; // opc[2] -> imm[5]
-				if (opc & 0x1000)
-					imm |= 0xfe00; // sign ex
-				const int16_t s_imm = int16_t(imm);
-				return new CompAddI16Sp(s_imm);
-			}
-			//else
-			uint32_t imm = (opc & 0x7c) << 10; // opc[6:2] -> imm[16:12]
-			if (opc & 0x1000) // opc[12] -> sign ex
-				imm |= 0xfffe0000;
+template<class Alloc>
+Inst* decodeCSd(uint32_t opc, Alloc &alloc)
+{
+	// zero extended imm
+	uint8_t imm = (opc >> (10 - 3)) & (7 << 3); // opc[12:10] -> imm[5:3]
+	imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
+	imm |= (opc & 0x40) ? 0x80 : 0; // opc[6] -> imm[7]
+	return alloc.template make<CompSdw>(imm, cR1p(opc), cR2p(opc), 8);
+}
 
-			return new CompLui(imm, rd);
-		}
-		else if (o15_13 == 0x8000)
-		{
-			const uint16_t op_11_10 = opc & 0x0c00; // opc[11:10]
-			if (op_11_10 == 0 || op_11_10 == 0x0400) // 00 - C.SRLI, 01 - C.SRAI
-			{
-				uint8_t imm = (opc >> 2) & 0x1f; // opc[6:2] -> imm[4:0]
-				if (opc & 0x1000) // opc[12] -> imm[5]
-					imm |= 0x20;
-				return new CompShiftRight(imm, rsd, op_11_10 == 0x0400);
-			}
-			if (op_11_10 == 0x0800) // 10 - C.ANDI
-			{
-				uint8_t raw_bits = (opc >> 2) & 0x1f; // opc[6:2] -> imm[4:0]
-				if (opc & 0x1000) // opc[12]
-					raw_bits |= 0xe0; // sign-ex imm[31:5]
-				const int8_t imm = raw_bits;
+// Quadrant 1, common compressed ops
 
-				return new Candi(imm, rsd);
+template<class Alloc>
+Inst* decodeCAddI(uint32_t opc, Alloc &alloc) // (and C.NOP)
+{
+	return alloc.template make<CompAddI>(cImm6(opc), cRd(opc));
+}
 
-			}
-			if (op_11_10 == 0x0c00) // 11
-			{
-				// rd op= r2
-				const uint8_t rs2 = ((opc >> 2) & 7) + 8; // opc[4:2]
-				const uint8_t fun = (opc >> 5) & 3; // opc[6:5]
-				if (opc & 0x1000)
-				{
-					// 32 bit form
-					return new CompAluW(fun, rs2, rsd);
-				}
-				else
-				{
-					return new CompAlu(fun, rs2, rsd);
-				}
-			}
-		}
-		else if (o15_13 == 0xa000) // C.J
-		{
-			uint16_t imm = (opc & 0x600) >> 1; // opc[10:9] -> imm[9:8]
-			imm |= (opc &      4) ? 0x020 : 0; // opc[ 2] -> imm[5]
-			imm |= (opc &      8) ? 0x002 : 0; // opc[ 3] -> imm[1]
-			imm |= (opc & 0x0010) ? 0x004 : 0; // opc[ 4] -> imm[2]
-			imm |= (opc & 0x0020) ? 0x008 : 0; // opc[ 5] -> imm[3]
-			imm |= (opc & 0x0040) ? 0x080 : 0; // opc[ 6] -> imm[7]
-			imm |= (opc & 0x0080) ? 0x040 : 0; // opc[ 7] -> imm[6]
-			imm |= (opc & 0x0100) ? 0x400 : 0; // opc[ 8] -> imm[10]
-			imm |= (opc & 0x0800) ? 0x010 : 0; // opc[11] -> imm[4]
-			if (opc & 0x1000) // opc[12] -> imm[15:11]
-				imm |= 0xf800;
-			const int16_t s_imm = imm;
-			return new CompJ(s_imm);
-		}
-		else if (o15_13 == 0xc000 || o15_13 == 0xe000) // C.BEQZ, C.BNEZ
-		{
-			uint16_t imm = (opc & 0x60) << 1; // opc[6:5] -> imm[7:6]
-			imm |= (opc &      4) ? 0x20 : 0; // opc[ 2] -> imm[5]
-			imm |= (opc &      8) ? 0x02 : 0; // opc[ 3] -> imm[1]
-			imm |= (opc & 0x0010) ? 0x04 : 0; // opc[ 4] -> imm[2]
-			imm |= (opc & 0x0400) ? 0x08 : 0; // opc[10] -> imm[3]
-			imm |= (opc & 0x0800) ? 0x10 : 0; // opc[11] -> imm[4]
-			if (opc & 0x1000) // opc[12] -> imm[15:8]
-				imm |= 0xff00;
-			const int16_t s_imm = imm;
-
-			const uint8_t rs = ((opc >> 7) & 7) + 8; // opc[9:7]
-			const bool eq = o15_13 == 0xc000; // else NE
-			return new CompBz(eq, s_imm, rs);
-		}
+template<class Alloc>
+Inst* decodeCAddIw(uint32_t opc, Alloc &alloc)
+{
+	return alloc.template make<CompAddIw>(cImm6(opc), cRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeCLi(uint32_t opc, Alloc &alloc)
+{
+	// TODO check for hint
+	return alloc.template make<CompLI>(cRd(opc), cImm6(opc));
+}
+
+template<class Alloc>
+Inst* decodeCLui(uint32_t opc, Alloc &alloc) // C.LUI, C.ADDI16SP
+{
+	const uint8_t rd = cRd(opc);
+	if (rd == 2)
+	{
+		uint16_t imm = (opc & 0x18) << 4; // opc[4:3] -> imm[8:7]
+		imm |= (opc & 0x40) ? 0x10 : 0; // opc[6] -> imm[4]
+		imm |= (opc & 0x20) ? 0x40 : 0; // opc[5] -> imm[6]
+		imm |= (opc &    4) ? 0x20 : 0; // opc[2] -> imm[5]
+		if (opc & 0x1000)
+			imm |= 0xfe00; // sign ex
+		const int16_t s_imm = int16_t(imm);
+		return alloc.template make<CompAddI16Sp>(s_imm);
 	}
-	else if (o10 == 2) // more ops
+	//else
+	uint32_t imm = (opc & 0x7c) << 10; // opc[6:2] -> imm[16:12]
+	if (opc & 0x1000) // opc[12] -> sign ex
+		imm |= 0xfffe0000;
+
+	return alloc.template make<CompLui>(imm, rd);
+}
+
+template<class Alloc>
+Inst* decodeCMiscAlu(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t rsd = cR1p(opc); // opc[9:7]
+	const uint16_t op_11_10 = opc & 0x0c00; // opc[11:10]
+	if (op_11_10 == 0 || op_11_10 == 0x0400) // 00 - C.SRLI, 01 - C.SRAI
 	{
-		const uint16_t o15_12 = opc & 0xf000; // opc[15:12]
+		uint8_t imm = (opc >> 2) & 0x1f; // opc[6:2] -> imm[4:0]
+		if (opc & 0x1000) // opc[12] -> imm[5]
+			imm |= 0x20;
+		return alloc.template make<CompShiftRight>(imm, rsd, op_11_10 == 0x0400);
+	}
+	if (op_11_10 == 0x0800) // 10 - C.ANDI
+		return alloc.template make<Candi>(cImm6(opc), rsd);
 
-		if (o15_12 < 0x2000) // C.SLLI
-		{
-			uint8_t sft = (opc >> 2) & 0x1f; // opc[6:2] -> sft[4:0]
-			sft |= (opc >> 7) & 0x20; // opc[12] -> sft[5]
-			return new CompSllI(sft, rd);
-		}
-		else if (o15_12 == 0x2000 || o15_12 == 0x3000) // C.FLDSP
-		{
-			uint64_t imm = (opc & 0x1c) << 4; // opc[4:2] -> imm[8:6]
-			if (opc & 0x1000) // opc[12] -> imm[5]
-				imm |= 0x20;
-			imm |= (opc & 0x60) >> 2; // opc[6:5] -> imm[4:3]
+	// 11 - rd op= r2
+	const uint8_t rs2 = cR2p(opc); // opc[4:2]
+	const uint8_t fun = (opc >> 5) & 3; // opc[6:5]
+	if (opc & 0x1000)
+	{
+		// 32 bit form
+		return alloc.template make<CompAluW>(fun, rs2, rsd);
+	}
+	return alloc.template make<CompAlu>(fun, rs2, rsd);
+}
 
-			return new CompFldSp(imm, rd);
-		}
-		else if (o15_12 == 0x4000 || o15_12 == 0x5000) // C.LWSP
-		{
-			// zero extended
-			uint64_t imm = (opc & 0xc) << 4; // opc[3:2] -> imm[7:6]
-			if (opc & 0x1000) // opc[12] -> imm[5]
-				imm |= 0x20;
-			imm |= (opc & 0x70) >> 2; // opc[6:4] -> imm[4:2]
+template<class Alloc>
+Inst* decodeCJ(uint32_t opc, Alloc &alloc)
+{
+	uint16_t imm = (opc & 0x600) >> 1; // opc[10:9] -> imm[9:8]
+	imm |= (opc &      4) ? 0x020 : 0; // opc[ 2] -> imm[5]
+	imm |= (opc &      8) ? 0x002 : 0; // opc[ 3] -> imm[1]
+	imm |= (opc & 0x0010) ? 0x004 : 0; // opc[ 4] -> imm[2]
+	imm |= (opc & 0x0020) ? 0x008 : 0; // opc[ 5] -> imm[3]
+	imm |= (opc & 0x0040) ? 0x080 : 0; // opc[ 6] -> imm[7]
+	imm |= (opc & 0x0080) ? 0x040 : 0; // opc[ 7] -> imm[6]
+	imm |= (opc & 0x0100) ? 0x400 : 0; // opc[ 8] -> imm[10]
+	imm |= (opc & 0x0800) ? 0x010 : 0; // opc[11] -> imm[4]
+	if (opc & 0x1000) // opc[12] -> imm[15:11]
+		imm |= 0xf800;
+	const int16_t s_imm = imm;
+	return alloc.template make<CompJ>(s_imm);
+}
 
-			return new CompLdwSp(imm, rd, 4);
-		}
-		else if (o15_12 == 0x6000 || o15_12 == 0x7000) // C.LDSP
-		{
-			uint64_t imm = (opc & 0x1c) << 4; // opc[4:2] -> imm[8:6]
-			if (opc & 0x1000) // opc[12] -> imm[5]
-				imm |= 0x20;
-			imm |= (opc & 0x60) >> 2; // opc[6:5] -> imm[4:3]
+template<class Alloc>
+Inst* decodeCBz(uint32_t opc, Alloc &alloc) // C.BEQZ, C.BNEZ
+{
+	uint16_t imm = (opc & 0x60) << 1; // opc[6:5] -> imm[7:6]
+	imm |= (opc &      4) ? 0x20 : 0; // opc[ 2] -> imm[5]
+	imm |= (opc &      8) ? 0x02 : 0; // opc[ 3] -> imm[1]
+	imm |= (opc & 0x0010) ? 0x04 : 0; // opc[ 4] -> imm[2]
+	imm |= (opc & 0x0400) ? 0x08 : 0; // opc[10] -> imm[3]
+	imm |= (opc & 0x0800) ? 0x10 : 0; // opc[11] -> imm[4]
+	if (opc & 0x1000) // opc[12] -> imm[15:8]
+		imm |= 0xff00;
+	const int16_t s_imm = imm;
+
+	const bool eq = (opc & 0xe000) == 0xc000; // else NE
+	return alloc.template make<CompBz>(eq, s_imm, cR1p(opc));
+}
 
-			return new CompLdwSp(imm, rd, 8);
-		}
-		else if (o15_12 == 0x8000) // C.JR and C.MV
-		{
-			if (rs == 0)
-				return new CompJr(rd);
-			//else
-			return new CompMv(rs, rd);
-		}
-		else if (o15_12 == 0x9000) // C.EBREAK, C.JALR, C.ADD
-		{
-			if (rd == 0) // C.EBREAK and C.HINT
-			{
-				return nullptr; // TODO
-			}
+// Quadrant 2, more ops
 
-			if (rs == 0) // C.JALR
-				return new CompJalr(rd);
+template<class Alloc>
+Inst* decodeCSllI(uint32_t opc, Alloc &alloc)
+{
+	uint8_t sft = (opc >> 2) & 0x1f; // opc[6:2] -> sft[4:0]
+	sft |= (opc >> 7) & 0x20; // opc[12] -> sft[5]
+	return alloc.template make<CompSllI>(sft, cRd(opc));
+}
 
-			return new CompAdd(rs, rd);
-		}
-		else if (o15_12 == 0xa000 || o15_12 == 0xb000) // C.FSDSP
-		{
-			uint16_t imm = (opc >> 1) & 0x1c0; // opc[9:7] -> imm[8:6]
-			const uint16_t low_imm = (opc >> 10) & 7; // opc[12:10]
-			imm |= low_imm << 3; // imm[5:3]
-			return new CompFsdSp(imm, rs);
-		}
-		else if (o15_12 == 0xc000 || o15_12 == 0xd000) // C.SWSP
-		{
-			uint16_t imm = (opc >> 1) & 0xc0; // opc[8:7] -> imm[7:6]
+template<class Alloc>
+Inst* decodeCFldSp(uint32_t opc, Alloc &alloc)
+{
+	uint64_t imm = (opc & 0x1c) << 4; // opc[4:2] -> imm[8:6]
+	if (opc & 0x1000) // opc[12] -> imm[5]
+		imm |= 0x20;
+	imm |= (opc & 0x60) >> 2; // opc[6:5] -> imm[4:3]
 
-			const uint16_t low_imm = (opc >> 9) & 0xf; // opc[12:9]
-			imm |= low_imm << 2; // imm[5:2]
+	return alloc.template make<CompFldSp>(imm, cRd(opc));
+}
 
-			return new CompSdwSp(imm, rs, 4);
-		}
-		else if (o15_12 == 0xe000 || o15_12 == 0xf000) // C.SDSP
-		{
-			uint16_t imm = (opc >> 1) & 0x1c0; // opc[9:7] -> imm[8:6]
-			const uint16_t low_imm = (opc >> 10) & 7; // opc[12:10]
-			imm |= low_imm << 3; // imm[5:3]
-			return new CompSdwSp(imm, rs, 8);
-		}
+template<class Alloc>
+Inst* decodeCLwSp(uint32_t opc, Alloc &alloc)
+{
+	// zero extended
+	uint64_t imm = (opc & 0xc) << 4; // opc[3:2] -> imm[7:6]
+	if (opc & 0x1000) // opc[12] -> imm[5]
+		imm |= 0x20;
+	imm |= (opc & 0x70) >> 2; // opc[6:4] -> imm[4:2]
+
+	return alloc.template make<CompLdwSp>(imm, cRd(opc), 4);
+}
+
+template<class Alloc>
+Inst* decodeCLdSp(uint32_t opc, Alloc &alloc)
+{
+	uint64_t imm = (opc & 0x1c) << 4; // opc[4:2] -> imm[8:6]
+	if (opc & 0x1000) // opc[12] -> imm[5]
+		imm |= 0x20;
+	imm |= (opc & 0x60) >> 2; // opc[6:5] -> imm[4:3]
+
+	return alloc.template make<CompLdwSp>(imm, cRd(opc), 8);
+}
+
+template<class Alloc>
+Inst* decodeCJrMvAdd(uint32_t opc, Alloc &alloc) // C.JR, C.MV, C.EBREAK, C.JALR, C.ADD
+{
+	const uint8_t rd = cRd(opc);
+	const uint8_t rs = cRs(opc);
+	if ((opc & 0x1000) == 0) // C.JR and C.MV
+	{
+		if (rs == 0)
+			return alloc.template make<CompJr>(rd);
+		//else
+		return alloc.template make<CompMv>(rs, rd);
 	}
-	return nullptr;
+
+	if (rd == 0) // C.EBREAK and C.HINT
+	{
+		return nullptr; // TODO
+	}
+
+	if (rs == 0) // C.JALR
+		return alloc.template make<CompJalr>(rd);
+
+	return alloc.template make<CompAdd>(rs, rd);
+}
+
+template<class Alloc>
+Inst* decodeCFsdSp(uint32_t opc, Alloc &alloc)
+{
+	uint16_t imm = (opc >> 1) & 0x1c0; // opc[9:7] -> imm[8:6]
+	const uint16_t low_imm = (opc >> 10) & 7; // opc[12:10]
+	imm |= low_imm << 3; // imm[5:3]
+	return alloc.template make<CompFsdSp>(imm, cRs(opc));
+}
+
+template<class Alloc>
+Inst* decodeCSwSp(uint32_t opc, Alloc &alloc)
+{
+	uint16_t imm = (opc >> 1) & 0xc0; // opc[8:7] -> imm[7:6]
+
+	const uint16_t low_imm = (opc >> 9) & 0xf; // opc[12:9]
+	imm |= low_imm << 2; // imm[5:2]
+
+	return alloc.template make<CompSdwSp>(imm, cRs(opc), 4);
+}
+
+template<class Alloc>
+Inst* decodeCSdSp(uint32_t opc, Alloc &alloc)
+{
+	uint16_t imm = (opc >> 1) & 0x1c0; // opc[9:7] -> imm[8:6]
+	const uint16_t low_imm = (opc >> 10) & 7; // opc[12:10]
+	imm |= low_imm << 3; // imm[5:3]
+	return alloc.template make<CompSdwSp>(imm, cRs(opc), 8);
 }
 
 /// Add Upper Immediate to PC
-class Auipc : public Inst
+class Auipc final : public InstBase<Auipc>
 {
 public:
 	Auipc(int32_t imm, uint8_t rd)
@@ -1440,11 +1618,12 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
 	// no source
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t pc = state.getPc();
 		state.setReg(rd_, pc + imm_);
@@ -1466,13 +1645,19 @@ public:
 
 	OpType opType() const override { return OT_MOVI; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::AUIPC, rd_, 0, imm_);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 	uint8_t rd_;
 };
 
 /// Jump and Link (imm)
-class Jal : public Inst
+class Jal final : public InstBase<Jal>
 {
 public:
 	Jal(int64_t imm, uint8_t rd)
@@ -1481,9 +1666,9 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override
+	RegDeps dsts() const override
 	{
-		std::vector<RegDep> ret;
+		RegDeps ret;
 		if (rd_ == 0)
 			return ret; // no dst
 
@@ -1492,9 +1677,10 @@ public:
 	}
 
 	// no sources
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t pc = state.getPc();
 		state.setReg(rd_, pc + 4);
@@ -1521,13 +1707,19 @@ public:
 
 	OpType opType() const override { return OT_BRANCH; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::jump(MicroOp::JAL, rd_, 0, imm_);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 	uint8_t rd_;
 };
 
 /// Jump and Link to register target
-class Jalr : public Inst
+class Jalr final : public InstBase<Jalr>
 {
 public:
 	Jalr(int32_t imm, uint8_t r1, uint8_t rd)
@@ -1538,10 +1730,11 @@ public:
 	}
 
 	// rd_ = PC+4; PC = r1_ + imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t pc = state.getPc();
 		state.setReg(rd_, pc + 4);
@@ -1564,6 +1757,12 @@ public:
 
 	OpType opType() const override { return OT_BRANCH; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::jump(MicroOp::JALR, rd_, r1_, imm_);
+		return true;
+	}
+
 private:
 	int32_t imm_;
 	uint8_t r1_;
@@ -1571,7 +1770,7 @@ private:
 };
 
 /// Register Op Immediate
-class OpImm : public Inst
+class OpImm final : public InstBase<OpImm>
 {
 public:
 	OpImm(uint8_t op, int16_t imm, uint8_t r1, uint8_t rd)
@@ -1583,10 +1782,11 @@ public:
 	}
 
 	// rd = r1 op imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		uint64_t val = state.getReg(r1_);
 
@@ -1671,6 +1871,22 @@ public:
 		return OT_ALU;
 	}
 
+	bool lower(MicroOp &uop) const override
+	{
+		static const MicroOp::Op ops[] = {MicroOp::ADD, MicroOp::SLL, MicroOp::SLT, MicroOp::SLTU,
+		                                       MicroOp::XOR, MicroOp::SRL, MicroOp::OR, MicroOp::AND};
+		if (op_ == 1 && (imm_ < 0 || imm_ > 63))
+			return false; // not a valid shift amount
+		if (op_ == 5)
+		{
+			const bool arith = (imm_ & 0x400) != 0;
+			uop = MicroOp::aluImm(arith ? MicroOp::SRA : MicroOp::SRL, rd_, r1_, imm_ & 0x3f);
+			return true;
+		}
+		uop = MicroOp::aluImm(ops[op_ & 7], rd_, r1_, imm_);
+		return true;
+	}
+
 private:
 	uint8_t op_;
 	int64_t imm_;
@@ -1679,7 +1895,7 @@ private:
 };
 
 /// Load Upper Immediate
-class Lui : public Inst
+class Lui final : public InstBase<Lui>
 {
 public:
 	Lui(int64_t imm, uint8_t rd)
@@ -1688,11 +1904,12 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
 	// no sources
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		state.setReg(rd_, imm_);
 		state.incPc(4);
@@ -1708,13 +1925,19 @@ public:
 
 	OpType opType() const override { return OT_MOVI; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::LI, rd_, 0, imm_);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 	uint8_t rd_;
 };
 
 /// Conditional Branch
-class Branch : public Inst
+class Branch final : public InstBase<Branch>
 {
 public:
 	Branch(int64_t imm, uint8_t op, uint8_t r2, uint8_t r1)
@@ -1726,10 +1949,11 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t r1 = state.getReg(r1_);
 		const uint64_t r2 = state.getReg(r2_);
@@ -1772,6 +1996,14 @@ public:
 
 	OpType opType() const override { return OT_BCC; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		if (op_ == 2 || op_ == 3)
+			return false; // reserved
+		uop = MicroOp::bcc(op_, r1_, r2_, imm_);
+		return true;
+	}
+
 private:
 	int64_t imm_;
 	uint8_t op_;
@@ -1780,7 +2012,7 @@ private:
 };
 
 /// Store
-class Store : public Inst
+class Store final : public InstBase<Store>
 {
 public:
 	Store(uint8_t sz, int32_t imm, uint8_t r1, uint8_t r2)
@@ -1792,18 +2024,21 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 	// help consumers figure out which is store data
 	RegDep stdSrc() const override { return RegNum(r2_); }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(r1_) + imm_; }
-	uint32_t opSize() const override { return sz_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(r1_) + imm_; }
+	uint32_t opSize() const override { return 1 << sz_; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t val = state.getReg(r2_);
-		state.writeMem(calcEa(state), 1 << sz_, val);
+		state.writeMem(effAddr(state), 1 << sz_, val);
 		state.incPc(4);
 	}
 
@@ -1824,6 +2059,14 @@ public:
 
 	OpType opType() const override { return OT_STORE; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		if (sz_ > 3)
+			return false;
+		uop = MicroOp::store(r2_, r1_, imm_, 1 << sz_);
+		return true;
+	}
+
 private:
 	uint8_t sz_;
 	int64_t imm_;
@@ -1832,7 +2075,7 @@ private:
 };
 
 /// Load
-class Load : public Inst
+class Load final : public InstBase<Load>
 {
 public:
 	Load(uint8_t op, int64_t imm, uint8_t r1, uint8_t rd)
@@ -1843,17 +2086,20 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(r1_) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(r1_) + imm_; }
 	uint32_t opSize() const override { return 1 << (op_ & 3); }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint8_t sz = opSize();
 
-		const uint64_t mval = state.readMem(calcEa(state), sz);
+		const uint64_t mval = state.readMem(effAddr(state), sz);
 
 		if (op_ > 3) // unsigned
 		{
@@ -1914,6 +2160,12 @@ public:
 
 	OpType opType() const override { return OT_LOAD; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::load(rd_, r1_, imm_, opSize(), op_ <= 3);
+		return true;
+	}
+
 private:
 	uint8_t op_;
 	int64_t imm_;
@@ -1922,7 +2174,7 @@ private:
 };
 
 /// Integer Multiply and Divide (and Remainder)
-class ImulDiv : public Inst
+class ImulDiv final : public InstBase<ImulDiv>
 {
 public:
 	ImulDiv(uint8_t op, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -1933,10 +2185,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t vr1 = state.getReg(r1_);
 		const uint64_t vr2 = state.getReg(r2_);
@@ -2016,6 +2269,14 @@ public:
 		return (op_ < 4) ? OT_MUL : OT_DIV;
 	}
 
+	bool lower(MicroOp &uop) const override
+	{
+		if (op_ != 0)
+			return false; // only MUL
+		uop = MicroOp::alu(MicroOp::MUL, rd_, r1_, r2_);
+		return true;
+	}
+
 private:
 	uint8_t op_;
 	uint8_t r2_;
@@ -2024,7 +2285,7 @@ private:
 };
 
 /// Add Immediate Word
-class AddIw : public Inst
+class AddIw final : public InstBase<AddIw>
 {
 public:
 	AddIw(int16_t imm, uint8_t r1, uint8_t rd)
@@ -2034,12 +2295,13 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t vrd = state.getReg(r1_) + imm_;
 		const int64_t svrd = int32_t(vrd);
@@ -2059,6 +2321,12 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(MicroOp::ADD, rd_, r1_, imm_, true);
+		return true;
+	}
+
 private:
 	int16_t imm_;
 	uint8_t r1_;
@@ -2066,7 +2334,7 @@ private:
 };
 
 /// Environment (Operating system) Call
-class Ecall : public Inst
+class Ecall final : public InstBase<Ecall>
 {
 public:
 	Ecall()
@@ -2074,10 +2342,11 @@ public:
 	}
 
 	// no standard dependencies
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t syscall = state.getReg(17); // r17 is syscall id
 		switch (syscall)
@@ -2114,11 +2383,31 @@ public:
 			state.getSys()->fstat(state);
 			break;
 
-		case 93: // exit
-		case 94: // exit_group (TODO: exit all threads)
+		case 82: // fsync
+		case 83: // fdatasync
+			state.getSys()->fsync(state);
+			break;
+
+		case 93: // exit (this thread)
 			state.getSys()->exit(state);
 			break;
 
+		case 94: // exit_group
+			state.getSys()->exitGroup(state);
+			break;
+
+		case 96: // set_tid_address
+			state.getSys()->setTidAddress(state);
+			break;
+
+		case 98: // futex
+			state.getSys()->futex(state);
+			break;
+
+		case 124: // sched_yield
+			state.setReg(10, 0);
+			break;
+
 		case 160: // uname
 			state.getSys()->uname(state);
 			break;
@@ -2130,16 +2419,32 @@ public:
 			state.setReg(10, 3); // return value
 			break;
 
+		case 178: // gettid
+			state.getSys()->gettid(state);
+			break;
+
 		case 214: // sbrk
 			state.getSys()->sbrk(state);
 			break;
 
+		case 215: // munmap
+			state.getSys()->munmap(state);
+			break;
+
+		case 220: // clone
+			state.getSys()->clone(state);
+			break;
+
 		case 222: // mmap
 			state.getSys()->mmap(state);
 			break;
 
+		case 226: // mprotect
+			state.getSys()->mprotect(state);
+			break;
+
 		default:
-			std::cerr << " Unimplemented system call " << syscall << std::endl;
+			state.getSys()->err() << " Unimplemented system call " << syscall << std::endl;
 			state.setReg(10, 0); // return value
 		}
 
@@ -2155,7 +2460,7 @@ public:
 };
 
 /// Alu op with two register sources
-class OpRegReg : public Inst
+class OpRegReg final : public InstBase<OpRegReg>
 {
 public:
 	OpRegReg(uint8_t op, bool op30, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -2167,10 +2472,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t vr1 = state.getReg(r1_);
 		const uint64_t vr2 = state.getReg(r2_);
@@ -2309,7 +2615,20 @@ public:
 		return OT_ALU;
 	}
 
-private:
+	bool lower(MicroOp &uop) const override
+	{
+		static const MicroOp::Op ops[] = {MicroOp::ADD, MicroOp::SLL, MicroOp::SLT, MicroOp::SLTU,
+		                                       MicroOp::XOR, MicroOp::SRL, MicroOp::OR, MicroOp::AND};
+		MicroOp::Op op = ops[op_ & 7];
+		if (op30_ && op_ == 0)
+			op = MicroOp::SUB;
+		else if (op30_ && op_ == 5)
+			op = MicroOp::SRA;
+		uop = MicroOp::alu(op, rd_, r1_, r2_);
+		return true;
+	}
+
+private:
 	uint8_t op_;
 	bool op30_;
 	uint8_t r2_;
@@ -2318,7 +2637,7 @@ private:
 };
 
 /// Shift Left Logical Immediate Word
-class Slliw : public Inst
+class Slliw final : public InstBase<Slliw>
 {
 public:
 	Slliw(uint8_t imm, uint8_t r1, uint8_t rd)
@@ -2328,12 +2647,13 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t vrd = state.getReg(r1_) << imm_;
 		const int64_t svrd = int32_t(vrd); // signed extend
@@ -2353,6 +2673,14 @@ public:
 
 	OpType opType() const override { return OT_SHIFT; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		if (imm_ > 31)
+			return false; // not a valid shift amount
+		uop = MicroOp::aluImm(MicroOp::SLL, rd_, r1_, imm_, true);
+		return true;
+	}
+
 private:
 	uint8_t imm_;
 	uint8_t r1_;
@@ -2360,7 +2688,7 @@ private:
 };
 
 /// Shift Right Arithmetic and Logical Immediate Word
-class Sraliw : public Inst
+class Sraliw final : public InstBase<Sraliw>
 {
 public:
 	Sraliw(uint8_t imm, uint8_t r1, uint8_t rd, bool arith)
@@ -2371,12 +2699,13 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t val = state.getReg(r1_);
 
@@ -2412,6 +2741,12 @@ public:
 
 	OpType opType() const override { return OT_SHIFT; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::aluImm(arith_ ? MicroOp::SRA : MicroOp::SRL, rd_, r1_, imm_, true);
+		return true;
+	}
+
 private:
 	uint8_t imm_;
 	uint8_t r1_;
@@ -2420,7 +2755,7 @@ private:
 };
 
 /// Shift Left Logical Word
-class Sllw : public Inst
+class Sllw final : public InstBase<Sllw>
 {
 public:
 	Sllw(uint8_t r2, uint8_t r1, uint8_t rd)
@@ -2431,12 +2766,13 @@ public:
 	}
 
 	// rd = r1 << r2
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t amt = state.getReg(r2_) & 0x1f; // use low 5 bits
 		const uint32_t vrd = state.getReg(r1_) << amt;
@@ -2457,6 +2793,12 @@ public:
 
 	OpType opType() const override { return OT_SHIFT; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::alu(MicroOp::SLL, rd_, r1_, r2_, true);
+		return true;
+	}
+
 private:
 	uint8_t r2_;
 	uint8_t r1_;
@@ -2464,7 +2806,7 @@ private:
 };
 
 /// Add and Subtract Word
-class AddSubW : public Inst
+class AddSubW final : public InstBase<AddSubW>
 {
 public:
 	AddSubW(uint8_t r2, uint8_t r1, uint8_t rd, bool sub)
@@ -2476,12 +2818,13 @@ public:
 	}
 
 	// rd = r1 +/- r2
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint64_t v2 = state.getReg(r2_);
 		uint64_t tmp = state.getReg(r1_);
@@ -2514,6 +2857,12 @@ public:
 
 	OpType opType() const override { return OT_ALU; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::alu(sub_ ? MicroOp::SUB : MicroOp::ADD, rd_, r1_, r2_, true);
+		return true;
+	}
+
 private:
 	uint8_t r2_;
 	uint8_t r1_;
@@ -2522,7 +2871,7 @@ private:
 };
 
 /// Multiply and Divide Word
-class MulDivW : public Inst
+class MulDivW final : public InstBase<MulDivW>
 {
 public:
 	MulDivW(uint8_t op, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -2533,12 +2882,13 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t v2 = state.getReg(r2_);
 		const uint32_t v1 = state.getReg(r1_);
@@ -2601,6 +2951,14 @@ public:
 		return op_ == 0 ? OT_MUL : OT_DIV;
 	}
 
+	bool lower(MicroOp &uop) const override
+	{
+		if (op_ != 0)
+			return false; // only MULW
+		uop = MicroOp::alu(MicroOp::MUL, rd_, r1_, r2_, true);
+		return true;
+	}
+
 private:
 	uint8_t op_;
 	uint8_t r2_;
@@ -2609,7 +2967,7 @@ private:
 };
 
 /// Load-reserve and Store-conditional
-class LoadReserveStoreCond : public Inst
+class LoadReserveStoreCond final : public InstBase<LoadReserveStoreCond>
 {
 public:
 	LoadReserveStoreCond(bool is_store, bool dword, bool aq, bool rl, uint8_t r2, uint8_t ar, uint8_t rd)
@@ -2624,11 +2982,11 @@ public:
 	}
 
 	// always write rd
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
 
-	std::vector<RegDep> srcs() const override
+	RegDeps srcs() const override
 	{
-		std::vector<RegDep> ret;
+		RegDeps ret;
 		ret.emplace_back(RegNum(ar_)); // always read address
 
 		if (is_store_)
@@ -2647,23 +3005,26 @@ public:
 		return RegDep(RegNum(0), RegFile::NONE);
 	}
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(ar_); }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(ar_); }
 	uint32_t opSize() const override { return dword_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
-		// TODO monitor reservation
 		const uint16_t sz = opSize();
-		const uint64_t addr = calcEa(state);
+		const uint64_t addr = effAddr(state);
 		if (is_store_)
 		{
 			const uint64_t write_val = state.getReg(r2_);
-			state.writeMem(addr, sz, write_val);
-			state.setReg(rd_, 0); // success!
+			const bool ok = state.storeConditional(addr, sz, write_val);
+			state.setReg(rd_, ok ? 0 : 1); // zero for success
 		}
 		else
 		{
-			state.setReg(rd_, state.readMem(addr, sz));
+			const uint64_t val = state.loadReserved(addr, sz);
+			state.setReg(rd_, dword_ ? val : int64_t(int32_t(val)));
 		}
 
 		state.incPc(4);
@@ -2705,7 +3066,7 @@ private:
 };
 
 /// Atomic Operation
-class AmoOp : public Inst
+class AmoOp final : public InstBase<AmoOp>
 {
 public:
 	AmoOp(uint8_t o31_27, bool dword, bool aq, bool rel, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -2719,27 +3080,44 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
 	// actually r2_ op mem
 	RegDep stdSrc() const override { return RegNum(r2_); }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(r1_); }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(r1_); }
 	uint32_t opSize() const override { return dword_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
-		const uint64_t ea = calcEa(state);
+		const uint64_t ea = effAddr(state);
 		const uint64_t vr2 = state.getReg(r2_);
 		const uint16_t sz = opSize();
-		// TODO: acquire and release
+		// compare exchange is sequentially consistent (covers acquire and release)
 
-		// initial value in memory (not needed for SWAP into r0)
-		const uint64_t init_val =
-		   (o31_27_ == 1 && rd_ == 0) ? 0 : state.readMem(ea, sz);
+		// retry until no other hart wrote in between
+		uint64_t init_val = 0;
+		do
+		{
+			init_val = state.readMem(ea, sz);
+		} while (!state.compareExchange(ea, sz, init_val, apply(init_val, vr2)));
 
-		uint64_t val = 0; // value to store back
+		if (dword_)
+			state.setReg(rd_, init_val);
+		else
+			state.setReg(rd_, int64_t(int32_t(init_val))); // sign-extend
+
+		state.incPc(4);
+	}
+
+	///@return value to store back, for 'init_val' in memory
+	uint64_t apply(uint64_t init_val, uint64_t vr2) const
+	{
+		uint64_t val = 0;
 
 		if (dword_)
 		{
@@ -2764,46 +3142,37 @@ public:
 			case 28: val = std::max(init_val, vr2); break; // MAXU
 			// 29..31 rsvd
 			}
-
-			state.setReg(rd_, init_val);
+			return val;
 		}
-		else
-		{
-			const int32_t init_valw = init_val;
-			const int32_t vr2w = vr2;
-
-			int32_t valw = 0;
-			switch (o31_27_)
-			{
-			case 0: valw = init_valw + vr2w; break; // ADD
-			case 1: valw = vr2w; break; // SWAP
-			//case 2: // LR
-			//case 3: // SC
-			case 4: valw = init_valw ^ vr2w; break; // XOR
-			// 5..7 rsvd
-			case 8: valw = init_valw | vr2w; break; // OR
-			// 9..1 rsvd
-			case 12: valw = init_valw & vr2w; break; // AND
-			// 13..15 rsvd
-			case 16: valw = std::min(init_valw, vr2w); break; // MIN
-			// 17..19 rsvd
-			case 20: valw = std::max(init_valw, vr2w); break; // MAX
-			// 21..23 rsvd
-			case 24: valw = std::min(init_valw, vr2w); break; // MINU
-			// 25..27 rsvd
-			case 28: valw = std::max(init_valw, vr2w); break; // MAXU
-			// 29..31 rsvd
-			}
 
-			// sign-extend
-			val = int64_t(valw);
+		const int32_t init_valw = init_val;
+		const int32_t vr2w = vr2;
 
-			state.setReg(rd_, int64_t(init_valw));
+		int32_t valw = 0;
+		switch (o31_27_)
+		{
+		case 0: valw = init_valw + vr2w; break; // ADD
+		case 1: valw = vr2w; break; // SWAP
+		//case 2: // LR
+		//case 3: // SC
+		case 4: valw = init_valw ^ vr2w; break; // XOR
+		// 5..7 rsvd
+		case 8: valw = init_valw | vr2w; break; // OR
+		// 9..1 rsvd
+		case 12: valw = init_valw & vr2w; break; // AND
+		// 13..15 rsvd
+		case 16: valw = std::min(init_valw, vr2w); break; // MIN
+		// 17..19 rsvd
+		case 20: valw = std::max(init_valw, vr2w); break; // MAX
+		// 21..23 rsvd
+		case 24: valw = std::min(uint32_t(init_valw), uint32_t(vr2w)); break; // MINU
+		// 25..27 rsvd
+		case 28: valw = std::max(uint32_t(init_valw), uint32_t(vr2w)); break; // MAXU
+		// 29..31 rsvd
 		}
 
-		state.writeMem(ea, sz, val);
-
-		state.incPc(4);
+		// memory only holds the word
+		return uint32_t(valw);
 	}
 
 	std::string disasm() const override
@@ -2862,7 +3231,7 @@ private:
 };
 
 /// Store Floating Point
-class StoreFp : public Inst
+class StoreFp final : public InstBase<StoreFp>
 {
 public:
 	StoreFp(int32_t imm, uint8_t rbase, uint8_t rsrc, uint16_t sz)
@@ -2874,15 +3243,20 @@ public:
 	}
 
 	// no dests
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(rbase_), stdSrc()}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {RegNum(rbase_), stdSrc()}; }
 	// help consumers figure out which is store data
 	RegDep stdSrc() const override { return RegDep(RegNum(rsrc_), RegFile::FLOAT); }
 
-	void execute(ArchState &state) const override
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(rbase_) + imm_; }
+	uint32_t opSize() const override { return sz_; }
+
+	template<class State>
+	void exec(State &state) const
 	{
-		const uint64_t base = state.getReg(rbase_);
-		state.writeMem(base + imm_, sz_, state.getFpRaw(rsrc_));
+		state.writeMem(effAddr(state), sz_, state.getFpRaw(rsrc_));
 		state.incPc(4);
 	}
 
@@ -2906,7 +3280,7 @@ private:
 };
 
 /// Move between int and float register files
-class Fmove : public Inst
+class Fmove final : public InstBase<Fmove>
 {
 public:
 	Fmove(bool dword, bool to_float, uint8_t r1, uint8_t rd)
@@ -2917,7 +3291,7 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override
+	RegDeps dsts() const override
 	{
 		if (to_float_)
 			return {RegDep(RegNum(rd_), RegFile::FLOAT)};
@@ -2926,7 +3300,7 @@ public:
 		return {RegNum(rd_)};
 	}
 
-	std::vector<RegDep> srcs() const override
+	RegDeps srcs() const override
 	{
 		if (to_float_)
 			return {RegNum(r1_)}; // int is default
@@ -2936,7 +3310,8 @@ public:
 
 	uint32_t opSize() const override { return dword_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// move bit patterns
 		IntFloat tmp;
@@ -3014,7 +3389,7 @@ private:
 };
 
 /// Load floating point
-class LoadFp : public Inst
+class LoadFp final : public InstBase<LoadFp>
 {
 public:
 	LoadFp(uint8_t op, int32_t s_imm, uint8_t r1, uint8_t rd)
@@ -3025,16 +3400,19 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_)}; }
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override { return {RegNum(r1_)}; }
 
-	uint64_t calcEa(ArchState &state) const override { return state.getReg(r1_) + imm_; }
+	uint64_t calcEa(ArchState &state) const override { return effAddr(state); }
+	template<class State>
+	uint64_t effAddr(State &state) const { return state.getReg(r1_) + imm_; }
 	uint32_t opSize() const override { return 1 << (op_ & 3); }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint8_t sz = opSize();
-		const uint64_t ea = calcEa(state);
+		const uint64_t ea = effAddr(state);
 
 		IntFloat tmp;
 		if (sz == 8)
@@ -3072,7 +3450,7 @@ private:
 };
 
 /// Convert between float and int
-class FcvtInt : public Inst
+class FcvtInt final : public InstBase<FcvtInt>
 {
 public:
 	FcvtInt(bool dbl, bool to_float, uint8_t int_sz, uint8_t round, uint8_t r1, uint8_t rd)
@@ -3085,7 +3463,7 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override
+	RegDeps dsts() const override
 	{
 		if (to_float_)
 			return {RegDep(RegNum(rd_), RegFile::FLOAT)};
@@ -3094,7 +3472,7 @@ public:
 		return {RegNum(rd_)};
 	}
 
-	std::vector<RegDep> srcs() const override
+	RegDeps srcs() const override
 	{
 		if (to_float_)
 			return {RegNum(r1_)}; // int is default
@@ -3110,7 +3488,8 @@ public:
 		return (dbl_ || int_sz_ > 1) ? 8 : 4;
 	}
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// TODO: rounding modes
 		if (to_float_)
@@ -3354,7 +3733,7 @@ private: // data
 };
 
 /// Float sign manipulate
-class Fsign : public Inst
+class Fsign final : public InstBase<Fsign>
 {
 public:
 	Fsign(bool dbl, uint8_t op, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -3366,8 +3745,8 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override
 	{
 		return {
 			RegDep(RegNum(r1_), RegFile::FLOAT),
@@ -3377,7 +3756,8 @@ public:
 
 	uint32_t opSize() const override { return dbl_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		if (dbl_)
 		{
@@ -3497,7 +3877,7 @@ private:
 };
 
 /// Float Multiply and Add (and variants)
-class Fmadd : public Inst
+class Fmadd final : public InstBase<Fmadd>
 {
 public:
 	Fmadd(bool dbl, uint8_t rm, uint8_t op, uint8_t r3, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -3511,8 +3891,8 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override
 	{
 		return {
 			RegDep(RegNum(r1_), RegFile::FLOAT),
@@ -3523,7 +3903,8 @@ public:
 
 	uint32_t opSize() const override { return dbl_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// TODO: rounding modes
 		if (dbl_)
@@ -3600,7 +3981,7 @@ private:
 };
 
 /// Float ALU ops (Add, Sub, Mul, Div)
-class FpAlu : public Inst
+class FpAlu final : public InstBase<FpAlu>
 {
 public:
 	FpAlu(uint8_t alu, bool dbl, uint8_t round, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -3613,8 +3994,8 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override
 	{
 		return {
 			RegDep(RegNum(r1_), RegFile::FLOAT),
@@ -3624,7 +4005,8 @@ public:
 
 	uint32_t opSize() const override { return dbl_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		if (dbl_)
 		{
@@ -3699,7 +4081,7 @@ private:
 };
 
 /// Float Compare (FLE, FLT, FEQ)
-class Fcmp : public Inst
+class Fcmp final : public InstBase<Fcmp>
 {
 public:
 	Fcmp(bool dbl, uint8_t op, uint8_t r2, uint8_t r1, uint8_t rd)
@@ -3712,8 +4094,8 @@ public:
 	}
 
 	// integer dest
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override
 	{
 		return {
 			RegDep(RegNum(r1_), RegFile::FLOAT),
@@ -3723,7 +4105,8 @@ public:
 
 	uint32_t opSize() const override { return dbl_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		bool val = false;
 
@@ -3790,7 +4173,7 @@ private:
 };
 
 /// Control register operators
-class ControlRegOp : public Inst
+class ControlRegOp final : public InstBase<ControlRegOp>
 {
 public:
 	ControlRegOp(uint8_t op, uint16_t csr, uint8_t r1, uint8_t rd)
@@ -3802,8 +4185,8 @@ public:
 	}
 
 	// TODO: control reg dep?
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override
 	{
 		if (op_ > 4)
 			return {}; // immediate
@@ -3811,7 +4194,8 @@ public:
 		return {RegNum(r1_)};
 	}
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		enum
 		{
@@ -3898,7 +4282,7 @@ private:
 };
 
 /// Float Square Root
-class Fsqrt : public Inst
+class Fsqrt final : public InstBase<Fsqrt>
 {
 public:
 	Fsqrt(bool dbl, uint8_t round, uint8_t r1, uint8_t rd)
@@ -3909,15 +4293,16 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override
 	{
 		return { RegDep(RegNum(r1_), RegFile::FLOAT) };
 	}
 
 	uint32_t opSize() const override { return dbl_ ? 8 : 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		if (dbl_)
 		{
@@ -3968,7 +4353,7 @@ private:
 };
 
 /// Memory Fence
-class Fence : public Inst
+class Fence final : public InstBase<Fence>
 {
 public:
 	Fence(uint16_t imm, uint8_t r1, uint8_t op, uint8_t rd)
@@ -3980,11 +4365,12 @@ public:
 	}
 
 	// no register dependencies
-	std::vector<RegDep> dsts() const override { return {}; }
-	std::vector<RegDep> srcs() const override { return {}; }
+	RegDeps dsts() const override { return {}; }
+	RegDeps srcs() const override { return {}; }
 	uint32_t opSize() const override { return 0; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// TODO: communitcate to archstate
 		state.incPc(4);
@@ -4005,7 +4391,7 @@ private:
 };
 
 /// Float Convert Single and Double (FCVT.S.D and FCVT.D.S)
-class FcvtDbl : public Inst
+class FcvtDbl final : public InstBase<FcvtDbl>
 {
 public:
 	FcvtDbl(bool dbl, uint8_t rm, uint8_t r1, uint8_t rd)
@@ -4016,10 +4402,11 @@ public:
 	{
 	}
 
-	std::vector<RegDep> dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
-	std::vector<RegDep> srcs() const override { return {RegDep(RegNum(r1_), RegFile::FLOAT)}; }
+	RegDeps dsts() const override { return {RegDep(RegNum(rd_), RegFile::FLOAT)}; }
+	RegDeps srcs() const override { return {RegDep(RegNum(r1_), RegFile::FLOAT)}; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		// TODO: rounding modes
 
@@ -4055,7 +4442,7 @@ private:
 };
 
 /// Shift Right Word (SR[AL]W)
-class Sralw : public Inst
+class Sralw final : public InstBase<Sralw>
 {
 public:
 	Sralw(uint8_t r2, uint8_t r1, uint8_t rd, bool op30)
@@ -4067,12 +4454,13 @@ public:
 	}
 
 	// rd = r1 op imm
-	std::vector<RegDep> dsts() const override { return {RegNum(rd_)}; }
-	std::vector<RegDep> srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override { return {RegNum(r1_), RegNum(r2_)}; }
 
 	uint32_t opSize() const override { return 4; }
 
-	void execute(ArchState &state) const override
+	template<class State>
+	void exec(State &state) const
 	{
 		const uint32_t sft = state.getReg(r2_) & 0x1f; // r2[4:0]
 		int32_t tmp = 0;
@@ -4108,6 +4496,12 @@ public:
 
 	OpType opType() const override { return OT_SHIFT; }
 
+	bool lower(MicroOp &uop) const override
+	{
+		uop = MicroOp::alu(op30_ ? MicroOp::SRA : MicroOp::SRL, rd_, r1_, r2_, true);
+		return true;
+	}
+
 private:
 	uint8_t r2_;
 	uint8_t r1_;
@@ -4115,291 +4509,1376 @@ private:
 	bool op30_;
 };
 
-Inst* decode32(uint32_t opc)
+//----------------------------------------------------------------------------
+// Vector extension (VLEN is ArchState::VLEN_BYTES, the element loops are in vec_kernels.hpp)
+
+/// Report a vector instruction which is reserved for the current vtype (or with a register not
+/// aligned to its group), and skip it (there are no traps)
+template<class State>
+void vecIllegal(State &state)
 {
-	// opc[1:0] == 2'b11
-	const uint32_t group = opc & 0x7c; // opc[6:2]
-	const uint8_t rd = (opc >> 7) & 0x1f; //opc[11:7]
-	const uint8_t r1 = (opc >> 15) & 0x1f; // opc[19:15]
-	const uint8_t r2 = (opc >> 20) & 0x1f; // opc[24:20]
-	const uint8_t op = (opc >> 12) & 7; // opc[14:12]
+	state.getSys()->err() << " Illegal vector instruction at 0x" << std::hex << state.getPc() << std::dec << std::endl;
+	state.incPc(4);
+}
 
-	switch (group)
-	{
-	case   0: // load
-	{
+///@return true if register 'r' can start a group of 'n'
+inline bool vecAligned(uint32_t r, uint32_t n)
+{
+	return (r & (n - 1)) == 0;
+}
 
-		uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
-		if (imm & 0x800)
-			imm |= 0xf000; // sign ex
-		int16_t s_imm = imm;
+inline std::ostream& printVtype(std::ostream &os, uint64_t vtype)
+{
+	const Vtype vt(vtype);
+	os << 'e' << (8 << vt.vsew) << ',';
+	if (vt.vlmul < 4)
+		os << 'm' << (1 << vt.vlmul);
+	else
+		os << "mf" << (1 << (8 - vt.vlmul));
+	return os << ',' << (vtype & 0x40 ? "ta" : "tu") << ',' << (vtype & 0x80 ? "ma" : "mu");
+}
 
-		return new Load(op, s_imm, r1, rd);
+/// Set vl and vtype (VSETVLI, VSETIVLI, VSETVL)
+class VsetVl final : public InstBase<VsetVl>
+{
+public:
+	enum Kind : uint8_t
+	{
+		VLI, ///< vtype immediate
+		IVLI, ///< AVL and vtype immediate
+		VL ///< vtype in rs2
+	};
+
+	VsetVl(Kind kind, uint16_t vtype, uint8_t rs2, uint8_t rs1, uint8_t rd)
+	: kind_(kind)
+	, vtype_(vtype)
+	, rs2_(rs2)
+	, rs1_(rs1)
+	, rd_(rd)
+	{
 	}
 
-	case   4: // load FP
+	RegDeps dsts() const override { return {RegNum(rd_)}; }
+	RegDeps srcs() const override
 	{
-		uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
-		if (imm & 0x800)
-			imm |= 0xf000; // sign ex
-		int16_t s_imm = imm;
-
-		return new LoadFp(op, s_imm, r1, rd);
+		RegDeps ret;
+		if (kind_ != IVLI)
+			ret.emplace_back(RegNum(rs1_));
+		if (kind_ == VL)
+			ret.emplace_back(RegNum(rs2_));
+		return ret;
 	}
 
-	case  12: // misc MEM
+	template<class State>
+	void exec(State &state) const
 	{
-		const uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
-		return new Fence(imm, r1, op, rd);
+		const uint64_t vtype = kind_ == VL ? state.getReg(rs2_) : vtype_;
+
+		// AVL (all ones for VLMAX, or keep vl)
+		uint64_t avl = rs1_;
+		if (kind_ != IVLI)
+			avl = rs1_ != 0 ? state.getReg(rs1_) : rd_ != 0 ? ~0ull : state.getCr(CsrFile::VL);
+
+		const Vtype vt(vtype);
+		const uint64_t vl = vt.vill ? 0 : std::min<uint64_t>(avl, vt.vlmax());
+		state.setCr(CsrFile::VTYPE, vt.vill ? Vtype::VILL : vtype);
+		state.setCr(CsrFile::VL, vl);
+		state.setCr(CsrFile::VSTART, 0);
+		state.setReg(rd_, vl);
+		state.incPc(4);
 	}
 
-	case  16: // op imm
+	std::string disasm() const override
 	{
-		uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
-		if (imm & 0x800)
-			imm |= 0xf000; // sign ex
-		return new OpImm(op, imm, r1, rd);
+		std::ostringstream os;
+		os << std::left << std::setw(MNE_WIDTH) << (kind_ == VLI ? "VSETVLI" : kind_ == IVLI ? "VSETIVLI" : "VSETVL") << ' ';
+		printReg(os, rd_) << " = ";
+		if (kind_ == IVLI)
+			os << uint32_t(rs1_);
+		else
+			os << 'r' << uint32_t(rs1_);
+
+		if (kind_ == VL)
+			os << ", r" << uint32_t(rs2_);
+		else
+			printVtype(os << ", ", vtype_);
+		return os.str();
 	}
 
-	case  20: // AUIPC
-	{
-		const uint32_t imm = opc & 0xfffff000; // opc[31:12]
-		return new Auipc(imm, rd);
+	OpType opType() const override { return OT_VEC; }
+
+private:
+	Kind kind_;
+	uint16_t vtype_;
+	uint8_t rs2_;
+	uint8_t rs1_;
+	uint8_t rd_;
+};
+
+/// A vector arithmetic op: its forms, operand shapes and kernels (see decodeOpV)
+struct VecOpDesc
+{
+	enum : uint32_t
+	{
+		VV = 1, ///< vector-vector form
+		VX = 2, ///< vector-integer register
+		VI = 4, ///< vector-immediate
+		VF = 8, ///< vector-FP register
+		UIMM = 0x10, ///< the immediate is unsigned
+		MASK_DST = 0x20, ///< vd is a mask
+		ELEM0_DST = 0x40, ///< only element 0 of vd is written
+		INT_DST = 0x80, ///< writes x[rd] instead of vd
+		FP_DST = 0x100, ///< writes f[rd] instead of vd
+		SINGLE_SRCS = 0x200, ///< vs2 and vs1 are single registers (masks, or element 0 is read)
+		ELEM0_VS1 = 0x400, ///< only element 0 of vs1 is read (reductions)
+		NO_VS2 = 0x800,
+		NO_VS1 = 0x1000, ///< (the field extends the opcode)
+		READS_VD = 0x2000, ///< multiply-add
+		FULL_NAME = 0x4000, ///< 'name' has its operand suffix
+		MERGE = 0x8000, ///< v0 selects, rather than masks (suffix .VVM ...)
+		SHORT_SUFFIX = 0x10000 ///< suffix .V .X .I .F
+	};
+
+	const char *name;
+	const VecKernel *kern; ///< by vsew (nullptr where the SEW is not supported)
+	uint32_t flags;
+};
+
+/// Vector arithmetic, run by a kernel for the current SEW over the elements below vl
+/// (tail and inactive elements are left undisturbed, which all policies allow)
+class VecOp final : public InstBase<VecOp>
+{
+public:
+	VecOp(const VecOpDesc &desc, uint32_t form, bool masked, uint8_t vs2, uint8_t vs1, uint8_t vd)
+	: desc_(desc)
+	, form_(form)
+	, masked_(masked)
+	, vs2_(vs2)
+	, vs1_(vs1)
+	, vd_(vd)
+	{
+	}
+
+	RegDeps dsts() const override
+	{
+		if (desc_.flags & VecOpDesc::INT_DST)
+			return {RegNum(vd_)};
+		if (desc_.flags & VecOpDesc::FP_DST)
+			return {RegDep(RegNum(vd_), RegFile::FLOAT)};
+		return {RegDep(RegNum(vd_), RegFile::VECTOR)};
+	}
+
+	RegDeps srcs() const override
+	{
+		RegDeps ret;
+		if ((desc_.flags & VecOpDesc::NO_VS2) == 0)
+			ret.emplace_back(RegNum(vs2_), RegFile::VECTOR);
+		if (readsVs1())
+			ret.emplace_back(RegNum(vs1_), RegFile::VECTOR);
+		else if (form_ == VecOpDesc::VX)
+			ret.emplace_back(RegNum(vs1_));
+		else if (form_ == VecOpDesc::VF)
+			ret.emplace_back(RegNum(vs1_), RegFile::FLOAT);
+		if (desc_.flags & VecOpDesc::READS_VD)
+			ret.emplace_back(RegNum(vd_), RegFile::VECTOR);
+		if (masked_)
+			ret.emplace_back(RegNum(0), RegFile::VECTOR);
+		return ret;
 	}
 
-	case  24: // op imm32
+	template<class State>
+	void exec(State &state) const
 	{
-		if (op == 0) // ADDIW
+		const uint32_t f = desc_.flags;
+		const Vtype vt(state.getCr(CsrFile::VTYPE));
+		const VecKernel k = vt.vill ? nullptr : desc_.kern[vt.vsew];
+		const uint32_t group = vt.groupRegs();
+		const uint32_t src_regs = f & VecOpDesc::SINGLE_SRCS ? 1 : group;
+		if (!k ||
+		    ((f & (VecOpDesc::INT_DST | VecOpDesc::FP_DST)) == 0 &&
+		     !vecAligned(vd_, f & (VecOpDesc::MASK_DST | VecOpDesc::ELEM0_DST) ? 1 : group)) ||
+		    ((f & VecOpDesc::NO_VS2) == 0 && !vecAligned(vs2_, src_regs)) ||
+		    (readsVs1() && !vecAligned(vs1_, f & VecOpDesc::ELEM0_VS1 ? 1 : src_regs)))
 		{
-			uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
-			if (imm & 0x800)
-				imm |= 0xf000; // sign ex
-			return new AddIw(imm, r1, rd);
-		}
-		if (op == 1) // SLLIW
-		{
-			const uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
-			return new Slliw(imm, r1, rd);
-		}
-		if (op == 5) // SR(AL)IW
-		{
-			const uint16_t imm = (opc >> 20) & 0x01f; // opc[24:20]
-			const bool op30 = opc & 0x40000000; // opc[30]
-			return new Sraliw(imm, r1, rd, op30);
+			vecIllegal(state);
+			return;
 		}
 
-		return nullptr; // TODO
+		VecArgs a;
+		a.vd = state.getVecReg(vd_);
+		a.vs2 = state.getVecReg(vs2_);
+		a.vs1 = readsVs1() ? state.getVecReg(vs1_) : nullptr;
+		a.mask = masked_ ? state.getVecReg(0) : nullptr;
+		a.scalar = scalar(state, vt);
+		a.vlmax = vt.vlmax();
+		a.vl = std::min<uint64_t>(state.getCr(CsrFile::VL), a.vlmax);
+
+		const uint64_t ret = k(a);
+		if (f & VecOpDesc::INT_DST)
+			state.setReg(vd_, ret);
+		else if (f & VecOpDesc::FP_DST)
+			state.setFpRaw(vd_, vt.vsew == 2 ? 0xffffffff00000000ull | ret : ret); // (NAN box)
+
+		state.incPc(4);
 	}
 
-	case  32: // store
+	std::string disasm() const override
 	{
-		uint16_t imm = rd; // opc[11:7] -> imm[4:0]
-		imm |= (opc >> 20) & 0xfe0; // opc[31:25] -> imm[11:5]
-		if (imm & 0x800)
-			imm |= 0xf000; // sign extend from bit 11
+		const uint32_t f = desc_.flags;
+		std::ostringstream mne;
+		mne << desc_.name;
+		if ((f & VecOpDesc::FULL_NAME) == 0)
+		{
+			const char kind = form_ == VecOpDesc::VV ? 'V' : form_ == VecOpDesc::VX ? 'X' : form_ == VecOpDesc::VI ? 'I' : 'F';
+			mne << '.';
+			if ((f & VecOpDesc::SHORT_SUFFIX) == 0)
+				mne << 'V';
+			mne << kind;
+			if (f & VecOpDesc::MERGE)
+				mne << 'M';
+		}
 
-		const int16_t s_imm = int16_t(imm);
-		const uint8_t sz = op; // opc[14:12]
-		return new Store(sz, s_imm, r1, r2);
+		std::ostringstream os;
+		os << std::left << std::setw(MNE_WIDTH) << mne.str() << ' ';
+		if (f & (VecOpDesc::INT_DST | VecOpDesc::FP_DST))
+			printReg(os, vd_, (f & VecOpDesc::FP_DST) != 0);
+		else
+			os << 'v' << uint32_t(vd_);
+
+		std::ostringstream ops;
+		if ((f & VecOpDesc::NO_VS2) == 0)
+			ops << ", v" << uint32_t(vs2_);
+		if (readsVs1())
+			ops << ", v" << uint32_t(vs1_);
+		else if (form_ == VecOpDesc::VX)
+			ops << ", r" << uint32_t(vs1_);
+		else if (form_ == VecOpDesc::VF)
+			ops << ", f" << uint32_t(vs1_);
+		else if (form_ == VecOpDesc::VI)
+			ops << ", " << int64_t(immediate());
+		if (masked_)
+			ops << (f & VecOpDesc::MERGE ? ", v0" : ", v0.t");
+
+		const std::string o = ops.str();
+		if (!o.empty())
+			os << " = " << o.substr(2);
+		return os.str();
 	}
 
-	case  36: // store FP
-	{
-		uint16_t imm = rd; // opc[11:7] -> imm[4:0]
-		imm |= (opc >> 20) & 0xfe0; // opc[31:25] -> imm[11:5]
-		if (imm & 0x800)
-			imm |= 0xf000; // sign extend from bit 11
-		const int16_t s_imm = int16_t(imm);
+	OpType opType() const override { return OT_VEC; }
 
-		const uint8_t sz = op == 2 ? 4 : 8;
-		const uint8_t rbase = r1;
-		const uint8_t rsrc = r2;
-		return new StoreFp(s_imm, rbase, rsrc, sz);
-	}
+private: // methods
+	bool readsVs1() const { return form_ == VecOpDesc::VV && (desc_.flags & VecOpDesc::NO_VS1) == 0; }
 
-	case  44: // AMO (atomics)
+	/// simm5 (or uimm5)
+	uint64_t immediate() const
 	{
-		const bool dword = op == 3; // else word
-		const bool o27 = (opc & 0x08000000) != 0; // opc[27]
-		const bool aq  = (opc & 0x04000000) != 0; // opc[26]
-		const bool rel = (opc & 0x02000000) != 0; // opc[25]
-
-		if (opc & 0x10000000) // opc[28]
-		{
-			// Load-reserve (LR) + Store-conditional (SC)
-			return new LoadReserveStoreCond(o27, dword, aq, rel, r2, r1, rd);
-		}
-		// atomic op
-		const uint8_t o31_27 = (opc >> 27) & 0x1f; // opc[31:27]
-		return new AmoOp(o31_27, dword, aq, rel, r2, r1, rd);
+		if (desc_.flags & VecOpDesc::UIMM)
+			return vs1_;
+		return int64_t(int8_t(vs1_ << 3) >> 3);
 	}
 
-	case  48: // op reg,reg
+	template<class State>
+	uint64_t scalar(State &state, const Vtype &vt) const
 	{
-		if (opc & 0x2000000) // opc[25]
+		switch (form_)
 		{
-			return new ImulDiv(op, r2, r1, rd);
+		case VecOpDesc::VX:
+			return state.getReg(vs1_);
+
+		case VecOpDesc::VI:
+			return immediate();
+
+		case VecOpDesc::VF:
+			if (vt.vsew == 2)
+			{
+				IntFloat tmp;
+				tmp.dw = 0;
+				tmp.f = state.getFloat(vs1_); // (checks the NAN box)
+				return tmp.dw;
+			}
+			return state.getFpRaw(vs1_);
 		}
-		//else int reg,reg
-		const bool op30 = opc & 0x40000000; // opc[30]
+		return 0;
+	}
+
+private: // data
+	const VecOpDesc &desc_;
+	uint32_t form_;
+	bool masked_;
+	uint8_t vs2_;
+	uint8_t vs1_; ///< (or rs1 or the immediate)
+	uint8_t vd_; ///< (or rd)
+};
 
-		return new OpRegReg(op, op30, r2, r1, rd);
+/// Vector loads and stores: unit stride, strided and indexed (each with segments), whole register and mask
+class VecMem final : public InstBase<VecMem>
+{
+public:
+	enum Mode : uint8_t
+	{
+		UNIT,
+		UNIT_FF, ///< fault only first (there are no faults, so as UNIT)
+		STRIDED, ///< stride in rs2
+		INDEXED, ///< offsets in vs2 (unordered)
+		INDEXED_ORD, ///< (ordered)
+		WHOLE, ///< 'nf' registers, regardless of vtype and vl
+		MASK ///< vl bits
+	};
+
+	VecMem(bool store, Mode mode, uint8_t nf, uint8_t eew, bool masked, uint8_t rs2, uint8_t rs1, uint8_t vd)
+	: store_(store)
+	, mode_(mode)
+	, nf_(nf)
+	, eew_(eew)
+	, masked_(masked)
+	, rs2_(rs2)
+	, rs1_(rs1)
+	, vd_(vd)
+	{
+	}
+
+	RegDeps dsts() const override
+	{
+		if (store_)
+			return {};
+		return {RegDep(RegNum(vd_), RegFile::VECTOR)};
+	}
+
+	RegDeps srcs() const override
+	{
+		RegDeps ret{RegNum(rs1_)};
+		if (mode_ == STRIDED)
+			ret.emplace_back(RegNum(rs2_));
+		else if (mode_ == INDEXED || mode_ == INDEXED_ORD)
+			ret.emplace_back(RegNum(rs2_), RegFile::VECTOR);
+		if (store_)
+			ret.push_back(stdSrc());
+		if (masked_)
+			ret.emplace_back(RegNum(0), RegFile::VECTOR);
+		return ret;
 	}
 
-	case  52: // LUI
+	RegDep stdSrc() const override
 	{
-		const int32_t imm = opc & 0xfffff000; // opc[31:12]
-		return new Lui(imm, rd);
+		if (store_)
+			return RegDep(RegNum(vd_), RegFile::VECTOR);
+		return RegDep(RegNum(0), RegFile::NONE);
 	}
 
-	case  56: // op32
+	uint64_t calcEa(ArchState &state) const override { return state.getReg(rs1_); }
+	uint32_t opSize() const override { return eew_; }
+
+	template<class State>
+	void exec(State &state) const
 	{
-		if (opc & 0x2000000) // opc[25]
+		const uint64_t base = state.getReg(rs1_);
+		uint8_t *const vd = state.getVecReg(vd_);
+		if (mode_ == WHOLE)
 		{
-			return new MulDivW(op, r2, r1, rd); // DIV/MUL word
+			if (!vecAligned(vd_, nf_))
+			{
+				vecIllegal(state);
+				return;
+			}
+			bulk(state, base, nf_ * ArchState::VLEN_BYTES, vd);
+			state.incPc(4);
+			return;
 		}
-		//else ADD/Shift word
-		const bool op30 = opc & 0x40000000; // opc[30]
-		if (op == 0) // ADD+SUB
+
+		Layout l;
+		if (!layout(state, l))
 		{
-			return new AddSubW(r2, r1, rd, op30);
+			vecIllegal(state);
+			return;
 		}
-		if (op == 1) // SLLW
+		const uint32_t vl = l.vl;
+		if (mode_ == MASK)
 		{
-			return new Sllw(r2, r1, rd);
+			bulk(state, base, (vl + 7) / 8, vd);
+			state.incPc(4);
+			return;
 		}
-		if (op == 5) // SR(AL)W
+
+		// contiguous, in one copy (short if it runs into unallocated memory, which the element loop reports)
+		const uint32_t esz = l.esz;
+		const uint32_t data_regs = l.data_regs;
+		const uint64_t bytes = uint64_t(vl) * esz;
+		if ((mode_ == UNIT || mode_ == UNIT_FF) && nf_ == 1 && !masked_ && bulk(state, base, bytes, vd) == bytes)
 		{
-			return new Sralw(r2, r1, rd, op30);
+			state.incPc(4);
+			return;
 		}
 
-		return nullptr; // TODO
-	}
+		const uint8_t *const mask = state.getVecReg(0);
+		for (uint32_t i = 0; i < vl; ++i)
+		{
+			if (masked_ && !maskBit(mask, i))
+				continue;
 
-	case  64: // FMADD
-	case  68: // FMSUB
-	case  72: // FNMSUB
-	case  76: // FNMADD
-	{
-		const bool dbl = (opc & 0x02000000) != 0; // opc[25]
-		const uint8_t r3 = (opc >> 27) & 0x1f; // opc[31:27]
-		const uint8_t rm = op;
-		const uint8_t op2 = (opc >> 2) & 3; // opc[3:2]
-		return new Fmadd(dbl, rm, op2, r3, r2, r1, rd);
+			const uint64_t ea = elementEa(state, base, l, i);
+
+			// segment fields are in consecutive groups
+			for (uint32_t fld = 0; fld < nf_; ++fld)
+			{
+				uint8_t *const p = vd + fld * data_regs * ArchState::VLEN_BYTES + i * esz;
+				uint64_t val = 0;
+				if (store_)
+				{
+					memcpy(&val, p, esz);
+					state.writeMem(ea + fld * esz, esz, val);
+				}
+				else
+				{
+					val = state.readMem(ea + fld * esz, esz);
+					memcpy(p, &val, esz);
+				}
+			}
+		}
+		state.incPc(4);
 	}
 
-	case  80: // fp op
+	std::string disasm() const override
 	{
-		const uint8_t op2 = (opc >> 25) & 0xff; // opc[31:25]
-		const uint8_t mask1 = op2 & 0x7e; // upper op bits[6:1]
-		const uint8_t mask2 = op2 & 0x76; // ignore bit 3 (opc[28])
-		const bool dbl = (op2 & 1) != 0; // float bar
-		if (mask2 == 0x70) // FMV
+		std::ostringstream mne;
+		mne << 'V' << (store_ ? 'S' : 'L');
+		switch (mode_)
 		{
-			const bool dword = dbl;
-			const bool to_float = (op2 & 8) != 0;
-			return new Fmove(dword, to_float, r1, rd);
+		case STRIDED: mne << 'S'; break;
+		case INDEXED: mne << "UX"; break;
+		case INDEXED_ORD: mne << "OX"; break;
+		case WHOLE: mne << uint32_t(nf_) << 'R'; break;
+		case MASK: mne << 'M'; break;
+		default: break;
 		}
-		if (mask2 == 0x60) // FCVT
+		if (mode_ != WHOLE && mode_ != MASK)
 		{
-			const bool to_float = (op2 & 8) != 0; // to_int bar
-			const uint8_t int_sz = r2; // sw, w, sx, x
-			const uint8_t round = op;
-			return new FcvtInt(dbl, to_float, int_sz, round, r1, rd);
+			if (nf_ > 1)
+				mne << "SEG" << uint32_t(nf_);
+			mne << 'E';
+			if (mode_ == INDEXED || mode_ == INDEXED_ORD)
+				mne << 'I';
+			mne << 8 * uint32_t(eew_);
+			if (mode_ == UNIT_FF)
+				mne << "FF";
 		}
-		if (mask2 == 0x04 || mask2 == 0x00) // FP ALU
+		else if (mode_ == WHOLE && !store_)
+			mne << 'E' << 8 * uint32_t(eew_);
+		mne << ".V";
+
+		std::ostringstream addr;
+		addr << "[r" << uint32_t(rs1_) << ']';
+		if (mode_ == STRIDED)
+			addr << ", r" << uint32_t(rs2_);
+		else if (mode_ == INDEXED || mode_ == INDEXED_ORD)
+			addr << ", v" << uint32_t(rs2_);
+
+		std::ostringstream os;
+		os << std::left << std::setw(MNE_WIDTH) << mne.str() << ' ';
+		if (store_)
+			os << addr.str() << " = v" << uint32_t(vd_);
+		else
+			os << 'v' << uint32_t(vd_) << " = " << addr.str();
+		if (masked_)
+			os << ", v0.t";
+		return os.str();
+	}
+
+	OpType opType() const override { return store_ ? OT_STORE_VEC : OT_LOAD_VEC; }
+
+	void memRanges(ArchState &state, std::vector<MemRange> &ranges) const override
+	{
+		const uint64_t base = state.getReg(rs1_);
+		if (mode_ == WHOLE)
 		{
-			const uint8_t alu = (op2 >> 2) & 3; // opc[28:27]
-			const uint8_t round = op;
-			return new FpAlu(alu, dbl, round, r2, r1, rd);
+			if (vecAligned(vd_, nf_))
+				ranges.push_back(MemRange{base, nf_ * uint64_t(ArchState::VLEN_BYTES)});
+			return;
 		}
-		if (mask1 == 0x10) // FSGN
+
+		Layout l;
+		if (!layout(state, l) || l.vl == 0)
+			return; // (nothing accessed)
+		if (mode_ == MASK)
 		{
-			return new Fsign(dbl, op, r2, r1, rd);
+			ranges.push_back(MemRange{base, (l.vl + 7) / 8});
+			return;
 		}
-		if (mask1 == 0x20) // FCVT.S.D and FCVT.D.S
+
+		// each element's fields are contiguous
+		const uint64_t seg = uint64_t(nf_) * l.esz;
+		if ((mode_ == UNIT || mode_ == UNIT_FF) && !masked_)
 		{
-			return new FcvtDbl(dbl, op, r1, rd);
+			ranges.push_back(MemRange{base, l.vl * seg});
+			return;
 		}
-		if (mask1 == 0x2c) // FSQRT
+		const uint8_t *const mask = state.getVecReg(0);
+		for (uint32_t i = 0; i < l.vl; ++i)
 		{
-			const uint8_t round = op;
-			return new Fsqrt(dbl, round, r1, rd);
+			if (!masked_ || maskBit(mask, i))
+				ranges.push_back(MemRange{elementEa(state, base, l, i), seg});
 		}
-		if (mask1 == 0x50) // FCMP
+	}
+
+private: // types
+	/// element geometry for the current vtype and vl
+	struct Layout
+	{
+		uint32_t vl = 0;
+		uint32_t esz = 0; ///< data element bytes
+		uint32_t data_regs = 0; ///< registers per field
+	};
+
+private: // methods
+	///@return false if the instruction is illegal for the vtype (MASK only sets 'vl'; not for WHOLE)
+	template<class State>
+	bool layout(State &state, Layout &l) const
+	{
+		const Vtype vt(state.getCr(CsrFile::VTYPE));
+		l.vl = std::min<uint64_t>(state.getCr(CsrFile::VL), vt.vlmax());
+		if (vt.vill)
+			return false;
+		if (mode_ == MASK)
+			return true;
+
+		// EMUL = EEW / SEW * LMUL (for indexed, the offsets are EEW and the data SEW)
+		const bool indexed = mode_ == INDEXED || mode_ == INDEXED_ORD;
+		const int32_t emul = vt.lmulLog2() + __builtin_ctz(eew_) - int32_t(vt.vsew);
+		const uint32_t emul_regs = emul > 0 ? 1u << emul : 1;
+		l.esz = indexed ? vt.sewBytes() : eew_;
+		l.data_regs = indexed ? vt.groupRegs() : emul_regs;
+		return !(emul < -3 || emul > 3 || nf_ * l.data_regs > 8 || !vecAligned(vd_, l.data_regs) ||
+		         vd_ + nf_ * l.data_regs > 32 || (indexed && !vecAligned(rs2_, emul_regs)));
+	}
+
+	///@return address of element 'i' (its first field)
+	template<class State>
+	uint64_t elementEa(State &state, uint64_t base, const Layout &l, uint32_t i) const
+	{
+		if (mode_ == INDEXED || mode_ == INDEXED_ORD)
 		{
-			return new Fcmp(dbl, op, r2, r1, rd);
+			uint64_t off = 0;
+			memcpy(&off, state.getVecReg(rs2_) + i * eew_, eew_);
+			return base + off;
 		}
-		return nullptr; // TODO FP
+		const uint64_t stride = mode_ == STRIDED ? state.getReg(rs2_) : uint64_t(nf_) * l.esz;
+		return base + i * stride;
 	}
 
-	case  96: // branch
+	///@return bytes copied between memory and registers from 'reg'
+	template<class State>
+	uint64_t bulk(State &state, uint64_t va, uint64_t sz, uint8_t *reg) const
 	{
-		uint32_t imm = (opc >> 7) & 0x1e; // opc[11:8] -> imm[4:1]
-		imm |= (opc >> 20) & 0x7e0; // opc[30:25] -> imm[10:5]
-		if (opc & 0x80)
-			imm |= 0x800; // opc[7] -> imm[11]
-		if (opc & 0x80000000)
-			imm |= 0xfffff000; // sign ex imm[31:12] from opc[31]
+		return store_ ? state.writeBlock(va, sz, reg) : state.readBlock(va, sz, reg);
+	}
+
+private: // data
+	bool store_;
+	Mode mode_;
+	uint8_t nf_; ///< fields (or registers for WHOLE)
+	uint8_t eew_; ///< bytes
+	bool masked_;
+	uint8_t rs2_; ///< stride or offsets
+	uint8_t rs1_;
+	uint8_t vd_; ///< (or store data)
+};
 
-		const int32_t s_imm = imm;
-		return new Branch(s_imm, op, r2, r1);
+/// Whole register move (VMV<nr>R.V)
+class VecMoveWhole final : public InstBase<VecMoveWhole>
+{
+public:
+	VecMoveWhole(uint8_t nr, uint8_t vs2, uint8_t vd)
+	: nr_(nr)
+	, vs2_(vs2)
+	, vd_(vd)
+	{
 	}
 
-	case 100: // JALR
+	RegDeps dsts() const override { return {RegDep(RegNum(vd_), RegFile::VECTOR)}; }
+	RegDeps srcs() const override { return {RegDep(RegNum(vs2_), RegFile::VECTOR)}; }
+
+	template<class State>
+	void exec(State &state) const
 	{
-		uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20] -> imm[11:0]
-		if (imm & 0x800)
-			imm |= 0xf000; // sign ex imm[11]
-		const int16_t s_imm = imm;
-		return new Jalr(s_imm, r1, rd);
+		if (!vecAligned(vd_, nr_) || !vecAligned(vs2_, nr_))
+		{
+			vecIllegal(state);
+			return;
+		}
+		memmove(state.getVecReg(vd_), state.getVecReg(vs2_), nr_ * ArchState::VLEN_BYTES);
+		state.incPc(4);
 	}
 
-	case 108: // JAL
+	std::string disasm() const override
 	{
-		uint64_t imm = 0; // imm[0] = 0
-		const uint32_t opc30_21 = (opc >> 21) & 0x3ff; // opc[30:21] -> imm[10:1]
-		imm |= opc30_21 << 1;
-		imm |= ((opc >> 20) & 1) << 11; // opc[20] -> imm[11]
-		const uint32_t opc19_12 = (opc >> 12) & 0xff; // opc[19:12] -> imm[19:12]
-		imm |= opc19_12 << 12;
-		if ((opc >> 31) & 1) // opc[31] sign bit
-			imm |= 0xfffffffffff00000;
+		std::ostringstream mne;
+		mne << "VMV" << uint32_t(nr_) << "R.V";
+		std::ostringstream os;
+		os << std::left << std::setw(MNE_WIDTH) << mne.str() << " v" << uint32_t(vd_) << " = v" << uint32_t(vs2_);
+		return os.str();
+	}
+
+	OpType opType() const override { return OT_VEC; }
+
+private:
+	uint8_t nr_;
+	uint8_t vs2_;
+	uint8_t vd_;
+};
+
+// 32 bit encoding fields
+inline uint8_t fRd(uint32_t opc) { return (opc >> 7) & 0x1f; } // opc[11:7]
+inline uint8_t fRs1(uint32_t opc) { return (opc >> 15) & 0x1f; } // opc[19:15]
+inline uint8_t fRs2(uint32_t opc) { return (opc >> 20) & 0x1f; } // opc[24:20]
+inline uint8_t fFunct3(uint32_t opc) { return (opc >> 12) & 7; } // opc[14:12]
+
+/// opc[31:20] sign extended to 16 bits
+inline int16_t fImmI(uint32_t opc)
+{
+	uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
+	if (imm & 0x800)
+		imm |= 0xf000; // sign ex
+	return imm;
+}
+
+/// opc[31:25] | opc[11:7] sign extended to 16 bits
+inline int16_t fImmS(uint32_t opc)
+{
+	uint16_t imm = fRd(opc); // opc[11:7] -> imm[4:0]
+	imm |= (opc >> 20) & 0xfe0; // opc[31:25] -> imm[11:5]
+	if (imm & 0x800)
+		imm |= 0xf000; // sign extend from bit 11
+	return int16_t(imm);
+}
+
+template<class Alloc>
+Inst* decodeLoad(uint32_t opc, Alloc &alloc)
+{
+	return alloc.template make<Load>(fFunct3(opc), fImmI(opc), fRs1(opc), fRd(opc));
+}
+
+/// vector loads and stores (in the FP load and store opcodes, by width)
+template<class Alloc>
+Inst* decodeVecMem(uint32_t opc, bool store, Alloc &alloc)
+{
+	static const uint8_t EEW[8] = {1, 0, 0, 0, 0, 2, 4, 8}; // bytes by width
+	const uint8_t eew = EEW[fFunct3(opc)];
+	const uint8_t nf = ((opc >> 29) & 7) + 1; // opc[31:29]
+	const bool mew = opc & 0x10000000; // opc[28]
+	const uint8_t mop = (opc >> 26) & 3; // opc[27:26]
+	const bool masked = (opc & 0x02000000) == 0; // vm = opc[25]
+	const uint8_t rs2 = fRs2(opc); // (lumop/sumop, stride or offsets)
+	if (mew)
+		return nullptr; // (EEW > 64)
+
+	VecMem::Mode mode = VecMem::UNIT;
+	switch (mop)
+	{
+	case 0: // unit stride
+		if (rs2 == 0x10 && !store)
+			mode = VecMem::UNIT_FF;
+		else if (rs2 == 0x08 && !masked && (nf & (nf - 1)) == 0 && (!store || eew == 1))
+			mode = VecMem::WHOLE;
+		else if (rs2 == 0x0b && !masked && nf == 1 && eew == 1)
+			mode = VecMem::MASK;
+		else if (rs2 != 0)
+			return nullptr;
+		break;
+	case 1: mode = VecMem::INDEXED; break;
+	case 2: mode = VecMem::STRIDED; break;
+	default: mode = VecMem::INDEXED_ORD; break;
+	}
+	return alloc.template make<VecMem>(store, mode, nf, eew, masked, rs2, fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeLoadFp(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t width = fFunct3(opc);
+	if (width == 0 || width >= 5)
+		return decodeVecMem(opc, false, alloc);
+	return alloc.template make<LoadFp>(fFunct3(opc), fImmI(opc), fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeMiscMem(uint32_t opc, Alloc &alloc)
+{
+	const uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
+	return alloc.template make<Fence>(imm, fRs1(opc), fFunct3(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeOpImm(uint32_t opc, Alloc &alloc)
+{
+	const uint16_t imm = fImmI(opc);
+	return alloc.template make<OpImm>(fFunct3(opc), imm, fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeAuipc(uint32_t opc, Alloc &alloc)
+{
+	const uint32_t imm = opc & 0xfffff000; // opc[31:12]
+	return alloc.template make<Auipc>(imm, fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeAddIw(uint32_t opc, Alloc &alloc)
+{
+	const uint16_t imm = fImmI(opc);
+	return alloc.template make<AddIw>(imm, fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeSlliw(uint32_t opc, Alloc &alloc)
+{
+	const uint16_t imm = (opc >> 20) & 0xfff; // opc[31:20]
+	return alloc.template make<Slliw>(imm, fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeSraliw(uint32_t opc, Alloc &alloc) // SR(AL)IW
+{
+	const uint16_t imm = (opc >> 20) & 0x01f; // opc[24:20]
+	const bool op30 = opc & 0x40000000; // opc[30]
+	return alloc.template make<Sraliw>(imm, fRs1(opc), fRd(opc), op30);
+}
 
-		return new Jal(imm, rd);
+template<class Alloc>
+Inst* decodeStore(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t sz = fFunct3(opc); // opc[14:12]
+	return alloc.template make<Store>(sz, fImmS(opc), fRs1(opc), fRs2(opc));
+}
+
+template<class Alloc>
+Inst* decodeStoreFp(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t width = fFunct3(opc);
+	if (width == 0 || width >= 5)
+		return decodeVecMem(opc, true, alloc);
+	const uint8_t sz = fFunct3(opc) == 2 ? 4 : 8;
+	const uint8_t rbase = fRs1(opc);
+	const uint8_t rsrc = fRs2(opc);
+	return alloc.template make<StoreFp>(fImmS(opc), rbase, rsrc, sz);
+}
+
+template<class Alloc>
+Inst* decodeAmo(uint32_t opc, Alloc &alloc) // atomics
+{
+	const bool dword = fFunct3(opc) == 3; // else word
+	const bool o27 = (opc & 0x08000000) != 0; // opc[27]
+	const bool aq  = (opc & 0x04000000) != 0; // opc[26]
+	const bool rel = (opc & 0x02000000) != 0; // opc[25]
+
+	if (opc & 0x10000000) // opc[28]
+	{
+		// Load-reserve (LR) + Store-conditional (SC)
+		return alloc.template make<LoadReserveStoreCond>(o27, dword, aq, rel, fRs2(opc), fRs1(opc), fRd(opc));
 	}
+	// atomic op
+	const uint8_t o31_27 = (opc >> 27) & 0x1f; // opc[31:27]
+	return alloc.template make<AmoOp>(o31_27, dword, aq, rel, fRs2(opc), fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeOp(uint32_t opc, Alloc &alloc) // op reg,reg
+{
+	if (opc & 0x2000000) // opc[25]
+		return alloc.template make<ImulDiv>(fFunct3(opc), fRs2(opc), fRs1(opc), fRd(opc));
+
+	//else int reg,reg
+	const bool op30 = opc & 0x40000000; // opc[30]
+	return alloc.template make<OpRegReg>(fFunct3(opc), op30, fRs2(opc), fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeLui(uint32_t opc, Alloc &alloc)
+{
+	const int32_t imm = opc & 0xfffff000; // opc[31:12]
+	return alloc.template make<Lui>(imm, fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeMulDivW(uint32_t opc, Alloc &alloc) // DIV/MUL word
+{
+	return alloc.template make<MulDivW>(fFunct3(opc), fRs2(opc), fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeAddSubW(uint32_t opc, Alloc &alloc)
+{
+	const bool op30 = opc & 0x40000000; // opc[30]
+	return alloc.template make<AddSubW>(fRs2(opc), fRs1(opc), fRd(opc), op30);
+}
+
+template<class Alloc>
+Inst* decodeSllw(uint32_t opc, Alloc &alloc)
+{
+	return alloc.template make<Sllw>(fRs2(opc), fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeSralw(uint32_t opc, Alloc &alloc) // SR(AL)W
+{
+	const bool op30 = opc & 0x40000000; // opc[30]
+	return alloc.template make<Sralw>(fRs2(opc), fRs1(opc), fRd(opc), op30);
+}
+
+template<class Alloc>
+Inst* decodeFmadd(uint32_t opc, Alloc &alloc) // FMADD, FMSUB, FNMSUB, FNMADD
+{
+	const bool dbl = (opc & 0x02000000) != 0; // opc[25]
+	const uint8_t r3 = (opc >> 27) & 0x1f; // opc[31:27]
+	const uint8_t rm = fFunct3(opc);
+	const uint8_t op2 = (opc >> 2) & 3; // opc[3:2]
+	return alloc.template make<Fmadd>(dbl, rm, op2, r3, fRs2(opc), fRs1(opc), fRd(opc));
+}
 
-	case 112: // system
+template<class Alloc>
+Inst* decodeOpFp(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t rd = fRd(opc);
+	const uint8_t r1 = fRs1(opc);
+	const uint8_t r2 = fRs2(opc);
+	const uint8_t op = fFunct3(opc);
+	const uint8_t op2 = (opc >> 25) & 0xff; // opc[31:25]
+	const uint8_t mask1 = op2 & 0x7e; // upper op bits[6:1]
+	const uint8_t mask2 = op2 & 0x76; // ignore bit 3 (opc[28])
+	const bool dbl = (op2 & 1) != 0; // float bar
+	if (mask2 == 0x70) // FMV
+	{
+		const bool dword = dbl;
+		const bool to_float = (op2 & 8) != 0;
+		return alloc.template make<Fmove>(dword, to_float, r1, rd);
+	}
+	if (mask2 == 0x60) // FCVT
+	{
+		const bool to_float = (op2 & 8) != 0; // to_int bar
+		const uint8_t int_sz = r2; // sw, w, sx, x
+		const uint8_t round = op;
+		return alloc.template make<FcvtInt>(dbl, to_float, int_sz, round, r1, rd);
+	}
+	if (mask2 == 0x04 || mask2 == 0x00) // FP ALU
+	{
+		const uint8_t alu = (op2 >> 2) & 3; // opc[28:27]
+		const uint8_t round = op;
+		return alloc.template make<FpAlu>(alu, dbl, round, r2, r1, rd);
+	}
+	if (mask1 == 0x10) // FSGN
+	{
+		return alloc.template make<Fsign>(dbl, op, r2, r1, rd);
+	}
+	if (mask1 == 0x20) // FCVT.S.D and FCVT.D.S
+	{
+		return alloc.template make<FcvtDbl>(dbl, op, r1, rd);
+	}
+	if (mask1 == 0x2c) // FSQRT
+	{
+		const uint8_t round = op;
+		return alloc.template make<Fsqrt>(dbl, round, r1, rd);
+	}
+	if (mask1 == 0x50) // FCMP
 	{
-		if (op == 0)
+		return alloc.template make<Fcmp>(dbl, op, r2, r1, rd);
+	}
+	return nullptr; // TODO FP
+}
+
+template<class Alloc>
+Inst* decodeBranch(uint32_t opc, Alloc &alloc)
+{
+	uint32_t imm = (opc >> 7) & 0x1e; // opc[11:8] -> imm[4:1]
+	imm |= (opc >> 20) & 0x7e0; // opc[30:25] -> imm[10:5]
+	if (opc & 0x80)
+		imm |= 0x800; // opc[7] -> imm[11]
+	if (opc & 0x80000000)
+		imm |= 0xfffff000; // sign ex imm[31:12] from opc[31]
+
+	const int32_t s_imm = imm;
+	return alloc.template make<Branch>(s_imm, fFunct3(opc), fRs2(opc), fRs1(opc));
+}
+
+template<class Alloc>
+Inst* decodeJalr(uint32_t opc, Alloc &alloc)
+{
+	return alloc.template make<Jalr>(fImmI(opc), fRs1(opc), fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeJal(uint32_t opc, Alloc &alloc)
+{
+	uint64_t imm = 0; // imm[0] = 0
+	const uint32_t opc30_21 = (opc >> 21) & 0x3ff; // opc[30:21] -> imm[10:1]
+	imm |= opc30_21 << 1;
+	imm |= ((opc >> 20) & 1) << 11; // opc[20] -> imm[11]
+	const uint32_t opc19_12 = (opc >> 12) & 0xff; // opc[19:12] -> imm[19:12]
+	imm |= opc19_12 << 12;
+	if ((opc >> 31) & 1) // opc[31] sign bit
+		imm |= 0xfffffffffff00000;
+
+	return alloc.template make<Jal>(imm, fRd(opc));
+}
+
+template<class Alloc>
+Inst* decodeSystem(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t op = fFunct3(opc);
+	if (op == 0)
+	{
+		// ECALL and EBREAK
+		// TODO: capture opc[20]
+		return alloc.template make<Ecall>();
+	}
+	//else CSRR
+	const uint16_t csr = (opc >> 20) & 0xfff; // opc[31:20]
+	return alloc.template make<ControlRegOp>(op, csr, fRs1(opc), fRd(opc));
+}
+
+typedef VecOpDesc VD;
+
+/// OPIVV, OPIVX and OPIVI by funct6
+inline const VecOpDesc* vecOpI(uint8_t funct6, bool masked)
+{
+	static const VD ADD = {"VADD", UintKernels<VecBinary, OpAdd>::k, VD::VV | VD::VX | VD::VI};
+	static const VD SUB = {"VSUB", UintKernels<VecBinary, OpSub>::k, VD::VV | VD::VX};
+	static const VD RSUB = {"VRSUB", UintKernels<VecBinary, OpRsub>::k, VD::VX | VD::VI};
+	static const VD MINU = {"VMINU", UintKernels<VecBinary, OpMin>::k, VD::VV | VD::VX};
+	static const VD MIN = {"VMIN", IntKernels<VecBinary, OpMin>::k, VD::VV | VD::VX};
+	static const VD MAXU = {"VMAXU", UintKernels<VecBinary, OpMax>::k, VD::VV | VD::VX};
+	static const VD MAX = {"VMAX", IntKernels<VecBinary, OpMax>::k, VD::VV | VD::VX};
+	static const VD AND = {"VAND", UintKernels<VecBinary, OpAnd>::k, VD::VV | VD::VX | VD::VI};
+	static const VD OR = {"VOR", UintKernels<VecBinary, OpOr>::k, VD::VV | VD::VX | VD::VI};
+	static const VD XOR = {"VXOR", UintKernels<VecBinary, OpXor>::k, VD::VV | VD::VX | VD::VI};
+	static const VD SLIDEUP = {"VSLIDEUP", UintKernels<VecSlideUp, OpNone>::k, VD::VX | VD::VI | VD::UIMM};
+	static const VD SLIDEDOWN = {"VSLIDEDOWN", UintKernels<VecSlideDown, OpNone>::k, VD::VX | VD::VI | VD::UIMM};
+	static const VD MERGE = {"VMERGE", UintKernels<VecMerge, OpNone>::k, VD::VV | VD::VX | VD::VI | VD::MERGE};
+	static const VD MV = {"VMV.V", UintKernels<VecMerge, OpNone>::k, VD::VV | VD::VX | VD::VI | VD::NO_VS2 | VD::SHORT_SUFFIX};
+	static const uint32_t CMP = VD::MASK_DST;
+	static const VD SEQ = {"VMSEQ", UintKernels<VecCompare, OpEq>::k, VD::VV | VD::VX | VD::VI | CMP};
+	static const VD SNE = {"VMSNE", UintKernels<VecCompare, OpNe>::k, VD::VV | VD::VX | VD::VI | CMP};
+	static const VD SLTU = {"VMSLTU", UintKernels<VecCompare, OpLt>::k, VD::VV | VD::VX | CMP};
+	static const VD SLT = {"VMSLT", IntKernels<VecCompare, OpLt>::k, VD::VV | VD::VX | CMP};
+	static const VD SLEU = {"VMSLEU", UintKernels<VecCompare, OpLe>::k, VD::VV | VD::VX | VD::VI | CMP};
+	static const VD SLE = {"VMSLE", IntKernels<VecCompare, OpLe>::k, VD::VV | VD::VX | VD::VI | CMP};
+	static const VD SGTU = {"VMSGTU", UintKernels<VecCompare, OpGt>::k, VD::VX | VD::VI | CMP};
+	static const VD SGT = {"VMSGT", IntKernels<VecCompare, OpGt>::k, VD::VX | VD::VI | CMP};
+	static const VD SLL = {"VSLL", UintKernels<VecBinary, OpShl>::k, VD::VV | VD::VX | VD::VI | VD::UIMM};
+	static const VD SRL = {"VSRL", UintKernels<VecBinary, OpShr>::k, VD::VV | VD::VX | VD::VI | VD::UIMM};
+	static const VD SRA = {"VSRA", IntKernels<VecBinary, OpShr>::k, VD::VV | VD::VX | VD::VI | VD::UIMM};
+
+	switch (funct6)
+	{
+	case 0x00: return &ADD;
+	case 0x02: return &SUB;
+	case 0x03: return &RSUB;
+	case 0x04: return &MINU;
+	case 0x05: return &MIN;
+	case 0x06: return &MAXU;
+	case 0x07: return &MAX;
+	case 0x09: return &AND;
+	case 0x0a: return &OR;
+	case 0x0b: return &XOR;
+	case 0x0e: return &SLIDEUP;
+	case 0x0f: return &SLIDEDOWN;
+	case 0x17: return masked ? &MERGE : &MV;
+	case 0x18: return &SEQ;
+	case 0x19: return &SNE;
+	case 0x1a: return &SLTU;
+	case 0x1b: return &SLT;
+	case 0x1c: return &SLEU;
+	case 0x1d: return &SLE;
+	case 0x1e: return &SGTU;
+	case 0x1f: return &SGT;
+	case 0x25: return &SLL;
+	case 0x28: return &SRL;
+	case 0x29: return &SRA;
+	}
+	return nullptr;
+}
+
+/// OPMVV and OPMVX by funct6 (and vs1 or vs2 where they extend it)
+inline const VecOpDesc* vecOpM(uint8_t funct6, uint32_t form, uint8_t vs1, uint8_t vs2)
+{
+	static const uint32_t RED = VD::VV | VD::ELEM0_DST | VD::ELEM0_VS1 | VD::FULL_NAME;
+	static const VD REDSUM = {"VREDSUM.VS", UintKernels<VecReduce, OpAdd>::k, RED};
+	static const VD REDAND = {"VREDAND.VS", UintKernels<VecReduce, OpAnd>::k, RED};
+	static const VD REDOR = {"VREDOR.VS", UintKernels<VecReduce, OpOr>::k, RED};
+	static const VD REDXOR = {"VREDXOR.VS", UintKernels<VecReduce, OpXor>::k, RED};
+	static const VD REDMINU = {"VREDMINU.VS", UintKernels<VecReduce, OpMin>::k, RED};
+	static const VD REDMIN = {"VREDMIN.VS", IntKernels<VecReduce, OpMin>::k, RED};
+	static const VD REDMAXU = {"VREDMAXU.VS", UintKernels<VecReduce, OpMax>::k, RED};
+	static const VD REDMAX = {"VREDMAX.VS", IntKernels<VecReduce, OpMax>::k, RED};
+	static const VD SLIDE1UP = {"VSLIDE1UP", UintKernels<VecSlide1Up, OpNone>::k, VD::VX};
+	static const VD SLIDE1DOWN = {"VSLIDE1DOWN", UintKernels<VecSlide1Down, OpNone>::k, VD::VX};
+	static const uint32_t TO_INT = VD::VV | VD::INT_DST | VD::SINGLE_SRCS | VD::NO_VS1 | VD::FULL_NAME;
+	static const VD MV_XS = {"VMV.X.S", IntKernels<VecMvXS, OpNone>::k, TO_INT};
+	static const VD CPOP = {"VCPOP.M", UintKernels<VecCpop, OpNone>::k, TO_INT};
+	static const VD FIRST = {"VFIRST.M", UintKernels<VecFirst, OpNone>::k, TO_INT};
+	static const VD MV_SX = {"VMV.S.X", UintKernels<VecMvSX, OpNone>::k, VD::VX | VD::ELEM0_DST | VD::NO_VS2 | VD::FULL_NAME};
+	static const VD ID = {"VID.V", UintKernels<VecId, OpNone>::k, VD::VV | VD::NO_VS2 | VD::NO_VS1 | VD::FULL_NAME};
+	static const uint32_t MASK = VD::VV | VD::MASK_DST | VD::SINGLE_SRCS | VD::FULL_NAME;
+	static const VD ANDN = {"VMANDN.MM", UintKernels<VecMaskLogic, OpAndn>::k, MASK};
+	static const VD AND = {"VMAND.MM", UintKernels<VecMaskLogic, OpAnd>::k, MASK};
+	static const VD OR = {"VMOR.MM", UintKernels<VecMaskLogic, OpOr>::k, MASK};
+	static const VD XOR = {"VMXOR.MM", UintKernels<VecMaskLogic, OpXor>::k, MASK};
+	static const VD ORN = {"VMORN.MM", UintKernels<VecMaskLogic, OpOrn>::k, MASK};
+	static const VD NAND = {"VMNAND.MM", UintKernels<VecMaskLogic, OpNand>::k, MASK};
+	static const VD NOR = {"VMNOR.MM", UintKernels<VecMaskLogic, OpNor>::k, MASK};
+	static const VD XNOR = {"VMXNOR.MM", UintKernels<VecMaskLogic, OpXnor>::k, MASK};
+	static const VD DIVU = {"VDIVU", UintKernels<VecBinary, OpDiv>::k, VD::VV | VD::VX};
+	static const VD DIV = {"VDIV", IntKernels<VecBinary, OpDiv>::k, VD::VV | VD::VX};
+	static const VD REMU = {"VREMU", UintKernels<VecBinary, OpRem>::k, VD::VV | VD::VX};
+	static const VD REM = {"VREM", IntKernels<VecBinary, OpRem>::k, VD::VV | VD::VX};
+	static const VD MULHU = {"VMULHU", UintKernels<VecBinary, OpMulh>::k, VD::VV | VD::VX};
+	static const VD MUL = {"VMUL", UintKernels<VecBinary, OpMul>::k, VD::VV | VD::VX};
+	static const VD MULHSU = {"VMULHSU", IntKernels<VecBinary, OpMulhsu>::k, VD::VV | VD::VX};
+	static const VD MULH = {"VMULH", IntKernels<VecBinary, OpMulh>::k, VD::VV | VD::VX};
+	static const uint32_t MAC = VD::VV | VD::VX | VD::READS_VD;
+	static const VD MADD = {"VMADD", UintKernels<VecTernary, OpMadd>::k, MAC};
+	static const VD NMSUB = {"VNMSUB", UintKernels<VecTernary, OpNmsub>::k, MAC};
+	static const VD MACC = {"VMACC", UintKernels<VecTernary, OpMacc>::k, MAC};
+	static const VD NMSAC = {"VNMSAC", UintKernels<VecTernary, OpNmsac>::k, MAC};
+
+	switch (funct6)
+	{
+	case 0x00: return &REDSUM;
+	case 0x01: return &REDAND;
+	case 0x02: return &REDOR;
+	case 0x03: return &REDXOR;
+	case 0x04: return &REDMINU;
+	case 0x05: return &REDMIN;
+	case 0x06: return &REDMAXU;
+	case 0x07: return &REDMAX;
+	case 0x0e: return &SLIDE1UP;
+	case 0x0f: return &SLIDE1DOWN;
+	case 0x10: // VWXUNARY0 (by vs1), VRXUNARY0 (by vs2)
+		if (form == VD::VX)
+			return vs2 == 0 ? &MV_SX : nullptr;
+		return vs1 == 0x00 ? &MV_XS : vs1 == 0x10 ? &CPOP : vs1 == 0x11 ? &FIRST : nullptr;
+	case 0x14: // VMUNARY0
+		return vs1 == 0x11 && vs2 == 0 ? &ID : nullptr;
+	case 0x18: return &ANDN;
+	case 0x19: return &AND;
+	case 0x1a: return &OR;
+	case 0x1b: return &XOR;
+	case 0x1c: return &ORN;
+	case 0x1d: return &NAND;
+	case 0x1e: return &NOR;
+	case 0x1f: return &XNOR;
+	case 0x20: return &DIVU;
+	case 0x21: return &DIV;
+	case 0x22: return &REMU;
+	case 0x23: return &REM;
+	case 0x24: return &MULHU;
+	case 0x25: return &MUL;
+	case 0x26: return &MULHSU;
+	case 0x27: return &MULH;
+	case 0x29: return &MADD;
+	case 0x2b: return &NMSUB;
+	case 0x2d: return &MACC;
+	case 0x2f: return &NMSAC;
+	}
+	return nullptr;
+}
+
+/// OPFVV and OPFVF by funct6 (and vs1 or vs2 where they extend it)
+inline const VecOpDesc* vecOpF(uint8_t funct6, uint32_t form, uint8_t vs1, uint8_t vs2, bool masked)
+{
+	static const VD ADD = {"VFADD", FpKernels<VecBinary, OpAdd>::k, VD::VV | VD::VF};
+	static const VD SUB = {"VFSUB", FpKernels<VecBinary, OpSub>::k, VD::VV | VD::VF};
+	static const VD MIN = {"VFMIN", FpKernels<VecBinary, OpFmin>::k, VD::VV | VD::VF};
+	static const VD MAX = {"VFMAX", FpKernels<VecBinary, OpFmax>::k, VD::VV | VD::VF};
+	static const uint32_t RED = VD::VV | VD::ELEM0_DST | VD::ELEM0_VS1 | VD::FULL_NAME;
+	static const VD REDUSUM = {"VFREDUSUM.VS", FpKernels<VecReduce, OpAdd>::k, RED};
+	static const VD REDOSUM = {"VFREDOSUM.VS", FpKernels<VecReduceOrdered, OpAdd>::k, RED};
+	static const VD REDMIN = {"VFREDMIN.VS", FpKernels<VecReduce, OpFmin>::k, RED};
+	static const VD REDMAX = {"VFREDMAX.VS", FpKernels<VecReduce, OpFmax>::k, RED};
+	static const VD SGNJ = {"VFSGNJ", FpBitsKernels<VecBinary, OpSgnj>::k, VD::VV | VD::VF};
+	static const VD SGNJN = {"VFSGNJN", FpBitsKernels<VecBinary, OpSgnjn>::k, VD::VV | VD::VF};
+	static const VD SGNJX = {"VFSGNJX", FpBitsKernels<VecBinary, OpSgnjx>::k, VD::VV | VD::VF};
+	static const VD SLIDE1UP = {"VFSLIDE1UP", FpBitsKernels<VecSlide1Up, OpNone>::k, VD::VF};
+	static const VD SLIDE1DOWN = {"VFSLIDE1DOWN", FpBitsKernels<VecSlide1Down, OpNone>::k, VD::VF};
+	static const VD MV_FS = {"VFMV.F.S", FpBitsKernels<VecMvXS, OpNone>::k,
+	                         VD::VV | VD::FP_DST | VD::SINGLE_SRCS | VD::NO_VS1 | VD::FULL_NAME};
+	static const VD MV_SF = {"VFMV.S.F", FpBitsKernels<VecMvSX, OpNone>::k, VD::VF | VD::ELEM0_DST | VD::NO_VS2 | VD::FULL_NAME};
+	static const uint32_t UNARY = VD::VV | VD::NO_VS1 | VD::FULL_NAME;
+	static const VD CVT_XU_F = {"VFCVT.XU.F.V", FpBitsKernels<VecUnary, OpCvtToInt<false, false> >::k, UNARY};
+	static const VD CVT_X_F = {"VFCVT.X.F.V", FpBitsKernels<VecUnary, OpCvtToInt<true, false> >::k, UNARY};
+	static const VD CVT_F_XU = {"VFCVT.F.XU.V", FpBitsKernels<VecUnary, OpCvtFromInt<false> >::k, UNARY};
+	static const VD CVT_F_X = {"VFCVT.F.X.V", FpBitsKernels<VecUnary, OpCvtFromInt<true> >::k, UNARY};
+	static const VD CVT_RTZ_XU_F = {"VFCVT.RTZ.XU.F.V", FpBitsKernels<VecUnary, OpCvtToInt<false, true> >::k, UNARY};
+	static const VD CVT_RTZ_X_F = {"VFCVT.RTZ.X.F.V", FpBitsKernels<VecUnary, OpCvtToInt<true, true> >::k, UNARY};
+	static const VD SQRT = {"VFSQRT.V", FpBitsKernels<VecUnary, OpFsqrt>::k, UNARY};
+	static const VD MERGE = {"VFMERGE", FpBitsKernels<VecMerge, OpNone>::k, VD::VF | VD::MERGE};
+	static const VD MV = {"VFMV.V", FpBitsKernels<VecMerge, OpNone>::k, VD::VF | VD::NO_VS2 | VD::SHORT_SUFFIX};
+	static const uint32_t CMP = VD::MASK_DST;
+	static const VD EQ = {"VMFEQ", FpKernels<VecCompare, OpEq>::k, VD::VV | VD::VF | CMP};
+	static const VD LE = {"VMFLE", FpKernels<VecCompare, OpLe>::k, VD::VV | VD::VF | CMP};
+	static const VD LT = {"VMFLT", FpKernels<VecCompare, OpLt>::k, VD::VV | VD::VF | CMP};
+	static const VD NE = {"VMFNE", FpKernels<VecCompare, OpNe>::k, VD::VV | VD::VF | CMP};
+	static const VD GT = {"VMFGT", FpKernels<VecCompare, OpGt>::k, VD::VF | CMP};
+	static const VD GE = {"VMFGE", FpKernels<VecCompare, OpGe>::k, VD::VF | CMP};
+	static const VD DIV = {"VFDIV", FpKernels<VecBinary, OpFdiv>::k, VD::VV | VD::VF};
+	static const VD RDIV = {"VFRDIV", FpKernels<VecBinary, OpFrdiv>::k, VD::VF};
+	static const VD MUL = {"VFMUL", FpKernels<VecBinary, OpMul>::k, VD::VV | VD::VF};
+	static const VD RSUB = {"VFRSUB", FpKernels<VecBinary, OpRsub>::k, VD::VF};
+	static const uint32_t MAC = VD::VV | VD::VF | VD::READS_VD;
+	static const VD MADD = {"VFMADD", FpKernels<VecTernary, OpMadd>::k, MAC};
+	static const VD NMADD = {"VFNMADD", FpKernels<VecTernary, OpFnmadd>::k, MAC};
+	static const VD MSUB = {"VFMSUB", FpKernels<VecTernary, OpFmsub>::k, MAC};
+	static const VD NMSUB = {"VFNMSUB", FpKernels<VecTernary, OpNmsub>::k, MAC};
+	static const VD MACC = {"VFMACC", FpKernels<VecTernary, OpMacc>::k, MAC};
+	static const VD NMACC = {"VFNMACC", FpKernels<VecTernary, OpFnmacc>::k, MAC};
+	static const VD MSAC = {"VFMSAC", FpKernels<VecTernary, OpFmsac>::k, MAC};
+	static const VD NMSAC = {"VFNMSAC", FpKernels<VecTernary, OpNmsac>::k, MAC};
+
+	switch (funct6)
+	{
+	case 0x00: return &ADD;
+	case 0x01: return &REDUSUM;
+	case 0x02: return &SUB;
+	case 0x03: return &REDOSUM;
+	case 0x04: return &MIN;
+	case 0x05: return &REDMIN;
+	case 0x06: return &MAX;
+	case 0x07: return &REDMAX;
+	case 0x08: return &SGNJ;
+	case 0x09: return &SGNJN;
+	case 0x0a: return &SGNJX;
+	case 0x0e: return &SLIDE1UP;
+	case 0x0f: return &SLIDE1DOWN;
+	case 0x10: // VWFUNARY0 (by vs1), VRFUNARY0 (by vs2)
+		if (form == VD::VF)
+			return vs2 == 0 ? &MV_SF : nullptr;
+		return vs1 == 0 ? &MV_FS : nullptr;
+	case 0x12: // VFUNARY0
+		switch (vs1)
 		{
-			// ECALL and EBREAK
-			// TODO: capture opc[20]
-			return new Ecall();
+		case 0x00: return &CVT_XU_F;
+		case 0x01: return &CVT_X_F;
+		case 0x02: return &CVT_F_XU;
+		case 0x03: return &CVT_F_X;
+		case 0x06: return &CVT_RTZ_XU_F;
+		case 0x07: return &CVT_RTZ_X_F;
 		}
-		//else CSRR
-		const uint16_t csr = (opc >> 20) & 0xfff; // opc[31:20]
-		return new ControlRegOp(op, csr, r1, rd);
+		return nullptr;
+	case 0x13: // VFUNARY1
+		return vs1 == 0 ? &SQRT : nullptr;
+	case 0x17: return masked ? &MERGE : &MV;
+	case 0x18: return &EQ;
+	case 0x19: return &LE;
+	case 0x1b: return &LT;
+	case 0x1c: return &NE;
+	case 0x1d: return &GT;
+	case 0x1f: return &GE;
+	case 0x20: return &DIV;
+	case 0x21: return &RDIV;
+	case 0x24: return &MUL;
+	case 0x27: return &RSUB;
+	case 0x28: return &MADD;
+	case 0x29: return &NMADD;
+	case 0x2a: return &MSUB;
+	case 0x2b: return &NMSUB;
+	case 0x2c: return &MACC;
+	case 0x2d: return &NMACC;
+	case 0x2e: return &MSAC;
+	case 0x2f: return &NMSAC;
 	}
+	return nullptr;
+}
 
-	case   8: // custom0
-	case  40: // custom1
-	case  88: // custom2
-	case 120: // custom3
-	case  28: // >32 bit opcode
-	case  60: // >32 bit opcode
-	case  92: // >32 bit opcode
-	case 124: // >32 bit opcode
-	case  84: // (rsvd)
-	case 104: // (rsvd)
-	case 116: // (rsvd)
-		return nullptr; // TODO InvalidOp
+/// vector arithmetic and configuration, by funct3 then funct6
+template<class Alloc>
+Inst* decodeOpV(uint32_t opc, Alloc &alloc)
+{
+	const uint8_t funct3 = fFunct3(opc);
+	const uint8_t rd = fRd(opc);
+	const uint8_t rs1 = fRs1(opc); // (or vs1, or the immediate)
+	const uint8_t rs2 = fRs2(opc); // (vs2)
+	if (funct3 == 7) // OPCFG
+	{
+		if ((opc & 0x80000000) == 0) // opc[31]
+			return alloc.template make<VsetVl>(VsetVl::VLI, (opc >> 20) & 0x7ff, 0, rs1, rd); // opc[30:20]
+		if ((opc & 0xc0000000) == 0xc0000000) // opc[31:30]
+			return alloc.template make<VsetVl>(VsetVl::IVLI, (opc >> 20) & 0x3ff, 0, rs1, rd); // opc[29:20]
+		if ((opc >> 25) == 0x40) // opc[31:25]
+			return alloc.template make<VsetVl>(VsetVl::VL, 0, rs2, rs1, rd);
+		return nullptr;
 	}
 
-	return nullptr;
+	// OPIVV, OPFVV, OPMVV, OPIVI, OPIVX, OPFVF, OPMVX
+	static const uint32_t FORM[7] = {VD::VV, VD::VV, VD::VV, VD::VI, VD::VX, VD::VF, VD::VX};
+	const uint32_t form = FORM[funct3];
+	const uint8_t funct6 = opc >> 26; // opc[31:26]
+	const bool masked = (opc & 0x02000000) == 0; // vm = opc[25]
+
+	const VecOpDesc *desc = nullptr;
+	switch (funct3)
+	{
+	case 0:
+	case 3:
+	case 4:
+		if (funct6 == 0x27 && funct3 == 3)
+		{
+			const uint8_t nr = rs1 + 1;
+			if (masked || (nr & (nr - 1)) != 0 || nr > 8)
+				return nullptr;
+			return alloc.template make<VecMoveWhole>(nr, rs2, rd);
+		}
+		desc = vecOpI(funct6, masked);
+		break;
+	case 2:
+	case 6:
+		desc = vecOpM(funct6, form, rs1, rs2);
+		break;
+	default:
+		desc = vecOpF(funct6, form, rs1, rs2, masked);
+		break;
+	}
+	if (!desc || (desc->flags & form) == 0)
+		return nullptr;
+	return alloc.template make<VecOp>(*desc, form, masked, rs2, rs1, rd);
 }
 
-Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug)
+/// reserved, custom and unimplemented encodings
+template<class Alloc>
+Inst* decodeInvalid(uint32_t, Alloc&)
+{
+	return nullptr; // TODO InvalidOp
+}
+
+template<class Alloc>
+Inst* decodeOpImm32(uint32_t opc, Alloc &alloc);
+
+template<class Alloc>
+Inst* decodeOp32(uint32_t opc, Alloc &alloc);
+
+/// Decoder dispatch tables, one entry per major opcode (or quadrant + funct3 for 16 bit).
+/// A new encoding group only needs its decode function and a slot here.
+template<class Alloc>
+struct DecodeTable
+{
+	typedef Inst* (*DecodeFn)(uint32_t opc, Alloc &alloc);
+
+	/// 32 bit opcodes by opc[6:2]
+	static constexpr DecodeFn op32[32] =
+	{
+		decodeLoad<Alloc>,      // 00000 load
+		decodeLoadFp<Alloc>,    // 00001 load FP
+		decodeInvalid<Alloc>,   // 00010 custom0
+		decodeMiscMem<Alloc>,   // 00011 misc MEM
+		decodeOpImm<Alloc>,     // 00100 op imm
+		decodeAuipc<Alloc>,     // 00101 AUIPC
+		decodeOpImm32<Alloc>,   // 00110 op imm32
+		decodeInvalid<Alloc>,   // 00111 >32 bit opcode
+		decodeStore<Alloc>,     // 01000 store
+		decodeStoreFp<Alloc>,   // 01001 store FP
+		decodeInvalid<Alloc>,   // 01010 custom1
+		decodeAmo<Alloc>,       // 01011 AMO
+		decodeOp<Alloc>,        // 01100 op reg,reg
+		decodeLui<Alloc>,       // 01101 LUI
+		decodeOp32<Alloc>,      // 01110 op32
+		decodeInvalid<Alloc>,   // 01111 >32 bit opcode
+		decodeFmadd<Alloc>,     // 10000 FMADD
+		decodeFmadd<Alloc>,     // 10001 FMSUB
+		decodeFmadd<Alloc>,     // 10010 FNMSUB
+		decodeFmadd<Alloc>,     // 10011 FNMADD
+		decodeOpFp<Alloc>,      // 10100 fp op
+		decodeOpV<Alloc>,       // 10101 OP-V
+		decodeInvalid<Alloc>,   // 10110 custom2
+		decodeInvalid<Alloc>,   // 10111 >32 bit opcode
+		decodeBranch<Alloc>,    // 11000 branch
+		decodeJalr<Alloc>,      // 11001 JALR
+		decodeInvalid<Alloc>,   // 11010 (rsvd)
+		decodeJal<Alloc>,       // 11011 JAL
+		decodeSystem<Alloc>,    // 11100 system
+		decodeInvalid<Alloc>,   // 11101 (rsvd)
+		decodeInvalid<Alloc>,   // 11110 custom3
+		decodeInvalid<Alloc>,   // 11111 >32 bit opcode
+	};
+
+	/// op imm32 by funct3
+	static constexpr DecodeFn op_imm32[8] =
+	{
+		decodeAddIw<Alloc>, decodeSlliw<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>,
+		decodeInvalid<Alloc>, decodeSraliw<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>,
+	};
+
+	/// op32 by opc[25] | funct3
+	static constexpr DecodeFn op32_w[16] =
+	{
+		decodeAddSubW<Alloc>, decodeSllw<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>,
+		decodeInvalid<Alloc>, decodeSralw<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>,
+		decodeMulDivW<Alloc>, decodeMulDivW<Alloc>, decodeMulDivW<Alloc>, decodeMulDivW<Alloc>,
+		decodeMulDivW<Alloc>, decodeMulDivW<Alloc>, decodeMulDivW<Alloc>, decodeMulDivW<Alloc>,
+	};
+
+	/// 16 bit opcodes by opc[1:0] | opc[15:13], quadrant 3 holds the 32 bit opcodes
+	static constexpr DecodeFn op16[32] =
+	{
+		// quadrant 0, memory
+		decodeCAddI4SpN<Alloc>, decodeCFld<Alloc>, decodeCLw<Alloc>, decodeCLd<Alloc>,
+		decodeInvalid<Alloc>, decodeCFsd<Alloc>, decodeCSw<Alloc>, decodeCSd<Alloc>,
+		// quadrant 1, common compressed ops
+		decodeCAddI<Alloc>, decodeCAddIw<Alloc>, decodeCLi<Alloc>, decodeCLui<Alloc>,
+		decodeCMiscAlu<Alloc>, decodeCJ<Alloc>, decodeCBz<Alloc>, decodeCBz<Alloc>,
+		// quadrant 2, more ops
+		decodeCSllI<Alloc>, decodeCFldSp<Alloc>, decodeCLwSp<Alloc>, decodeCLdSp<Alloc>,
+		decodeCJrMvAdd<Alloc>, decodeCFsdSp<Alloc>, decodeCSwSp<Alloc>, decodeCSdSp<Alloc>,
+		// quadrant 3
+		decodeInvalid<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>,
+		decodeInvalid<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>, decodeInvalid<Alloc>,
+	};
+};
+
+template<class Alloc>
+constexpr typename DecodeTable<Alloc>::DecodeFn DecodeTable<Alloc>::op32[32];
+template<class Alloc>
+constexpr typename DecodeTable<Alloc>::DecodeFn DecodeTable<Alloc>::op_imm32[8];
+template<class Alloc>
+constexpr typename DecodeTable<Alloc>::DecodeFn DecodeTable<Alloc>::op32_w[16];
+template<class Alloc>
+constexpr typename DecodeTable<Alloc>::DecodeFn DecodeTable<Alloc>::op16[32];
+
+template<class Alloc>
+Inst* decodeOpImm32(uint32_t opc, Alloc &alloc)
+{
+	return DecodeTable<Alloc>::op_imm32[fFunct3(opc)](opc, alloc);
+}
+
+template<class Alloc>
+Inst* decodeOp32(uint32_t opc, Alloc &alloc)
+{
+	const uint32_t idx = ((opc >> 22) & 8) | fFunct3(opc); // opc[25] | opc[14:12]
+	return DecodeTable<Alloc>::op32_w[idx](opc, alloc);
+}
+
+template<class Alloc>
+Inst* decode16Impl(uint32_t opc, Alloc &alloc)
+{
+	const uint32_t idx = ((opc & 3) << 3) | ((opc >> 13) & 7); // opc[1:0] | opc[15:13]
+	return DecodeTable<Alloc>::op16[idx](opc, alloc);
+}
+
+template<class Alloc>
+Inst* decode32Impl(uint32_t opc, Alloc &alloc)
+{
+	// opc[1:0] == 2'b11
+	return DecodeTable<Alloc>::op32[(opc >> 2) & 0x1f](opc, alloc);
+}
+
+/// plain heap allocation (caller owns the result)
+struct HeapAlloc
+{
+	template<class T, class... Args>
+	T* make(Args&&... args)
+	{
+		return new T(std::forward<Args>(args)...);
+	}
+};
+
+template<class Alloc>
+Inst* decodeImpl(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug, Alloc &alloc)
 {
 	Inst *inst = nullptr;
 	const uint64_t pc = state.getPc();
@@ -4413,11 +5892,51 @@ Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug
 		opc_sz = 4;
 		full_inst |= state.readImem(pc + 2, 2) << 16;
 
-		inst = decode32(full_inst);
+		inst = decode32Impl(full_inst, alloc);
 	}
 	else
-		inst = decode16(full_inst);
+		inst = decode16Impl(full_inst, alloc);
+
+	printDecode(state.getSys(), pc, full_inst, opc_sz, inst, debug);
+
+	return inst;
+}
+
+Inst* decode16(uint32_t opc)
+{
+	HeapAlloc alloc;
+	return decode16Impl(opc, alloc);
+}
 
+Inst* decode16(uint32_t opc, InstArena &arena)
+{
+	return decode16Impl(opc, arena);
+}
+
+Inst* decode32(uint32_t opc)
+{
+	HeapAlloc alloc;
+	return decode32Impl(opc, alloc);
+}
+
+Inst* decode32(uint32_t opc, InstArena &arena)
+{
+	return decode32Impl(opc, arena);
+}
+
+Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug)
+{
+	HeapAlloc alloc;
+	return decodeImpl(state, opc_sz, full_inst, debug, alloc);
+}
+
+Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug, InstArena &arena)
+{
+	return decodeImpl(state, opc_sz, full_inst, debug, arena);
+}
+
+void printDecode(System *sys, uint64_t pc, uint32_t full_inst, uint32_t opc_sz, const Inst *inst, bool debug)
+{
 	if (debug)
 		std::cout
 		          << std::hex
@@ -4427,7 +5946,9 @@ Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug
 
 	if (!inst)
 	{
-		std::cout << "(null inst)(" << std::hex << full_inst << std::dec << ')' << '\n';
+		// (the end of the decode line, else a message about the guest)
+		std::ostream &os = debug ? std::cout : sys ? sys->err() : std::cerr;
+		os << "(null inst)(" << std::hex << full_inst << std::dec << ')' << '\n';
 	}
 	else if (debug)
 	{
@@ -4435,8 +5956,39 @@ Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug
 			std::cout << ' ' << ' '; // shift for C.
 		std::cout << inst->disasm();
 	}
+}
 
-	return inst;
+void Inst::memRanges(ArchState &state, std::vector<MemRange> &ranges) const
+{
+	const OpType ot = opType();
+	if (ot >= OT_LOAD && ot <= OT_ATOMIC)
+		ranges.push_back(MemRange{calcEa(state), opSize()});
+}
+
+const char* opTypeName(Inst::OpType ot)
+{
+	switch (ot)
+	{
+	case Inst::OT_MOV: return "mov";
+	case Inst::OT_MOVI: return "movi";
+	case Inst::OT_ALU: return "alu";
+	case Inst::OT_SHIFT: return "shift";
+	case Inst::OT_MUL: return "mul";
+	case Inst::OT_DIV: return "div";
+	case Inst::OT_FP: return "fp";
+	case Inst::OT_VEC: return "vec";
+	case Inst::OT_LOAD: return "load";
+	case Inst::OT_STORE: return "store";
+	case Inst::OT_LOAD_FP: return "load_fp";
+	case Inst::OT_STORE_FP: return "store_fp";
+	case Inst::OT_LOAD_VEC: return "load_vec";
+	case Inst::OT_STORE_VEC: return "store_vec";
+	case Inst::OT_ATOMIC: return "atomic";
+	case Inst::OT_BCC: return "bcc";
+	case Inst::OT_BRANCH: return "branch";
+	case Inst::OT_SYSTEM: return "system";
+	}
+	return "unknown";
 }
 
 } // namespace
@@ -12,11 +12,58 @@ class ArchMem
 public:
 	virtual ~ArchMem() = default;
 
+	/// access rights (same values as the guest's PROT_READ, PROT_WRITE, PROT_EXEC)
+	enum : uint32_t
+	{
+		READ = 1,
+		WRITE = 2,
+		EXEC = 4,
+		ALL = READ | WRITE | EXEC
+	};
+
 	/// read memory
 	virtual uint64_t readMem(uint64_t va, uint32_t sz) const = 0;
 
 	/// write memory
 	virtual void    writeMem(uint64_t va, uint32_t sz, uint64_t val) = 0;
+
+	/// copy 'sz' bytes at 'va' to 'dst'
+	///@return bytes copied (short if the range runs into unallocated memory)
+	virtual uint64_t readBlock(uint64_t va, uint64_t sz, void *dst) const
+	{
+		uint8_t *const bytes = static_cast<uint8_t*>(dst);
+		for (uint64_t i = 0; i < sz; ++i)
+			bytes[i] = readMem(va + i, 1);
+		return sz;
+	}
+
+	/// copy 'sz' bytes from 'src' to 'va'
+	///@return bytes copied (short if the range runs into unallocated memory)
+	virtual uint64_t writeBlock(uint64_t va, uint64_t sz, const void *src)
+	{
+		const uint8_t *const bytes = static_cast<const uint8_t*>(src);
+		for (uint64_t i = 0; i < sz; ++i)
+			writeMem(va + i, 1, bytes[i]);
+		return sz;
+	}
+
+	///@return host address of [va, va+sz), or nullptr if it is not contiguous
+	/// (whatever its access rights, like readBlock() and writeBlock())
+	virtual uint8_t* hostPtr(uint64_t va, uint64_t sz) { return nullptr; }
+
+	///@return access rights at 'va' (0 if it is not allocated)
+	virtual uint32_t protection(uint64_t va) const { return ALL; }
+
+	/// write 'val' if memory holds 'expected' (atomic where the implementation allows)
+	///@return true if 'val' was written
+	virtual bool compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val)
+	{
+		if (readMem(va, sz) != expected)
+			return false;
+
+		writeMem(va, sz, val);
+		return true;
+	}
 };
 
 } // namespace
@@ -11,6 +11,9 @@ class System;
 class ArchState
 {
 public:
+	/// bytes in a vector register (VLEN 128, the width of an SSE or NEON register)
+	static constexpr uint32_t VLEN_BYTES = 16;
+
 	virtual ~ArchState() = default;
 
 	virtual uint64_t getReg(uint32_t num) const = 0;
@@ -26,6 +29,10 @@ public:
 	virtual uint64_t getFpRaw(uint32_t num) const = 0;
 	virtual void     setFpRaw(uint32_t num, uint64_t val) = 0;
 
+	/// vector register 'num' (VLEN_BYTES, registers are contiguous, so an LMUL group is too)
+	virtual uint8_t*       getVecReg(uint32_t num) = 0;
+	virtual const uint8_t* getVecReg(uint32_t num) const = 0;
+
 	virtual uint64_t getCr(uint32_t num) const = 0;
 	virtual void     setCr(uint32_t num, uint64_t val) = 0;
 
@@ -34,6 +41,25 @@ public:
 	virtual uint64_t readMem(uint64_t va, uint32_t sz) const = 0;
 	virtual void     writeMem(uint64_t va, uint32_t sz, uint64_t val) = 0;
 
+	/// bulk copies (for system calls)
+	///@return bytes copied (short if the range runs into unallocated memory)
+	virtual uint64_t readBlock(uint64_t va, uint64_t sz, void *dst) const = 0;
+	virtual uint64_t writeBlock(uint64_t va, uint64_t sz, const void *src) = 0;
+
+	///@return read only view of [va, va+sz), or nullptr if it is not contiguous
+	virtual const uint8_t* hostPtr(uint64_t va, uint64_t sz) const = 0;
+
+	/// atomic memory operations (coherent across harts sharing memory)
+	///@return true if 'val' was written (memory held 'expected')
+	virtual bool compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val) = 0;
+
+	/// read and reserve
+	virtual uint64_t loadReserved(uint64_t va, uint32_t sz) = 0;
+
+	/// write, if the reservation still holds (it is cleared in any case)
+	///@return true if 'val' was written
+	virtual bool storeConditional(uint64_t va, uint32_t sz, uint64_t val) = 0;
+
 	/// update PC
 	virtual void incPc(int64_t delta = 4) = 0;
 
@@ -41,6 +67,15 @@ public:
 	virtual uint64_t getPc() const = 0;
 	virtual void setPc(uint64_t pc) = 0;
 
+	/// count 'n' retired instructions (read by the cycle/time/instret CSRs)
+	virtual void retire(uint64_t n) = 0;
+
+	/// forget cached host addresses of guest memory (call after memory is added, grown or moved)
+	virtual void flushTlb() {}
+
+	/// drop decoded instructions of [va, va+sz) (call after memory is unmapped or replaced)
+	virtual void invalidateCode(uint64_t, uint64_t) {}
+
 	virtual System* getSys() = 0;
 	virtual const System* getSys() const = 0;
 };
@@ -50,7 +85,8 @@ namespace Reg
 	enum
 	{
 		RA = 1, ///< Return Address (aka Link Register)
-		SP = 2  ///< Stack Pointer
+		SP = 2, ///< Stack Pointer
+		TP = 4  ///< Thread Pointer
 	};
 }
 
@@ -0,0 +1,119 @@
+#include "batch_runner.hpp"
+#include <getopt.h>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace rvfun;
+
+int main(int argc, char **argv)
+{
+	if (argc == 1)
+	{
+		std::cerr << "Usage: " << argv[0] << " [-t threads] [-i max_insts] [-v] job_file" << std::endl;
+		std::cerr << "Each line of job_file is: elf_file [args...]" << std::endl;
+		std::cerr << "-t number of host threads (default: all cores)" << std::endl;
+		std::cerr << "-i maximum instructions per job" << std::endl;
+		std::cerr << "-v print each job's simulator messages (failed jobs' always)" << std::endl;
+		return 1;
+	}
+
+	uint32_t num_threads = std::thread::hardware_concurrency();
+	uint64_t max_insts = 0;
+	bool verbose = false;
+	const char *optstring = "+i:t:v";
+	int optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	while (optc != -1)
+	{
+		if (optc == 'i')
+		{
+			max_insts = std::strtoull(optarg, nullptr, 0);
+		}
+		else if (optc == 't')
+		{
+			num_threads = std::strtoul(optarg, nullptr, 0);
+		}
+		else if (optc == 'v')
+		{
+			verbose = true;
+		}
+		optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	}
+
+	if (optind >= argc)
+	{
+		std::cerr << "Missing job file." << std::endl;
+		return 1;
+	}
+
+	std::ifstream in(argv[optind]);
+	if (!in)
+	{
+		std::cerr << "Failure opening " << argv[optind] << std::endl;
+		return 1;
+	}
+
+	std::vector<BatchJob> jobs;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream ss(line);
+		BatchJob job;
+		if (!(ss >> job.elf) || job.elf[0] == '#')
+			continue;
+
+		std::string arg;
+		while (ss >> arg)
+			job.args.push_back(arg);
+		job.max_insts = max_insts;
+		jobs.push_back(job);
+	}
+
+	if (num_threads == 0)
+		num_threads = 1;
+	BatchRunner runner(num_threads);
+	const std::vector<BatchResult> results = runner.run(jobs);
+
+	int ret = 0;
+	uint64_t total_insts = 0;
+	double total_seconds = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const BatchResult &r = results[i];
+		std::cout << std::setw(4) << i << ' ' << jobs[i].elf << ": ";
+		if (r.failed)
+		{
+			std::cout << "simulation failed" << std::endl;
+			ret = 1;
+		}
+		else if (!r.loaded)
+		{
+			std::cout << "failure loading ELF" << std::endl;
+			ret = 1;
+		}
+		else
+		{
+			std::cout << r.icount << " instructions, ";
+			if (r.exited)
+				std::cout << "exit " << r.exit_status;
+			else
+				std::cout << "no exit";
+			std::cout << ", " << std::fixed << std::setprecision(3) << r.seconds << 's'
+			          << std::defaultfloat << std::endl;
+		}
+
+		if (verbose || r.failed)
+			std::cout << r.log;
+
+		total_insts += r.icount;
+		total_seconds += r.seconds;
+	}
+	std::cout << "Ran " << jobs.size() << " jobs (" << total_insts << " instructions, "
+	          << std::fixed << std::setprecision(3) << total_seconds << "s) on "
+	          << num_threads << " threads." << std::endl;
+
+	return ret;
+}
@@ -0,0 +1,155 @@
+// Checks that batch jobs keep their messages to themselves: two jobs run on two threads, one
+// hits an illegal instruction, and each job's log must hold only its own messages (with nothing
+// on the process' stdout or stderr).
+#include "batch_runner.hpp"
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace rvfun;
+
+namespace
+{
+constexpr uint64_t TEXT = 0x10000;
+
+const uint32_t EXIT[] = {
+	0x00000513, // li a0, 0
+	0x05d00893, // li a7, 93 (exit)
+	0x00000073 // ecall
+};
+constexpr uint32_t ILLEGAL = 0xffffffff;
+
+/// write 'code' as a static ELF (one text segment)
+///@return true on error
+bool writeElf(const std::string &path, const std::vector<uint32_t> &code)
+{
+	const uint64_t text_off = 0x1000;
+	const uint64_t code_sz = code.size() * sizeof(uint32_t);
+	std::vector<uint8_t> img(text_off + code_sz, 0);
+
+	Elf64_Ehdr eh;
+	memset(&eh, 0, sizeof(eh));
+	memcpy(eh.e_ident, ELFMAG, SELFMAG);
+	eh.e_ident[EI_CLASS] = ELFCLASS64;
+	eh.e_ident[EI_DATA] = ELFDATA2LSB;
+	eh.e_ident[EI_VERSION] = EV_CURRENT;
+	eh.e_type = ET_EXEC;
+	eh.e_machine = EM_RISCV;
+	eh.e_version = EV_CURRENT;
+	eh.e_entry = TEXT;
+	eh.e_phoff = sizeof(eh);
+	eh.e_ehsize = sizeof(eh);
+	eh.e_phentsize = sizeof(Elf64_Phdr);
+	eh.e_phnum = 1;
+	memcpy(img.data(), &eh, sizeof(eh));
+
+	Elf64_Phdr ph;
+	memset(&ph, 0, sizeof(ph));
+	ph.p_type = PT_LOAD;
+	ph.p_flags = PF_R | PF_X;
+	ph.p_offset = text_off;
+	ph.p_vaddr = ph.p_paddr = TEXT;
+	ph.p_filesz = ph.p_memsz = code_sz;
+	ph.p_align = 0x1000;
+	memcpy(img.data() + sizeof(eh), &ph, sizeof(ph));
+
+	memcpy(img.data() + text_off, code.data(), code_sz);
+
+	std::ofstream f(path, std::ios::binary);
+	f.write(reinterpret_cast<const char*>(img.data()), img.size());
+	return !f;
+}
+
+///@return true (after a message) if 'cond' is false
+bool fail(bool cond, const char *what)
+{
+	if (!cond)
+		std::cerr << "FAIL: " << what << std::endl;
+	return !cond;
+}
+}
+
+int main()
+{
+	// (guest output files go to the current directory)
+	char dir[] = "/tmp/rvfun_batch_check.XXXXXX";
+	if (!mkdtemp(dir) || chdir(dir) != 0)
+	{
+		std::cerr << "Failure making a scratch directory" << std::endl;
+		return 1;
+	}
+
+	std::vector<uint32_t> good(EXIT, EXIT + 3);
+	std::vector<uint32_t> bad(1, ILLEGAL);
+	bad.insert(bad.end(), EXIT, EXIT + 3);
+	if (writeElf("good.elf", good) || writeElf("bad.elf", bad))
+	{
+		std::cerr << "Failure writing test programs" << std::endl;
+		return 1;
+	}
+
+	std::vector<BatchJob> jobs(2);
+	jobs[0].elf = "good.elf";
+	jobs[1].elf = "bad.elf";
+
+	// catch anything written to the process' stdout or stderr
+	std::cout.flush();
+	std::cerr.flush();
+	const int saved_out = dup(1);
+	const int saved_err = dup(2);
+	const int capture = ::open("process.out", O_RDWR|O_CREAT|O_TRUNC, 0666);
+	dup2(capture, 1);
+	dup2(capture, 2);
+
+	BatchRunner runner(2);
+	const std::vector<BatchResult> results = runner.run(jobs);
+
+	std::cout.flush();
+	std::cerr.flush();
+	fflush(nullptr);
+	dup2(saved_out, 1);
+	dup2(saved_err, 2);
+	const off_t leaked = lseek(capture, 0, SEEK_END);
+	::close(capture);
+
+	bool failed = fail(results.size() == 2, "a result per job");
+	for (const auto &r : results)
+		failed |= fail(r.loaded && r.exited && !r.failed && r.exit_status == 0, "both jobs exit cleanly");
+	if (!failed)
+	{
+		failed |= fail(results[0].log.find("(null inst)") == std::string::npos, "the good job's log has no other job's messages");
+		failed |= fail(results[0].log.find("good.elf") != std::string::npos, "the good job's log has its own messages");
+		failed |= fail(results[1].log.find("(null inst)(ffffffff)") != std::string::npos, "the bad job's log has its illegal instruction");
+		failed |= fail(results[1].log.find("good.elf") == std::string::npos, "the bad job's log has no other job's messages");
+	}
+	failed |= fail(leaked == 0, "nothing on the process' stdout or stderr");
+
+	// clean up the scratch directory
+	const std::vector<std::string> files = {"good.elf", "bad.elf", "process.out"};
+	for (const auto &f : files)
+		unlink(f.c_str());
+	for (uint32_t i = 0; i < jobs.size(); ++i)
+	{
+		const std::string suffix = "." + std::to_string(getpid()) + '.' + std::to_string(i);
+		unlink(("stdout" + suffix).c_str());
+		unlink(("stderr" + suffix).c_str());
+	}
+	if (chdir("/") == 0)
+		rmdir(dir);
+
+	if (failed)
+	{
+		for (uint32_t i = 0; i < results.size(); ++i)
+			std::cerr << "--- job " << i << " log:\n" << results[i].log;
+		return 1;
+	}
+	std::cout << "Batch jobs keep their output to themselves." << std::endl;
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include "batch_runner.hpp"
+#include "block_cache.hpp"
+#include "fast_arch_state.hpp"
+#include "fast_forward.hpp"
+#include "host_system.hpp"
+#include "sparse_mem.hpp"
+#include <unistd.h>
+#include <chrono>
+#include <exception>
+#include <sstream>
+
+namespace rvfun
+{
+BatchRunner::BatchRunner(uint32_t num_threads)
+: pool_(num_threads)
+{
+}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob> &jobs)
+{
+	std::vector<BatchResult> results(jobs.size());
+	pool_.parallelFor(jobs.size(), [&](uint32_t i) { results[i] = runJob(jobs[i], i); });
+	return results;
+}
+
+BatchResult BatchRunner::runJob(const BatchJob &job, uint32_t index)
+{
+	const auto start = std::chrono::steady_clock::now();
+	BatchResult ret;
+
+	// everything is per job, nothing goes to the shared streams
+	std::ostringstream log;
+	std::ostringstream suffix;
+	suffix << '.' << getpid() << '.' << index;
+
+	// (a failing job must not take down the pool, or the other jobs' results)
+	try
+	{
+		simulate(job, suffix.str(), log, ret);
+	}
+	catch (const std::exception &e)
+	{
+		ret.failed = true;
+		log << "Simulation failed: " << e.what() << std::endl;
+	}
+	catch (...)
+	{
+		ret.failed = true;
+		log << "Simulation failed: unknown exception" << std::endl;
+	}
+	ret.log = log.str();
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	ret.seconds = elapsed.count();
+	return ret;
+}
+
+void BatchRunner::simulate(const BatchJob &job, const std::string &suffix, std::ostream &log, BatchResult &ret)
+{
+	HostSystem host;
+	host.setLog(&log, &log);
+	host.setOutputSuffix(suffix);
+
+	BlockCache bcache;
+	FastState state;
+	state.setSys(&host);
+	state.setMem(host.getSparseMem());
+	state.setCodeCache(&bcache);
+
+	if (host.loadElf(job.elf.c_str(), state))
+		return;
+	ret.loaded = true;
+
+	for (const auto &a : job.args)
+		host.addArg(a);
+	host.setStdin(job.elf + ".stdin");
+	host.completeEnv(state);
+
+	ret.icount = fastForward(state, bcache, host, job.max_insts);
+	ret.exited = host.hadExit();
+	ret.exit_status = host.exitStatus();
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef RVFUN_BATCH_RUNNER_HPP
+#define RVFUN_BATCH_RUNNER_HPP
+
+#include "thread_pool.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace rvfun
+{
+/// One program to simulate
+struct BatchJob
+{
+	std::string elf;
+	std::vector<std::string> args; ///< argv[1..n]
+	uint64_t max_insts = 0; ///< 0 for no limit
+};
+
+/// Outcome of one BatchJob
+struct BatchResult
+{
+	bool loaded = false; ///< false if the ELF failed to load
+	bool exited = false; ///< program called exit (else returned or hit max_insts)
+	bool failed = false; ///< the simulation threw (why is at the end of 'log')
+	uint64_t exit_status = 0;
+	uint64_t icount = 0;
+	double seconds = 0; ///< wall time
+	std::string log; ///< simulator messages
+};
+
+/// Runs many independent programs, each with its own HostSystem and state,
+/// on a work-stealing thread pool
+class BatchRunner
+{
+public:
+	explicit BatchRunner(uint32_t num_threads);
+
+	///@return one result per job (in job order)
+	std::vector<BatchResult> run(const std::vector<BatchJob> &jobs);
+
+	/// guest output files get suffix ".<pid>.<job index>"
+	static BatchResult runJob(const BatchJob &job, uint32_t index);
+
+private: // methods
+	/// fill in 'ret' (all but the log and time), messages to 'log'; may throw
+	static void simulate(const BatchJob &job, const std::string &suffix, std::ostream &log, BatchResult &ret);
+
+private: // data
+	ThreadPool pool_;
+};
+
+}
+
+#endif
+
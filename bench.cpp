@@ -0,0 +1,686 @@
+// Throughput benchmarks: decode, SparseMem access, end to end MIPS.
+// Results are JSON lines on stdout (one measurement per line).
+#include "block_cache.hpp"
+#include "decode_cache.hpp"
+#include "fast_arch_state.hpp"
+#include "fast_forward.hpp"
+#include "host_system.hpp"
+#include "inst.hpp"
+#include "inst_arena.hpp"
+#include "jit.hpp"
+#include "sparse_mem.hpp"
+#include <elf.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace rvfun;
+
+namespace
+{
+constexpr uint64_t TEXT = 0x10000;
+constexpr uint64_t DATA = 0x20000;
+constexpr uint64_t DATA_SZ = 0x30000; // (two 64KB buffers for the copy kernel)
+
+//--- instruction encoding
+uint32_t encR(uint32_t op, uint32_t rd, uint32_t f3, uint32_t r1, uint32_t r2, uint32_t f7)
+{
+	return (f7 << 25) | (r2 << 20) | (r1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+uint32_t encI(uint32_t op, uint32_t rd, uint32_t f3, uint32_t r1, int32_t imm)
+{
+	return ((imm & 0xfff) << 20) | (r1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+uint32_t encS(uint32_t op, uint32_t f3, uint32_t r1, uint32_t r2, int32_t imm)
+{
+	return (((imm >> 5) & 0x7f) << 25) | (r2 << 20) | (r1 << 15) | (f3 << 12) | ((imm & 0x1f) << 7) | op;
+}
+
+uint32_t encB(uint32_t f3, uint32_t r1, uint32_t r2, int32_t imm)
+{
+	return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) | (r2 << 20) | (r1 << 15) | (f3 << 12) |
+	       (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7) | 0x63;
+}
+
+uint32_t encJ(uint32_t rd, int32_t imm)
+{
+	return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) | (((imm >> 11) & 1) << 20) |
+	       (((imm >> 12) & 0xff) << 12) | (rd << 7) | 0x6f;
+}
+
+/// Tiny RV64 assembler (enough for the benchmark kernels)
+class Asm
+{
+public:
+	uint64_t pc() const { return TEXT + code_.size(); }
+	void label(const std::string &name) { labels_[name] = pc(); }
+
+	void emit32(uint32_t w)
+	{
+		for (uint32_t i = 0; i < 4; ++i)
+			code_.push_back(uint8_t(w >> (8 * i)));
+	}
+
+	void emit16(uint16_t h)
+	{
+		code_.push_back(uint8_t(h));
+		code_.push_back(uint8_t(h >> 8));
+	}
+
+	void addi(uint32_t rd, uint32_t r1, int32_t imm) { emit32(encI(0x13, rd, 0, r1, imm)); }
+	void li(uint32_t rd, int64_t v)
+	{
+		const int64_t hi = (v + 0x800) >> 12;
+		const int64_t lo = v - (hi << 12);
+		if (hi)
+		{
+			emit32(uint32_t(hi << 12) | (rd << 7) | 0x37); // lui
+			addi(rd, rd, lo);
+		}
+		else
+			addi(rd, 0, lo);
+	}
+
+	/// branch (or jal, f3 < 0) to a label
+	void branch(int32_t f3, uint32_t r1, uint32_t r2, const std::string &target)
+	{
+		fixups_.push_back(Fixup{code_.size(), f3, r1, r2, target});
+		emit32(0);
+	}
+
+	void exit()
+	{
+		li(10, 0);
+		li(17, 93);
+		emit32(0x73); // ecall
+	}
+
+	const std::vector<uint8_t>& finish()
+	{
+		for (const Fixup &f : fixups_)
+		{
+			const int32_t off = labels_[f.target] - (TEXT + f.pos);
+			const uint32_t w = f.f3 < 0 ? encJ(f.r1, off) : encB(f.f3, f.r1, f.r2, off);
+			memcpy(&code_[f.pos], &w, sizeof(w));
+		}
+		fixups_.clear();
+		return code_;
+	}
+
+private:
+	struct Fixup
+	{
+		size_t pos;
+		int32_t f3;
+		uint32_t r1;
+		uint32_t r2;
+		std::string target;
+	};
+
+	std::vector<uint8_t> code_;
+	std::map<std::string, uint64_t> labels_;
+	std::vector<Fixup> fixups_;
+};
+
+enum : uint32_t
+{
+	ZERO = 0, RA = 1, SP = 2, T0 = 5, T1 = 6, T2 = 7, S0 = 8, S1 = 9,
+	A0 = 10, A1 = 11, A2 = 12, A3 = 13, T3 = 28, T4 = 29, T5 = 30
+};
+
+enum : int32_t { BEQ = 0, BNE = 1, JAL = -1 };
+
+/// one benchmark program
+struct Kernel
+{
+	std::string name;
+	std::vector<uint8_t> code;
+};
+
+/// integer ALU, multiply and a loop branch
+Kernel aluKernel(int64_t n)
+{
+	Asm a;
+	a.li(A0, 0);
+	a.li(T0, n);
+	a.label("loop");
+	a.emit32(encR(0x33, A0, 0, A0, T0, 0)); // add
+	a.emit32(encR(0x33, T2, 4, A0, T0, 0)); // xor
+	a.emit32(encI(0x13, T3, 7, T0, 0xff)); // andi
+	a.emit32(encI(0x13, T3, 1, T3, 3)); // slli
+	a.emit32(encR(0x33, T4, 0, T2, T2, 1)); // mul
+	a.emit32(encR(0x33, A0, 0, A0, T4, 0x20)); // sub
+	a.emit32(encI(0x13, T5, 5, A0, 7)); // srli
+	a.emit32(encR(0x33, A0, 6, A0, T5, 0)); // or
+	a.addi(T0, T0, -1);
+	a.branch(BNE, T0, ZERO, "loop");
+	a.exit();
+	return Kernel{"alu", a.finish()};
+}
+
+/// copy and sum a 64KB buffer with 8 byte loads and stores (plus narrow accesses)
+Kernel memKernel(int64_t n)
+{
+	Asm a;
+	a.li(S0, n);
+	a.label("outer");
+	a.li(A1, DATA);
+	a.li(A2, DATA + 0x10000);
+	a.li(T0, 0x10000 / 8);
+	a.label("inner");
+	a.emit32(encI(0x03, T1, 3, A1, 0)); // ld
+	a.emit32(encS(0x23, 3, A2, T1, 0)); // sd
+	a.emit32(encR(0x33, A0, 0, A0, T1, 0)); // add
+	a.emit32(encI(0x03, T2, 2, A1, 4)); // lw
+	a.emit32(encS(0x23, 0, A2, T2, 7)); // sb
+	a.addi(A1, A1, 8);
+	a.addi(A2, A2, 8);
+	a.addi(T0, T0, -1);
+	a.branch(BNE, T0, ZERO, "inner");
+	a.addi(S0, S0, -1);
+	a.branch(BNE, S0, ZERO, "outer");
+	a.exit();
+	return Kernel{"mem", a.finish()};
+}
+
+/// calls, returns and a data dependent branch
+Kernel callKernel(int64_t n)
+{
+	Asm a;
+	a.li(T0, n);
+	a.label("loop");
+	a.branch(JAL, RA, 0, "func");
+	a.emit32(encI(0x13, T1, 7, T0, 1)); // andi
+	a.branch(BEQ, T1, ZERO, "skip");
+	a.addi(A0, A0, 3);
+	a.label("skip");
+	a.addi(T0, T0, -1);
+	a.branch(BNE, T0, ZERO, "loop");
+	a.exit();
+	a.label("func");
+	a.addi(A1, A1, 1);
+	a.emit32(encI(0x67, 0, 0, RA, 0)); // ret
+	return Kernel{"call", a.finish()};
+}
+
+/// compressed (RVC) instructions
+Kernel compressedKernel(int64_t n)
+{
+	auto ci = [](uint32_t f3, uint32_t rd, int32_t imm, uint32_t op) -> uint16_t
+	{
+		return (f3 << 13) | (((imm >> 5) & 1) << 12) | (rd << 7) | ((imm & 0x1f) << 2) | op;
+	};
+	auto cr = [](uint32_t f4, uint32_t rd, uint32_t rs2) -> uint16_t
+	{
+		return (f4 << 12) | (rd << 7) | (rs2 << 2) | 2;
+	};
+
+	Asm a;
+	a.li(S0, n);
+	a.label("loop");
+	a.emit16(ci(0, A0, 1, 1)); // c.addi
+	a.emit16(cr(9, A1, A0)); // c.add
+	a.emit16(cr(8, A2, A1)); // c.mv
+	a.emit16(ci(0, A2, 3, 2)); // c.slli
+	a.emit16(cr(9, A0, A2)); // c.add
+	a.emit16(ci(2, A3, 5, 1)); // c.li
+	a.emit16(cr(9, A1, A3)); // c.add
+	a.emit16(ci(0, S0, -1, 1)); // c.addi
+	a.branch(BNE, S0, ZERO, "loop");
+	a.exit();
+	return Kernel{"compressed", a.finish()};
+}
+
+/// double precision add, multiply and FP loads and stores
+Kernel fpKernel(int64_t n)
+{
+	Asm a;
+	a.li(T0, n);
+	a.li(T1, 3);
+	a.li(A1, DATA);
+	a.emit32(encR(0x53, 1, 0, T0, 2, 0x69)); // fcvt.d.l f1, t0
+	a.emit32(encR(0x53, 2, 0, T1, 2, 0x69)); // fcvt.d.l f2, t1
+	a.label("loop");
+	a.emit32(encR(0x53, 3, 0, 3, 1, 0x01)); // fadd.d f3, f3, f1
+	a.emit32(encR(0x53, 4, 0, 3, 2, 0x09)); // fmul.d f4, f3, f2
+	a.emit32(encR(0x53, 5, 0, 4, 3, 0x05)); // fsub.d f5, f4, f3
+	a.emit32(encS(0x27, 3, A1, 5, 0)); // fsd f5, 0(a1)
+	a.emit32(encI(0x07, 6, 3, A1, 0)); // fld f6, 0(a1)
+	a.emit32(encR(0x53, 3, 0, 6, 2, 0x0d)); // fdiv.d f3, f6, f2
+	a.addi(T0, T0, -1);
+	a.branch(BNE, T0, ZERO, "loop");
+	a.exit();
+	return Kernel{"fp", a.finish()};
+}
+
+std::vector<Kernel> kernels()
+{
+	return {aluKernel(1000000), memKernel(100), callKernel(1500000), compressedKernel(1000000), fpKernel(1000000)};
+}
+
+/// write 'k' as a static ELF (text, then a zeroed data segment)
+///@return true on error
+bool writeElf(const std::string &path, const Kernel &k)
+{
+	const uint64_t text_off = 0x1000;
+	std::vector<uint8_t> img(text_off + k.code.size(), 0);
+
+	Elf64_Ehdr eh;
+	memset(&eh, 0, sizeof(eh));
+	memcpy(eh.e_ident, ELFMAG, SELFMAG);
+	eh.e_ident[EI_CLASS] = ELFCLASS64;
+	eh.e_ident[EI_DATA] = ELFDATA2LSB;
+	eh.e_ident[EI_VERSION] = EV_CURRENT;
+	eh.e_type = ET_EXEC;
+	eh.e_machine = EM_RISCV;
+	eh.e_version = EV_CURRENT;
+	eh.e_entry = TEXT;
+	eh.e_phoff = sizeof(eh);
+	eh.e_ehsize = sizeof(eh);
+	eh.e_phentsize = sizeof(Elf64_Phdr);
+	eh.e_phnum = 2;
+	memcpy(img.data(), &eh, sizeof(eh));
+
+	Elf64_Phdr ph[2];
+	memset(ph, 0, sizeof(ph));
+	ph[0].p_type = PT_LOAD;
+	ph[0].p_flags = PF_R | PF_X;
+	ph[0].p_offset = text_off;
+	ph[0].p_vaddr = ph[0].p_paddr = TEXT;
+	ph[0].p_filesz = ph[0].p_memsz = k.code.size();
+	ph[0].p_align = 0x1000;
+	ph[1].p_type = PT_LOAD;
+	ph[1].p_flags = PF_R | PF_W;
+	ph[1].p_offset = text_off; // (no file bytes)
+	ph[1].p_vaddr = ph[1].p_paddr = DATA;
+	ph[1].p_memsz = DATA_SZ;
+	ph[1].p_align = 0x1000;
+	memcpy(img.data() + sizeof(eh), ph, sizeof(ph));
+
+	memcpy(img.data() + text_off, k.code.data(), k.code.size());
+
+	std::ofstream f(path, std::ios::binary);
+	f.write(reinterpret_cast<const char*>(img.data()), img.size());
+	return !f;
+}
+
+///@return contents of the executable segments of ELF 'path'
+std::vector<uint8_t> readText(const std::string &path)
+{
+	std::ifstream f(path, std::ios::binary);
+	const std::vector<uint8_t> img((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	std::vector<uint8_t> ret;
+	if (img.size() < sizeof(Elf64_Ehdr))
+		return ret;
+
+	Elf64_Ehdr eh;
+	memcpy(&eh, img.data(), sizeof(eh));
+	for (uint32_t i = 0; i < eh.e_phnum; ++i)
+	{
+		const uint64_t off = eh.e_phoff + i * sizeof(Elf64_Phdr);
+		if (off + sizeof(Elf64_Phdr) > img.size())
+			break;
+
+		Elf64_Phdr ph;
+		memcpy(&ph, img.data() + off, sizeof(ph));
+		if (ph.p_type == PT_LOAD && (ph.p_flags & PF_X) && ph.p_offset + ph.p_filesz <= img.size())
+			ret.insert(ret.end(), img.begin() + ph.p_offset, img.begin() + ph.p_offset + ph.p_filesz);
+	}
+	return ret;
+}
+
+/// split 'code' into 16 and 32 bit opcodes
+void splitOpcodes(const std::vector<uint8_t> &code, std::vector<uint32_t> &op16, std::vector<uint32_t> &op32)
+{
+	for (size_t i = 0; i + 1 < code.size();)
+	{
+		const uint32_t lo = code[i] | (code[i + 1] << 8);
+		if ((lo & 3) != 3)
+		{
+			op16.push_back(lo);
+			i += 2;
+		}
+		else if (i + 3 < code.size())
+		{
+			op32.push_back(lo | (code[i + 2] << 16) | (code[i + 3] << 24));
+			i += 4;
+		}
+		else
+			break;
+	}
+}
+
+//--- measurement
+uint32_t g_reps = 3;
+
+///@return fastest of g_reps calls to 'fn' (seconds)
+double bestTime(const std::function<void()> &fn)
+{
+	double best = 0;
+	for (uint32_t i = 0; i < g_reps; ++i)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		fn();
+		const std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+		if (i == 0 || secs.count() < best)
+			best = secs.count();
+	}
+	return best;
+}
+
+void report(const std::string &bench, const std::string &name, double value, const char *unit, int64_t insts = -1)
+{
+	std::cout << "{\"bench\": \"" << bench << "\", \"case\": \"" << name << "\", \"value\": " << value
+	          << ", \"unit\": \"" << unit << '"';
+	if (insts >= 0)
+		std::cout << ", \"insts\": " << insts;
+	std::cout << '}' << std::endl;
+}
+
+//--- decode
+void benchDecode(const std::string &name, const std::vector<uint32_t> &op16, const std::vector<uint32_t> &op32)
+{
+	constexpr uint64_t DECODES = 2000000;
+	InstArena arena;
+	uint64_t sink = 0;
+
+	if (!op32.empty())
+	{
+		const double secs = bestTime([&]
+		{
+			for (uint64_t i = 0; i < DECODES;)
+			{
+				arena.clear();
+				for (size_t j = 0; j < op32.size() && i < DECODES; ++j, ++i)
+				{
+					const Inst *const inst = decode32(op32[j], arena);
+					sink += inst ? inst->opType() : 0;
+				}
+			}
+		});
+		report("decode32", name, DECODES / secs / 1e6, "Mops/s");
+	}
+
+	if (!op16.empty())
+	{
+		const double secs = bestTime([&]
+		{
+			for (uint64_t i = 0; i < DECODES;)
+			{
+				arena.clear();
+				for (size_t j = 0; j < op16.size() && i < DECODES; ++j, ++i)
+				{
+					const Inst *const inst = decode16(op16[j], arena);
+					sink += inst ? inst->opType() : 0;
+				}
+			}
+		});
+		report("decode16", name, DECODES / secs / 1e6, "Mops/s");
+	}
+
+	if (sink == 1) // (keep the decodes)
+		std::cerr << ' ';
+}
+
+//--- SparseMem
+void benchMem()
+{
+	constexpr uint32_t BLOCK_SZ = 64 * 1024;
+	constexpr uint64_t BLOCK_STRIDE = 1 << 20; // (never adjacent)
+	constexpr uint64_t ACCESSES = 4000000;
+
+	for (const uint32_t num_blocks : {1u, 16u, 256u, 4096u})
+	{
+		SparseMem mem;
+		for (uint32_t i = 0; i < num_blocks; ++i)
+			mem.addBlock(0x10000000 + i * BLOCK_STRIDE, BLOCK_SZ);
+
+		// random blocks, and runs of 64 accesses within one block
+		std::vector<uint64_t> random;
+		std::vector<uint64_t> local;
+		uint64_t seed = 12345;
+		for (uint32_t i = 0; i < 65536; ++i)
+		{
+			seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+			const uint64_t blk = (seed >> 33) % num_blocks;
+			const uint64_t off = ((seed >> 17) % (BLOCK_SZ / 8)) * 8;
+			random.push_back(0x10000000 + blk * BLOCK_STRIDE + off);
+			local.push_back(0x10000000 + ((i / 64) % num_blocks) * BLOCK_STRIDE + off);
+		}
+
+		for (const auto *pattern : {&random, &local})
+		{
+			const std::vector<uint64_t> &addrs = *pattern;
+			const std::string name = std::string(pattern == &random ? "random" : "local") +
+			                         "/blocks=" + std::to_string(num_blocks);
+			uint64_t sink = 0;
+
+			const double rd = bestTime([&]
+			{
+				for (uint64_t i = 0; i < ACCESSES; ++i)
+					sink += mem.SparseMem::readMem(addrs[i & 0xffff], 8);
+			});
+			report("mem_read", name, rd / ACCESSES * 1e9, "ns");
+
+			const double wr = bestTime([&]
+			{
+				for (uint64_t i = 0; i < ACCESSES; ++i)
+					mem.SparseMem::writeMem(addrs[i & 0xffff], 8, i);
+			});
+			report("mem_write", name, wr / ACCESSES * 1e9, "ns");
+
+			if (sink == 1)
+				std::cerr << ' ';
+		}
+	}
+}
+
+//--- end to end
+enum class Mode { JIT, BLOCKS, DCACHE, STEP };
+
+///@return instructions executed (-1 on error)
+int64_t runProgram(const std::string &path, Mode mode, uint64_t max_insts, double &secs)
+{
+	std::ostringstream log;
+	std::ostringstream suffix;
+	suffix << ".bench." << getpid();
+
+	HostSystem host;
+	host.setLog(&log, &log);
+	host.setOutputSuffix(suffix.str());
+
+	FastState state;
+	state.setSys(&host);
+	state.setMem(host.getSparseMem());
+
+	BlockCache bcache;
+	DecodeCache dcache;
+	InstArena arena;
+	if (mode == Mode::BLOCKS || mode == Mode::JIT)
+		state.setCodeCache(&bcache);
+	else if (mode == Mode::DCACHE)
+		state.setCodeCache(&dcache);
+
+	if (host.loadElf(path.c_str(), state))
+		return -1;
+	host.completeEnv(state);
+	if (mode == Mode::JIT)
+		bcache.setJit(true);
+
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t icount = 0;
+	if (mode == Mode::BLOCKS || mode == Mode::JIT)
+		icount = fastForward(state, bcache, host, max_insts);
+	else
+	{
+		while (!host.hadExit() && (state.getPc() & -63ll) != 0 && (max_insts == 0 || icount < max_insts))
+		{
+			uint32_t opc_sz = 2;
+			uint32_t full_inst = 0;
+			Inst *inst = nullptr;
+			if (mode == Mode::DCACHE)
+				inst = dcache.decode(state, opc_sz, full_inst, false);
+			else
+			{
+				arena.clear();
+				inst = decode(state, opc_sz, full_inst, false, arena);
+			}
+
+			if (inst)
+				inst->execute(state);
+			else
+				state.incPc(opc_sz);
+			++icount;
+		}
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	secs = elapsed.count();
+
+	::unlink(("stdout" + suffix.str()).c_str());
+	::unlink(("stderr" + suffix.str()).c_str());
+	return icount;
+}
+
+///@return true on error
+bool benchRun(const std::string &name, const std::string &path, uint64_t max_insts)
+{
+	const std::pair<Mode, const char*> modes[] =
+	{
+		{Mode::JIT, "jit"},
+		{Mode::BLOCKS, "blocks"},
+		{Mode::DCACHE, "dcache"},
+		{Mode::STEP, "step"}
+	};
+
+	int64_t expect = -1;
+	for (const auto &m : modes)
+	{
+		if (m.first == Mode::JIT && !Jit::supported())
+			continue;
+
+		int64_t icount = 0;
+		double secs = 0;
+		for (uint32_t i = 0; i < g_reps && icount >= 0; ++i)
+		{
+			double t = 0;
+			icount = runProgram(path, m.first, max_insts, t);
+			if (i == 0 || t < secs)
+				secs = t;
+		}
+
+		if (icount < 0 || (expect >= 0 && icount != expect))
+		{
+			std::cerr << "Failure running " << name << " (" << m.second << ')' << std::endl;
+			return true;
+		}
+		expect = icount;
+		report("run", name + '/' + m.second, secs > 0 ? icount / secs / 1e6 : 0, "MIPS", icount);
+	}
+	return false;
+}
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t max_insts = 0;
+	const char *write_dir = nullptr;
+	const char *optstring = "+hi:r:w:";
+	int optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	while (optc != -1)
+	{
+		if (optc == 'i')
+		{
+			max_insts = strtoull(optarg, nullptr, 10);
+		}
+		else if (optc == 'r')
+		{
+			g_reps = strtoul(optarg, nullptr, 10);
+			if (g_reps == 0)
+				g_reps = 1;
+		}
+		else if (optc == 'w')
+		{
+			write_dir = optarg;
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [-i max_insts] [-r repetitions] [-w dir] [elf files...]" << std::endl;
+			std::cerr << "-i limit each run (for long ELF files)" << std::endl;
+			std::cerr << "-r keep the best of this many runs (default 3)" << std::endl;
+			std::cerr << "-w write the built in kernels to dir as ELF files, and exit" << std::endl;
+			return 1;
+		}
+		optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	}
+
+	const std::vector<Kernel> ks = kernels();
+	if (write_dir)
+	{
+		for (const Kernel &k : ks)
+		{
+			const std::string path = std::string(write_dir) + '/' + k.name + ".elf";
+			if (writeElf(path, k))
+			{
+				std::cerr << "Failure writing " << path << std::endl;
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	// kernels run from temporary ELF files
+	std::vector<std::pair<std::string, std::string>> programs;
+	std::vector<uint8_t> all_code;
+	for (const Kernel &k : ks)
+	{
+		char tmp[] = "/tmp/rvfun_bench_XXXXXX";
+		const int fd = mkstemp(tmp);
+		if (fd < 0 || writeElf(tmp, k))
+		{
+			std::cerr << "Failure writing a temporary ELF" << std::endl;
+			return 1;
+		}
+		::close(fd);
+		programs.emplace_back(k.name, tmp);
+		all_code.insert(all_code.end(), k.code.begin(), k.code.end());
+	}
+
+	// decode mixes: the kernels, then the text of each ELF given
+	std::vector<uint32_t> op16;
+	std::vector<uint32_t> op32;
+	splitOpcodes(all_code, op16, op32);
+	benchDecode("kernels", op16, op32);
+
+	for (int i = optind; i < argc; ++i)
+	{
+		std::vector<uint32_t> e16;
+		std::vector<uint32_t> e32;
+		splitOpcodes(readText(argv[i]), e16, e32);
+		benchDecode(argv[i], e16, e32);
+	}
+
+	benchMem();
+
+	bool fail = false;
+	for (const auto &p : programs)
+	{
+		fail = benchRun(p.first, p.second, max_insts) || fail;
+		::unlink(p.second.c_str());
+	}
+
+	for (int i = optind; i < argc; ++i)
+		fail = benchRun(argv[i], argv[i], max_insts) || fail;
+
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,314 @@
+#include "block_cache.hpp"
+#include "arch_state.hpp"
+#include "fast_arch_state.hpp"
+#include "simpoint.hpp"
+#include "sparse_mem.hpp"
+#include <utility>
+
+namespace
+{
+constexpr uint64_t MIN_RECLAIM = 4096; // stale instructions before the arena is recycled
+}
+
+namespace rvfun
+{
+struct BlockCache::Block
+{
+	uint64_t pc = 0; ///< first instruction
+	uint64_t end = 0; ///< first byte past the last instruction
+	std::vector<Inst*> insts; ///< owned by arena
+	uint32_t null_sz = 0; ///< size of trailing illegal instruction (0 for none)
+	bool sys = false; ///< ends in a system instruction
+	Block *next[2] = {nullptr, nullptr}; ///< successors seen so far, most recently hit first
+	uint32_t runs = 0; ///< executions, until HOT_RUNS
+	uint32_t code_ct = 0; ///< instructions translated to 'code'
+	Jit::Code code = nullptr;
+	uint32_t bbv_id = 0; ///< (0 until counted)
+
+	/// forget the translation (it may be translated again once hot)
+	void dropCode()
+	{
+		runs = 0;
+		code_ct = 0;
+		code = nullptr;
+	}
+};
+
+BlockCache::BlockCache()
+{
+}
+
+BlockCache::~BlockCache()
+{
+}
+
+bool BlockCache::setJit(bool on)
+{
+	if (on && !Jit::supported())
+		return true;
+
+	if (!on)
+	{
+		// the translations go with the JIT's buffer (a later JIT must not run them)
+		dropTranslations();
+		jit_.reset();
+	}
+	else if (!jit_)
+		jit_.reset(new Jit);
+	return false;
+}
+
+BlockCache::Block* BlockCache::build(ArchState &state, const uint64_t pc)
+{
+	std::unique_ptr<Block> b(new Block);
+	b->pc = pc;
+
+	// decode needs the PC, restore it when done
+	uint64_t cur_pc = pc;
+	while (b->insts.size() < MAX_BLOCK_INSTS)
+	{
+		state.setPc(cur_pc);
+
+		uint32_t opc_sz = 2;
+		uint32_t full_inst = 0;
+		Inst *const inst = decode(state, opc_sz, full_inst, false, arena_);
+		cur_pc += opc_sz;
+
+		if (!inst)
+		{
+			b->null_sz = opc_sz;
+			break;
+		}
+
+		b->insts.emplace_back(inst);
+
+		const Inst::OpType ot = inst->opType();
+		if (ot == Inst::OT_SYSTEM)
+		{
+			b->sys = true;
+			break;
+		}
+		if (ot == Inst::OT_BCC || ot == Inst::OT_BRANCH)
+			break;
+	}
+	state.setPc(pc);
+	b->end = cur_pc;
+
+	if (b->pc < code_lo_)
+		code_lo_ = b->pc;
+	if (b->end > code_hi_)
+		code_hi_ = b->end;
+
+	++built_;
+	Block *const ret = b.get();
+	blocks_[pc] = std::move(b);
+	return ret;
+}
+
+BlockCache::Block* BlockCache::lookup(ArchState &state, const uint64_t pc)
+{
+	// follow chain from previous block (most recently hit link first)
+	if (prev_)
+	{
+		Block **const next = prev_->next;
+		if (next[0] && next[0]->pc == pc)
+		{
+			++chain_hits_;
+			return next[0];
+		}
+		if (next[1] && next[1]->pc == pc)
+		{
+			++chain_hits_;
+			std::swap(next[0], next[1]);
+			return next[0];
+		}
+	}
+
+	auto i = blocks_.find(pc);
+	Block *const b = i != blocks_.end() ? i->second.get() : build(state, pc);
+
+	// link in first (the least recently hit link drops out, if full)
+	if (prev_)
+	{
+		prev_->next[1] = prev_->next[0];
+		prev_->next[0] = b;
+	}
+	return b;
+}
+
+uint64_t BlockCache::execute(ArchState &state, uint64_t max_insts)
+{
+	return run(state, max_insts);
+}
+
+uint64_t BlockCache::execute(FastState &state, uint64_t max_insts)
+{
+	return run(state, max_insts);
+}
+
+uint64_t BlockCache::runBlocks(FastState &state, uint64_t max_insts)
+{
+	uint64_t ct = 0;
+	while (1)
+	{
+		ct += run(state, max_insts ? max_insts - ct : 0);
+		if (last_sys_ || (max_insts != 0 && ct >= max_insts) || (state.getPc() & -63ll) == 0)
+			return ct;
+	}
+}
+
+template<class State>
+uint64_t BlockCache::run(State &state, uint64_t max_insts)
+{
+	// nothing can be executing now
+	dead_.clear();
+	if (flush_pending_)
+		reclaim();
+
+	Block *const b = lookup(state, state.getPc());
+
+	uint64_t ct = b->insts.size();
+	if (max_insts != 0 && ct > max_insts)
+		ct = max_insts;
+
+	// (a system instruction may read instret, retire the ones before it first)
+	last_sys_ = b->sys && ct == b->insts.size();
+	const uint64_t body = last_sys_ ? ct - 1 : ct;
+	uint64_t i = jit_ ? runJit(state, *b, body) : 0;
+	for (; i < body; ++i)
+		b->insts[i]->execute(state);
+	state.retire(body);
+	if (last_sys_)
+	{
+		b->insts[body]->execute(state);
+		state.retire(1);
+	}
+
+	// illegal instruction (skip it, like the driver does)
+	if (b->null_sz && ct == b->insts.size() && (max_insts == 0 || ct < max_insts))
+	{
+		state.incPc(b->null_sz);
+		state.retire(1);
+		++ct;
+	}
+
+	if (bbv_)
+	{
+		// the rest of a block cut short by 'max_insts' is still that block
+		uint32_t id = b->pc == cut_pc_ ? cut_id_ : 0;
+		if (!id)
+		{
+			if (!b->bbv_id)
+				b->bbv_id = bbv_->blockId(b->pc);
+			id = b->bbv_id;
+		}
+		bbv_->add(id, ct);
+
+		const bool cut = ct < b->insts.size() + (b->null_sz != 0);
+		cut_id_ = cut ? id : 0;
+		cut_pc_ = state.getPc();
+	}
+
+	// don't chain from invalidated blocks
+	prev_ = dead_.empty() ? b : nullptr;
+
+	return ct;
+}
+
+uint64_t BlockCache::runJit(FastState &state, Block &b, uint64_t max_insts)
+{
+	if (!b.code)
+	{
+		if (b.runs >= HOT_RUNS || ++b.runs < HOT_RUNS)
+			return 0;
+		b.code = jit_->translate(b.pc, b.insts, b.code_ct);
+		if (!b.code && jit_->full())
+		{
+			// start the buffer over (blocks still hot will be translated again)
+			dropTranslations();
+			jit_->clear();
+			b.runs = HOT_RUNS;
+			b.code = jit_->translate(b.pc, b.insts, b.code_ct);
+		}
+		if (!b.code)
+			return 0;
+	}
+
+	// (the interpreter runs partial translations)
+	if (b.code_ct > max_insts)
+		return 0;
+
+	state.setPc(b.code(state.intRegs(), &state));
+	jit_insts_ += b.code_ct;
+	return b.code_ct;
+}
+
+void BlockCache::dropTranslations()
+{
+	for (auto &i : blocks_)
+		i.second->dropCode();
+	for (const auto &b : dead_)
+		b->dropCode();
+}
+
+void BlockCache::unlinkAll()
+{
+	for (auto &i : blocks_)
+	{
+		i.second->next[0] = nullptr;
+		i.second->next[1] = nullptr;
+	}
+	prev_ = nullptr;
+}
+
+void BlockCache::invalidate(uint64_t va, uint64_t sz)
+{
+	// cheap filter for data accesses
+	if (va >= code_hi_ || va + sz <= code_lo_)
+		return;
+
+	const uint64_t end = va + sz;
+	bool found = false;
+	for (auto i = blocks_.begin(); i != blocks_.end();)
+	{
+		Block *const b = i->second.get();
+		if (b->pc < end && va < b->end)
+		{
+			// block may be running, delete it later
+			stale_ += b->insts.size();
+			dead_.emplace_back(std::move(i->second));
+			i = blocks_.erase(i);
+			found = true;
+		}
+		else
+			++i;
+	}
+
+	if (found)
+		unlinkAll();
+
+	// recycle the arena once it is mostly garbage
+	if (stale_ >= MIN_RECLAIM && stale_ * 2 >= arena_.size())
+		flush_pending_ = true;
+}
+
+void BlockCache::reclaim()
+{
+	blocks_.clear();
+	arena_.clear();
+	prev_ = nullptr;
+	code_lo_ = uint64_t(-1);
+	code_hi_ = 0;
+	stale_ = 0;
+	flush_pending_ = false;
+	if (jit_)
+		jit_->clear();
+}
+
+void BlockCache::flush()
+{
+	// a block may be running, free everything on the next execute
+	flush_pending_ = true;
+}
+
+}
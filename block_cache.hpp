@@ -0,0 +1,98 @@
+#ifndef RVFUN_BLOCK_CACHE_HPP
+#define RVFUN_BLOCK_CACHE_HPP
+
+#include "code_cache.hpp"
+#include "inst.hpp"
+#include "inst_arena.hpp"
+#include "jit.hpp"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace rvfun
+{
+class ArchState;
+class BbvWriter;
+
+/// Cache of decoded basic blocks, indexed by starting PC
+class BlockCache : public CodeCache
+{
+public:
+	/// blocks end at a branch, system op, illegal instruction, or this many instructions
+	static constexpr uint32_t MAX_BLOCK_INSTS = 64;
+	/// (with the JIT on) blocks are translated when they start this many times
+	static constexpr uint32_t HOT_RUNS = 32;
+
+	BlockCache();
+	~BlockCache();
+
+	/// execute (at most 'max_insts', 0 for no limit) instructions of the block at PC
+	///@return number of instructions executed
+	uint64_t execute(ArchState &state, uint64_t max_insts = 0);
+
+	/// as above, with state access bound statically
+	uint64_t execute(FastState &state, uint64_t max_insts = 0);
+
+	/// execute blocks back to back until a system instruction (the only way to exit),
+	/// the PC returns to the shell, or 'max_insts' (0 for no limit)
+	///@return number of instructions executed
+	uint64_t runBlocks(FastState &state, uint64_t max_insts = 0);
+
+	/// translate hot blocks to host code (FastState execution only)
+	///@return true if the JIT is not supported on this host
+	bool setJit(bool on);
+	const Jit* jit() const { return jit_.get(); }
+	uint64_t jitInsts() const { return jit_insts_; }
+
+	/// count the instructions of every block executed in 'w' (nullptr for none)
+	void setBbv(BbvWriter *w) { bbv_ = w; }
+
+	//---from CodeCache
+	void invalidate(uint64_t va, uint64_t sz) override;
+	void flush() override;
+
+	uint64_t blocksBuilt() const { return built_; }
+	uint64_t chainHits() const { return chain_hits_; }
+
+private: // types
+	struct Block;
+
+private: // methods
+	Block* lookup(ArchState &state, uint64_t pc);
+	Block* build(ArchState &state, uint64_t pc);
+
+	template<class State>
+	uint64_t run(State &state, uint64_t max_insts);
+	/// run the translation of 'b' if there is one (translating it once hot) which fits in 'max_insts'
+	///@return number of instructions executed
+	uint64_t runJit(FastState &state, Block &b, uint64_t max_insts);
+	uint64_t runJit(ArchState&, Block&, uint64_t) { return 0; }
+	/// forget the host code of every block (none may be running)
+	void dropTranslations();
+	void unlinkAll();
+	void reclaim();
+
+private: // data
+	InstArena arena_;
+	std::unordered_map<uint64_t, std::unique_ptr<Block>> blocks_;
+	std::vector<std::unique_ptr<Block>> dead_; ///< invalidated, possibly still executing
+	Block *prev_ = nullptr; ///< last block executed (for chaining)
+	uint64_t code_lo_ = uint64_t(-1); ///< lowest cached address
+	uint64_t code_hi_ = 0; ///< highest cached address (exclusive)
+	uint64_t stale_ = 0; ///< instructions of invalidated blocks still in the arena
+	bool flush_pending_ = false; ///< free everything on the next execute
+	bool last_sys_ = false; ///< last block executed ended in a system instruction
+	uint64_t built_ = 0;
+	uint64_t chain_hits_ = 0;
+	std::unique_ptr<Jit> jit_; ///< null when off
+	uint64_t jit_insts_ = 0; ///< executed as host code
+	BbvWriter *bbv_ = nullptr;
+	uint64_t cut_pc_ = 0; ///< where the last block counted stopped
+	uint32_t cut_id_ = 0; ///< its BBV id, if it was cut short (else 0)
+};
+
+}
+
+#endif
+
@@ -0,0 +1,266 @@
+#include "branch_predictor.hpp"
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+namespace
+{
+using namespace rvfun;
+
+/// 2 bit saturating counter update
+void train2(uint8_t &c, bool taken)
+{
+	if (taken)
+		c += c < 3;
+	else
+		c -= c > 0;
+}
+
+class Bimodal : public BranchPredictor
+{
+public:
+	static constexpr uint32_t BITS = 14;
+
+	Bimodal()
+	: ctrs_(1 << BITS, 1)
+	{
+	}
+
+	const char* name() const override { return "bimodal"; }
+
+protected:
+	bool predict(uint64_t pc) override { return ctrs_[idx(pc)] >= 2; }
+	void update(uint64_t pc, bool taken) override { train2(ctrs_[idx(pc)], taken); }
+
+private:
+	static uint32_t idx(uint64_t pc) { return (pc >> 1) & ((1 << BITS) - 1); }
+
+	std::vector<uint8_t> ctrs_;
+};
+
+class Gshare : public BranchPredictor
+{
+public:
+	static constexpr uint32_t BITS = 14; ///< (of table index and global history)
+
+	Gshare()
+	: ctrs_(1 << BITS, 1)
+	{
+	}
+
+	const char* name() const override { return "gshare"; }
+
+protected:
+	bool predict(uint64_t pc) override { return ctrs_[idx(pc)] >= 2; }
+
+	void update(uint64_t pc, bool taken) override
+	{
+		train2(ctrs_[idx(pc)], taken);
+		hist_ = ((hist_ << 1) | taken) & ((1 << BITS) - 1);
+	}
+
+private:
+	uint32_t idx(uint64_t pc) const { return ((pc >> 1) ^ hist_) & ((1 << BITS) - 1); }
+
+	std::vector<uint8_t> ctrs_;
+	uint32_t hist_ = 0;
+};
+
+/// TAGE with a bimodal base, four tagged tables, no loop predictor or alternate use tuning
+class TageLite : public BranchPredictor
+{
+public:
+	static constexpr uint32_t BASE_BITS = 13;
+	static constexpr uint32_t NUM_TABLES = 4;
+	static constexpr uint32_t TABLE_BITS = 10;
+	static constexpr uint32_t TAG_BITS = 9;
+	static constexpr uint32_t HIST_SZ = 256; ///< (power of 2, past the longest history)
+	static constexpr uint64_t U_RESET = 256 * 1024; ///< branches between halvings of usefulness
+
+	TageLite()
+	: base_(1 << BASE_BITS, 1)
+	{
+		static const uint32_t HIST_LEN[NUM_TABLES] = {5, 15, 44, 130};
+		for (uint32_t i = 0; i < NUM_TABLES; ++i)
+		{
+			tables_[i].resize(1 << TABLE_BITS);
+			idx_fold_[i].init(HIST_LEN[i], TABLE_BITS);
+			tag_fold_[i][0].init(HIST_LEN[i], TAG_BITS);
+			tag_fold_[i][1].init(HIST_LEN[i], TAG_BITS - 1);
+		}
+	}
+
+	const char* name() const override { return "tage"; }
+
+protected:
+	bool predict(uint64_t pc) override;
+	void update(uint64_t pc, bool taken) override;
+
+private: // types
+	struct Entry
+	{
+		uint16_t tag = 0;
+		int8_t ctr = 0; ///< 3 bits, taken if >= 0
+		uint8_t u = 0; ///< 2 bits of usefulness
+	};
+
+	/// global history, newest first
+	struct History
+	{
+		uint8_t bits[HIST_SZ] = {0,};
+		uint32_t head = 0;
+
+		void push(bool b)
+		{
+			head = (head + 1) & (HIST_SZ - 1);
+			bits[head] = b;
+		}
+
+		uint32_t bit(uint32_t age) const { return bits[(head - age) & (HIST_SZ - 1)]; }
+	};
+
+	/// the last 'olen' history bits folded (xor) into 'clen' bits, kept up to date one bit at a time
+	struct Folded
+	{
+		uint32_t comp = 0;
+		uint32_t clen = 0;
+		uint32_t olen = 0;
+
+		void init(uint32_t o, uint32_t c)
+		{
+			olen = o;
+			clen = c;
+		}
+
+		/// (after a push to 'h', which took bit 'olen' out of the window)
+		void update(const History &h)
+		{
+			comp = (comp << 1) | h.bit(0);
+			comp ^= h.bit(olen) << (olen % clen);
+			comp ^= comp >> clen;
+			comp &= (1u << clen) - 1;
+		}
+	};
+
+private: // data
+	std::vector<uint8_t> base_;
+	std::vector<Entry> tables_[NUM_TABLES]; ///< by increasing history length
+	History hist_;
+	Folded idx_fold_[NUM_TABLES];
+	Folded tag_fold_[NUM_TABLES][2];
+	uint64_t updates_ = 0;
+
+	// from predict() for update()
+	uint32_t idx_[NUM_TABLES] = {0,};
+	uint16_t tag_[NUM_TABLES] = {0,};
+	int provider_ = -1; ///< longest matching table
+	bool pred_ = false;
+	bool alt_pred_ = false; ///< of the next longest match (or the base)
+};
+
+bool TageLite::predict(uint64_t pc)
+{
+	const uint64_t p = pc >> 1;
+	for (uint32_t i = 0; i < NUM_TABLES; ++i)
+	{
+		idx_[i] = (p ^ (p >> TABLE_BITS) ^ idx_fold_[i].comp) & ((1 << TABLE_BITS) - 1);
+		tag_[i] = (p ^ tag_fold_[i][0].comp ^ (tag_fold_[i][1].comp << 1)) & ((1 << TAG_BITS) - 1);
+	}
+
+	provider_ = -1;
+	int alt = -1;
+	for (int i = NUM_TABLES - 1; i >= 0 && alt < 0; --i)
+	{
+		if (tables_[i][idx_[i]].tag != tag_[i])
+			continue;
+		if (provider_ < 0)
+			provider_ = i;
+		else
+			alt = i;
+	}
+
+	const bool base_pred = base_[p & ((1 << BASE_BITS) - 1)] >= 2;
+	alt_pred_ = alt >= 0 ? tables_[alt][idx_[alt]].ctr >= 0 : base_pred;
+	pred_ = provider_ >= 0 ? tables_[provider_][idx_[provider_]].ctr >= 0 : base_pred;
+	return pred_;
+}
+
+void TageLite::update(uint64_t pc, bool taken)
+{
+	if (provider_ >= 0)
+	{
+		Entry &e = tables_[provider_][idx_[provider_]];
+		if (pred_ != alt_pred_)
+		{
+			if (pred_ == taken)
+				e.u += e.u < 3;
+			else
+				e.u -= e.u > 0;
+		}
+		if (taken)
+			e.ctr += e.ctr < 3;
+		else
+			e.ctr -= e.ctr > -4;
+	}
+	else
+		train2(base_[(pc >> 1) & ((1 << BASE_BITS) - 1)], taken);
+
+	// on a misprediction, take a longer history entry which is not useful (or age them)
+	if (pred_ != taken && provider_ < int(NUM_TABLES) - 1)
+	{
+		bool taken_entry = false;
+		for (uint32_t i = provider_ + 1; i < NUM_TABLES && !taken_entry; ++i)
+		{
+			Entry &e = tables_[i][idx_[i]];
+			if (e.u == 0)
+			{
+				e.tag = tag_[i];
+				e.ctr = taken ? 0 : -1;
+				taken_entry = true;
+			}
+		}
+		for (uint32_t i = provider_ + 1; i < NUM_TABLES && !taken_entry; ++i)
+			tables_[i][idx_[i]].u--;
+	}
+
+	if (++updates_ % U_RESET == 0)
+	{
+		for (std::vector<Entry> &t : tables_)
+		{
+			for (Entry &e : t)
+				e.u >>= 1;
+		}
+	}
+
+	hist_.push(taken);
+	for (uint32_t i = 0; i < NUM_TABLES; ++i)
+	{
+		idx_fold_[i].update(hist_);
+		tag_fold_[i][0].update(hist_);
+		tag_fold_[i][1].update(hist_);
+	}
+}
+}
+
+namespace rvfun
+{
+void BranchPredictor::report(std::ostream &os, uint64_t insts) const
+{
+	os << "Branch predictor " << name() << ": " << branches_ << " conditional branches, " << mispredicts_
+	   << " mispredicted (" << std::fixed << std::setprecision(2)
+	   << (branches_ ? 100.0 * mispredicts_ / branches_ : 0.0) << "%), "
+	   << (insts ? 1000.0 * mispredicts_ / insts : 0.0) << " MPKI" << std::defaultfloat << std::endl;
+}
+
+std::unique_ptr<BranchPredictor> makeBranchPredictor(const std::string &name)
+{
+	if (name == "bimodal")
+		return std::unique_ptr<BranchPredictor>(new Bimodal);
+	if (name == "gshare")
+		return std::unique_ptr<BranchPredictor>(new Gshare);
+	if (name == "tage")
+		return std::unique_ptr<BranchPredictor>(new TageLite);
+	return nullptr;
+}
+
+}
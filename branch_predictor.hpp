@@ -0,0 +1,49 @@
+#ifndef RVFUN_BRANCH_PREDICTOR_HPP
+#define RVFUN_BRANCH_PREDICTOR_HPP
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+namespace rvfun
+{
+/// Direction predictor for conditional branches, scored as it is trained
+class BranchPredictor
+{
+public:
+	virtual ~BranchPredictor() {}
+
+	virtual const char* name() const = 0;
+
+	/// predict the conditional branch at 'pc', then train on its outcome
+	void branch(uint64_t pc, bool taken)
+	{
+		++branches_;
+		mispredicts_ += predict(pc) != taken;
+		update(pc, taken);
+	}
+
+	uint64_t branches() const { return branches_; }
+	uint64_t mispredicts() const { return mispredicts_; }
+
+	/// print the branches, mispredictions and MPKI
+	void report(std::ostream &os, uint64_t insts) const;
+
+protected:
+	virtual bool predict(uint64_t pc) = 0;
+	/// (always right after predict() for the same branch)
+	virtual void update(uint64_t pc, bool taken) = 0;
+
+private:
+	uint64_t branches_ = 0;
+	uint64_t mispredicts_ = 0;
+};
+
+///@return "bimodal" (2 bit counters by PC), "gshare" (by PC and global history) or
+/// "tage" (a bimodal base and four tagged tables of geometric history lengths), or nullptr
+std::unique_ptr<BranchPredictor> makeBranchPredictor(const std::string &name);
+
+}
+
+#endif
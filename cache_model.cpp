@@ -0,0 +1,105 @@
+#include "cache_model.hpp"
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+namespace
+{
+bool isPow2(uint64_t v) { return v && (v & (v - 1)) == 0; }
+
+uint32_t log2(uint64_t v)
+{
+	uint32_t ret = 0;
+	while (v >>= 1)
+		++ret;
+	return ret;
+}
+
+/// parse "<n>[k|m]"
+///@return true on error
+bool parseSize(const std::string &s, uint64_t &v)
+{
+	char *end = nullptr;
+	v = strtoull(s.c_str(), &end, 10);
+	if (end == s.c_str())
+		return true;
+	if (*end == 'k' || *end == 'K')
+		v <<= 10;
+	else if (*end == 'm' || *end == 'M')
+		v <<= 20;
+	else
+		return *end != '\0';
+	return end[1] != '\0';
+}
+
+std::string sizeName(uint64_t sz)
+{
+	std::ostringstream os;
+	if (sz >= (1 << 20) && sz % (1 << 20) == 0)
+		os << (sz >> 20) << " MB";
+	else if (sz >= 1024 && sz % 1024 == 0)
+		os << (sz >> 10) << " KB";
+	else
+		os << sz << " B";
+	return os.str();
+}
+}
+
+namespace rvfun
+{
+CacheLevel::CacheLevel(const std::string &name, uint64_t size, uint32_t ways, uint32_t line_sz)
+: name_(name)
+, size_(size)
+, ways_(ways)
+, line_shift_(log2(line_sz))
+, set_mask_(size / ways / line_sz - 1)
+, tags_(size / line_sz, ~0ull)
+{
+}
+
+bool CacheHierarchy::configure(const std::string &spec)
+{
+	levels_.clear();
+	std::istringstream is(spec);
+	std::string level;
+	while (std::getline(is, level, ','))
+	{
+		std::istringstream ls(level);
+		std::string f[3];
+		uint32_t ct = 0;
+		while (ct < 3 && std::getline(ls, f[ct], ':'))
+			++ct;
+
+		uint64_t size = 0;
+		uint64_t ways = 0;
+		uint64_t line = 64;
+		if (ct < 2 || !ls.eof() || parseSize(f[0], size) || parseSize(f[1], ways) || (ct == 3 && parseSize(f[2], line)))
+			return true;
+		if (!isPow2(line) || line < 4 || ways == 0 || ways > 64 || size % (ways * line) != 0 || !isPow2(size / (ways * line)))
+			return true;
+
+		if (levels_.empty())
+		{
+			levels_.emplace_back("L1I", size, ways, line);
+			levels_.emplace_back("L1D", size, ways, line);
+			l1_shift_ = log2(line);
+		}
+		else
+			levels_.emplace_back("L" + std::to_string(levels_.size()), size, ways, line);
+	}
+	return levels_.empty();
+}
+
+void CacheHierarchy::report(std::ostream &os, uint64_t insts) const
+{
+	for (const CacheLevel &l : levels_)
+	{
+		os << "Cache " << l.name() << " (" << sizeName(l.size()) << ", " << l.ways() << " ways, " << l.lineSize()
+		   << " B lines): " << l.accesses() << " accesses, " << l.misses() << " misses (" << std::fixed
+		   << std::setprecision(2) << (l.accesses() ? 100.0 * l.misses() / l.accesses() : 0.0) << "%), "
+		   << (insts ? 1000.0 * l.misses() / insts : 0.0) << " MPKI" << std::defaultfloat << std::endl;
+	}
+}
+
+}
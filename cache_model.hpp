@@ -0,0 +1,98 @@
+#ifndef RVFUN_CACHE_MODEL_HPP
+#define RVFUN_CACHE_MODEL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace rvfun
+{
+/// One set associative cache level with LRU replacement (tags only, misses allocate)
+class CacheLevel
+{
+public:
+	CacheLevel(const std::string &name, uint64_t size, uint32_t ways, uint32_t line_sz);
+
+	///@return true on a hit (a miss fills the line, evicting the least recently used of its set)
+	bool access(uint64_t addr)
+	{
+		const uint64_t line = addr >> line_shift_;
+		uint64_t *const set = &tags_[(line & set_mask_) * ways_];
+		++accesses_;
+		if (set[0] == line)
+			return true;
+
+		// (ways are kept most recently used first)
+		uint32_t w = 1;
+		while (w < ways_ && set[w] != line)
+			++w;
+		const bool hit = w < ways_;
+		if (!hit)
+		{
+			++misses_;
+			w = ways_ - 1;
+		}
+		memmove(set + 1, set, w * sizeof(uint64_t));
+		set[0] = line;
+		return hit;
+	}
+
+	const std::string& name() const { return name_; }
+	uint64_t size() const { return size_; }
+	uint32_t ways() const { return ways_; }
+	uint32_t lineSize() const { return 1u << line_shift_; }
+	uint64_t accesses() const { return accesses_; }
+	uint64_t misses() const { return misses_; }
+
+private:
+	std::string name_;
+	uint64_t size_;
+	uint32_t ways_;
+	uint32_t line_shift_;
+	uint64_t set_mask_;
+	std::vector<uint64_t> tags_; ///< line numbers, by set then way
+	uint64_t accesses_ = 0;
+	uint64_t misses_ = 0;
+};
+
+/// Split L1 instruction and data caches in front of unified outer levels.
+/// Each access goes out a level for as long as it misses.
+class CacheHierarchy
+{
+public:
+	/// set up levels from 'spec': "<size>:<ways>[:<line>],..." from L1 (split) out, sizes in
+	/// bytes with an optional k or m (for example "32k:8,1m:16"), lines 64 bytes by default
+	///@return true if 'spec' is bad
+	bool configure(const std::string &spec);
+
+	void fetch(uint64_t pc, uint32_t sz) { access(0, pc, sz); }
+	void data(uint64_t ea, uint32_t sz) { access(1, ea, sz); }
+
+	/// print the accesses, misses and MPKI of each level
+	void report(std::ostream &os, uint64_t insts) const;
+
+private: // methods
+	/// access the L1 lines of [addr, addr+sz) at levels_[l1] (L1I or L1D)
+	void access(uint32_t l1, uint64_t addr, uint32_t sz)
+	{
+		const uint64_t last = (addr + (sz ? sz - 1 : 0)) >> l1_shift_;
+		for (uint64_t line = addr >> l1_shift_; line <= last; ++line)
+		{
+			const uint64_t a = line << l1_shift_;
+			if (levels_[l1].access(a))
+				continue;
+			for (size_t i = 2; i < levels_.size() && !levels_[i].access(a); ++i)
+				;
+		}
+	}
+
+private: // data
+	std::vector<CacheLevel> levels_; ///< L1I, L1D, L2...
+	uint32_t l1_shift_ = 6;
+};
+
+}
+
+#endif
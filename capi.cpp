@@ -0,0 +1,293 @@
+#include "rvfun.h"
+#include "block_cache.hpp"
+#include "csr_file.hpp"
+#include "decode_cache.hpp"
+#include "fast_arch_state.hpp"
+#include "fast_forward.hpp"
+#include "host_system.hpp"
+#include "inst.hpp"
+#include "sparse_mem.hpp"
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+struct rvfun_sim
+{
+	std::ostream null_os{nullptr}; ///< (outlives 'host', which may report on it)
+	rvfun::HostSystem host;
+	rvfun::FastState state;
+	rvfun::BlockCache bcache; ///< runs with no break or watch points
+	rvfun::DecodeCache dcache; ///< steps checking them
+	rvfun::CodeCache *active = nullptr; ///< the one 'state' invalidates
+	std::unordered_set<uint64_t> breaks;
+	std::vector<std::pair<uint64_t, uint64_t>> watches; ///< [first, last] bytes
+	std::vector<rvfun::Inst::MemRange> accesses; ///< (of the instruction checked)
+	uint64_t icount = 0;
+	bool loaded = false;
+};
+
+namespace
+{
+using namespace rvfun;
+
+/// make 'cc' the code cache of 'sim->state' (its decodes may be stale from before)
+void useCache(rvfun_sim *sim, CodeCache *cc)
+{
+	if (sim->active == cc)
+		return;
+	cc->flush();
+	sim->state.setCodeCache(cc);
+	sim->active = cc;
+}
+
+bool returnedToShell(const rvfun_sim *sim)
+{
+	return (sim->state.getPc() & -63ll) == 0;
+}
+
+///@return true if 'inst' accesses a watched address (the start of that access put in 'ea')
+bool watched(rvfun_sim *sim, const Inst &inst, uint64_t &ea)
+{
+	sim->accesses.clear();
+	inst.memRanges(sim->state, sim->accesses);
+	for (const Inst::MemRange &r : sim->accesses)
+	{
+		const uint64_t last = r.va + (r.sz ? r.sz - 1 : 0);
+		for (const auto &w : sim->watches)
+		{
+			if (r.va <= w.second && w.first <= last)
+			{
+				ea = r.va;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/// execute one instruction at a time, checking the break and watch points (from the second)
+uint64_t step(rvfun_sim *sim, uint64_t max_insts, rvfun_result &res)
+{
+	useCache(sim, &sim->dcache);
+	uint64_t ct = 0;
+	while ((max_insts == 0 || ct < max_insts) && !sim->host.hadExit() && !returnedToShell(sim))
+	{
+		if (ct != 0 && sim->breaks.count(sim->state.getPc()))
+		{
+			res.reason = RVFUN_STOP_BREAKPOINT;
+			break;
+		}
+
+		uint32_t opc_sz = 2;
+		uint32_t full_inst = 0;
+		Inst *const inst = sim->dcache.decode(sim->state, opc_sz, full_inst, false);
+		if (!inst)
+			sim->state.incPc(opc_sz); // (like the driver)
+		else
+		{
+			uint64_t ea = 0;
+			if (ct != 0 && !sim->watches.empty() && watched(sim, *inst, ea))
+			{
+				res.reason = RVFUN_STOP_WATCHPOINT;
+				res.addr = ea;
+				break;
+			}
+			inst->execute(sim->state);
+		}
+		sim->state.retire(1);
+		++ct;
+	}
+	return ct;
+}
+}
+
+uint32_t rvfun_api_version(void)
+{
+	return RVFUN_API_VERSION;
+}
+
+// (no exceptions may leave these, any one is a failure)
+
+rvfun_sim* rvfun_create(uint32_t flags)
+{
+	rvfun_sim *sim = nullptr;
+	try
+	{
+		sim = new rvfun_sim;
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+
+	sim->state.setSys(&sim->host);
+	sim->state.setMem(sim->host.getSparseMem());
+	if (flags & RVFUN_QUIET)
+		sim->host.setLog(&sim->null_os, &sim->null_os);
+	return sim;
+}
+
+void rvfun_destroy(rvfun_sim *sim)
+{
+	delete sim;
+}
+
+int rvfun_load(rvfun_sim *sim, const char *elf, int argc, const char *const *argv)
+{
+	try
+	{
+		if (sim->loaded || !elf || sim->host.loadElf(elf, sim->state))
+			return 1;
+
+		for (int i = 0; i < argc; ++i)
+			sim->host.addArg(argv[i]);
+		sim->host.setStdin(std::string(elf) + ".stdin");
+		sim->host.completeEnv(sim->state);
+	}
+	catch (...)
+	{
+		return 1;
+	}
+	sim->loaded = true;
+	return 0;
+}
+
+int rvfun_restore(rvfun_sim *sim, const char *path)
+{
+	try
+	{
+		if (sim->loaded || !path || sim->host.restoreCheckpoint(path, sim->state, sim->icount))
+			return 1;
+	}
+	catch (...)
+	{
+		return 1;
+	}
+	sim->loaded = true;
+	return 0;
+}
+
+void rvfun_run(rvfun_sim *sim, uint64_t max_insts, rvfun_result *result)
+{
+	rvfun_result res = rvfun_result();
+	res.reason = RVFUN_STOP_COUNT;
+	const uint64_t start = sim->state.getCr(CsrFile::INSTRET);
+	try
+	{
+		if (!sim->loaded)
+			res.reason = RVFUN_STOP_ERROR;
+		else if (sim->breaks.empty() && sim->watches.empty())
+		{
+			useCache(sim, &sim->bcache);
+			res.icount = fastForward(sim->state, sim->bcache, sim->host, max_insts);
+		}
+		else
+			res.icount = step(sim, max_insts, res);
+	}
+	catch (...)
+	{
+		res.reason = RVFUN_STOP_ERROR;
+		res.icount = sim->state.getCr(CsrFile::INSTRET) - start; // (those retired before the failure)
+	}
+
+	if (res.reason == RVFUN_STOP_COUNT && sim->host.hadExit())
+		res.reason = RVFUN_STOP_EXIT;
+	else if (res.reason == RVFUN_STOP_COUNT && sim->loaded && returnedToShell(sim))
+		res.reason = RVFUN_STOP_RETURN;
+
+	sim->icount += res.icount;
+	res.pc = sim->state.getPc();
+	*result = res;
+}
+
+int rvfun_add_breakpoint(rvfun_sim *sim, uint64_t pc)
+{
+	try
+	{
+		return sim->breaks.insert(pc).second ? 0 : 1;
+	}
+	catch (...)
+	{
+		return -1;
+	}
+}
+
+int rvfun_remove_breakpoint(rvfun_sim *sim, uint64_t pc)
+{
+	return sim->breaks.erase(pc) ? 0 : 1;
+}
+
+int rvfun_add_watchpoint(rvfun_sim *sim, uint64_t addr, uint64_t len)
+{
+	try
+	{
+		if (len)
+			sim->watches.emplace_back(addr, addr + len - 1);
+	}
+	catch (...)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+void rvfun_clear_points(rvfun_sim *sim)
+{
+	sim->breaks.clear();
+	sim->watches.clear();
+}
+
+uint64_t rvfun_icount(const rvfun_sim *sim)
+{
+	return sim->icount;
+}
+
+uint64_t rvfun_exit_status(const rvfun_sim *sim)
+{
+	return sim->host.exitStatus();
+}
+
+uint64_t rvfun_get_reg(const rvfun_sim *sim, uint32_t num)
+{
+	return num < 32 ? sim->state.getReg(num) : 0;
+}
+
+void rvfun_set_reg(rvfun_sim *sim, uint32_t num, uint64_t val)
+{
+	if (num < 32)
+		sim->state.setReg(num, val);
+}
+
+uint64_t rvfun_get_pc(const rvfun_sim *sim)
+{
+	return sim->state.getPc();
+}
+
+void rvfun_set_pc(rvfun_sim *sim, uint64_t pc)
+{
+	sim->state.setPc(pc);
+}
+
+uint64_t rvfun_read_mem(rvfun_sim *sim, uint64_t va, void *buf, uint64_t len)
+{
+	return sim->host.getSparseMem()->readBlock(va, len, buf);
+}
+
+uint64_t rvfun_write_mem(rvfun_sim *sim, uint64_t va, const void *buf, uint64_t len)
+{
+	const uint64_t ret = sim->host.getSparseMem()->writeBlock(va, len, buf);
+	if (sim->active)
+	{
+		try
+		{
+			sim->active->invalidate(va, len);
+		}
+		catch (...)
+		{
+			sim->active->flush(); // (drops all the decodes instead)
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef RVFUN_CODE_CACHE_HPP
+#define RVFUN_CODE_CACHE_HPP
+
+#include <cstdint>
+
+namespace rvfun
+{
+/// Interface to anything holding decoded copies of memory
+class CodeCache
+{
+public:
+	virtual ~CodeCache() = default;
+
+	/// drop any instruction which overlaps [va, va+sz)
+	virtual void invalidate(uint64_t va, uint64_t sz) = 0;
+
+	/// drop all instructions
+	virtual void flush() = 0;
+};
+
+}
+
+#endif
+
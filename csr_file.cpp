@@ -0,0 +1,13 @@
+#include "csr_file.hpp"
+#include "arch_state.hpp"
+
+namespace rvfun
+{
+CsrFile::CsrFile()
+: regs_{0,}
+{
+	regs_[VLENB] = ArchState::VLEN_BYTES;
+}
+
+}
+
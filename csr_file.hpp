@@ -0,0 +1,98 @@
+#ifndef RVFUN_CSR_FILE_HPP
+#define RVFUN_CSR_FILE_HPP
+
+#include <cstdint>
+
+namespace rvfun
+{
+/// Control and Status Registers, one flat slot per CSR number.
+/// fflags and frm are views of fcsr (and vxsat and vxrm of vcsr); cycle, time and instret (and their
+/// machine aliases) read the count of retired instructions (one instruction per cycle and per time tick).
+/// vlenb is read only.
+class CsrFile
+{
+public:
+	enum : uint16_t
+	{
+		FFLAGS = 1,
+		FRM = 2,
+		FCSR = 3,
+		VSTART = 8,
+		VXSAT = 9,
+		VXRM = 0xa,
+		VCSR = 0xf,
+		MCYCLE = 0xb00,
+		MINSTRET = 0xb02,
+		CYCLE = 0xc00,
+		TIME = 0xc01,
+		INSTRET = 0xc02,
+		VL = 0xc20,
+		VTYPE = 0xc21,
+		VLENB = 0xc22,
+		NUM_CSRS = 4096
+	};
+
+	CsrFile();
+
+	uint64_t get(uint32_t csr) const
+	{
+		csr &= NUM_CSRS - 1;
+		switch (csr)
+		{
+		case FFLAGS: return regs_[FCSR] & 0x1f; // bits[4:0]
+		case FRM: return (regs_[FCSR] >> 5) & 7; // bits[7:5]
+		case VXSAT: return regs_[VCSR] & 1; // bit[0]
+		case VXRM: return (regs_[VCSR] >> 1) & 3; // bits[2:1]
+		case MCYCLE:
+		case MINSTRET:
+		case CYCLE:
+		case TIME:
+		case INSTRET:
+			return instret_;
+		}
+		return regs_[csr];
+	}
+
+	/// (writing a counter sets the retired count, e.g. for checkpoints)
+	void set(uint32_t csr, uint64_t val)
+	{
+		csr &= NUM_CSRS - 1;
+		switch (csr)
+		{
+		case FFLAGS:
+			regs_[FCSR] = (regs_[FCSR] & ~uint64_t(0x1f)) | (val & 0x1f);
+			return;
+		case FRM:
+			regs_[FCSR] = (regs_[FCSR] & ~uint64_t(0xe0)) | ((val & 7) << 5);
+			return;
+		case VXSAT:
+			regs_[VCSR] = (regs_[VCSR] & ~uint64_t(1)) | (val & 1);
+			return;
+		case VXRM:
+			regs_[VCSR] = (regs_[VCSR] & ~uint64_t(6)) | ((val & 3) << 1);
+			return;
+		case VLENB:
+			return;
+		case MCYCLE:
+		case MINSTRET:
+		case CYCLE:
+		case TIME:
+		case INSTRET:
+			instret_ = val;
+			return;
+		}
+		regs_[csr] = val;
+	}
+
+	/// count 'n' retired instructions
+	void retire(uint64_t n) { instret_ += n; }
+
+private: // data
+	uint64_t regs_[NUM_CSRS];
+	uint64_t instret_ = 0;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,142 @@
+#include "decode_cache.hpp"
+#include "arch_state.hpp"
+#include "inst.hpp"
+#include <algorithm>
+
+namespace
+{
+constexpr uint32_t PAGE_SHIFT = 12;
+constexpr uint64_t PAGE_SIZE = uint64_t(1) << PAGE_SHIFT;
+constexpr uint32_t SLOTS_PER_PAGE = PAGE_SIZE / 2; // instructions are 2B aligned
+constexpr uint64_t MIN_RECLAIM = 4096; // stale instructions before the arena is recycled
+}
+
+namespace rvfun
+{
+struct DecodeCache::Entry
+{
+	Inst *inst = nullptr; ///< null for illegal instructions (owned by arena)
+	uint32_t full_inst = 0;
+	uint8_t opc_sz = 0; ///< zero for empty slot
+};
+
+struct DecodeCache::Page
+{
+	Entry slots[SLOTS_PER_PAGE];
+};
+
+DecodeCache::DecodeCache()
+{
+}
+
+DecodeCache::~DecodeCache()
+{
+}
+
+DecodeCache::Page* DecodeCache::findPage(uint64_t page_num) const
+{
+	auto i = pages_.find(page_num);
+	if (i == pages_.end())
+		return nullptr;
+
+	return i->second.get();
+}
+
+void DecodeCache::reclaim()
+{
+	pages_.clear();
+	arena_.clear();
+	last_page_ = nullptr;
+	code_lo_ = uint64_t(-1);
+	code_hi_ = 0;
+	stale_ = 0;
+	flush_pending_ = false;
+}
+
+Inst* DecodeCache::decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug)
+{
+	// the previously returned instruction is done now
+	if (flush_pending_)
+		reclaim();
+
+	const uint64_t pc = state.getPc();
+	const uint64_t page_num = pc >> PAGE_SHIFT;
+
+	Page *page = last_page_;
+	if (!page || page_num != last_page_num_)
+	{
+		page = findPage(page_num);
+		if (!page)
+		{
+			page = new Page;
+			pages_[page_num].reset(page);
+		}
+		last_page_num_ = page_num;
+		last_page_ = page;
+	}
+
+	Entry &e = page->slots[(pc & (PAGE_SIZE - 1)) >> 1];
+	if (e.opc_sz != 0)
+	{
+		++hits_;
+		opc_sz = e.opc_sz;
+		full_inst = e.full_inst;
+		if (debug || !e.inst)
+			printDecode(state.getSys(), pc, full_inst, opc_sz, e.inst, debug);
+		return e.inst;
+	}
+
+	++misses_;
+	e.inst = rvfun::decode(state, opc_sz, full_inst, debug, arena_);
+	e.full_inst = full_inst;
+	e.opc_sz = opc_sz;
+
+	if (pc < code_lo_)
+		code_lo_ = pc;
+	if (pc + opc_sz > code_hi_)
+		code_hi_ = pc + opc_sz;
+
+	return e.inst;
+}
+
+void DecodeCache::invalidate(uint64_t va, uint64_t sz)
+{
+	// cheap filter for data accesses
+	if (va >= code_hi_ || va + sz <= code_lo_)
+		return;
+
+	// a 4B instruction at va-2 overlaps va (and nothing is cached outside the code range)
+	const uint64_t begin = std::max(va < 2 ? 0 : va - 2, code_lo_);
+	const uint64_t end = std::min(va + sz, code_hi_);
+	for (uint64_t pc = begin & ~uint64_t(1); pc < end; pc += 2)
+	{
+		const uint64_t page_num = pc >> PAGE_SHIFT;
+		Page *const page = page_num == last_page_num_ ? last_page_ : findPage(page_num);
+		if (!page)
+		{
+			// skip to next page
+			pc = ((page_num + 1) << PAGE_SHIFT) - 2;
+			continue;
+		}
+
+		// the instruction may be executing, leave it in the arena
+		Entry &e = page->slots[(pc & (PAGE_SIZE - 1)) >> 1];
+		if (e.inst)
+			++stale_;
+		e.inst = nullptr;
+		e.opc_sz = 0;
+	}
+
+	// recycle the arena once it is mostly garbage
+	if (stale_ >= MIN_RECLAIM && stale_ * 2 >= arena_.size())
+		flush_pending_ = true;
+}
+
+void DecodeCache::flush()
+{
+	// the last instruction may be executing, free everything on the next decode
+	flush_pending_ = true;
+}
+
+}
+
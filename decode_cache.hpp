@@ -0,0 +1,57 @@
+#ifndef RVFUN_DECODE_CACHE_HPP
+#define RVFUN_DECODE_CACHE_HPP
+
+#include "code_cache.hpp"
+#include "inst_arena.hpp"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+namespace rvfun
+{
+class ArchState;
+class Inst;
+
+/// Cache of decoded instructions, indexed by PC
+class DecodeCache : public CodeCache
+{
+public:
+	DecodeCache();
+	~DecodeCache();
+
+	/// same contract as decode(), but 'Inst' stays owned by the cache
+	/// (valid until the next call, even if invalidated)
+	Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug);
+
+	//---from CodeCache
+	void invalidate(uint64_t va, uint64_t sz) override;
+	void flush() override;
+
+	uint64_t hits() const { return hits_; }
+	uint64_t misses() const { return misses_; }
+
+private: // types
+	struct Entry;
+	struct Page;
+
+private: // methods
+	Page* findPage(uint64_t page_num) const;
+	void reclaim();
+
+private: // data
+	InstArena arena_;
+	std::unordered_map<uint64_t, std::unique_ptr<Page>> pages_;
+	uint64_t last_page_num_ = 0;
+	Page *last_page_ = nullptr; ///< fast path for straight line code
+	uint64_t code_lo_ = uint64_t(-1); ///< lowest cached address
+	uint64_t code_hi_ = 0; ///< highest cached address (exclusive)
+	uint64_t stale_ = 0; ///< invalidated instructions still in the arena
+	bool flush_pending_ = false; ///< free everything on the next decode
+	uint64_t hits_ = 0;
+	uint64_t misses_ = 0;
+};
+
+}
+
+#endif
+
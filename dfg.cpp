@@ -1,10 +1,21 @@
 #include "inst.hpp"
+#include "inst_arena.hpp"
+#include "trace.hpp"
+#include <elf.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <map>
 #include <string>
-#include <sstream>
+#include <vector>
 
 class DotPrinter
 {
@@ -16,122 +27,481 @@ public:
 	}
 
 	void setPrint() { do_print_ = true; }
+	bool printing() const { return do_print_; }
 
 	void start()
 	{
 		if (do_print_)
 		{
+			f_.rdbuf()->pubsetbuf(buf_, sizeof(buf_));
 			f_.open("dfg.dot");
-			f_ << "strict digraph {" << std::endl;
+			f_ << "strict digraph {\n";
 		}
 	}
 
-	void print(uint32_t node, const std::string &label)
+	void print(uint64_t node, const std::string &label)
 	{
 		if (do_print_)
 		{
-			f_ << node << " [label =\"" << label << "\"]" << std::endl;
+			f_ << node << " [label =\"" << label << "\"]\n";
 		}
 	}
 
-	void printEdge(uint32_t p, uint32_t c)
+	void printEdge(uint64_t p, uint64_t c)
 	{
 		if (do_print_)
-			f_ << p << " -> " << c << std::endl;
+			f_ << p << " -> " << c << '\n';
 	}
 
 private:
 	std::ofstream f_;
+	char buf_[64 * 1024];
 	bool do_print_ = false;
 };
 
-int main(int argc, char **argv)
+/// Hex opcodes, one per line
+class TextSource
 {
-	if (argc == 1)
+public:
+	///@return true on error
+	bool open(const char *path)
 	{
-		std::cerr << "Usage: " << argv[0] << " [-p] [-f opcode_file] [elf_file]" << std::endl;
-		std::cerr << "-p to print the dataflow graph to dfg.dot" << std::endl;
-		return 1;
+		f_ = std::fopen(path, "r");
+		return f_ == nullptr;
 	}
 
-	DotPrinter dp;
-	const char *op_file = nullptr;
-	const char *optstring = "+f:p";
-	int optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
-	while (optc != -1)
+	~TextSource()
+	{
+		if (f_)
+			std::fclose(f_);
+	}
+
+	bool next(uint32_t &opc)
 	{
-		if (optc == 'f')
+		char line[256];
+		if (!std::fgets(line, sizeof(line), f_))
+			return false;
+		opc = std::strtoul(line, nullptr, 16);
+		return true;
+	}
+
+private:
+	std::FILE *f_ = nullptr;
+};
+
+/// Opcodes of an ELF section (by default .text, or the executable segments if there is no .text)
+class ElfSource
+{
+public:
+	~ElfSource()
+	{
+		if (mem_)
+			::munmap(mem_, size_);
+	}
+
+	///@param section nullptr for the default
+	///@return true on error
+	bool open(const char *path, const char *section)
+	{
+		const int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return true;
+		struct stat s;
+		if (::fstat(fd, &s) < 0 || size_t(s.st_size) < sizeof(Elf64_Ehdr))
 		{
-			op_file = optarg;
+			::close(fd);
+			return true;
 		}
-		else if (optc == 'p')
+		size_ = s.st_size;
+		void *const mem = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (mem == MAP_FAILED)
+			return true;
+		mem_ = static_cast<uint8_t*>(mem);
+
+		const Elf64_Ehdr *const eh = reinterpret_cast<const Elf64_Ehdr*>(mem_);
+		if (std::memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64)
+			return true;
+
+		// named section
+		const char *const name = section ? section : ".text";
+		if (eh->e_shnum != 0 && eh->e_shstrndx < eh->e_shnum && eh->e_shentsize == sizeof(Elf64_Shdr) &&
+		    inFile(eh->e_shoff, uint64_t(eh->e_shnum) * sizeof(Elf64_Shdr)))
 		{
-			dp.setPrint();
+			const Elf64_Shdr *const sh = reinterpret_cast<const Elf64_Shdr*>(mem_ + eh->e_shoff);
+			const Elf64_Shdr &strs = sh[eh->e_shstrndx];
+			const bool strs_ok = inFile(strs.sh_offset, strs.sh_size);
+			for (Elf64_Half i = 0; i < eh->e_shnum; ++i)
+			{
+				if (!strs_ok || sh[i].sh_type != SHT_PROGBITS || sh[i].sh_name >= strs.sh_size)
+					continue;
+
+				// (the name must end inside the string table)
+				const char *const sh_name = reinterpret_cast<const char*>(mem_ + strs.sh_offset + sh[i].sh_name);
+				const size_t max_len = strs.sh_size - sh[i].sh_name;
+				if (strnlen(sh_name, max_len) < max_len && std::strcmp(sh_name, name) == 0)
+					addRange(sh[i].sh_offset, sh[i].sh_size);
+			}
 		}
-		optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+		if (ranges_.empty() && section)
+		{
+			std::cerr << "No section " << section << " in " << path << std::endl;
+			return true;
+		}
+
+		// else executable segments
+		if (ranges_.empty() && eh->e_phentsize >= sizeof(Elf64_Phdr) &&
+		    inFile(eh->e_phoff, uint64_t(eh->e_phnum) * eh->e_phentsize))
+		{
+			for (Elf64_Half i = 0; i < eh->e_phnum; ++i)
+			{
+				const Elf64_Phdr *const ph = reinterpret_cast<const Elf64_Phdr*>(mem_ + eh->e_phoff + eh->e_phentsize * i);
+				if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X))
+					addRange(ph->p_offset, ph->p_filesz);
+			}
+		}
+		return ranges_.empty();
 	}
 
-	if (!op_file)
+	bool next(uint32_t &opc)
 	{
-		// TODO support ELF
-		std::cout << "Only support file right now" << std::endl;
-		return 1;
+		while (cur_ < ranges_.size())
+		{
+			const Range &r = ranges_[cur_];
+			if (pos_ + 2 <= r.end)
+			{
+				opc = mem_[pos_] | (mem_[pos_ + 1] << 8);
+				if ((opc & 3) != 3)
+				{
+					pos_ += 2;
+					return true;
+				}
+				if (pos_ + 4 <= r.end)
+				{
+					opc |= (mem_[pos_ + 2] << 16) | (uint32_t(mem_[pos_ + 3]) << 24);
+					pos_ += 4;
+					return true;
+				}
+			}
+			if (++cur_ < ranges_.size())
+				pos_ = ranges_[cur_].begin;
+		}
+		return false;
+	}
+
+private:
+	struct Range
+	{
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	///@return true if [off, off+sz) is inside the file
+	bool inFile(uint64_t off, uint64_t sz) const { return off <= size_ && sz <= size_ - off; }
+
+	void addRange(uint64_t off, uint64_t sz)
+	{
+		if (!inFile(off, sz))
+			return;
+		if (ranges_.empty())
+			pos_ = off;
+		ranges_.push_back(Range{off, off + sz});
+	}
+
+	std::vector<Range> ranges_;
+	size_t cur_ = 0; ///< index in 'ranges_'
+	uint64_t pos_ = 0; ///< file offset in 'ranges_[cur_]'
+	uint8_t *mem_ = nullptr;
+	size_t size_ = 0;
+};
+
+/// Retired instructions from a driver.exe -T trace
+class TraceSource
+{
+public:
+	///@return true on error
+	bool open(const char *path) { return reader_.open(path); }
+
+	bool next(uint32_t &opc)
+	{
+		rvfun::TraceRecord r;
+		if (!reader_.next(r))
+			return false;
+		opc = r.opcode;
+		return true;
+	}
+
+	bool ok() const { return reader_.ok(); }
+
+private:
+	rvfun::TraceReader reader_;
+};
+
+/// Streaming critical path and ILP of the register dataflow (memory dependencies are ignored).
+/// Each window size W models a machine with W instructions in flight: an instruction can't
+/// start before the one W older has finished.
+class PathAnalyzer
+{
+public:
+	static constexpr uint32_t NUM_OP_TYPES = rvfun::Inst::OT_SYSTEM + 1;
+
+	PathAnalyzer()
+	{
+		// default latencies (cycles)
+		for (uint32_t &l : latency_)
+			l = 1;
+		latency_[rvfun::Inst::OT_MUL] = 3;
+		latency_[rvfun::Inst::OT_DIV] = 20;
+		latency_[rvfun::Inst::OT_FP] = 4;
+		latency_[rvfun::Inst::OT_LOAD] = 3;
+		latency_[rvfun::Inst::OT_LOAD_FP] = 3;
+		latency_[rvfun::Inst::OT_LOAD_VEC] = 3;
+		latency_[rvfun::Inst::OT_ATOMIC] = 10;
+	}
+
+	/// parse "type=cycles[,type=cycles...]"
+	///@return true on error
+	bool setLatencies(const std::string &spec)
+	{
+		size_t pos = 0;
+		while (pos < spec.size())
+		{
+			size_t end = spec.find(',', pos);
+			if (end == std::string::npos)
+				end = spec.size();
+			const std::string item = spec.substr(pos, end - pos);
+			const size_t eq = item.find('=');
+			if (eq == std::string::npos)
+				return true;
+			const std::string name = item.substr(0, eq);
+			uint32_t ot = 0;
+			while (ot < NUM_OP_TYPES && name != rvfun::opTypeName(rvfun::Inst::OpType(ot)))
+				++ot;
+			if (ot == NUM_OP_TYPES)
+				return true;
+			latency_[ot] = std::strtoul(item.c_str() + eq + 1, nullptr, 10);
+			pos = end + 1;
+		}
+		return false;
+	}
+
+	void addWindow(uint32_t sz)
+	{
+		if (sz != 0)
+			windows_.emplace_back(sz);
+	}
+
+	void add(const rvfun::Inst &inst)
+	{
+		const uint32_t ot = inst.opType();
+		const uint32_t lat = latency_[ot];
+		++count_;
+
+		uint32_t srcs[rvfun::Inst::RegDeps::MAX_DEPS];
+		uint32_t num_srcs = 0;
+		for (const auto &rd : inst.srcs())
+		{
+			const uint32_t r = regIdx(rd);
+			if (r != NO_REG)
+				srcs[num_srcs++] = r;
+		}
+		uint32_t dsts[rvfun::Inst::RegDeps::MAX_DEPS];
+		uint32_t num_dsts = 0;
+		for (const auto &rd : inst.dsts())
+		{
+			const uint32_t r = regIdx(rd);
+			if (r != NO_REG)
+				dsts[num_dsts++] = r;
+		}
+
+		// unbounded machine, unit and weighted latency
+		uint64_t depth = 0;
+		uint32_t crit = NO_REG; // source on the weighted critical path
+		uint64_t ready = 0;
+		for (uint32_t i = 0; i < num_srcs; ++i)
+		{
+			depth = std::max(depth, depth_[srcs[i]]);
+			if (crit == NO_REG || time_[srcs[i]] > ready)
+			{
+				ready = time_[srcs[i]];
+				crit = srcs[i];
+			}
+		}
+		++depth;
+		const uint64_t done = ready + lat;
+		max_depth_ = std::max(max_depth_, depth);
+
+		Chain chain;
+		if (crit != NO_REG)
+			chain = chains_[crit];
+		++chain.count[ot];
+		if (done > max_time_)
+		{
+			max_time_ = done;
+			crit_chain_ = chain;
+		}
+		for (uint32_t i = 0; i < num_dsts; ++i)
+		{
+			depth_[dsts[i]] = depth;
+			time_[dsts[i]] = done;
+			chains_[dsts[i]] = chain;
+		}
+
+		// windowed machines
+		for (Window &w : windows_)
+		{
+			uint64_t start = w.ring[w.pos]; // finish of the instruction 'size' older
+			for (uint32_t i = 0; i < num_srcs; ++i)
+				start = std::max(start, w.time[srcs[i]]);
+			const uint64_t fin = start + lat;
+			w.ring[w.pos] = fin;
+			if (++w.pos == w.ring.size())
+				w.pos = 0;
+			w.max_time = std::max(w.max_time, fin);
+			for (uint32_t i = 0; i < num_dsts; ++i)
+				w.time[dsts[i]] = fin;
+		}
 	}
 
-	// open the file
-	std::fstream ifile(op_file);
-	dp.start();
+	void report(std::ostream &os) const
+	{
+		os << "Critical path: " << max_depth_ << " instructions";
+		if (max_depth_)
+			os << ", ILP " << double(count_) / max_depth_;
+		os << '\n';
+		os << "Latency weighted critical path: " << max_time_ << " cycles";
+		if (max_time_)
+			os << ", IPC " << double(count_) / max_time_;
+		os << '\n';
+		for (const Window &w : windows_)
+		{
+			os << "Window " << w.ring.size() << ": " << w.max_time << " cycles";
+			if (w.max_time)
+				os << ", IPC " << double(count_) / w.max_time;
+			os << '\n';
+		}
 
-	std::map<uint32_t, uint32_t> prod_int;
-	std::map<uint32_t, uint32_t> prod_fp;
+		os << "Weighted critical path by type (latency, instructions, cycles):\n";
+		for (uint32_t ot = 0; ot < NUM_OP_TYPES; ++ot)
+		{
+			const uint64_t n = crit_chain_.count[ot];
+			if (n == 0)
+				continue;
+			const uint64_t cycles = n * latency_[ot];
+			os << std::setw(10) << rvfun::opTypeName(rvfun::Inst::OpType(ot)) << std::setw(4) << latency_[ot]
+			   << std::setw(14) << n << std::setw(14) << cycles << std::fixed << std::setprecision(2)
+			   << std::setw(8) << (max_time_ ? 100.0 * cycles / max_time_ : 0.0) << '%'
+			   << std::defaultfloat << '\n';
+		}
+	}
+
+private:
+	static constexpr uint32_t NO_REG = ~0u;
+	static constexpr uint32_t NUM_REGS = 96; ///< integer, FP then vector
+
+	/// instructions by type on a dependency chain
+	struct Chain
+	{
+		uint64_t count[NUM_OP_TYPES] = {0,};
+	};
+
+	struct Window
+	{
+		explicit Window(uint32_t sz) : ring(sz, 0) {}
+
+		std::vector<uint64_t> ring; ///< finish times of the last 'size' instructions
+		size_t pos = 0; ///< oldest in 'ring'
+		uint64_t time[NUM_REGS] = {0,}; ///< when each register is ready
+		uint64_t max_time = 0;
+	};
+
+	static uint32_t regIdx(const rvfun::Inst::RegDep &rd)
+	{
+		const uint32_t rn = uint32_t(rd.reg) & 0x1f;
+		if (rd.rf == rvfun::Inst::RegFile::INT)
+			return rn == 0 ? NO_REG : rn; // (x0 carries no dependency)
+		if (rd.rf == rvfun::Inst::RegFile::FLOAT)
+			return 32 + rn;
+		if (rd.rf == rvfun::Inst::RegFile::VECTOR)
+			return 64 + rn;
+		return NO_REG;
+	}
+
+	uint32_t latency_[NUM_OP_TYPES];
+	uint64_t depth_[NUM_REGS] = {0,}; ///< chain length to each register
+	uint64_t time_[NUM_REGS] = {0,}; ///< when each register is ready
+	Chain chains_[NUM_REGS]; ///< weighted critical chain to each register
+	Chain crit_chain_;
+	std::vector<Window> windows_;
+	uint64_t count_ = 0;
+	uint64_t max_depth_ = 0;
+	uint64_t max_time_ = 0;
+};
+
+/// Builds the dataflow graph of the instructions from 'src'
+template<class Source>
+uint64_t analyze(Source &src, DotPrinter &dp, PathAnalyzer *paths, bool quiet)
+{
+	// last producer of each register (0 for none)
+	uint64_t prod_int[32] = {0,};
+	uint64_t prod_fp[32] = {0,};
+	uint64_t prod_vec[32] = {0,};
+	rvfun::InstArena arena;
 
-	//foreach line in the file
 	uint64_t icount = 0;
-	std::string line;
-	while (std::getline(ifile, line))
+	uint64_t edges = 0;
+	uint64_t illegal = 0;
+	uint32_t opc = 0;
+	while (src.next(opc))
 	{
 		++icount;
 
-		// pull opcode from hex string
-		std::istringstream is(line);
-		uint32_t opc = 0;
-		is >> std::hex >> opc;
-
-		// decode
+		// decode (reusing the last instruction's storage)
+		arena.clear();
 		bool is_compressed = false;
 		rvfun::Inst *inst = nullptr;
 		if ((opc & 3) == 3)
 		{
-			inst = rvfun::decode32(opc);
+			inst = rvfun::decode32(opc, arena);
 		}
 		else
 		{
-			inst = rvfun::decode16(opc);
+			inst = rvfun::decode16(opc, arena);
 			is_compressed = true;
 		}
 
 		if (!inst)
 		{
-			std::cout << "No decode for " << std::hex << opc << std::dec << std::endl;
+			++illegal;
+			if (!quiet)
+				std::cout << "No decode for " << std::hex << opc << std::dec << '\n';
 			continue;
 		}
 		//else
-		std::cout << icount << '\t';
-		if (!is_compressed) std::cout << ' ' << ' ';
-		const std::string disasm = inst->disasm();
-		std::ostringstream los;
-		los << icount << ' ' << disasm;
-		std::string label(los.str());
-		std::cout << disasm;
+		if (paths)
+			paths->add(*inst);
+
+		std::string label;
+		if (!quiet || dp.printing())
+		{
+			const std::string disasm = inst->disasm();
+			label = std::to_string(icount) + ' ' + disasm;
+			if (!quiet)
+			{
+				std::cout << icount << '\t';
+				if (!is_compressed) std::cout << ' ' << ' ';
+				std::cout << disasm;
+			}
+		}
 
 		// pull producers for sources
 		bool first = true;
-		std::vector<rvfun::Inst::RegDep> srcs = inst->srcs();
+		const rvfun::Inst::RegDeps srcs = inst->srcs();
 		for (const auto &rd : srcs)
 		{
-			const uint32_t rn = uint32_t(rd.reg);
+			const uint32_t rn = uint32_t(rd.reg) & 0x1f;
 
-			uint32_t srci = 0;
+			uint64_t srci = 0;
 			if (rd.rf == rvfun::Inst::RegFile::INT)
 			{
 				srci = prod_int[rn];
@@ -140,32 +510,43 @@ int main(int argc, char **argv)
 			{
 				srci = prod_fp[rn];
 			}
+			else if (rd.rf == rvfun::Inst::RegFile::VECTOR)
+			{
+				srci = prod_vec[rn];
+			}
 
 			if (srci != 0)
 			{
 				if (first)
 				{
 					dp.print(icount, label);
-					std::cout << '\t' << '[';
+					if (!quiet)
+						std::cout << '\t' << '[';
 				}
-				else
+				else if (!quiet)
 				{
 					std::cout << ',';
 				}
-				std::cout << srci;
+				if (!quiet)
+					std::cout << srci;
 				first = false;
 				dp.printEdge(srci, icount);
+				++edges;
 			}
 		}
-		if (!first) std::cout << ']';
-		else dp.print(icount, label);
-		std::cout << std::endl;
+		if (first)
+			dp.print(icount, label);
+		if (!quiet)
+		{
+			if (!first) std::cout << ']';
+			std::cout << '\n';
+		}
 
 		// update dests with this instruction as producer
-		std::vector<rvfun::Inst::RegDep> dsts = inst->dsts();
+		const rvfun::Inst::RegDeps dsts = inst->dsts();
 		for (const auto &rd : dsts)
 		{
-			const uint32_t rn = uint32_t(rd.reg);
+			const uint32_t rn = uint32_t(rd.reg) & 0x1f;
 
 			if (rd.rf == rvfun::Inst::RegFile::INT)
 			{
@@ -175,9 +556,151 @@ int main(int argc, char **argv)
 			{
 				prod_fp[rn] = icount;
 			}
+			else if (rd.rf == rvfun::Inst::RegFile::VECTOR)
+			{
+				prod_vec[rn] = icount;
+			}
 		}
 	}
 
-	return 0;
+	std::cout << "Analyzed " << icount << " instructions, " << edges << " dependencies";
+	if (illegal)
+		std::cout << ", " << illegal << " with no decode";
+	std::cout << '.' << std::endl;
+	if (paths)
+		paths->report(std::cout);
+	return icount;
 }
 
+int main(int argc, char **argv)
+{
+	if (argc == 1)
+	{
+		std::cerr << "Usage: " << argv[0] << " [-p] [-q] [-a] [-L latencies] [-w windows]"
+		          << " [-f opcode_file | -t trace_file | [-S section] elf_file]" << std::endl;
+		std::cerr << "-p to print the dataflow graph to dfg.dot" << std::endl;
+		std::cerr << "-q to only print the summary" << std::endl;
+		std::cerr << "-f hex opcodes, one per line" << std::endl;
+		std::cerr << "-t binary trace from driver.exe -T (in execution order)" << std::endl;
+		std::cerr << "-S ELF section to decode (default .text, or the executable segments)" << std::endl;
+		std::cerr << "-a to print the critical path and ILP (register dependencies)" << std::endl;
+		std::cerr << "-L latencies for -a, as type=cycles,... (types: alu, shift, mul, div, fp, load, ...)" << std::endl;
+		std::cerr << "-w window sizes for -a, as n,... (default 64,128,256)" << std::endl;
+		return 1;
+	}
+
+	std::ios::sync_with_stdio(false);
+
+	DotPrinter dp;
+	const char *op_file = nullptr;
+	const char *trace_file = nullptr;
+	const char *section = nullptr;
+	bool quiet = false;
+	bool analyze_paths = false;
+	const char *latencies = nullptr;
+	std::string windows = "64,128,256";
+	const char *optstring = "+af:L:pqS:t:w:";
+	int optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	while (optc != -1)
+	{
+		if (optc == 'a')
+		{
+			analyze_paths = true;
+		}
+		else if (optc == 'f')
+		{
+			op_file = optarg;
+		}
+		else if (optc == 'L')
+		{
+			latencies = optarg;
+		}
+		else if (optc == 'p')
+		{
+			dp.setPrint();
+		}
+		else if (optc == 'q')
+		{
+			quiet = true;
+		}
+		else if (optc == 'S')
+		{
+			section = optarg;
+		}
+		else if (optc == 't')
+		{
+			trace_file = optarg;
+		}
+		else if (optc == 'w')
+		{
+			windows = optarg;
+		}
+		optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	}
+
+	PathAnalyzer path_analyzer;
+	PathAnalyzer *const paths = analyze_paths ? &path_analyzer : nullptr;
+	if (latencies && path_analyzer.setLatencies(latencies))
+	{
+		std::cerr << "Bad latencies " << latencies << std::endl;
+		return 1;
+	}
+	for (const char *w = windows.c_str(); *w;)
+	{
+		char *end = nullptr;
+		const uint32_t sz = std::strtoul(w, &end, 10);
+		if (end == w || (*end != ',' && *end != 0))
+		{
+			std::cerr << "Bad window sizes " << windows << std::endl;
+			return 1;
+		}
+		path_analyzer.addWindow(sz);
+		w = *end ? end + 1 : end;
+	}
+
+	if (op_file)
+	{
+		TextSource src;
+		if (src.open(op_file))
+		{
+			std::cerr << "Failure opening " << op_file << std::endl;
+			return 1;
+		}
+		dp.start();
+		analyze(src, dp, paths, quiet);
+	}
+	else if (trace_file)
+	{
+		TraceSource src;
+		if (src.open(trace_file))
+		{
+			std::cerr << "Failure opening trace " << trace_file << std::endl;
+			return 1;
+		}
+		dp.start();
+		analyze(src, dp, paths, quiet);
+		if (!src.ok())
+		{
+			std::cerr << "Bad record in " << trace_file << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		if (optind >= argc)
+		{
+			std::cerr << "Missing ELF file." << std::endl;
+			return 1;
+		}
+		ElfSource src;
+		if (src.open(argv[optind], section))
+		{
+			std::cerr << "Failure loading code from ELF " << argv[optind] << std::endl;
+			return 1;
+		}
+		dp.start();
+		analyze(src, dp, paths, quiet);
+	}
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+#ifndef RVFUN_FAST_ARCH_STATE_HPP
+#define RVFUN_FAST_ARCH_STATE_HPP
+
+#include "arch_state.hpp"
+#include "code_cache.hpp"
+#include "csr_file.hpp"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace rvfun
+{
+/// Implementation of ArchState specialized at compile time.
+/// Memory calls bind statically to 'Mem' (which can inline its fast path),
+/// and debug printing is compiled out unless DEBUG is set.
+/// Instructions executed via Inst::execute(FastState&) bind statically to this.
+template<class Mem, bool DEBUG = false>
+class FastArchState final : public ArchState
+{
+public:
+	void setMem(Mem *mem) { mem_ = mem; }
+	void setSys(System *sys) { sys_ = sys; }
+
+	/// writes to memory will invalidate stale decodes in 'cc'
+	void setCodeCache(CodeCache *cc) { ccache_ = cc; }
+
+	/// integer registers, for translated code (which must leave register 0 zero)
+	uint64_t* intRegs() { return ireg; }
+
+	//---from ArchState
+	uint64_t getReg(uint32_t num) const override
+	{
+		return num == 0 ? 0 : ireg[num];
+	}
+
+	void setReg(uint32_t num, uint64_t val) override
+	{
+		if (num == 0)
+			return; // no-op
+
+		ireg[num] = val;
+		if (DEBUG)
+			std::cout << " setReg " << num << ' ' << std::hex << val << std::dec << ' ';
+	}
+
+	float getFloat(uint32_t num) const override
+	{
+		if ((freg[num] >> 32) != 0xffffffff) // not NAN boxed
+			return nanf("");
+
+		const uint32_t bits = uint32_t(freg[num]);
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	void setFloat(uint32_t num, float val) override
+	{
+		uint32_t bits;
+		memcpy(&bits, &val, sizeof(bits));
+		freg[num] = 0xffffffff00000000ull | bits; // NAN box
+
+		if (DEBUG)
+			std::cout << " setFloat " << num << ' ' << val << ' ';
+	}
+
+	double getDouble(uint32_t num) const override
+	{
+		double d;
+		memcpy(&d, &freg[num], sizeof(d));
+		return d;
+	}
+
+	void setDouble(uint32_t num, double val) override
+	{
+		memcpy(&freg[num], &val, sizeof(val));
+
+		if (DEBUG)
+			std::cout << " setFloat " << num << ' ' << val << ' ';
+	}
+
+	uint64_t getFpRaw(uint32_t num) const override { return freg[num]; }
+	void setFpRaw(uint32_t num, uint64_t val) override
+	{
+		freg[num] = val;
+	}
+
+	uint8_t* getVecReg(uint32_t num) override { return vreg + num * VLEN_BYTES; }
+	const uint8_t* getVecReg(uint32_t num) const override { return vreg + num * VLEN_BYTES; }
+
+	uint64_t getCr(uint32_t num) const override { return cregs_.get(num); }
+	void     setCr(uint32_t num, uint64_t val) override { cregs_.set(num, val); }
+	void retire(uint64_t n) override { cregs_.retire(n); }
+
+	uint64_t readImem(uint64_t va, uint32_t sz) const override
+	{
+		return mem_->Mem::readMem(va, sz);
+	}
+
+	uint64_t readMem(uint64_t va, uint32_t sz) const override
+	{
+		const uint64_t val = mem_->Mem::readMem(va, sz);
+		if (DEBUG)
+			std::cout << " readMem " << std::hex << va << ' ' << sz << ' ' << val << std::dec;
+		return val;
+	}
+
+	void writeMem(uint64_t va, uint32_t sz, uint64_t val) override
+	{
+		if (DEBUG)
+			std::cout << " writeMem " << std::hex << va << ' ' << sz << ' ' << val << std::dec;
+		mem_->Mem::writeMem(va, sz, val);
+		if (ccache_)
+			ccache_->invalidate(va, sz);
+	}
+
+	uint64_t readBlock(uint64_t va, uint64_t sz, void *dst) const override
+	{
+		if (DEBUG)
+			std::cout << " readBlock " << std::hex << va << ' ' << sz << std::dec;
+		return mem_->Mem::readBlock(va, sz, dst);
+	}
+
+	uint64_t writeBlock(uint64_t va, uint64_t sz, const void *src) override
+	{
+		if (DEBUG)
+			std::cout << " writeBlock " << std::hex << va << ' ' << sz << std::dec;
+		const uint64_t ret = mem_->Mem::writeBlock(va, sz, src);
+		if (ccache_)
+			ccache_->invalidate(va, sz);
+		return ret;
+	}
+
+	const uint8_t* hostPtr(uint64_t va, uint64_t sz) const override
+	{
+		return mem_->Mem::hostPtr(va, sz);
+	}
+
+	bool compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val) override
+	{
+		const bool ret = mem_->Mem::compareExchange(va, sz, expected, val);
+		if (DEBUG)
+			std::cout << " compareExchange " << std::hex << va << ' ' << sz << ' ' << expected << ' ' << val << std::dec << ' ' << ret;
+		if (ret && ccache_)
+			ccache_->invalidate(va, sz);
+		return ret;
+	}
+
+	uint64_t loadReserved(uint64_t va, uint32_t sz) override
+	{
+		resv_val_ = readMem(va, sz);
+		resv_va_ = va;
+		resv_sz_ = sz;
+		return resv_val_;
+	}
+
+	bool storeConditional(uint64_t va, uint32_t sz, uint64_t val) override
+	{
+		const bool match = resv_va_ == va && resv_sz_ == sz;
+		resv_va_ = uint64_t(-1);
+		return match && compareExchange(va, sz, resv_val_, val);
+	}
+
+	void incPc(int64_t delta) override
+	{
+		pc_ += delta;
+	}
+
+	uint64_t getPc() const override
+	{
+		return pc_;
+	}
+
+	void setPc(uint64_t pc) override
+	{
+		pc_ = pc;
+	}
+
+	void invalidateCode(uint64_t va, uint64_t sz) override
+	{
+		if (ccache_)
+			ccache_->invalidate(va, sz);
+	}
+
+	System* getSys() override { return sys_; }
+	const System* getSys() const override { return sys_; }
+
+private: // data
+	static constexpr uint32_t NUM_REGS = 32;
+	uint64_t pc_ = 0;
+	uint64_t ireg[NUM_REGS] = {0,};
+	uint64_t freg[NUM_REGS] = {0,}; // store raw bits for NAN boxing
+	alignas(16) uint8_t vreg[NUM_REGS * VLEN_BYTES] = {0,};
+	CsrFile cregs_;
+	Mem *mem_ = nullptr;
+	System *sys_ = nullptr;
+	CodeCache *ccache_ = nullptr;
+	// LR/SC reservation (SC compares against the value LR saw)
+	uint64_t resv_va_ = uint64_t(-1); ///< all ones for none
+	uint64_t resv_val_ = 0;
+	uint32_t resv_sz_ = 0;
+};
+
+}
+
+#endif
+
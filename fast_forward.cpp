@@ -0,0 +1,20 @@
+#include "fast_forward.hpp"
+#include "block_cache.hpp"
+#include "fast_arch_state.hpp"
+#include "host_system.hpp"
+
+namespace rvfun
+{
+uint64_t fastForward(FastState &state, BlockCache &bcache, const HostSystem &host, uint64_t max_insts)
+{
+	uint64_t icount = 0;
+	while (!host.hadExit() && (state.getPc() & -63ll) != 0)
+	{
+		icount += bcache.runBlocks(state, max_insts ? max_insts - icount : 0);
+		if (max_insts != 0 && icount >= max_insts)
+			break;
+	}
+	return icount;
+}
+
+}
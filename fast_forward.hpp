@@ -0,0 +1,21 @@
+#ifndef RVFUN_FAST_FORWARD_HPP
+#define RVFUN_FAST_FORWARD_HPP
+
+#include "inst.hpp"
+#include <cstdint>
+
+namespace rvfun
+{
+class BlockCache;
+class HostSystem;
+
+/// Run the program in 'state' (whose code cache must be 'bcache') with no tracing,
+/// until 'max_insts' (0 for no limit), exit, or return to the shell.
+/// Exit is only checked after system instructions, and the limit at block boundaries.
+///@return number of instructions executed
+uint64_t fastForward(FastState &state, BlockCache &bcache, const HostSystem &host, uint64_t max_insts = 0);
+
+}
+
+#endif
+
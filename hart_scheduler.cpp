@@ -0,0 +1,438 @@
+#include "hart_scheduler.hpp"
+#include "arch_state.hpp"
+#include "block_cache.hpp"
+#include "host_system.hpp"
+#include "simple_arch_state.hpp"
+#include "sparse_mem_view.hpp"
+#include <linux/futex.h>
+#include <sched.h>
+#include <algorithm>
+#include <cerrno>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace
+{
+using namespace rvfun;
+
+/// Records a system call, for the scheduler to perform once all harts are stopped
+class DeferredSystem : public System
+{
+public:
+	typedef void (System::*Call)(ArchState&);
+
+	bool pending() const { return call_ != nullptr; }
+
+	///@return the recorded call (and clear it)
+	Call take()
+	{
+		const Call c = call_;
+		call_ = nullptr;
+		return c;
+	}
+
+	//---from System
+	void exit(ArchState&) override { call_ = &System::exit; }
+	void exitGroup(ArchState&) override { call_ = &System::exitGroup; }
+	void fstat(ArchState&) override { call_ = &System::fstat; }
+	void mmap(ArchState&) override { call_ = &System::mmap; }
+	void munmap(ArchState&) override { call_ = &System::munmap; }
+	void mprotect(ArchState&) override { call_ = &System::mprotect; }
+	void open(ArchState&) override { call_ = &System::open; }
+	void readlinkat(ArchState&) override { call_ = &System::readlinkat; }
+	void sbrk(ArchState&) override { call_ = &System::sbrk; }
+	void seek(ArchState&) override { call_ = &System::seek; }
+	void uname(ArchState&) override { call_ = &System::uname; }
+	void read(ArchState&) override { call_ = &System::read; }
+	void write(ArchState&) override { call_ = &System::write; }
+	void writev(ArchState&) override { call_ = &System::writev; }
+	void fsync(ArchState&) override { call_ = &System::fsync; }
+	void clone(ArchState&) override { call_ = &System::clone; }
+	void futex(ArchState&) override { call_ = &System::futex; }
+	void gettid(ArchState&) override { call_ = &System::gettid; }
+	void setTidAddress(ArchState&) override { call_ = &System::setTidAddress; }
+	/// (kept until the slice ends, harts run in parallel)
+	std::ostream& err() override { return err_; }
+
+	/// move the messages of the slice to 'os'
+	void takeErr(std::ostream &os)
+	{
+		if (err_.tellp() > 0)
+			os << err_.str();
+		err_.str(std::string());
+	}
+
+private:
+	Call call_ = nullptr;
+	std::ostringstream err_;
+};
+
+/// Invalidates a hart's code cache, and remembers the pages written for the other harts' caches
+class WriteLog : public CodeCache
+{
+public:
+	static constexpr uint32_t PAGE_SHIFT = 12;
+
+	explicit WriteLog(CodeCache &cache)
+	: cache_(cache)
+	{
+	}
+
+	/// written page ranges, [first, last] page numbers
+	const std::vector<std::pair<uint64_t, uint64_t>>& pages() const { return pages_; }
+	void clear() { pages_.clear(); }
+
+	//---from CodeCache
+	void invalidate(uint64_t va, uint64_t sz) override
+	{
+		cache_.invalidate(va, sz);
+		if (sz == 0)
+			return;
+
+		// (stores mostly hit the last range)
+		const uint64_t first = va >> PAGE_SHIFT;
+		const uint64_t last = (va + sz - 1) >> PAGE_SHIFT;
+		if (!pages_.empty() && first <= pages_.back().second + 1 && pages_.back().first <= last + 1)
+		{
+			pages_.back().first = std::min(pages_.back().first, first);
+			pages_.back().second = std::max(pages_.back().second, last);
+		}
+		else
+			pages_.emplace_back(first, last);
+	}
+
+	void flush() override { cache_.flush(); }
+
+private:
+	CodeCache &cache_;
+	std::vector<std::pair<uint64_t, uint64_t>> pages_;
+};
+}
+
+namespace rvfun
+{
+struct HartScheduler::Hart
+{
+	enum Status
+	{
+		RUNNABLE,
+		WAITING, ///< on a futex
+		EXITED
+	};
+
+	explicit Hart(SparseMem &mem)
+	: view(mem)
+	, written(bcache)
+	{
+	}
+
+	SimpleArchState state;
+	SparseMemView view; ///< this hart's path to memory
+	BlockCache bcache; ///< (other harts' writes are invalidated after each slice)
+	WriteLog written; ///< the code cache of 'state'
+	DeferredSystem sys;
+	uint32_t tid = 0;
+	Status status = RUNNABLE;
+	uint64_t futex_addr = 0; ///< when WAITING
+	bool has_timeout = false; ///< when WAITING
+	uint64_t clear_tid = 0; ///< zeroed (and woken) on exit
+	uint64_t slice = 0; ///< instructions executed in the last slice
+	uint64_t icount = 0;
+	bool returned = false; ///< returned from _start
+};
+
+HartScheduler::HartScheduler(HostSystem &host, uint32_t num_threads, uint64_t quantum)
+: host_(host)
+, pool_(num_threads)
+, quantum_(quantum)
+{
+	host_.getSparseMem()->setShared();
+}
+
+HartScheduler::~HartScheduler()
+{
+	host_.getSparseMem()->setShared(false);
+}
+
+HartScheduler::Hart* HartScheduler::newHart(const SimpleArchState &init)
+{
+	std::unique_ptr<Hart> h(new Hart(*host_.getSparseMem()));
+	h->state = init;
+	h->state.setMem(&h->view);
+	h->state.setSys(&h->sys);
+	h->state.setCodeCache(&h->written);
+	h->tid = next_tid_++;
+
+	Hart *const ret = h.get();
+	harts_.emplace_back(std::move(h));
+	return ret;
+}
+
+void HartScheduler::addHart(const SimpleArchState &init)
+{
+	newHart(init);
+}
+
+void HartScheduler::runSlice(Hart &h, uint64_t quantum)
+{
+	uint64_t ct = 0;
+	while (ct < quantum)
+	{
+		if ((h.state.getPc() & -63ll) == 0)
+		{
+			h.returned = true;
+			h.status = Hart::EXITED;
+			break;
+		}
+
+		ct += h.bcache.execute(h.state, quantum - ct);
+
+		// system calls wait for the other harts
+		if (h.sys.pending())
+			break;
+	}
+	h.slice = ct;
+}
+
+uint64_t HartScheduler::run(uint64_t max_insts)
+{
+	std::vector<Hart*> runnable;
+	while (!host_.hadExit() && !returned_)
+	{
+		runnable.clear();
+		for (const auto &h : harts_)
+		{
+			if (h->status == Hart::RUNNABLE)
+				runnable.push_back(h.get());
+		}
+
+		if (runnable.empty())
+		{
+			if (timeoutWaiters())
+				continue;
+
+			host_.err() << "All harts are blocked." << std::endl;
+			break;
+		}
+
+		uint64_t quantum = quantum_;
+		if (max_insts != 0)
+		{
+			if (icount_ >= max_insts)
+				break;
+
+			// split what is left
+			const uint64_t share = (max_insts - icount_ + runnable.size() - 1) / runnable.size();
+			quantum = std::min(quantum, share);
+		}
+
+		pool_.parallelFor(runnable.size(), [&](uint32_t i) { runSlice(*runnable[i], quantum); });
+
+		for (Hart *h : runnable)
+		{
+			icount_ += h->slice;
+			h->icount += h->slice;
+			h->sys.takeErr(host_.err());
+			if (h->returned)
+				returned_ = true;
+		}
+
+		// system calls, in hart order
+		for (Hart *h : runnable)
+		{
+			if (!h->sys.pending())
+				continue;
+
+			cur_ = h;
+			const DeferredSystem::Call call = h->sys.take();
+			(this->*call)(h->state);
+			cur_ = nullptr;
+
+			if (host_.hadExit())
+				break;
+		}
+
+		// blocks may have been added (or moved)
+		for (const auto &h : harts_)
+		{
+			h->view.flush();
+			h->state.flushTlb();
+		}
+
+		// code written by one hart is stale in the others
+		for (const auto &h : harts_)
+		{
+			for (const auto &p : h->written.pages())
+			{
+				const uint64_t va = p.first << WriteLog::PAGE_SHIFT;
+				const uint64_t sz = (p.second - p.first + 1) << WriteLog::PAGE_SHIFT;
+				for (const auto &other : harts_)
+				{
+					if (other != h)
+						other->bcache.invalidate(va, sz);
+				}
+			}
+			h->written.clear();
+		}
+	}
+	return icount_;
+}
+
+uint32_t HartScheduler::futexWake(uint64_t addr, uint32_t ct)
+{
+	uint32_t woken = 0;
+	for (const auto &h : harts_)
+	{
+		if (woken == ct)
+			break;
+
+		if (h->status == Hart::WAITING && h->futex_addr == addr)
+		{
+			h->status = Hart::RUNNABLE;
+			++woken;
+		}
+	}
+	return woken;
+}
+
+bool HartScheduler::timeoutWaiters()
+{
+	bool woke = false;
+	for (const auto &h : harts_)
+	{
+		if (h->status == Hart::WAITING && h->has_timeout)
+		{
+			h->status = Hart::RUNNABLE;
+			h->state.setReg(10, -ETIMEDOUT);
+			woke = true;
+		}
+	}
+	return woke;
+}
+
+void HartScheduler::exit(ArchState &state)
+{
+	Hart &h = *cur_;
+	if (h.clear_tid)
+	{
+		state.writeMem(h.clear_tid, 4, 0);
+		futexWake(h.clear_tid, 1);
+	}
+	h.status = Hart::EXITED;
+
+	// last one out ends the program
+	for (const auto &o : harts_)
+	{
+		if (o->status != Hart::EXITED)
+			return;
+	}
+	host_.exit(state);
+}
+
+void HartScheduler::exitGroup(ArchState &state)
+{
+	for (const auto &h : harts_)
+		h->status = Hart::EXITED;
+
+	host_.exit(state);
+}
+
+void HartScheduler::fstat(ArchState &state) { host_.fstat(state); }
+void HartScheduler::mmap(ArchState &state) { host_.mmap(state); }
+void HartScheduler::munmap(ArchState &state) { host_.munmap(state); }
+void HartScheduler::mprotect(ArchState &state) { host_.mprotect(state); }
+void HartScheduler::open(ArchState &state) { host_.open(state); }
+void HartScheduler::readlinkat(ArchState &state) { host_.readlinkat(state); }
+void HartScheduler::sbrk(ArchState &state) { host_.sbrk(state); }
+void HartScheduler::seek(ArchState &state) { host_.seek(state); }
+void HartScheduler::uname(ArchState &state) { host_.uname(state); }
+void HartScheduler::read(ArchState &state) { host_.read(state); }
+void HartScheduler::write(ArchState &state) { host_.write(state); }
+void HartScheduler::writev(ArchState &state) { host_.writev(state); }
+void HartScheduler::fsync(ArchState &state) { host_.fsync(state); }
+
+void HartScheduler::clone(ArchState &state)
+{
+	const uint64_t flags = state.getReg(10);
+	const uint64_t new_sp = state.getReg(11);
+	const uint64_t ptid = state.getReg(12);
+	const uint64_t tls = state.getReg(13);
+	const uint64_t ctid = state.getReg(14);
+
+	if ((flags & CLONE_VM) == 0)
+	{
+		host_.err() << " clone without CLONE_VM (fork) is not supported";
+		state.setReg(10, -ENOSYS);
+		return;
+	}
+
+	// child resumes after the ecall, like the parent
+	Hart *const child = newHart(cur_->state);
+	child->state.setReg(10, 0);
+	if (new_sp)
+		child->state.setReg(Reg::SP, new_sp);
+	if (flags & CLONE_SETTLS)
+		child->state.setReg(Reg::TP, tls);
+	if (flags & CLONE_CHILD_CLEARTID)
+		child->clear_tid = ctid;
+
+	if (flags & CLONE_PARENT_SETTID)
+		state.writeMem(ptid, 4, child->tid);
+	if (flags & CLONE_CHILD_SETTID)
+		state.writeMem(ctid, 4, child->tid);
+
+	state.setReg(10, child->tid);
+}
+
+void HartScheduler::futex(ArchState &state)
+{
+	const uint64_t addr = state.getReg(10);
+	const uint64_t op = state.getReg(11) & FUTEX_CMD_MASK;
+	const uint32_t val = state.getReg(12);
+	const uint64_t timeout = state.getReg(13);
+
+	switch (op)
+	{
+	case FUTEX_WAIT:
+	case FUTEX_WAIT_BITSET: // (bits ignored)
+		if (uint32_t(state.readMem(addr, 4)) != val)
+		{
+			state.setReg(10, -EAGAIN);
+			return;
+		}
+		cur_->status = Hart::WAITING;
+		cur_->futex_addr = addr;
+		cur_->has_timeout = timeout != 0;
+		state.setReg(10, 0); // result when woken
+		return;
+
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+		state.setReg(10, futexWake(addr, val));
+		return;
+	}
+
+	host_.err() << " futex op " << op << " is not supported";
+	state.setReg(10, -ENOSYS);
+}
+
+std::ostream& HartScheduler::err()
+{
+	return host_.err();
+}
+
+void HartScheduler::gettid(ArchState &state)
+{
+	state.setReg(10, cur_->tid);
+}
+
+void HartScheduler::setTidAddress(ArchState &state)
+{
+	cur_->clear_tid = state.getReg(10);
+	state.setReg(10, cur_->tid);
+}
+
+}
+
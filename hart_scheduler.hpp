@@ -0,0 +1,92 @@
+#ifndef RVFUN_HART_SCHEDULER_HPP
+#define RVFUN_HART_SCHEDULER_HPP
+
+#include "system.hpp"
+#include "thread_pool.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace rvfun
+{
+class HostSystem;
+class SimpleArchState;
+
+/// Runs several harts (guest threads) sharing one memory image.
+/// Harts execute in parallel on a host thread pool, for up to 'quantum'
+/// instructions or until they make a system call. System calls are then
+/// performed in hart order, with all harts stopped (so HostSystem and the
+/// memory map need no locking). Code written by one hart is invalidated in
+/// the others' caches then too.
+class HartScheduler : public System
+{
+public:
+	static constexpr uint64_t DEFAULT_QUANTUM = 10000;
+
+	HartScheduler(HostSystem &host, uint32_t num_threads, uint64_t quantum = DEFAULT_QUANTUM);
+	~HartScheduler();
+
+	/// add the first hart, from a state set up by HostSystem::loadElf/completeEnv
+	void addHart(const SimpleArchState &init);
+
+	/// run until the program exits (or 'max_insts' total, 0 for no limit)
+	///@return instructions executed (by all harts)
+	uint64_t run(uint64_t max_insts = 0);
+
+	/// number of harts created
+	uint32_t numHarts() const { return harts_.size(); }
+
+	/// true if the program returned from _start (rather than calling exit)
+	bool returnedToShell() const { return returned_; }
+
+	//---from System (called with all harts stopped)
+	void exit(ArchState &state) override;
+	void exitGroup(ArchState &state) override;
+	void fstat(ArchState &state) override;
+	void mmap(ArchState &state) override;
+	void munmap(ArchState &state) override;
+	void mprotect(ArchState &state) override;
+	void open(ArchState &state) override;
+	void readlinkat(ArchState &state) override;
+	void sbrk(ArchState &state) override;
+	void seek(ArchState &state) override;
+	void uname(ArchState &state) override;
+	void read(ArchState &state) override;
+	void write(ArchState &state) override;
+	void writev(ArchState &state) override;
+	void fsync(ArchState &state) override;
+	void clone(ArchState &state) override;
+	void futex(ArchState &state) override;
+	void gettid(ArchState &state) override;
+	void setTidAddress(ArchState &state) override;
+	std::ostream& err() override;
+
+private: // types
+	struct Hart;
+
+private: // methods
+	Hart* newHart(const SimpleArchState &init);
+	void runSlice(Hart &h, uint64_t quantum);
+
+	///@return number of harts woken
+	uint32_t futexWake(uint64_t addr, uint32_t ct);
+
+	/// time out waits (used when every hart is blocked)
+	///@return true if any hart was woken
+	bool timeoutWaiters();
+
+private: // data
+	HostSystem &host_;
+	ThreadPool pool_;
+	const uint64_t quantum_;
+	std::vector<std::unique_ptr<Hart>> harts_;
+	Hart *cur_ = nullptr; ///< hart making the current system call
+	uint32_t next_tid_ = 1;
+	uint64_t icount_ = 0;
+	bool returned_ = false;
+};
+
+}
+
+#endif
+
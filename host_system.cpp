@@ -3,15 +3,25 @@
 #include "sparse_mem.hpp"
 #include <elf.h>
 #include <fcntl.h>
+#include <linux/futex.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 
 namespace
 {
+constexpr uint64_t HOST_PAGE_SIZE = 4096;
+constexpr uint32_t MAIN_TID = 1;
+constexpr uint64_t BOUNCE_SZ = 16 * 1024; ///< guest bytes copied per host call (where not contiguous)
+
 uint64_t padTo16(uint64_t begin, uint64_t alignment = 16)
 {
 	uint32_t pad = begin & (alignment - 1);
@@ -20,17 +30,173 @@ uint64_t padTo16(uint64_t begin, uint64_t alignment = 16)
 
 	return begin;
 }
+
+//--- checkpoint file
+const char CKPT_MAGIC[8] = {'R', 'v', 'F', 'u', 'n', 'C', 'k', '3'};
+constexpr uint32_t NUM_CSRS = 4096; // 12 bit CSR numbers
+constexpr uint32_t CSR_FFLAGS = 1; // (fflags and frm are fields of fcsr)
+constexpr uint32_t CSR_FRM = 2;
+constexpr uint32_t CSR_VXSAT = 9; // (vxsat and vxrm are fields of vcsr)
+constexpr uint32_t CSR_VXRM = 0xa;
+constexpr uint32_t CSR_VLENB = 0xc22; // (read only)
+constexpr uint32_t VREG_WORDS = rvfun::ArchState::VLEN_BYTES / sizeof(uint64_t);
+
+/// builds the checkpoint header (host byte order)
+class CkptWriter
+{
+public:
+	void put(uint64_t v) { buf_.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+	void put(const std::string &s)
+	{
+		put(s.size());
+		buf_.append(s);
+	}
+
+	const std::string& data() const { return buf_; }
+
+private:
+	std::string buf_;
+};
+
+/// parses the checkpoint header (any overrun clears ok())
+class CkptReader
+{
+public:
+	CkptReader(const uint8_t *p, size_t sz)
+	: p_(p)
+	, sz_(sz)
+	{
+	}
+
+	bool ok() const { return ok_; }
+
+	uint64_t get()
+	{
+		uint64_t v = 0;
+		if (sz_ - pos_ < sizeof(v))
+		{
+			ok_ = false;
+			return 0;
+		}
+		memcpy(&v, p_ + pos_, sizeof(v));
+		pos_ += sizeof(v);
+		return v;
+	}
+
+	std::string getStr()
+	{
+		const uint64_t len = get();
+		if (!ok_ || sz_ - pos_ < len)
+		{
+			ok_ = false;
+			return std::string();
+		}
+		const std::string ret(reinterpret_cast<const char*>(p_ + pos_), len);
+		pos_ += len;
+		return ret;
+	}
+
+private:
+	const uint8_t *p_;
+	size_t sz_;
+	size_t pos_ = sizeof(CKPT_MAGIC);
+	bool ok_ = true;
+};
+
+///@return true on error
+bool writeAll(int fd, const void *buf, size_t len, off_t off)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(buf);
+	while (len)
+	{
+		const ssize_t ret = ::pwrite(fd, p, len, off);
+		if (ret <= 0)
+			return true;
+
+		p += ret;
+		len -= ret;
+		off += ret;
+	}
+	return false;
+}
+
+bool allZero(const uint8_t *p, size_t len)
+{
+	return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
+}
+
+/// which host pages of [p, p+len) are resident (all of them, if that is unknown)
+class Residency
+{
+public:
+	Residency(const uint8_t *p, size_t len)
+	: page_(sysconf(_SC_PAGESIZE))
+	, first_(reinterpret_cast<uintptr_t>(p) & ~(page_ - 1))
+	, vec_((reinterpret_cast<uintptr_t>(p) + len - first_ + page_ - 1) / page_, 1)
+	{
+		if (len && mincore(reinterpret_cast<void*>(first_), vec_.size() * page_, vec_.data()) != 0)
+			std::fill(vec_.begin(), vec_.end(), 1);
+	}
+
+	///@return true if any page of [p, p+len) is resident
+	bool any(const uint8_t *p, size_t len) const
+	{
+		const uintptr_t a = reinterpret_cast<uintptr_t>(p);
+		for (uintptr_t i = (a - first_) / page_; i <= (a + len - 1 - first_) / page_; ++i)
+		{
+			if (vec_[i] & 1)
+				return true;
+		}
+		return false;
+	}
+
+private:
+	uintptr_t page_;
+	uintptr_t first_;
+	std::vector<unsigned char> vec_;
+};
+
+///@return host path of open file 'fd' (empty if unknown)
+std::string fdPath(int fd)
+{
+	std::ostringstream os;
+	os << "/proc/self/fd/" << fd;
+
+	char buf[PATH_MAX];
+	const ssize_t len = ::readlink(os.str().c_str(), buf, sizeof(buf));
+	return len > 0 ? std::string(buf, len) : std::string();
+}
 }
 
 namespace rvfun
 {
 HostSystem::HostSystem()
 : mem_(new SparseMem)
+, out_(new OutputBuffer)
 {
+	std::ostringstream os;
+	os << '.' << getpid();
+	out_suffix_ = os.str();
 }
 
 HostSystem::~HostSystem()
 {
+	// instances may come and go within one process
+	if (!exited_ && out_->flush()) // (exit() reports it otherwise)
+		*err_ << "Failed to write some guest output" << std::endl;
+	out_.reset();
+	for (const auto fd : fds_)
+	{
+		if (int32_t(fd) >= 0)
+			::close(fd);
+	}
+}
+
+void HostSystem::setLog(std::ostream *log, std::ostream *err)
+{
+	log_ = log;
+	err_ = err;
+	mem_->setErr(err);
 }
 
 ArchMem* HostSystem::getMem() { return mem_.get(); }
@@ -40,20 +206,22 @@ bool HostSystem::loadElf(const char *prog_name, ArchState &state)
 	const int ifd = ::open(prog_name, O_RDONLY);
 	if (ifd < 0)
 	{
-		std::cerr << "Failed to open " << prog_name << std::endl;
+		*err_ << "Failed to open " << prog_name << std::endl;
 		return true;
 	}
 	struct stat s;
 	if (::fstat(ifd, &s) < 0)
 	{
-		std::cerr << "Failed to stat " << prog_name << std::endl;
+		*err_ << "Failed to stat " << prog_name << std::endl;
+		::close(ifd);
 		return true;
 	}
 	const size_t file_size = s.st_size;
 	uint8_t *elf_mem = static_cast<uint8_t*>(::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, ifd, 0));
-	if (!elf_mem)
+	if (elf_mem == MAP_FAILED)
 	{
-		std::cerr << "Failed to mmap " << prog_name << std::endl;
+		*err_ << "Failed to mmap " << prog_name << std::endl;
+		::close(ifd);
 		return true;
 	}
 
@@ -64,13 +232,17 @@ bool HostSystem::loadElf(const char *prog_name, ArchState &state)
 	    eh64->e_ident[2] != 'L' ||
 	    eh64->e_ident[3] != 'F')
 	{
-		std::cerr << "Badly formed ELF " << prog_name << std::endl;
+		*err_ << "Badly formed ELF " << prog_name << std::endl;
+		::munmap(elf_mem, file_size);
+		::close(ifd);
 		return true;
 	}
 	if (eh64->e_ident[EI_CLASS] != ELFCLASS64)
 	{
 		// TODO - handle 32 bit (code 1)
-		std::cerr << "Not a 64 bit exe" << std::endl;
+		*err_ << "Not a 64 bit exe" << std::endl;
+		::munmap(elf_mem, file_size);
+		::close(ifd);
 		return true;
 	}
 	// TODO check arch for RISCV
@@ -83,7 +255,7 @@ bool HostSystem::loadElf(const char *prog_name, ArchState &state)
 
 		// copy segment to specified VA
 		const auto file_sz = phdr->p_filesz;
-		std::cout << "Load block of size " << file_sz;
+		*log_ << "Load block of size " << file_sz;
 		auto tgt_sz = file_sz; // hopefully 1:1 from file to memory
 		if (phdr->p_memsz > tgt_sz)
 			tgt_sz = phdr->p_memsz;
@@ -98,24 +270,25 @@ bool HostSystem::loadElf(const char *prog_name, ArchState &state)
 			tgt_sz += phdr->p_align - spill;
 		}
 
-		if (file_sz < tgt_sz)
+		if (map_segments_ && mapSegment(ifd, *phdr, tgt_sz))
 		{
-			// create bigger block of zeroes
-			uint8_t *block = reinterpret_cast<uint8_t*>(calloc(tgt_sz, 1));
-
-			// copy in what we have
-			memcpy(block, elf_mem + phdr->p_offset, phdr->p_filesz);
+			const uint64_t end_of_block = phdr->p_vaddr + tgt_sz - 1;
+			if (end_of_block > top_of_mem_)
+				top_of_mem_ = end_of_block;
 
-			// add it
-			mem_->addBlock(phdr->p_vaddr, tgt_sz, block);
+			*log_ << '(' << tgt_sz << " mapped)";
+		}
+		else if (file_sz < tgt_sz)
+		{
+			// reserve zero pages, copy in what we have
+			mem_->addBlock(phdr->p_vaddr, tgt_sz);
+			mem_->writeBlock(phdr->p_vaddr, phdr->p_filesz, elf_mem + phdr->p_offset);
 
 			const uint64_t end_of_block = phdr->p_vaddr + tgt_sz - 1;
 			if (end_of_block > top_of_mem_)
 				top_of_mem_ = end_of_block;
 
-			free(block);
-
-			std::cout << '(' << tgt_sz << ')';
+			*log_ << '(' << tgt_sz << ')';
 		}
 		else
 		{
@@ -126,20 +299,67 @@ bool HostSystem::loadElf(const char *prog_name, ArchState &state)
 				top_of_mem_ = end_of_block;
 		}
 
-		std::cout << " from 0x"
+		// (writable segments keep all rights, so sbrk can grow them)
+		if (!(phdr->p_flags & PF_W))
+		{
+			const uint32_t prot = ((phdr->p_flags & PF_R) ? ArchMem::READ : 0) | ((phdr->p_flags & PF_X) ? ArchMem::EXEC : 0);
+			mem_->protect(phdr->p_vaddr, tgt_sz, prot);
+		}
+
+		*log_ << " from 0x"
 		    << std::hex << phdr->p_offset
 		    << " to VA 0x" << phdr->p_vaddr << std::dec
 		    << std::endl;
 	}
-	std::cout << "Top of memory is 0x" << std::hex << top_of_mem_ << std::dec << std::endl;
+	*log_ << "Top of memory is 0x" << std::hex << top_of_mem_ << std::dec << std::endl;
+	state.flushTlb();
+
+	// segments are copied or hold their own mapping
+	const Elf64_Addr entry = eh64->e_entry;
+	::munmap(elf_mem, file_size);
+	::close(ifd);
 
 	// set entry point
-	state.setPc(eh64->e_entry);
+	state.setPc(entry);
 
 	prog_name_ = prog_name; // save program name
 	return false; // no errors
 }
 
+bool HostSystem::mapSegment(int fd, const Elf64_Phdr &phdr, uint64_t tgt_sz)
+{
+	// file offset and VA must agree within a page
+	const uint64_t lead = phdr.p_vaddr & (HOST_PAGE_SIZE - 1);
+	if ((phdr.p_offset & (HOST_PAGE_SIZE - 1)) != lead)
+		return false;
+
+	// reserve zero pages for the whole segment (the kernel fills .bss on first touch)
+	const size_t map_len = padTo16(lead + tgt_sz, HOST_PAGE_SIZE);
+	uint8_t *const base = static_cast<uint8_t*>(::mmap(nullptr, map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+	if (base == MAP_FAILED)
+		return false;
+
+	// overlay the file contents (copy on write)
+	const size_t file_end = lead + phdr.p_filesz;
+	if (phdr.p_filesz)
+	{
+		const size_t file_len = padTo16(file_end, HOST_PAGE_SIZE);
+		void *const f = ::mmap(base, file_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, phdr.p_offset - lead);
+		if (f == MAP_FAILED)
+		{
+			::munmap(base, map_len);
+			return false;
+		}
+
+		// rest of the last file page belongs to .bss (or alignment padding)
+		if (file_len > file_end)
+			memset(base + file_end, 0, file_len - file_end);
+	}
+
+	mem_->addMapping(phdr.p_vaddr, tgt_sz, base + lead, base, map_len);
+	return true;
+}
+
 void HostSystem::addArg(const std::string &s)
 {
 	args_.emplace_back(s);
@@ -151,6 +371,7 @@ void HostSystem::completeEnv(ArchState &state)
 	const uint32_t stack_sz = 4096 * 1024; // 4 MB
 	const uint64_t sp = 0x10000000;
 	mem_->addBlock(sp, stack_sz);
+	state.flushTlb();
 
 	// complete environment
 	const uint32_t sim_argc = args_.size() + 1; // include argv[0] (program name)
@@ -167,56 +388,52 @@ void HostSystem::completeEnv(ArchState &state)
 	const uint64_t top_of_stack = sp + stack_sz;
 	mmap_zone_ = top_of_stack + sp; // push mmap way up
 	const uint64_t start_pt = top_of_stack - env_sz - 16; // leave 16B near top of stack
-	std::cout << "Copying environment to "
+	*log_ << "Copying environment to "
 	    << std::hex << start_pt << std::dec
 	    << ' ' << env_sz << " bytes."
 	    << std::endl;
 
-	// copy the args into virtual environment
+	// copy the args into virtual environment (with terminators)
 	uint64_t ptr = start_pt;
 	sim_argv.emplace_back(ptr);
-	for (const auto &c : prog_name_)
-		state.writeMem(ptr++, 1, c);
-	state.writeMem(ptr++, 1, 0);
-	ptr = padTo16(ptr);
+	state.writeBlock(ptr, prog_name_.size() + 1, prog_name_.c_str());
+	ptr = padTo16(ptr + prog_name_.size() + 1);
 
 	for(const auto &arg : args_)
 	{
 		sim_argv.emplace_back(ptr);
-		for (const auto &c : arg)
-			state.writeMem(ptr++, 1, c);
-		state.writeMem(ptr++, 1, 0);
-		ptr = padTo16(ptr);
+		state.writeBlock(ptr, arg.size() + 1, arg.c_str());
+		ptr = padTo16(ptr + arg.size() + 1);
 	}
 
 	// TODO envp
-	std::cout << "Environment configured. End ptr: " << std::hex << ptr << std::dec << std::endl;
+	*log_ << "Environment configured. End ptr: " << std::hex << ptr << std::dec << std::endl;
 
 	const uint64_t final_sp = sp + stack_sz/2;
 
+	// build the initial stack, then copy it in
+	std::vector<uint64_t> init_stack;
 	//--- return canary
-	ptr = final_sp - 8;
-	state.writeMem(ptr, 8, 0);
-	ptr += 8;
+	init_stack.push_back(0);
 
-	// write args to stack
 	//--- argc
-	state.writeMem(ptr, 8, sim_argc);
-	ptr += 8;
+	init_stack.push_back(sim_argc);
 
 	//--- argv[]
-	for (const auto &a : sim_argv)
-	{
-		state.writeMem(ptr, 8, a);
-		ptr += 8;
-	}
+	init_stack.insert(init_stack.end(), sim_argv.begin(), sim_argv.end());
 	//--- TODO envp
 
+	state.writeBlock(final_sp - 8, init_stack.size() * sizeof(uint64_t), init_stack.data());
+
 	state.setReg(Reg::SP, final_sp); // put SP in the middle
 	state.setReg(10, sim_argc);
 	state.setReg(11, final_sp); // argv
 
-	// set up standard file descriptors
+	openStdio();
+}
+
+void HostSystem::openStdio()
+{
 	if (stdin_file_.empty())
 	{
 		fds_.push_back(-1); // block access to stdin
@@ -226,36 +443,296 @@ void HostSystem::completeEnv(ArchState &state)
 		const int sim_stdin = ::open(stdin_file_.c_str(), O_RDONLY);
 		if (sim_stdin < 0)
 		{
-			std::cerr << "No stdin " << stdin_file_ << std::endl;
+			*err_ << "No stdin " << stdin_file_ << std::endl;
 			fds_.push_back(-1); // block access to stdin
 		}
 		else
 		{
-			std::cerr << "Using stdin " << stdin_file_ << std::endl;
+			*err_ << "Using stdin " << stdin_file_ << std::endl;
 			fds_.push_back(sim_stdin);
 		}
 	}
 
 	// remap stdout
 	std::ostringstream os;
-	os << "stdout." << getpid();
+	os << "stdout" << out_suffix_;
 	const uint32_t stdout_fd = ::open(os.str().c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
 	fds_.push_back(stdout_fd);
 
 	// remap stderr
 	os.str("");
-	os << "stderr." << getpid();
+	os << "stderr" << out_suffix_;
 	const uint32_t stderr_fd = ::open(os.str().c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
 	fds_.push_back(stderr_fd);
 }
 
+bool HostSystem::saveCheckpoint(const char *path, const ArchState &state, uint64_t icount) const
+{
+	out_->flush(); // (for the file offsets)
+
+	CkptWriter w;
+	w.put(icount);
+	w.put(state.getPc());
+	for (uint32_t i = 0; i < 32; ++i)
+		w.put(state.getReg(i));
+	for (uint32_t i = 0; i < 32; ++i)
+		w.put(state.getFpRaw(i));
+	for (uint32_t i = 0; i < 32; ++i)
+	{
+		uint64_t words[VREG_WORDS];
+		memcpy(words, state.getVecReg(i), sizeof(words));
+		for (const uint64_t v : words)
+			w.put(v);
+	}
+
+	// only CSRs which have been set
+	std::vector<std::pair<uint64_t, uint64_t>> csrs;
+	for (uint32_t i = 0; i < NUM_CSRS; ++i)
+	{
+		if (i == CSR_FFLAGS || i == CSR_FRM || i == CSR_VXSAT || i == CSR_VXRM || i == CSR_VLENB)
+			continue;
+
+		const uint64_t val = state.getCr(i);
+		if (val)
+			csrs.emplace_back(i, val);
+	}
+	w.put(csrs.size());
+	for (const auto &c : csrs)
+	{
+		w.put(c.first);
+		w.put(c.second);
+	}
+
+	w.put(prog_name_);
+	w.put(stdin_file_);
+	w.put(args_.size());
+	for (const auto &a : args_)
+		w.put(a);
+	w.put(top_of_mem_);
+	w.put(mmap_zone_);
+
+	// files are reopened by path (stdout and stderr start over)
+	w.put(fds_.size());
+	for (uint32_t i = 0; i < fds_.size(); ++i)
+	{
+		const int fd = int32_t(fds_[i]);
+		if (fd < 0 || i == 1 || i == 2)
+		{
+			w.put(uint64_t(-1));
+			w.put(0);
+			w.put(std::string());
+			continue;
+		}
+		w.put(::lseek(fd, 0, SEEK_CUR));
+		w.put(::fcntl(fd, F_GETFL) & (O_ACCMODE | O_APPEND));
+		w.put(i == 0 ? std::string() : fdPath(fd)); // (stdin comes from stdin_file_)
+	}
+
+	// block data follows the header, each on a page boundary
+	const std::vector<SparseMem::Extent> blocks = mem_->extents();
+	const uint64_t hdr_sz = sizeof(CKPT_MAGIC) + w.data().size() + sizeof(uint64_t) + 4 * sizeof(uint64_t) * blocks.size();
+	std::vector<uint64_t> offsets;
+	uint64_t file_sz = padTo16(hdr_sz, HOST_PAGE_SIZE);
+	w.put(blocks.size());
+	for (const auto &b : blocks)
+	{
+		w.put(b.va);
+		w.put(b.sz);
+		w.put(b.prot);
+		w.put(file_sz);
+		offsets.push_back(file_sz);
+		file_sz += padTo16(b.sz, HOST_PAGE_SIZE);
+	}
+
+	const int fd = ::open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd < 0)
+	{
+		*err_ << "Failed to open " << path << std::endl;
+		return true;
+	}
+
+	bool fail = writeAll(fd, CKPT_MAGIC, sizeof(CKPT_MAGIC), 0) ||
+	            writeAll(fd, w.data().data(), w.data().size(), sizeof(CKPT_MAGIC));
+	for (uint32_t i = 0; i < blocks.size() && !fail; ++i)
+	{
+		const SparseMem::Extent &b = blocks[i];
+		// (zero pages never touched are holes, reading them would fault them in)
+		const Residency res(b.mem, b.anon ? b.sz : 0);
+		for (uint64_t off = 0; off < b.sz && !fail; off += HOST_PAGE_SIZE)
+		{
+			const uint64_t len = std::min(HOST_PAGE_SIZE, b.sz - off);
+			if (b.anon && !res.any(b.mem + off, len))
+				continue;
+			if (!allZero(b.mem + off, len))
+				fail = writeAll(fd, b.mem + off, len, offsets[i] + off);
+		}
+	}
+	fail = fail || ::ftruncate(fd, file_sz) != 0; // (trailing holes)
+	::close(fd);
+
+	if (fail)
+	{
+		*err_ << "Failed to write " << path << std::endl;
+		return true;
+	}
+
+	*log_ << "Wrote checkpoint " << path << " at " << icount << " instructions." << std::endl;
+	return false;
+}
+
+bool HostSystem::restoreCheckpoint(const char *path, ArchState &state, uint64_t &icount)
+{
+	const int ifd = ::open(path, O_RDONLY);
+	if (ifd < 0)
+	{
+		*err_ << "Failed to open " << path << std::endl;
+		return true;
+	}
+	struct stat s;
+	if (::fstat(ifd, &s) < 0 || size_t(s.st_size) < sizeof(CKPT_MAGIC))
+	{
+		*err_ << "Failed to stat " << path << std::endl;
+		::close(ifd);
+		return true;
+	}
+	const size_t file_size = s.st_size;
+	uint8_t *const file_mem = static_cast<uint8_t*>(::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, ifd, 0));
+	if (file_mem == MAP_FAILED)
+	{
+		*err_ << "Failed to mmap " << path << std::endl;
+		::close(ifd);
+		return true;
+	}
+
+	CkptReader r(file_mem, file_size);
+	const bool bad_magic = memcmp(file_mem, CKPT_MAGIC, sizeof(CKPT_MAGIC)) != 0;
+
+	icount = r.get();
+	state.setPc(r.get());
+	for (uint32_t i = 0; i < 32; ++i)
+		state.setReg(i, r.get());
+	for (uint32_t i = 0; i < 32; ++i)
+		state.setFpRaw(i, r.get());
+	for (uint32_t i = 0; i < 32; ++i)
+	{
+		uint64_t words[VREG_WORDS];
+		for (uint64_t &v : words)
+			v = r.get();
+		memcpy(state.getVecReg(i), words, sizeof(words));
+	}
+
+	const uint64_t num_csrs = r.get();
+	for (uint64_t i = 0; i < num_csrs && r.ok(); ++i)
+	{
+		const uint64_t csr = r.get();
+		state.setCr(csr, r.get());
+	}
+
+	prog_name_ = r.getStr();
+	stdin_file_ = r.getStr();
+	const uint64_t num_args = r.get();
+	for (uint64_t i = 0; i < num_args && r.ok(); ++i)
+		args_.emplace_back(r.getStr());
+	top_of_mem_ = r.get();
+	mmap_zone_ = r.get();
+
+	struct SavedFd
+	{
+		uint64_t offset;
+		uint64_t flags;
+		std::string path;
+	};
+	std::vector<SavedFd> saved_fds;
+	const uint64_t num_fds = r.get();
+	for (uint64_t i = 0; i < num_fds && r.ok(); ++i)
+	{
+		SavedFd f;
+		f.offset = r.get();
+		f.flags = r.get();
+		f.path = r.getStr();
+		saved_fds.emplace_back(f);
+	}
+
+	// memory maps straight from the file (copy on write)
+	const uint64_t num_blocks = r.get();
+	bool fail = bad_magic || !r.ok();
+	for (uint64_t i = 0; i < num_blocks && !fail; ++i)
+	{
+		const uint64_t va = r.get();
+		const uint64_t sz = r.get();
+		const uint64_t prot = r.get();
+		const uint64_t off = r.get();
+		const size_t map_len = padTo16(sz ? sz : 1, HOST_PAGE_SIZE);
+		if (!r.ok() || (off & (HOST_PAGE_SIZE - 1)) != 0 || off > file_size || file_size - off < map_len)
+		{
+			fail = true;
+			break;
+		}
+
+		void *const base = ::mmap(nullptr, map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE, ifd, off);
+		if (base == MAP_FAILED)
+		{
+			fail = true;
+			break;
+		}
+		mem_->addMapping(va, sz, static_cast<uint8_t*>(base), base, map_len);
+		mem_->protect(va, sz, prot);
+	}
+	::munmap(file_mem, file_size);
+	::close(ifd);
+
+	if (fail)
+	{
+		*err_ << "Badly formed checkpoint " << path << std::endl;
+		return true;
+	}
+
+	openStdio();
+	for (uint32_t i = 0; i < saved_fds.size(); ++i)
+	{
+		const SavedFd &f = saved_fds[i];
+		if (i < fds_.size())
+		{
+			// stdin is already open (stdout and stderr are new)
+			if (i == 0 && int32_t(fds_[0]) >= 0 && int64_t(f.offset) >= 0)
+				::lseek(fds_[0], f.offset, SEEK_SET);
+			continue;
+		}
+
+		int new_fd = -1;
+		if (int64_t(f.offset) >= 0)
+		{
+			const int host_flags = (f.flags & O_ACCMODE) == O_RDONLY ? int(f.flags) : int(f.flags) | O_CREAT;
+			new_fd = ::open(f.path.c_str(), host_flags, 0666);
+			if (new_fd < 0)
+				*err_ << "Failed to reopen " << f.path << std::endl;
+			else
+				::lseek(new_fd, f.offset, SEEK_SET);
+		}
+		fds_.push_back(new_fd);
+	}
+
+	state.flushTlb();
+	*log_ << "Restored checkpoint " << path << " at " << icount << " instructions." << std::endl;
+	return false;
+}
+
 void HostSystem::exit(ArchState &state)
 {
 	const uint64_t status = state.getReg(10);
 	if (status != 0)
-		std::cerr << "Program exited with non-zero status: " << status << std::endl;
+		*err_ << "Program exited with non-zero status: " << status << std::endl;
 
+	exit_status_ = status;
 	exited_ = true;
+
+	if (out_->flush())
+		*err_ << "Failed to write some guest output" << std::endl;
+}
+
+void HostSystem::exitGroup(ArchState &state)
+{
+	exit(state); // only one thread
 }
 
 void HostSystem::fstat(ArchState &state)
@@ -276,7 +753,7 @@ void HostSystem::fstat(ArchState &state)
 
 	if (!path_p)
 	{
-		std::cerr << " fstat fd=" << fd
+		*err_ << " fstat fd=" << fd
 		    << " path=null ptr";
 		state.setReg(10, -1); // error
 		return;
@@ -306,6 +783,7 @@ void HostSystem::fstat(ArchState &state)
 			return;
 		}
 
+		out_->flush(fds_[fd]); // (for the size)
 		struct stat s;
 		const int ret = ::fstat(fds_[fd], &s);
 
@@ -320,13 +798,13 @@ void HostSystem::fstat(ArchState &state)
 		return;
 	}
 	//else
-	std::cerr << " fstat fd=" << fd
+	*err_ << " fstat fd=" << fd
 	          << " path='";
 	if (!bad_chars)
-		std::cerr << pathname;
+		*err_ << pathname;
 	else
-		std::cerr << "(bad path)";
-	std::cerr << '\'';
+		*err_ << "(bad path)";
+	*err_ << '\'';
 
 	state.setReg(10, 0); // success!
 }
@@ -340,17 +818,32 @@ void HostSystem::mmap(ArchState &state)
 	const uint64_t fd = state.getReg(14);
 	const uint64_t offset = state.getReg(15);
 
-	const uint64_t out_addr = mmap_zone_;
-	mmap_zone_ += padTo16(len, 4096);
-	if (flags & 0x20)
+	const uint64_t map_len = padTo16(len, HOST_PAGE_SIZE);
+	if (len == 0 || ((flags & MAP_FIXED) && (addr & (HOST_PAGE_SIZE - 1))))
+	{
+		state.setReg(10, -EINVAL);
+		return;
+	}
+
+	const uint64_t out_addr = (flags & MAP_FIXED) ? addr : mmap_zone_;
+	if (flags & MAP_ANONYMOUS)
 	{
 		// annonymous (no file)
+		if (flags & MAP_FIXED)
+		{
+			mem_->removeRange(out_addr, map_len);
+			state.invalidateCode(out_addr, map_len);
+		}
+		else
+			mmap_zone_ += map_len;
 		mem_->addBlock(out_addr, len);
+		protectMapping(out_addr, len, prot);
+		state.flushTlb(); // (blocks may have moved)
 		state.setReg(10, out_addr); // success!
 		return; // done
 	}
 
-	std::cerr << ' ' << __FUNCTION__
+	*err_ << ' ' << __FUNCTION__
 	    << ' ' << addr
 	    << ' ' << len
 	    << ' ' << prot
@@ -358,19 +851,106 @@ void HostSystem::mmap(ArchState &state)
 	    << ' ' << fd
 	    << ' ' << offset
 	;
-	if (fd <= 2 || fd >= fds_.size() || len == 0)
+	struct stat st;
+	if (fd <= 2 || fd >= fds_.size() || ::fstat(fds_[fd], &st) != 0)
 	{
-		state.setReg(10, -1); // error
+		state.setReg(10, -EBADF);
+		return;
+	}
+	if (offset & (HOST_PAGE_SIZE - 1))
+	{
+		state.setReg(10, -EINVAL);
 		return;
 	}
 
-	void *ptr = ::mmap(nullptr, len, prot, flags, fds_[fd], offset);
-	mem_->addBlock(out_addr, len, ptr);
-	::munmap(ptr, len);
+	// the guest gets the host's pages (no copy), shared writes go to the file
+	// (mapped writable on the host either way, SparseMem checks the guest's protection)
+	out_->flush(fds_[fd]);
+	const uint64_t file_sz = uint64_t(st.st_size) > offset ? st.st_size - offset : 0;
+	const uint64_t file_len = std::min(map_len, padTo16(file_sz, HOST_PAGE_SIZE));
+	uint8_t *ptr = nullptr;
+	if (file_len)
+	{
+		const int host_flags = (flags & MAP_SHARED) && (prot & PROT_WRITE) ? MAP_SHARED : MAP_PRIVATE;
+		void *const p = ::mmap(nullptr, file_len, PROT_READ|PROT_WRITE, host_flags, fds_[fd], offset);
+		if (p == MAP_FAILED)
+		{
+			state.setReg(10, -errno);
+			return;
+		}
+		ptr = static_cast<uint8_t*>(p);
+	}
+
+	if (flags & MAP_FIXED)
+	{
+		mem_->removeRange(out_addr, map_len);
+		state.invalidateCode(out_addr, map_len);
+	}
+	else
+		mmap_zone_ += map_len;
+	if (file_len)
+		mem_->addMapping(out_addr, std::min(len, file_len), ptr, ptr, file_len);
+	if (len > file_len) // (zero pages past the end of the file)
+		mem_->addBlock(out_addr + file_len, len - file_len);
+	protectMapping(out_addr, len, prot);
+	state.flushTlb();
 
 	state.setReg(10, out_addr); // success!
 }
 
+void HostSystem::munmap(ArchState &state)
+{
+	const uint64_t addr = state.getReg(10);
+	const uint64_t len = state.getReg(11);
+	if ((addr & (HOST_PAGE_SIZE - 1)) || len == 0)
+	{
+		state.setReg(10, -EINVAL);
+		return;
+	}
+
+	const uint64_t map_len = padTo16(len, HOST_PAGE_SIZE);
+	mem_->removeRange(addr, map_len);
+	state.invalidateCode(addr, map_len);
+	state.flushTlb();
+	state.setReg(10, 0);
+}
+
+void HostSystem::mprotect(ArchState &state)
+{
+	const uint64_t addr = state.getReg(10);
+	const uint64_t len = state.getReg(11);
+	const uint64_t prot = state.getReg(12);
+	if (addr & (HOST_PAGE_SIZE - 1))
+	{
+		state.setReg(10, -EINVAL);
+		return;
+	}
+
+	// all of the range must be mapped
+	const uint64_t end = addr + padTo16(len, HOST_PAGE_SIZE);
+	for (uint64_t a = addr; a < end;)
+	{
+		SparseMem::Extent e;
+		if (!mem_->findExtent(a, e))
+		{
+			state.setReg(10, -ENOMEM);
+			return;
+		}
+		a = e.va + e.sz;
+	}
+
+	mem_->protect(addr, end - addr, prot);
+	state.flushTlb();
+	state.setReg(10, 0);
+}
+
+void HostSystem::protectMapping(uint64_t va, uint64_t len, uint64_t prot)
+{
+	// (execute is not checked, leave blocks which may be read and written whole)
+	if ((prot & (PROT_READ | PROT_WRITE)) != (PROT_READ | PROT_WRITE))
+		mem_->protect(va, len, prot);
+}
+
 void HostSystem::open(ArchState &state)
 {
 	const uint64_t dirfd = state.getReg(10);
@@ -407,12 +987,12 @@ void HostSystem::open(ArchState &state)
 		return;
 	}
 
-	std::cerr << " openat " << dirfd << ' ';
+	*err_ << " openat " << dirfd << ' ';
 	if (!bad_chars)
-		std::cerr << '\'' << pathname << '\'';
+		*err_ << '\'' << pathname << '\'';
 	else
-		std::cerr << "(bad path)";
-	std:: cerr << ' ' << flags << ' ' << mode;
+		*err_ << "(bad path)";
+	*err_ << ' ' << flags << ' ' << mode;
 
 	// TODO: whitelist file access and redirect writes
 	int host_flags = O_RDONLY;
@@ -420,10 +1000,11 @@ void HostSystem::open(ArchState &state)
 	{
 		host_flags = O_WRONLY | O_CREAT | O_TRUNC;
 		std::ostringstream os;
-		os << pathname << '.' << getpid();
+		os << pathname << out_suffix_;
 		pathname = os.str();
-		std::cerr << " openat write file " << pathname << std::endl;
+		*err_ << " openat write file " << pathname << std::endl;
 	}
+	out_->flush(); // (it may have been written through another descriptor)
 	const int32_t new_fd = ::open(pathname.c_str(), host_flags, 0666);
 	if (new_fd < 0)
 	{
@@ -470,27 +1051,22 @@ void HostSystem::readlinkat(ArchState &state)
 	// TODO: /proc/self/exe should resolve to program name (full path)
 	if (pathname != "/proc/self/exe")
 	{
-		std::cerr << " readlinkat " << dirfd << ' ';
+		*err_ << " readlinkat " << dirfd << ' ';
 		if (!bad_chars)
-			std::cerr << '\'' << pathname << '\'';
+			*err_ << '\'' << pathname << '\'';
 		else
-			std::cerr << "(bad path)";
-		std:: cerr << ' ' << buf << ' ' << buf_sz;
+			*err_ << "(bad path)";
+		*err_ << ' ' << buf << ' ' << buf_sz;
 
 		uint32_t bytes_copied = 0;
 		state.setReg(10, bytes_copied);
 		return;
 	}
 
-	off = 0;
-	for (const auto &v : pathname)
-	{
-		state.writeMem(buf + off, 1, v);
-		++off;
-		if (off == buf_sz)
-			break;
-	}
-	state.setReg(10, off);
+	// no terminator (like readlink)
+	const uint64_t ct = std::min<uint64_t>(pathname.size(), buf_sz);
+	state.writeBlock(buf, ct, pathname.data());
+	state.setReg(10, ct);
 }
 
 void HostSystem::sbrk(ArchState &state)
@@ -511,6 +1087,7 @@ void HostSystem::sbrk(ArchState &state)
 	// alloc more mem
 	const uint64_t delta = new_top_of_mem - top_of_mem_;
 	mem_->addBlock(top_of_mem_+1, delta, nullptr);
+	state.flushTlb(); // (blocks may have moved)
 
 	top_of_mem_ = new_top_of_mem;
 	state.setReg(10, top_of_mem_);
@@ -526,6 +1103,7 @@ void HostSystem::seek(ArchState &state)
 		state.setReg(10, -1);
 		return;
 	}
+	out_->flush(fds_[fd]);
 	const uint64_t ret = ::lseek(fds_[fd], off, wh);
 	state.setReg(10, ret);
 }
@@ -541,32 +1119,24 @@ void HostSystem::uname(ArchState &state)
 
 	constexpr uint32_t UTS_LEN = 65;
 	constexpr uint32_t NUM_FIELDS = 6;
-	// zero buf
-	for (uint32_t i = 0; i < UTS_LEN*NUM_FIELDS; ++i)
-	{
-		state.writeMem(buf+i, 1, 0);
-	}
+	char uts[UTS_LEN * NUM_FIELDS] = {0,};
 
 	// first member: system name
 	const std::string sysname("Linux");
-	for (uint32_t i = 0; i < sysname.size(); ++i)
-	{
-		state.writeMem(buf+i, 1, sysname[i]);
-	}
+	sysname.copy(uts, UTS_LEN - 1);
 
 	// second member: node name
-	// buf+UTS_LEN: leave blank
+	// uts+UTS_LEN: leave blank
 
 	// third member: release
 	const std::string release("4.15.0");
-	for (uint32_t i = 0; i < release.size(); ++i)
-	{
-		state.writeMem(buf+i+2*UTS_LEN, 1, release[i]);
-	}
+	release.copy(uts + 2*UTS_LEN, UTS_LEN - 1);
 
 	// leave rest blank (TODO: if anyone cares)
 	// version, machine, domainname
 
+	state.writeBlock(buf, sizeof(uts), uts);
+
 	state.setReg(10, 0); // success
 }
 
@@ -583,31 +1153,43 @@ void HostSystem::read(ArchState &state)
 	}
 
 	const auto sim_fd = fds_[fd];
-	const std::unique_ptr<uint8_t[]> sim_buf(new uint8_t[ct ? ct : 1]);
+	out_->flush(sim_fd); // (a file may be read back)
 
-	const int ret = ::read(sim_fd, sim_buf.get(), ct);
-	for (int b = 0; b < ret; ++b)
+	// read straight into simulated memory, if it is contiguous
+	if (const uint8_t *dst = state.hostPtr(buf, ct))
 	{
-		state.writeMem(buf+b, 1, sim_buf[b]);
+		const ssize_t ret = ::read(sim_fd, const_cast<uint8_t*>(dst), ct);
+		if (ret > 0)
+			state.invalidateCode(buf, ret);
+		state.setReg(10, ret < 0 ? -errno : ret);
+		return;
 	}
 
-	state.setReg(10, ret);
-}
-
-uint64_t HostSystem::writeBuf(ArchState &state, uint64_t buf, uint64_t ct)
-{
-	uint64_t bytes_written = 0;
-	std::cout << ' ' << '\'';
-	while (ct)
+	// else through a bounce buffer, until a short read (so more is not waited for)
+	// only as much as the guest buffer holds is read, so no input is lost
+	uint8_t chunk[BOUNCE_SZ];
+	uint64_t done = 0;
+	while (done < ct)
 	{
-		const uint8_t v = state.readMem(buf, 1);
-		std::cout << ' ' << uint32_t(v);
-		++buf;
-		--ct;
-		++bytes_written;
+		const uint64_t n = state.readBlock(buf + done, std::min(ct - done, BOUNCE_SZ), chunk); // (mapped length)
+		if (n == 0)
+		{
+			state.setReg(10, done ? int64_t(done) : -EFAULT);
+			return;
+		}
+
+		const ssize_t ret = ::read(sim_fd, chunk, n);
+		if (ret < 0)
+		{
+			state.setReg(10, done ? int64_t(done) : -errno);
+			return;
+		}
+
+		done += state.writeBlock(buf + done, ret, chunk);
+		if (uint64_t(ret) != n)
+			break;
 	}
-	std::cout << '\'';
-	return bytes_written;
+	state.setReg(10, done);
 }
 
 void HostSystem::write(ArchState &state)
@@ -622,51 +1204,138 @@ void HostSystem::write(ArchState &state)
 	const uint64_t buf = state.getReg(11);
 	const uint64_t ct = state.getReg(12);
 
-	const uint32_t sim_fd = fds_[fd];
-	for (uint32_t i = 0; i < ct; ++i)
+	state.setReg(10, writeGuest(state, fds_[fd], buf, ct));
+}
+
+void HostSystem::writev(ArchState &state)
+{
+	const uint64_t fd = state.getReg(10);
+	const uint64_t iovec = state.getReg(11);
+	const uint64_t iovct = state.getReg(12);
+	if (fd >= fds_.size() || iovec == 0 || iovct > IOV_MAX)
+	{
+		state.setReg(10, -1);
+		return;
+	}
+
+	// guest iovecs are {base, len} pairs of 8B each (same as host)
+	std::vector<uint64_t> sim_iov(2 * iovct);
+	if (state.readBlock(iovec, sim_iov.size() * sizeof(uint64_t), sim_iov.data()) != sim_iov.size() * sizeof(uint64_t))
+	{
+		state.setReg(10, -1);
+		return;
+	}
+
+	// point host iovecs into simulated memory, if it is all contiguous
+	std::vector<struct iovec> host_iov(iovct);
+	bool contiguous = true;
+	for (uint64_t i = 0; i < iovct && contiguous; ++i)
+	{
+		const uint64_t buf = sim_iov[2 * i];
+		const uint64_t ct = sim_iov[2 * i + 1];
+
+		const uint8_t *src = ct ? state.hostPtr(buf, ct) : nullptr;
+		contiguous = !ct || src;
+		host_iov[i].iov_base = const_cast<uint8_t*>(src);
+		host_iov[i].iov_len = ct;
+	}
+	if (contiguous)
+	{
+		const ssize_t ret = out_->writev(fds_[fd], host_iov.data(), iovct);
+		state.setReg(10, ret < 0 ? -errno : ret);
+		return;
+	}
+
+	// else one at a time, until a short one
+	uint64_t done = 0;
+	for (uint64_t i = 0; i < iovct; ++i)
 	{
-		// TODO: read/write larger blocks
-		const uint8_t byte = state.readImem(buf+i, 1);
-		const size_t ret = ::write(sim_fd, &byte, 1);
-		if (ret != 1)
+		const uint64_t ct = sim_iov[2 * i + 1];
+		const ssize_t ret = writeGuest(state, fds_[fd], sim_iov[2 * i], ct);
+		if (ret < 0)
 		{
-			state.setReg(10, -1);
+			state.setReg(10, done ? done : ret);
 			return;
 		}
+
+		done += ret;
+		if (uint64_t(ret) != ct)
+			break;
 	}
-	state.setReg(10, ct);
+	state.setReg(10, done);
 }
 
-void HostSystem::writev(ArchState &state)
+ssize_t HostSystem::writeGuest(ArchState &state, uint32_t sim_fd, uint64_t buf, uint64_t ct)
 {
-	uint64_t iovec = state.getReg(11);
-	if (iovec == 0)
+	// write straight from simulated memory, if it is contiguous
+	if (const uint8_t *src = state.hostPtr(buf, ct))
 	{
-		state.setReg(10, -1);
-		return;
+		const ssize_t ret = out_->write(sim_fd, src, ct);
+		return ret < 0 ? -errno : ret;
 	}
 
-	const uint64_t fd = state.getReg(10);
-	uint64_t iovct = state.getReg(12);
-	uint64_t bytes_written = 0;
-	if (fd == 1) // stdout
+	// else through a bounce buffer, until a short read or write
+	uint8_t chunk[BOUNCE_SZ];
+	uint64_t done = 0;
+	while (done < ct)
 	{
-		while (iovct)
-		{
-			const uint64_t buf = state.readMem(iovec, 8);
-			const uint64_t ct = state.readMem(iovec+8, 8);
-			bytes_written += writeBuf(state, buf, ct);
+		const uint64_t n = std::min(ct - done, BOUNCE_SZ);
+		const uint64_t got = state.readBlock(buf + done, n, chunk);
+		if (got == 0)
+			return done ? ssize_t(done) : -EFAULT;
 
-			--iovct;
-			iovec += 16;
-		}
+		const ssize_t ret = out_->write(sim_fd, chunk, got);
+		if (ret < 0)
+			return done ? ssize_t(done) : -errno;
+
+		done += ret;
+		if (uint64_t(ret) != n)
+			break;
 	}
-	else
+	return done;
+}
+
+void HostSystem::fsync(ArchState &state)
+{
+	const uint64_t fd = state.getReg(10);
+	if (fd >= fds_.size() || int32_t(fds_[fd]) < 0)
 	{
-		std::cerr << " Writev to fd " << fd << std::endl;
+		state.setReg(10, -EBADF);
+		return;
 	}
-	state.setReg(10, bytes_written);
+
+	if (out_->flush(fds_[fd]))
+	{
+		state.setReg(10, -EIO);
+		return;
+	}
+	state.setReg(10, ::fsync(fds_[fd]) == 0 ? 0 : -errno);
+}
+
+void HostSystem::clone(ArchState &state)
+{
+	*err_ << " clone (no threads without harts)";
+	state.setReg(10, -1); // error
 }
 
+void HostSystem::futex(ArchState &state)
+{
+	// no one to wait for (or to wake)
+	const uint64_t op = state.getReg(11) & FUTEX_CMD_MASK;
+	if (op == FUTEX_WAIT || op == FUTEX_WAIT_BITSET)
+		state.setReg(10, -EAGAIN);
+	else
+		state.setReg(10, 0);
+}
+
+void HostSystem::gettid(ArchState &state)
+{
+	state.setReg(10, MAIN_TID);
 }
 
+void HostSystem::setTidAddress(ArchState &state)
+{
+	state.setReg(10, MAIN_TID);
+}
+
+}
@@ -1,8 +1,11 @@
 #ifndef RVFUN_HOST_SYSTEM_HPP
 #define RVFUN_HOST_SYSTEM_HPP
 
+#include "output_buffer.hpp"
 #include "system.hpp"
+#include <elf.h>
 #include <cstdint>
+#include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
@@ -19,16 +22,44 @@ public:
 	~HostSystem();
 
 	ArchMem* getMem();
+	SparseMem* getSparseMem() { return mem_.get(); }
 	bool loadElf(const char *prog_name, ArchState &state);
 	void addArg(const std::string &s);
 	void setStdin(const std::string &s) { stdin_file_ = s; }
+
+	/// map ELF segments copy-on-write (instead of copying them)
+	void setMapSegments(bool b = true) { map_segments_ = b; }
 	void completeEnv(ArchState &state);
 	bool hadExit() const { return exited_; }
 
+	/// write registers, memory and open files to 'path' (after 'icount' instructions)
+	/// (memory is stored page aligned, all zero pages are left as holes)
+	///@return true on error
+	bool saveCheckpoint(const char *path, const ArchState &state, uint64_t icount) const;
+
+	/// replaces loadElf and completeEnv (memory is mapped copy-on-write from 'path')
+	/// guest output continues in new stdout and stderr files
+	///@return true on error
+	bool restoreCheckpoint(const char *path, ArchState &state, uint64_t &icount);
+
+	uint64_t exitStatus() const { return exit_status_; }
+
+	/// send messages to 'log' and errors (bad guest accesses too) to 'err' (default std::cout and std::cerr)
+	void setLog(std::ostream *log, std::ostream *err);
+
+	/// guest output goes to files named 'stdout<suffix>', 'stderr<suffix>' (default ".<pid>")
+	void setOutputSuffix(const std::string &s) { out_suffix_ = s; }
+
+	/// how guest writes reach the host files (default OutputBuffer::Mode::ASYNC)
+	void setOutputMode(OutputBuffer::Mode mode) { out_->setMode(mode); }
+
 	//---from System
 	void exit(ArchState &state) override;
+	void exitGroup(ArchState &state) override;
 	void fstat(ArchState &state) override;
 	void mmap(ArchState &state) override;
+	void munmap(ArchState &state) override;
+	void mprotect(ArchState &state) override;
 	void open(ArchState &state) override;
 	void readlinkat(ArchState &state) override;
 	void sbrk(ArchState &state) override;
@@ -37,18 +68,43 @@ public:
 	void read(ArchState &state) override;
 	void write(ArchState &state) override;
 	void writev(ArchState &state) override;
+	void fsync(ArchState &state) override;
+
+	// single threaded (see HartScheduler for more harts)
+	void clone(ArchState &state) override;
+	void futex(ArchState &state) override;
+	void gettid(ArchState &state) override;
+	void setTidAddress(ArchState &state) override;
+	std::ostream& err() override { return *err_; }
 
 private: // methods
-	uint64_t writeBuf(ArchState &state, uint64_t buf, uint64_t ct);
+	///@return true if 'phdr' was mapped directly from 'fd'
+	bool mapSegment(int fd, const Elf64_Phdr &phdr, uint64_t tgt_sz);
+
+	/// apply the guest's PROT_ bits to a new mapping
+	void protectMapping(uint64_t va, uint64_t len, uint64_t prot);
+
+	/// set up guest descriptors 0-2 (stdin file, new stdout and stderr files)
+	void openStdio();
+
+	/// write 'ct' guest bytes from 'buf' to 'sim_fd' (in bounded chunks where they are not contiguous)
+	///@return bytes written, or a negative error if none were
+	ssize_t writeGuest(ArchState &state, uint32_t sim_fd, uint64_t buf, uint64_t ct);
 
 private: // data
 	std::unique_ptr<SparseMem> mem_; ///< memory image
 	std::vector<uint32_t> fds_; ///< open file descriptors
+	std::unique_ptr<OutputBuffer> out_; ///< guest writes to 'fds_'
 	std::string prog_name_; ///< argv[0]
 	std::string stdin_file_; ///< file to use for stdin
+	std::string out_suffix_; ///< for files written by the guest
 	std::vector<std::string> args_; ///< argv[1..n]
 	uint64_t top_of_mem_ = 0; ///< cache highest block in mem image
 	uint64_t mmap_zone_ = 0;
+	std::ostream *log_ = &std::cout;
+	std::ostream *err_ = &std::cerr;
+	uint64_t exit_status_ = 0;
+	bool map_segments_ = false; ///< loadElf mode
 	bool exited_ = false; ///< track calls to exit()
 };
 
@@ -1,12 +1,118 @@
 #ifndef RVFUN_INST_HPP
 #define RVFUN_INST_HPP
 
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace rvfun
 {
 class ArchState;
+class InstArena;
+class SparseMem;
+class System;
+template<class Mem, bool DEBUG> class FastArchState;
+
+/// state type with a statically bound execution path
+typedef FastArchState<SparseMem, false> FastState;
+
+/// Integer operation described simply enough to translate to host code (see Inst::lower()).
+/// Register 0 reads as zero and writes to it are dropped.
+struct MicroOp
+{
+	enum Kind : uint8_t
+	{
+		ALU, ///< rd = rs1 op (use_imm ? imm : rs2)
+		LOAD, ///< rd = mem[rs1 + imm]
+		STORE, ///< mem[rs1 + imm] = rs2
+		BCC, ///< PC += (rs1 cond rs2) ? imm : len
+		JAL, ///< rd = PC + len, PC += imm
+		JALR, ///< rd = PC + len, then PC = (rs1 + imm) & ~1
+		JR ///< PC = rs1
+	};
+
+	enum Op : uint8_t
+	{
+		ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND, MUL,
+		LI, ///< rd = imm
+		AUIPC ///< rd = PC + imm
+	};
+
+	Kind kind = ALU;
+	Op op = ADD;
+	uint8_t rd = 0;
+	uint8_t rs1 = 0;
+	uint8_t rs2 = 0;
+	bool use_imm = false;
+	bool word = false; ///< (ALU) 32 bit operation, result sign extended
+	bool sign = false; ///< (LOAD) sign extend
+	uint8_t size = 0; ///< (LOAD, STORE) bytes
+	uint8_t cond = 0; ///< (BCC) funct3 of BEQ, BNE, BLT, BGE, BLTU or BGEU
+	uint8_t len = 4; ///< instruction bytes
+	int64_t imm = 0;
+
+	static MicroOp alu(Op op, uint8_t rd, uint8_t rs1, uint8_t rs2, bool word = false, uint8_t len = 4)
+	{
+		MicroOp u(ALU, rd, rs1, 0, len);
+		u.op = op;
+		u.rs2 = rs2;
+		u.word = word;
+		return u;
+	}
+
+	static MicroOp aluImm(Op op, uint8_t rd, uint8_t rs1, int64_t imm, bool word = false, uint8_t len = 4)
+	{
+		MicroOp u(ALU, rd, rs1, imm, len);
+		u.op = op;
+		u.use_imm = true;
+		u.word = word;
+		return u;
+	}
+
+	static MicroOp load(uint8_t rd, uint8_t rs1, int64_t imm, uint8_t size, bool sign, uint8_t len = 4)
+	{
+		MicroOp u(LOAD, rd, rs1, imm, len);
+		u.size = size;
+		u.sign = sign;
+		return u;
+	}
+
+	static MicroOp store(uint8_t rs2, uint8_t rs1, int64_t imm, uint8_t size, uint8_t len = 4)
+	{
+		MicroOp u(STORE, 0, rs1, imm, len);
+		u.rs2 = rs2;
+		u.size = size;
+		return u;
+	}
+
+	static MicroOp bcc(uint8_t cond, uint8_t rs1, uint8_t rs2, int64_t imm, uint8_t len = 4)
+	{
+		MicroOp u(BCC, 0, rs1, imm, len);
+		u.rs2 = rs2;
+		u.cond = cond;
+		return u;
+	}
+
+	static MicroOp jump(Kind kind, uint8_t rd, uint8_t rs1, int64_t imm, uint8_t len = 4)
+	{
+		return MicroOp(kind, rd, rs1, imm, len);
+	}
+
+	MicroOp() {}
+
+private:
+	MicroOp(Kind k, uint8_t d, uint8_t s1, int64_t i, uint8_t l)
+	: kind(k)
+	, rd(d)
+	, rs1(s1)
+	, len(l)
+	, imm(i)
+	{
+	}
+};
 
 /// Interface to one architected instruction
 class Inst
@@ -20,6 +126,7 @@ public:
 		NONE,  ///!< no dependency
 		INT,   ///!< integer file
 		FLOAT, ///!< floating point file
+		VECTOR, ///!< vector file (first register of a group)
 		MAX_RF
 	};
 
@@ -32,6 +139,12 @@ public:
 		RegFile  rf;  ///!< register file
 		RegNum  reg; ///!< register number
 
+		RegDep()
+		: rf(RegFile::NONE)
+		, reg(RegNum(0))
+		{
+		}
+
 		RegDep(RegNum n, RegFile f = RegFile::INT)
 		: rf(f)
 		, reg(n)
@@ -39,11 +152,49 @@ public:
 		}
 	};
 
+	/// Fixed capacity list of register dependencies (no allocation)
+	class RegDeps
+	{
+	public:
+		static constexpr uint32_t MAX_DEPS = 4; ///< masked vector multiply-adds read three and v0
+
+		RegDeps() {}
+
+		RegDeps(std::initializer_list<RegDep> deps)
+		{
+			for (const RegDep &d : deps)
+				push_back(d);
+		}
+
+		void push_back(const RegDep &d)
+		{
+			assert(sz_ < MAX_DEPS);
+			deps_[sz_++] = d;
+		}
+
+		template<class... Args>
+		void emplace_back(Args&&... args)
+		{
+			push_back(RegDep(std::forward<Args>(args)...));
+		}
+
+		uint32_t size() const { return sz_; }
+		bool empty() const { return sz_ == 0; }
+
+		const RegDep& operator[](uint32_t i) const { return deps_[i]; }
+		const RegDep* begin() const { return deps_; }
+		const RegDep* end() const { return deps_ + sz_; }
+
+	private:
+		RegDep deps_[MAX_DEPS];
+		uint32_t sz_ = 0;
+	};
+
 	///@return all the registers written by this
-	virtual std::vector<RegDep> dsts() const = 0;
+	virtual RegDeps dsts() const = 0;
 
 	///@return all the registers read by this
-	virtual std::vector<RegDep> srcs() const = 0;
+	virtual RegDeps srcs() const = 0;
 
 	///@return register dependency for store data
 	virtual RegDep stdSrc() const { return RegDep(RegNum(0), RegFile::NONE); }
@@ -51,9 +202,23 @@ public:
 	virtual uint64_t calcEa(ArchState &) const { return 0; }
 	virtual uint32_t opSize() const { return 8; }
 
+	/// memory accessed, [va, va+sz)
+	struct MemRange
+	{
+		uint64_t va;
+		uint64_t sz;
+	};
+
+	/// append the memory this accesses executing on 'state' (by default opSize() bytes at calcEa(),
+	/// for memory op types; vector ops list their whole footprint)
+	virtual void memRanges(ArchState &state, std::vector<MemRange> &ranges) const;
+
 	/// update 'state' for execution of this
 	virtual void execute(ArchState &state) const = 0;
 
+	/// as above, with state access bound statically (no virtual calls)
+	virtual void execute(FastState &state) const = 0;
+
 	///@return assembly string of this
 	virtual std::string disasm() const = 0;
 
@@ -66,22 +231,51 @@ public:
 		OT_MUL,
 		OT_DIV,
 		OT_FP, // TODO: more FP types
+		OT_VEC, ///< vector arithmetic and configuration
 		OT_LOAD,
 		OT_STORE,
 		OT_LOAD_FP,
 		OT_STORE_FP,
+		OT_LOAD_VEC,
+		OT_STORE_VEC,
 		OT_ATOMIC,
 		OT_BCC, ///< conditional branch
 		OT_BRANCH, ///< unconditional branch
 		OT_SYSTEM
 	};
 	virtual OpType opType() const = 0;
+
+	/// describe this as one MicroOp (for translation)
+	///@return false if it has no such form (it must be interpreted)
+	virtual bool lower(MicroOp &) const { return false; }
 };
 
+/// Implements both execute() paths with T::exec<State>()
+template<class T>
+class InstBase : public Inst
+{
+public:
+	void execute(ArchState &state) const override { static_cast<const T*>(this)->exec(state); }
+	void execute(FastState &state) const override { static_cast<const T*>(this)->exec(state); }
+};
+
+/// decode functions return heap allocated instructions (owned by the caller)
 Inst* decode16(uint32_t opc);
 Inst* decode32(uint32_t opc);
 Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug);
 
+/// as above, but the instruction lives until 'arena' is cleared
+Inst* decode16(uint32_t opc, InstArena &arena);
+Inst* decode32(uint32_t opc, InstArena &arena);
+Inst* decode(ArchState &state, uint32_t &opc_sz, uint32_t &full_inst, bool debug, InstArena &arena);
+
+/// print the output of decode() to stdout when 'debug' (illegal instructions are always reported,
+/// to the error stream of 'sys' if there is one, else stderr)
+void printDecode(System *sys, uint64_t pc, uint32_t full_inst, uint32_t opc_sz, const Inst *inst, bool debug);
+
+///@return short lower case name of 'ot' ("alu", "load_fp", ...)
+const char* opTypeName(Inst::OpType ot);
+
 } // namespace
 
 #endif
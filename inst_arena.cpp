@@ -0,0 +1,45 @@
+#include "inst_arena.hpp"
+#include "inst.hpp"
+
+namespace rvfun
+{
+InstArena::InstArena(size_t chunk_sz)
+: chunk_sz_(chunk_sz)
+{
+}
+
+InstArena::~InstArena()
+{
+	clear();
+}
+
+void* InstArena::alloc(size_t sz, size_t align)
+{
+	// round up for alignment
+	size_t off = (used_ + align - 1) & ~(align - 1);
+	if (chunks_.empty() || off + sz > chunk_sz_)
+	{
+		// move to the next chunk (reusing one from before a clear)
+		if (!chunks_.empty())
+			++cur_chunk_;
+		if (cur_chunk_ == chunks_.size())
+			chunks_.emplace_back(new uint8_t[chunk_sz_]);
+		off = 0;
+	}
+
+	used_ = off + sz;
+	return chunks_[cur_chunk_].get() + off;
+}
+
+void InstArena::clear()
+{
+	for (Inst *i : insts_)
+		i->~Inst();
+	insts_.clear();
+
+	cur_chunk_ = 0;
+	used_ = 0;
+}
+
+}
+
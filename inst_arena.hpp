@@ -0,0 +1,58 @@
+#ifndef RVFUN_INST_ARENA_HPP
+#define RVFUN_INST_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace rvfun
+{
+class Inst;
+
+/// Bump allocator for decoded instructions, freed all at once
+class InstArena
+{
+public:
+	explicit InstArena(size_t chunk_sz = 64 * 1024);
+	~InstArena();
+
+	InstArena(const InstArena&) = delete;
+	InstArena& operator=(const InstArena&) = delete;
+
+	/// construct a T (derived from Inst) in the arena
+	template<class T, class... Args>
+	T* make(Args&&... args)
+	{
+		void *const p = alloc(sizeof(T), alignof(T));
+		T *const t = new (p) T(std::forward<Args>(args)...);
+		insts_.push_back(t);
+		return t;
+	}
+
+	/// destroy all instructions (keeping the memory for reuse)
+	void clear();
+
+	/// number of live instructions
+	size_t size() const { return insts_.size(); }
+
+	/// bytes of backing storage
+	size_t capacity() const { return chunks_.size() * chunk_sz_; }
+
+private: // methods
+	void* alloc(size_t sz, size_t align);
+
+private: // data
+	const size_t chunk_sz_;
+	std::vector<std::unique_ptr<uint8_t[]>> chunks_;
+	size_t cur_chunk_ = 0; ///< index of chunk being filled
+	size_t used_ = 0; ///< bytes used in current chunk
+	std::vector<Inst*> insts_; ///< for destruction
+};
+
+}
+
+#endif
+
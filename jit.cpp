@@ -0,0 +1,345 @@
+#include "jit.hpp"
+#include "fast_arch_state.hpp"
+#include "sparse_mem.hpp"
+#include <sys/mman.h>
+#include <cstring>
+
+namespace
+{
+using namespace rvfun;
+
+// (called from translated code)
+uint64_t loadMem(FastState *state, uint64_t va, uint32_t sz)
+{
+	return state->readMem(va, sz);
+}
+
+void storeMem(FastState *state, uint64_t va, uint64_t val, uint32_t sz)
+{
+	state->writeMem(va, sz, val);
+}
+
+#if defined(__x86_64__)
+/// x86-64 host registers
+enum HostReg : uint8_t
+{
+	RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+	R12 = 12, R13 = 13
+};
+
+/// Emits x86-64 code for MicroOps.
+/// RBX holds the guest registers and R12 the state, the rest are scratch.
+/// Guest registers are loaded and stored around each op, so helper calls need no spills.
+class Emitter
+{
+public:
+	explicit Emitter(std::vector<uint8_t> &code)
+	: code_(code)
+	{
+	}
+
+	// uint64_t fn(uint64_t *regs, FastState *state)
+	void prologue()
+	{
+		bytes({0x53}); // push rbx
+		bytes({0x41, 0x54}); // push r12
+		bytes({0x41, 0x55}); // push r13 (keeps the stack 16 byte aligned for calls)
+		bytes({0x48, 0x89, 0xfb}); // mov rbx, rdi
+		bytes({0x49, 0x89, 0xf4}); // mov r12, rsi
+	}
+
+	/// return the PC in RAX
+	void epilogue()
+	{
+		bytes({0x41, 0x5d}); // pop r13
+		bytes({0x41, 0x5c}); // pop r12
+		bytes({0x5b}); // pop rbx
+		bytes({0xc3}); // ret
+	}
+
+	/// translate 'u' at 'pc'
+	///@return true if it ends the translation (RAX has the next PC)
+	bool op(const MicroOp &u, uint64_t pc)
+	{
+		switch (u.kind)
+		{
+		case MicroOp::ALU:
+			alu(u, pc);
+			return false;
+
+		case MicroOp::LOAD:
+			bytes({0x4c, 0x89, 0xe7}); // mov rdi, r12
+			effAddr(u);
+			bytes({0xba}); // mov edx, size
+			imm32(u.size);
+			call(reinterpret_cast<const void*>(&loadMem));
+			if (u.sign && u.size == 1)
+				bytes({0x48, 0x0f, 0xbe, 0xc0}); // movsx rax, al
+			else if (u.sign && u.size == 2)
+				bytes({0x48, 0x0f, 0xbf, 0xc0}); // movsx rax, ax
+			else if (u.sign && u.size == 4)
+				bytes({0x48, 0x63, 0xc0}); // movsxd rax, eax
+			storeReg(u.rd, RAX);
+			return false;
+
+		case MicroOp::STORE:
+			bytes({0x4c, 0x89, 0xe7}); // mov rdi, r12
+			effAddr(u);
+			loadReg(RDX, u.rs2);
+			bytes({0xb9}); // mov ecx, size
+			imm32(u.size);
+			call(reinterpret_cast<const void*>(&storeMem));
+			return false;
+
+		case MicroOp::BCC:
+		{
+			// cmovcc condition codes, by funct3
+			static const uint8_t cc[8] = {0x4, 0x5, 0, 0, 0xc, 0xd, 0x2, 0x3};
+			loadReg(RAX, u.rs1);
+			loadReg(RCX, u.rs2);
+			bytes({0x48, 0x39, 0xc8}); // cmp rax, rcx
+			movImm(RAX, pc + u.len); // (mov keeps the flags)
+			movImm(RDX, pc + u.imm);
+			bytes({0x48, 0x0f, uint8_t(0x40 | cc[u.cond & 7]), 0xc2}); // cmovcc rax, rdx
+			return true;
+		}
+
+		case MicroOp::JAL:
+			link(u, pc);
+			movImm(RAX, pc + u.imm);
+			return true;
+
+		case MicroOp::JALR:
+			// (the link is written before the target is read, as the interpreter does)
+			link(u, pc);
+			loadReg(RAX, u.rs1);
+			bytes({0x48, 0x05}); // add rax, imm
+			imm32(u.imm);
+			bytes({0x48, 0x83, 0xe0, 0xfe}); // and rax, -2
+			return true;
+
+		case MicroOp::JR:
+			loadReg(RAX, u.rs1);
+			return true;
+		}
+		return true;
+	}
+
+	void movImm(HostReg r, uint64_t v)
+	{
+		if (int64_t(v) == int32_t(v))
+		{
+			bytes({0x48, 0xc7, uint8_t(0xc0 | r)}); // mov r, simm32
+			imm32(v);
+		}
+		else
+		{
+			bytes({0x48, uint8_t(0xb8 | r)}); // mov r, imm64
+			for (uint32_t i = 0; i < 8; ++i)
+				code_.push_back(uint8_t(v >> (8 * i)));
+		}
+	}
+
+private: // methods
+	void bytes(std::initializer_list<uint8_t> b) { code_.insert(code_.end(), b); }
+
+	void imm32(uint64_t v)
+	{
+		for (uint32_t i = 0; i < 4; ++i)
+			code_.push_back(uint8_t(v >> (8 * i)));
+	}
+
+	/// 'opc' between host register 'h' and guest register 'r' ([rbx + 8*r])
+	void regMem(uint8_t opc, HostReg h, uint8_t r)
+	{
+		const uint32_t disp = r * 8;
+		bytes({uint8_t(0x48 | ((h >> 3) << 2)), opc});
+		if (disp < 0x80)
+		{
+			bytes({uint8_t(0x40 | (h & 7) << 3 | RBX), uint8_t(disp)});
+		}
+		else
+		{
+			bytes({uint8_t(0x80 | (h & 7) << 3 | RBX)});
+			imm32(disp);
+		}
+	}
+
+	void loadReg(HostReg h, uint8_t r) { regMem(0x8b, h, r); } // (register 0 is kept zero)
+
+	void storeReg(uint8_t r, HostReg h)
+	{
+		if (r != 0)
+			regMem(0x89, h, r);
+	}
+
+	/// RSI = rs1 + imm
+	void effAddr(const MicroOp &u)
+	{
+		loadReg(RSI, u.rs1);
+		if (u.imm != 0)
+		{
+			bytes({0x48, 0x81, 0xc6}); // add rsi, imm
+			imm32(u.imm);
+		}
+	}
+
+	void call(const void *fn)
+	{
+		movImm(RAX, reinterpret_cast<uint64_t>(fn));
+		bytes({0xff, 0xd0}); // call rax
+	}
+
+	void link(const MicroOp &u, uint64_t pc)
+	{
+		if (u.rd == 0)
+			return;
+		movImm(RAX, pc + u.len);
+		storeReg(u.rd, RAX);
+	}
+
+	void alu(const MicroOp &u, uint64_t pc)
+	{
+		if (u.rd == 0)
+			return; // (no side effects)
+
+		if (u.op == MicroOp::LI || u.op == MicroOp::AUIPC)
+		{
+			movImm(RAX, u.op == MicroOp::LI ? u.imm : pc + u.imm);
+			storeReg(u.rd, RAX);
+			return;
+		}
+
+		loadReg(RAX, u.rs1);
+		if (u.use_imm)
+			movImm(RCX, u.imm);
+		else
+			loadReg(RCX, u.rs2);
+
+		// RAX op= RCX, with 32 bit operands for words
+		const uint8_t w = u.word ? 0x40 : 0x48;
+		switch (u.op)
+		{
+		case MicroOp::ADD:  bytes({w, 0x01, 0xc8}); break;
+		case MicroOp::SUB:  bytes({w, 0x29, 0xc8}); break;
+		case MicroOp::XOR:  bytes({w, 0x31, 0xc8}); break;
+		case MicroOp::OR:   bytes({w, 0x09, 0xc8}); break;
+		case MicroOp::AND:  bytes({w, 0x21, 0xc8}); break;
+		case MicroOp::MUL:  bytes({w, 0x0f, 0xaf, 0xc1}); break; // imul rax, rcx
+		case MicroOp::SLL:  bytes({w, 0xd3, 0xe0}); break; // shl rax, cl (x86 masks the count like RISC-V)
+		case MicroOp::SRL:  bytes({w, 0xd3, 0xe8}); break; // shr rax, cl
+		case MicroOp::SRA:  bytes({w, 0xd3, 0xf8}); break; // sar rax, cl
+		case MicroOp::SLT:
+		case MicroOp::SLTU:
+			bytes({0x48, 0x39, 0xc8}); // cmp rax, rcx
+			bytes({0x0f, uint8_t(u.op == MicroOp::SLT ? 0x9c : 0x92), 0xc0}); // setl/setb al
+			bytes({0x0f, 0xb6, 0xc0}); // movzx eax, al
+			break;
+		case MicroOp::LI:
+		case MicroOp::AUIPC:
+			break;
+		}
+		if (u.word)
+			bytes({0x48, 0x63, 0xc0}); // movsxd rax, eax
+		storeReg(u.rd, RAX);
+	}
+
+private: // data
+	std::vector<uint8_t> &code_;
+};
+#endif
+}
+
+namespace rvfun
+{
+Jit::Jit()
+{
+}
+
+Jit::~Jit()
+{
+	if (buf_)
+		munmap(buf_, CODE_SZ);
+}
+
+bool Jit::supported()
+{
+#if defined(__x86_64__)
+	return true;
+#else
+	return false;
+#endif
+}
+
+Jit::Code Jit::translate(uint64_t pc, const std::vector<Inst*> &insts, uint32_t &count)
+{
+	count = 0;
+	full_ = false;
+#if defined(__x86_64__)
+	if (!buf_ && !map_fail_)
+	{
+		void *const p = mmap(nullptr, CODE_SZ, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			map_fail_ = true;
+		else
+			buf_ = static_cast<uint8_t*>(p);
+	}
+	if (!buf_)
+		return nullptr;
+
+	tmp_.clear();
+	Emitter em(tmp_);
+	em.prologue();
+
+	uint64_t cur_pc = pc;
+	bool ended = false;
+	for (const Inst *inst : insts)
+	{
+		MicroOp u;
+		if (!inst->lower(u))
+			break;
+
+		++count;
+		ended = em.op(u, cur_pc);
+		cur_pc += u.len;
+		if (ended)
+			break;
+	}
+	if (count == 0)
+		return nullptr;
+
+	if (!ended)
+		em.movImm(RAX, cur_pc);
+	em.epilogue();
+
+	if (tmp_.size() > CODE_SZ - used_)
+	{
+		count = 0;
+		full_ = true;
+		++fills_;
+		return nullptr;
+	}
+
+	uint8_t *const entry = buf_ + used_;
+	memcpy(entry, tmp_.data(), tmp_.size());
+	used_ += (tmp_.size() + 15) & ~size_t(15);
+	if (used_ > CODE_SZ)
+		used_ = CODE_SZ;
+
+	++blocks_;
+	insts_ += count;
+	return reinterpret_cast<Code>(entry);
+#else
+	(void)pc;
+	(void)insts;
+	return nullptr;
+#endif
+}
+
+void Jit::clear()
+{
+	used_ = 0;
+	full_ = false;
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef RVFUN_JIT_HPP
+#define RVFUN_JIT_HPP
+
+#include "inst.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rvfun
+{
+/// Translates runs of integer instructions (see Inst::lower()) to host code.
+/// Translated code works on the integer registers of a FastState in memory, and goes through
+/// its memory calls (so stores still invalidate stale code). Only x86-64 hosts are implemented.
+class Jit
+{
+public:
+	/// run translated instructions from the first one's PC
+	///@return PC of the next instruction
+	typedef uint64_t (*Code)(uint64_t *regs, FastState *state);
+
+	/// bytes of host code (translation fails once they are used, until clear(), see full())
+	static constexpr size_t CODE_SZ = 16 * 1024 * 1024;
+
+	Jit();
+	~Jit();
+
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+
+	///@return true if this host can run translations
+	static bool supported();
+
+	/// translate the longest prefix of 'insts' (the first at 'pc') which lowers to MicroOps,
+	/// ending after the first control transfer
+	///@return entry point, or nullptr if nothing was translated ('count' gets the instructions translated)
+	Code translate(uint64_t pc, const std::vector<Inst*> &insts, uint32_t &count);
+
+	/// free all translations (none may be running)
+	void clear();
+
+	///@return true if the last translate() failed for lack of space
+	bool full() const { return full_; }
+
+	uint64_t blocksTranslated() const { return blocks_; }
+	uint64_t instsTranslated() const { return insts_; }
+	size_t codeUsed() const { return used_; }
+	/// times the buffer filled up
+	uint64_t fills() const { return fills_; }
+
+private: // data
+	uint8_t *buf_ = nullptr; ///< CODE_SZ bytes, executable
+	size_t used_ = 0;
+	bool map_fail_ = false;
+	bool full_ = false;
+	std::vector<uint8_t> tmp_; ///< code being emitted
+	uint64_t blocks_ = 0;
+	uint64_t insts_ = 0;
+	uint64_t fills_ = 0;
+};
+
+}
+
+#endif
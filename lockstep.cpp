@@ -0,0 +1,248 @@
+#include "lockstep.hpp"
+#include "inst.hpp"
+#include <unistd.h>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+using namespace rvfun;
+
+bool returnedToShell(const ArchState &state)
+{
+	return (state.getPc() & -63ll) == 0;
+}
+
+std::ostream& printHex(std::ostream &os, uint64_t v)
+{
+	return os << "0x" << std::hex << v << std::dec;
+}
+
+/// (most significant byte first)
+std::ostream& printVec(std::ostream &os, const uint8_t *v)
+{
+	os << "0x" << std::hex << std::setfill('0');
+	for (uint32_t i = ArchState::VLEN_BYTES; i-- > 0;)
+		os << std::setw(2) << uint32_t(v[i]);
+	return os << std::setfill(' ') << std::dec;
+}
+}
+
+namespace rvfun
+{
+Lockstep::Lockstep(Engine engine, uint64_t every)
+: engine_(engine)
+, every_(every)
+, null_os_(nullptr)
+, window_(MAX_WINDOW)
+{
+	test_.setSys(&test_host_);
+	test_.setMem(test_host_.getSparseMem());
+	ref_.setSys(&ref_host_);
+	ref_.setMem(ref_host_.getMem());
+
+	if (engine_ == Engine::DCACHE)
+		test_.setCodeCache(&dcache_);
+	else if (engine_ == Engine::BLOCKS || engine_ == Engine::JIT)
+		test_.setCodeCache(&bcache_);
+	if (engine_ == Engine::JIT)
+		bcache_.setJit(true);
+
+	// the reference's messages would repeat the test's, and its output must not overwrite them
+	ref_host_.setLog(&null_os_, &null_os_);
+	std::ostringstream os;
+	os << '.' << getpid() << ".ref";
+	ref_host_.setOutputSuffix(os.str());
+}
+
+void Lockstep::setMapSegments(bool b)
+{
+	test_host_.setMapSegments(b);
+	ref_host_.setMapSegments(b);
+}
+
+bool Lockstep::load(const char *elf, const std::vector<std::string> &args)
+{
+	if (test_host_.loadElf(elf, test_) || ref_host_.loadElf(elf, ref_))
+		return true;
+
+	for (const std::string &a : args)
+	{
+		test_host_.addArg(a);
+		ref_host_.addArg(a);
+	}
+	const std::string stdin_file = std::string(elf) + ".stdin";
+	test_host_.setStdin(stdin_file);
+	ref_host_.setStdin(stdin_file);
+	test_host_.completeEnv(test_);
+	ref_host_.completeEnv(ref_);
+	return false;
+}
+
+uint64_t Lockstep::stepTest(uint64_t max_insts)
+{
+	if (engine_ == Engine::BLOCKS || engine_ == Engine::JIT)
+		return bcache_.execute(test_, max_insts);
+
+	uint32_t opc_sz = 2;
+	uint32_t full_inst = 0;
+	Inst *inst = nullptr;
+	if (engine_ == Engine::DCACHE)
+		inst = dcache_.decode(test_, opc_sz, full_inst, false);
+	else
+	{
+		test_arena_.clear();
+		inst = decode(test_, opc_sz, full_inst, false, test_arena_);
+	}
+
+	if (inst)
+		inst->execute(test_);
+	else
+		test_.incPc(opc_sz);
+	test_.retire(1);
+	return 1;
+}
+
+void Lockstep::stepRef()
+{
+	uint32_t opc_sz = 2;
+	uint32_t full_inst = 0;
+	ref_arena_.clear();
+	const uint64_t pc = ref_.getPc();
+	Inst *const inst = decode(ref_, opc_sz, full_inst, false, ref_arena_);
+	window_[window_ct_++ % MAX_WINDOW] = Retired{pc, full_inst, opc_sz};
+
+	if (inst)
+		inst->execute(ref_);
+	else
+		ref_.incPc(opc_sz);
+	ref_.retire(1);
+}
+
+bool Lockstep::exited() const
+{
+	return test_host_.hadExit() || ref_host_.hadExit() || returnedToShell(test_) || returnedToShell(ref_);
+}
+
+bool Lockstep::run(std::ostream &os, uint64_t max_insts)
+{
+	uint64_t last_match = icount_;
+	while (!exited() && (max_insts == 0 || icount_ < max_insts))
+	{
+		// run the engine to the next comparison, then the reference as far
+		uint64_t ct = 0;
+		do
+		{
+			uint64_t limit = every_ != EVERY_BLOCK ? every_ - ct : 0;
+			if (max_insts != 0 && (limit == 0 || max_insts - icount_ - ct < limit))
+				limit = max_insts - icount_ - ct;
+			ct += stepTest(limit);
+		}
+		while (every_ != EVERY_BLOCK && ct < every_ && !test_host_.hadExit() && !returnedToShell(test_) &&
+		       (max_insts == 0 || icount_ + ct < max_insts));
+
+		for (uint64_t i = 0; i < ct && !ref_host_.hadExit(); ++i)
+			stepRef();
+		icount_ += ct;
+
+		if (compare(os, last_match))
+			return true;
+		last_match = icount_;
+		window_ct_ = 0;
+	}
+	return false;
+}
+
+bool Lockstep::compare(std::ostream &os, uint64_t last_match)
+{
+	++compares_;
+
+	std::ostringstream diff;
+	std::vector<uint32_t> bad_regs; // integer, then FP + 32, then vector + 64
+	if (test_.getPc() != ref_.getPc())
+	{
+		diff << "  pc  test ";
+		printHex(diff, test_.getPc()) << " reference ";
+		printHex(diff, ref_.getPc()) << std::endl;
+	}
+	for (uint32_t i = 1; i < 32; ++i)
+	{
+		if (test_.getReg(i) != ref_.getReg(i))
+		{
+			diff << "  x" << std::left << std::setw(2) << i << std::right << " test ";
+			printHex(diff, test_.getReg(i)) << " reference ";
+			printHex(diff, ref_.getReg(i)) << std::endl;
+			bad_regs.push_back(i);
+		}
+	}
+	for (uint32_t i = 0; i < 32; ++i)
+	{
+		if (test_.getFpRaw(i) != ref_.getFpRaw(i))
+		{
+			diff << "  f" << std::left << std::setw(2) << i << std::right << " test ";
+			printHex(diff, test_.getFpRaw(i)) << " reference ";
+			printHex(diff, ref_.getFpRaw(i)) << std::endl;
+			bad_regs.push_back(32 + i);
+		}
+	}
+	for (uint32_t i = 0; i < 32; ++i)
+	{
+		if (memcmp(test_.getVecReg(i), ref_.getVecReg(i), ArchState::VLEN_BYTES) != 0)
+		{
+			diff << "  v" << std::left << std::setw(2) << i << std::right << " test ";
+			printVec(diff, test_.getVecReg(i)) << " reference ";
+			printVec(diff, ref_.getVecReg(i)) << std::endl;
+			bad_regs.push_back(64 + i);
+		}
+	}
+	if (test_host_.hadExit() != ref_host_.hadExit() ||
+	    (test_host_.hadExit() && test_host_.exitStatus() != ref_host_.exitStatus()))
+	{
+		diff << "  exit test " << (test_host_.hadExit() ? "yes" : "no") << " (" << test_host_.exitStatus()
+		     << ") reference " << (ref_host_.hadExit() ? "yes" : "no") << " (" << ref_host_.exitStatus() << ')' << std::endl;
+	}
+
+	const std::string d = diff.str();
+	if (d.empty())
+		return false;
+
+	os << "Lockstep divergence after " << icount_ << " instructions (last match at " << last_match << "):" << std::endl;
+	os << d;
+
+	// the reference's instructions since the last match, marking the first to write a differing register
+	const uint64_t shown = window_ct_ < MAX_WINDOW ? window_ct_ : MAX_WINDOW;
+	os << "Reference instructions since the last match";
+	if (shown < window_ct_)
+		os << " (last " << shown << " of " << window_ct_ << ')';
+	os << ':' << std::endl;
+
+	bool marked = false;
+	for (uint64_t n = window_ct_ - shown; n < window_ct_; ++n)
+	{
+		const Retired &r = window_[n % MAX_WINDOW];
+		std::unique_ptr<Inst> inst(r.opc_sz == 2 ? decode16(r.opcode) : decode32(r.opcode));
+
+		bool first = false;
+		if (inst && !marked)
+		{
+			for (const Inst::RegDep &dep : inst->dsts())
+			{
+				const uint32_t reg = uint32_t(dep.reg) + (dep.rf == Inst::RegFile::FLOAT ? 32 :
+				                                          dep.rf == Inst::RegFile::VECTOR ? 64 : 0);
+				for (const uint32_t b : bad_regs)
+					first |= dep.rf != Inst::RegFile::NONE && b == reg;
+			}
+			marked = first;
+		}
+
+		os << (first ? "=> " : "   ");
+		printHex(os, r.pc) << ' ' << std::hex << std::setfill('0') << std::setw(r.opc_sz * 2) << r.opcode
+		   << std::setfill(' ') << std::dec << ' ' << (inst ? inst->disasm() : std::string("(illegal)")) << std::endl;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef RVFUN_LOCKSTEP_HPP
+#define RVFUN_LOCKSTEP_HPP
+
+#include "block_cache.hpp"
+#include "decode_cache.hpp"
+#include "fast_arch_state.hpp"
+#include "host_system.hpp"
+#include "inst_arena.hpp"
+#include "simple_arch_state.hpp"
+#include "sparse_mem.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace rvfun
+{
+/// Runs one program on an engine under test and on the reference path side by side (each with
+/// its own HostSystem), comparing the integer, FP and vector registers and the PC at intervals.
+/// The reference is a SimpleArchState stepping through freshly decoded instructions.
+class Lockstep
+{
+public:
+	enum class Engine
+	{
+		STEP, ///< FastState, decoding every instruction
+		DCACHE, ///< FastState, through a DecodeCache
+		BLOCKS, ///< FastState, through a BlockCache
+		JIT ///< as BLOCKS, with hot blocks translated
+	};
+
+	/// compare after every block (every instruction for the stepping engines)
+	static constexpr uint64_t EVERY_BLOCK = 0;
+	/// reference instructions kept for a divergence report
+	static constexpr uint32_t MAX_WINDOW = 256;
+
+	///@param every instructions between comparisons (or EVERY_BLOCK)
+	Lockstep(Engine engine, uint64_t every);
+
+	/// map ELF segments copy-on-write (before load())
+	void setMapSegments(bool b = true);
+
+	/// load 'elf' with arguments 'args' (and stdin from '<elf>.stdin') into both states
+	///@return true on error
+	bool load(const char *elf, const std::vector<std::string> &args);
+
+	/// run until exit, return to the shell, 'max_insts' (0 for no limit) or a divergence,
+	/// which is described on 'os'
+	///@return true on divergence
+	bool run(std::ostream &os, uint64_t max_insts = 0);
+
+	uint64_t icount() const { return icount_; }
+	uint64_t compares() const { return compares_; }
+	const HostSystem& testHost() const { return test_host_; }
+
+private: // types
+	struct Retired
+	{
+		uint64_t pc;
+		uint32_t opcode;
+		uint32_t opc_sz;
+	};
+
+private: // methods
+	/// execute at least one instruction (at most 'max_insts', 0 for no limit) on the engine under test
+	///@return number executed
+	uint64_t stepTest(uint64_t max_insts);
+	void stepRef();
+	bool exited() const;
+
+	///@return true (and describe it on 'os') if the states differ
+	bool compare(std::ostream &os, uint64_t last_match);
+
+private: // data
+	const Engine engine_;
+	const uint64_t every_;
+	HostSystem test_host_;
+	HostSystem ref_host_;
+	FastState test_;
+	SimpleArchState ref_;
+	DecodeCache dcache_;
+	BlockCache bcache_;
+	InstArena test_arena_; ///< (STEP) recycled every instruction
+	InstArena ref_arena_; ///< recycled every instruction
+	std::ostream null_os_; ///< drops the reference's messages
+	std::vector<Retired> window_; ///< ring of the last reference instructions
+	uint64_t window_ct_ = 0; ///< instructions put in 'window_' since the last match
+	uint64_t icount_ = 0;
+	uint64_t compares_ = 0;
+};
+
+}
+
+#endif
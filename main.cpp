@@ -1,83 +1,205 @@
 #include "inst.hpp"
+#include "inst_arena.hpp"
+#include "block_cache.hpp"
+#include "decode_cache.hpp"
+#include "fast_forward.hpp"
+#include "hart_scheduler.hpp"
+#include "fast_arch_state.hpp"
 #include "sparse_mem.hpp"
 #include "simple_arch_state.hpp"
+#include "profile.hpp"
+#include "simpoint.hpp"
+#include "trace.hpp"
 #include "host_system.hpp"
+#include "lockstep.hpp"
+#include "observer.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <getopt.h>
 
 using namespace rvfun;
 
-int main(int argc, char **argv)
+namespace
+{
+/// command line controls
+struct Options
 {
-	if (argc == 1)
-	{
-		std::cerr << "Usage: " << argv[0] << "[-d][-i instruction_count] <elf file>" << std::endl;
-		return 1;
-	}
-
 	bool debug = false;
 	bool verbose = false;
+	bool use_dcache = false;
+	bool use_blocks = false;
+	bool step = false; ///< one instruction at a time, no caching
+	bool map_elf = false;
+	uint32_t hart_threads = 0; ///< host threads for multi-hart mode (0 for single hart)
 	uint64_t max_icount = 0;
-	const char *optstring = "+di:v";
-	int optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
-	while (optc != -1)
-	{
-		if (optc == 'd')
-		{
-			debug = true;
-		}
-		else if (optc == 'i')
-		{
-			max_icount = strtoll(optarg, nullptr, 10);
-		}
-		else if (optc == 'v')
-		{
-			verbose = true;
-		}
+	uint64_t ckpt_at = 0; ///< write a checkpoint at this icount (0 for none)
+	std::string ckpt_file; ///< checkpoint to write
+	const char *resume_file = nullptr; ///< checkpoint to start from
+	const char *trace_file = nullptr; ///< binary trace of retired instructions
+	bool trace_packed = true;
+	bool profile = false; ///< count retired instructions by type, mnemonic and PC
+	bool jit = false; ///< translate hot blocks to host code
+	bool lockstep = false; ///< check the engine against the reference path
+	uint64_t lockstep_every = Lockstep::EVERY_BLOCK; ///< instructions between lockstep comparisons
+	OutputBuffer::Mode output = OutputBuffer::Mode::ASYNC; ///< guest writes
+	uint64_t bbv_interval = 0; ///< instructions per basic block vector (0 for none)
+	std::vector<SimPoint> simpoints; ///< checkpoint at these intervals (instead of writing vectors)
+	uint64_t warmup = 0; ///< instructions before each simulation point to checkpoint at
+	const char *caches = nullptr; ///< cache levels to model (see CacheHierarchy::configure())
+	const char *predictors = nullptr; ///< branch predictors to model (comma separated names)
+};
 
-		optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
-	}
+/// checkpoint to write
+struct CkptPoint
+{
+	uint64_t at; ///< icount
+	std::string file;
+};
 
-	// pull unused arg from getopt
-	const char *prog_name = argv[optind];
+///@return checkpoints asked for by 'opt' after 'icount', in order
+std::vector<CkptPoint> checkpointsAfter(const Options &opt, uint64_t icount)
+{
+	std::vector<CkptPoint> ret;
+	if (opt.ckpt_at != 0 && opt.ckpt_at > icount)
+		ret.push_back(CkptPoint{opt.ckpt_at, opt.ckpt_file});
 
-	std::cout << "Run program " << prog_name;
-	if (max_icount != 0)
+	// '<file>.<cluster>', at the start of the interval less the warmup
+	for (const SimPoint &p : opt.simpoints)
 	{
-		std::cout << " for " << max_icount << " instructions";
+		const uint64_t start = p.interval * opt.bbv_interval;
+		const uint64_t at = start > opt.warmup ? start - opt.warmup : 0;
+		if (at >= icount)
+			ret.push_back(CkptPoint{at, opt.ckpt_file + '.' + std::to_string(p.cluster)});
 	}
-	std::cout << '.' << std::endl;
-
-	HostSystem host;
-	SimpleArchState state;
 
-	state.setSys(&host);
-	state.setMem(host.getMem());
-	state.setDebug(verbose);
+	std::stable_sort(ret.begin(), ret.end(), [](const CkptPoint &a, const CkptPoint &b) { return a.at < b.at; });
+	return ret;
+}
 
+/// load the ELF and set up argv and the stack in 'state'
+///@return true on error
+bool loadProgram(const char *prog_name, char **args, HostSystem &host, ArchState &state)
+{
 	if (host.loadElf(prog_name, state))
 	{
 		std::cerr << "Failure loading ELF." << std::endl;
-		return 1;
+		return true;
 	}
 
-	++optind;
-	while (optind < argc)
+	for (; *args; ++args)
 	{
-		const char *arg = argv[optind];
+		const char *arg = *args;
 		std::cout << "Add argument: " << arg << std::endl;
 		host.addArg(arg);
-		++optind;
 	}
 
 	host.setStdin(std::string(prog_name) + ".stdin"); // TODO: make an option
 	host.completeEnv(state);
+	return false;
+}
+
+void printMemStats(HostSystem &host)
+{
+	const SparseMem::Stats ms = host.getSparseMem()->stats();
+	std::cout << "Memory: " << ms.resident / 1024 << " KB resident of "
+	          << ms.reserved / 1024 << " KB reserved." << std::endl;
+}
+
+void printMips(uint64_t icount, std::chrono::steady_clock::time_point start)
+{
+	const std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+	if (secs.count() > 0)
+		std::cout << "Simulation speed: " << icount / secs.count() / 1e6 << " MIPS." << std::endl;
+}
+
+/// execute blocks until 'max_insts' (0 for no limit), exit, or return to the shell
+uint64_t runBlocks(FastState &state, BlockCache &bcache, const HostSystem &host, uint64_t max_insts)
+{
+	return fastForward(state, bcache, host, max_insts);
+}
+
+/// (traced state, one block per call)
+uint64_t runBlocks(ArchState &state, BlockCache &bcache, const HostSystem&, uint64_t max_insts)
+{
+	return bcache.execute(state, max_insts);
+}
+
+/// load and run the program (for any type of state), calling 'obs' around each stepped instruction
+template<class State, class Observer>
+int simulate(const Options &opt, const char *prog_name, char **args, HostSystem &host, State &state, Observer &obs)
+{
+	DecodeCache dcache;
+	BlockCache bcache;
+	InstArena arena; // uncached instructions, recycled every step
+	TraceWriter trace;
+	Profiler prof;
+	if (opt.trace_file && trace.open(opt.trace_file, opt.trace_packed))
+	{
+		std::cerr << "Failure opening trace " << opt.trace_file << std::endl;
+		return 1;
+	}
+
+	std::unique_ptr<BbvWriter> bbv;
+	const std::string bbv_file = std::string(prog_name) + ".bb";
+	if (opt.bbv_interval != 0 && opt.simpoints.empty())
+	{
+		bbv.reset(new BbvWriter(opt.bbv_interval));
+		if (bbv->open(bbv_file.c_str()))
+		{
+			std::cerr << "Failure opening " << bbv_file << std::endl;
+			return 1;
+		}
+		bcache.setBbv(bbv.get());
+	}
+
+	if (opt.use_blocks)
+		state.setCodeCache(&bcache);
+	else if (opt.use_dcache)
+		state.setCodeCache(&dcache);
+	if (opt.jit && bcache.setJit(true))
+		std::cerr << "The JIT is not supported on this host, interpreting." << std::endl;
 
 	uint64_t icount = 0;
+	if (opt.resume_file)
+	{
+		if (host.restoreCheckpoint(opt.resume_file, state, icount))
+			return 1;
+	}
+	else if (loadProgram(prog_name, args, host, state))
+		return 1;
+
+	const bool debug = opt.debug;
+	const uint64_t max_icount = opt.max_icount;
+	const uint64_t start_icount = icount;
+	const auto start = std::chrono::steady_clock::now();
+	const std::vector<CkptPoint> ckpts = checkpointsAfter(opt, icount);
+	size_t next_ckpt = 0;
+	bool ckpt_fail = false;
+	auto checkpoint = [&]
+	{
+		for (; next_ckpt < ckpts.size() && icount >= ckpts[next_ckpt].at && !ckpt_fail; ++next_ckpt)
+			ckpt_fail = host.saveCheckpoint(ckpts[next_ckpt].file.c_str(), state, icount);
+	};
+	uint64_t next_bbv = bbv ? (icount / opt.bbv_interval + 1) * opt.bbv_interval : 0;
+
 	while (1)
 	{
+		checkpoint();
+		if (ckpt_fail)
+			return 1;
+		if (!opt.simpoints.empty() && next_ckpt == ckpts.size())
+		{
+			std::cout << "Checkpointed every simulation point after " << icount << " instructions." << std::endl;
+			break;
+		}
+
 		if (host.hadExit())
 		{
 			std::cout << "Program exited after " << icount << " instructions." << std::endl;
@@ -90,30 +212,73 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		if (opt.use_blocks)
+		{
+			// checks are only needed at block boundaries
+			uint64_t limit = max_icount ? max_icount - icount : 0;
+			if (next_ckpt < ckpts.size() && (limit == 0 || ckpts[next_ckpt].at - icount < limit))
+				limit = ckpts[next_ckpt].at - icount;
+			if (bbv && (limit == 0 || next_bbv - icount < limit))
+				limit = next_bbv - icount;
+
+			icount += runBlocks(state, bcache, host, limit);
+			if (bbv && icount >= next_bbv)
+			{
+				bbv->endInterval();
+				next_bbv += opt.bbv_interval;
+			}
+			if (max_icount != 0 && icount >= max_icount)
+				break;
+			continue;
+		}
+
 		uint32_t opc_sz = 2;
 		uint32_t full_inst = 0;
 
 		if (debug)
 			std::cout << std::setw(12) << icount << ' ';
 
-		std::unique_ptr<Inst> inst(decode(state, opc_sz, full_inst, debug));
+		Inst *inst = nullptr;
+		if (opt.use_dcache)
+		{
+			inst = dcache.decode(state, opc_sz, full_inst, debug);
+		}
+		else
+		{
+			arena.clear();
+			inst = decode(state, opc_sz, full_inst, debug, arena);
+		}
+
 		if (!inst)
 		{
+			if (opt.profile)
+				prof.recordIllegal();
 			state.incPc(opc_sz);
 		}
 		else
 		{
+			if (opt.trace_file)
+				trace.record(state, *inst, full_inst, opc_sz); // (before execute, for the EA)
+			if (opt.profile)
+				prof.record(state, *inst, full_inst, opc_sz);
+			obs.before(state, *inst, opc_sz);
 			inst->execute(state);
+			obs.after(state, *inst);
 		}
 
 		if (debug)
 			std::cout << std::endl;
 
+		state.retire(1);
 		++icount;
 		if (max_icount != 0 && icount >= max_icount)
 			break;
 	}
 
+	checkpoint(); // (at the instruction limit)
+	if (ckpt_fail)
+		return 1;
+
 	// dump architected state
 	if (debug)
 	{
@@ -129,7 +294,359 @@ int main(int argc, char **argv)
 		}
 	}
 	std::cout << "Executed " << icount << " instructions." << std::endl;
+	if (opt.trace_file)
+	{
+		trace.close();
+		std::cout << "Traced " << trace.count() << " instructions to " << opt.trace_file << '.' << std::endl;
+	}
+	if (bbv)
+	{
+		if (bbv->close())
+		{
+			std::cerr << "Failure writing " << bbv_file << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote " << bbv->intervals() << " basic block vectors (" << bbv->blocks()
+		          << " blocks) to " << bbv_file << '.' << std::endl;
+	}
+	if (const Jit *jit = bcache.jit())
+	{
+		std::cout << "JIT translated " << jit->instsTranslated() << " instructions in " << jit->blocksTranslated()
+		          << " blocks, and executed " << bcache.jitInsts() << '.' << std::endl;
+		if (jit->fills())
+			std::cout << "JIT code buffer filled " << jit->fills() << " times (translations were dropped)." << std::endl;
+	}
+	if (!debug && !opt.verbose)
+		printMips(icount - start_icount, start);
+	printMemStats(host);
+	if (opt.profile)
+		prof.report(std::cout);
+	obs.report(std::cout);
+
+	return 0;
+}
+
+/// simulate() observed by 'models' (if there are any)
+template<class State>
+int simulateModels(const Options &opt, const char *prog_name, char **args, HostSystem &host, State &state, ModelObserver &models)
+{
+	if (models.empty())
+	{
+		NullObserver none;
+		return simulate(opt, prog_name, args, host, state, none);
+	}
+	return simulate(opt, prog_name, args, host, state, models);
+}
+
+/// run the program on the engine picked by 'opt' and the reference path, comparing them
+int simulateLockstep(const Options &opt, const char *prog_name, char **args)
+{
+	Lockstep::Engine engine = Lockstep::Engine::STEP;
+	if (opt.jit)
+		engine = Lockstep::Engine::JIT;
+	else if (opt.use_blocks)
+		engine = Lockstep::Engine::BLOCKS;
+	else if (opt.use_dcache)
+		engine = Lockstep::Engine::DCACHE;
+
+	Lockstep ls(engine, opt.lockstep_every);
+	ls.setMapSegments(opt.map_elf);
+	std::vector<std::string> arg_list;
+	for (; *args; ++args)
+	{
+		std::cout << "Add argument: " << *args << std::endl;
+		arg_list.emplace_back(*args);
+	}
+	if (ls.load(prog_name, arg_list))
+	{
+		std::cerr << "Failure loading ELF." << std::endl;
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	if (ls.run(std::cout, opt.max_icount))
+		return 1;
+
+	if (ls.testHost().hadExit())
+		std::cout << "Program exited after " << ls.icount() << " instructions." << std::endl;
+	std::cout << "Lockstep matched " << ls.icount() << " instructions (" << ls.compares() << " comparisons)." << std::endl;
+	printMips(ls.icount(), start);
+	return 0;
+}
+
+/// run the program's threads as harts, on 'opt.hart_threads' host threads
+int simulateHarts(const Options &opt, const char *prog_name, char **args, HostSystem &host)
+{
+	SimpleArchState init;
+	init.setSys(&host);
+	init.setMem(host.getMem());
+	if (loadProgram(prog_name, args, host, init))
+		return 1;
+
+	HartScheduler sched(host, opt.hart_threads);
+	sched.addHart(init);
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t icount = sched.run(opt.max_icount);
+
+	if (host.hadExit())
+		std::cout << "Program exited after " << icount << " instructions." << std::endl;
+	else if (sched.returnedToShell())
+		std::cout << "Program returned to shell after " << icount << " instructions." << std::endl;
+
+	std::cout << "Executed " << icount << " instructions on " << sched.numHarts() << " harts." << std::endl;
+	printMips(icount, start);
+	printMemStats(host);
 
 	return 0;
 }
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 1)
+	{
+		std::cerr << "Usage: " << argv[0] << "[-b][-B none|line|async][-c][-C cache_levels][-d][-G predictors][-i instruction_count][-j][-l inst|block|count][-m][-p][-s][-t host_threads][-T trace_file][-u][-v]"
+		          << "[-V bbv_interval [-P simpoints_file][-W warmup]][-w checkpoint_icount][-o checkpoint_file] <elf file>" << std::endl;
+		std::cerr << "   or: " << argv[0] << " [options] -r checkpoint_file" << std::endl;
+		return 1;
+	}
+
+	Options opt;
+	const char *optstring = "+bB:cC:dG:i:jl:mo:pP:r:st:T:uvV:w:W:";
+	const char *simpoints_file = nullptr;
+	int optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	while (optc != -1)
+	{
+		if (optc == 'b')
+		{
+			opt.use_blocks = true;
+		}
+		else if (optc == 'B')
+		{
+			if (strcmp(optarg, "none") == 0)
+				opt.output = OutputBuffer::Mode::NONE;
+			else if (strcmp(optarg, "line") == 0)
+				opt.output = OutputBuffer::Mode::LINE;
+			else if (strcmp(optarg, "async") == 0)
+				opt.output = OutputBuffer::Mode::ASYNC;
+			else
+			{
+				std::cerr << "Unknown output buffering " << optarg << " (none, line or async)." << std::endl;
+				return 1;
+			}
+		}
+		else if (optc == 'c')
+		{
+			opt.use_dcache = true;
+		}
+		else if (optc == 'C')
+		{
+			opt.caches = optarg;
+		}
+		else if (optc == 'd')
+		{
+			opt.debug = true;
+		}
+		else if (optc == 'G')
+		{
+			opt.predictors = optarg;
+		}
+		else if (optc == 'i')
+		{
+			opt.max_icount = strtoll(optarg, nullptr, 10);
+		}
+		else if (optc == 'j')
+		{
+			opt.jit = true;
+		}
+		else if (optc == 'l')
+		{
+			opt.lockstep = true;
+			if (strcmp(optarg, "inst") == 0)
+				opt.lockstep_every = 1;
+			else if (strcmp(optarg, "block") == 0)
+				opt.lockstep_every = Lockstep::EVERY_BLOCK;
+			else
+				opt.lockstep_every = strtoull(optarg, nullptr, 10);
+		}
+		else if (optc == 'm')
+		{
+			opt.map_elf = true;
+		}
+		else if (optc == 'o')
+		{
+			opt.ckpt_file = optarg;
+		}
+		else if (optc == 'p')
+		{
+			opt.profile = true;
+		}
+		else if (optc == 'P')
+		{
+			simpoints_file = optarg;
+		}
+		else if (optc == 'r')
+		{
+			opt.resume_file = optarg;
+		}
+		else if (optc == 's')
+		{
+			opt.step = true;
+		}
+		else if (optc == 't')
+		{
+			opt.hart_threads = strtoul(optarg, nullptr, 10);
+		}
+		else if (optc == 'T')
+		{
+			opt.trace_file = optarg;
+		}
+		else if (optc == 'u')
+		{
+			opt.trace_packed = false;
+		}
+		else if (optc == 'v')
+		{
+			opt.verbose = true;
+		}
+		else if (optc == 'V')
+		{
+			opt.bbv_interval = strtoull(optarg, nullptr, 10);
+		}
+		else if (optc == 'w')
+		{
+			opt.ckpt_at = strtoll(optarg, nullptr, 10);
+		}
+		else if (optc == 'W')
+		{
+			opt.warmup = strtoull(optarg, nullptr, 10);
+		}
+
+		optc = getopt_long(argc, argv, optstring, nullptr, nullptr);
+	}
+
+	// tracing, profiling and models are per instruction (they step through the decode cache, unless -s)
+	const bool per_inst = opt.trace_file || opt.profile || opt.caches || opt.predictors;
+	if (per_inst && !opt.step)
+		opt.use_dcache = true;
+	const bool stepping = opt.debug || per_inst;
+
+	// fast forward through blocks, unless stepping is asked for
+	if (!opt.use_dcache && !opt.step)
+		opt.use_blocks = true;
+	if (stepping)
+		opt.use_blocks = false;
+
+	// pull unused arg from getopt
+	const char *prog_name = optind < argc ? argv[optind] : opt.resume_file;
+	char **const args = optind < argc ? argv + optind + 1 : argv + optind;
+	if (!prog_name)
+	{
+		std::cerr << "Missing ELF file." << std::endl;
+		return 1;
+	}
+	if (opt.ckpt_file.empty())
+		opt.ckpt_file = std::string(prog_name) + ".ckpt";
+
+	if (simpoints_file && opt.bbv_interval == 0)
+	{
+		std::cerr << "Simulation points (-P) need the interval they were picked with (-V)." << std::endl;
+		return 1;
+	}
+	if (simpoints_file && (readSimPoints(simpoints_file, opt.simpoints) || opt.simpoints.empty()))
+	{
+		std::cerr << "Failure reading simulation points " << simpoints_file << std::endl;
+		return 1;
+	}
+	if ((opt.ckpt_at != 0 || opt.resume_file || !opt.simpoints.empty()) && opt.hart_threads != 0)
+	{
+		std::cerr << "Checkpoints are not supported with harts (-t)." << std::endl;
+		return 1;
+	}
+	if (opt.bbv_interval != 0 && (!opt.use_blocks || opt.hart_threads != 0 || opt.lockstep))
+	{
+		std::cerr << "Basic block vectors (-V) are collected by the block engine (not -c, -C, -d, -G, -l, -p, -s, -t or -T)." << std::endl;
+		return 1;
+	}
+	if (opt.jit && (!opt.use_blocks || opt.verbose || opt.hart_threads != 0))
+	{
+		std::cerr << "The JIT (-j) only runs with the block engine (not -c, -C, -d, -G, -p, -s, -t, -T or -v)." << std::endl;
+		return 1;
+	}
+	if (opt.lockstep && (stepping || opt.verbose || opt.hart_threads != 0 || opt.ckpt_at != 0 || opt.resume_file))
+	{
+		std::cerr << "Lockstep (-l) does not combine with -C, -d, -G, -p, -r, -t, -T, -v or -w." << std::endl;
+		return 1;
+	}
+	if (per_inst && opt.hart_threads != 0)
+	{
+		std::cerr << "Traces, profiles and models are not supported with harts (-t)." << std::endl;
+		return 1;
+	}
+
+	ModelObserver models;
+	if (opt.caches)
+	{
+		std::unique_ptr<CacheHierarchy> caches(new CacheHierarchy);
+		if (caches->configure(opt.caches))
+		{
+			std::cerr << "Bad cache levels " << opt.caches << " (<size>:<ways>[:<line>],... from L1 out)." << std::endl;
+			return 1;
+		}
+		models.setCaches(std::move(caches));
+	}
+	if (opt.predictors)
+	{
+		std::istringstream is(opt.predictors);
+		std::string name;
+		while (std::getline(is, name, ','))
+		{
+			std::unique_ptr<BranchPredictor> p = makeBranchPredictor(name);
+			if (!p)
+			{
+				std::cerr << "Unknown branch predictor " << name << " (bimodal, gshare or tage)." << std::endl;
+				return 1;
+			}
+			models.addPredictor(std::move(p));
+		}
+	}
+
+	if (opt.resume_file)
+		std::cout << "Resume checkpoint " << opt.resume_file;
+	else
+		std::cout << "Run program " << prog_name;
+	if (opt.max_icount != 0)
+	{
+		std::cout << " for " << opt.max_icount << " instructions";
+	}
+	std::cout << '.' << std::endl;
+
+	if (opt.lockstep)
+		return simulateLockstep(opt, prog_name, args);
+
+	HostSystem host;
+	host.setMapSegments(opt.map_elf);
+	host.setOutputMode(opt.output);
+
+	if (opt.hart_threads != 0)
+		return simulateHarts(opt, prog_name, args, host);
+
+	if (opt.verbose)
+	{
+		// verbose tracing comes from SimpleArchState
+		SimpleArchState state;
+		state.setSys(&host);
+		state.setMem(host.getMem());
+		state.setDebug(opt.verbose);
+
+		return simulateModels(opt, prog_name, args, host, state, models);
+	}
+
+	// no tracing, bind state access statically
+	FastState state;
+	state.setSys(&host);
+	state.setMem(host.getSparseMem());
+
+	return simulateModels(opt, prog_name, args, host, state, models);
+}
 
@@ -0,0 +1,14 @@
+#include "observer.hpp"
+#include <ostream>
+
+namespace rvfun
+{
+void ModelObserver::report(std::ostream &os) const
+{
+	if (caches_)
+		caches_->report(os, insts_);
+	for (const auto &p : preds_)
+		p->report(os, insts_);
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef RVFUN_OBSERVER_HPP
+#define RVFUN_OBSERVER_HPP
+
+#include "arch_state.hpp"
+#include "branch_predictor.hpp"
+#include "cache_model.hpp"
+#include "inst.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+namespace rvfun
+{
+/// Observers see every instruction of the driver's stepping loop, which is a template over
+/// the observer type (so the calls bind statically, and NullObserver's compile away). Members:
+///   template<class State> void before(State&, const Inst&, uint32_t opc_sz) (the PC is the instruction's)
+///   template<class State> void after(State&, const Inst&) (the PC is the next instruction's)
+///   void report(std::ostream&) const (at exit)
+/// The block engine never calls them, so asking for one means stepping.
+struct NullObserver
+{
+	template<class State>
+	void before(State&, const Inst&, uint32_t) {}
+
+	template<class State>
+	void after(State&, const Inst&) {}
+
+	void report(std::ostream&) const {}
+};
+
+/// Feeds instruction fetches and data accesses (by Inst::memRanges(), so vector memory ops
+/// by the elements they access) to a CacheHierarchy, and conditional branches
+/// (by Inst::opType()) to BranchPredictors.
+class ModelObserver
+{
+public:
+	void setCaches(std::unique_ptr<CacheHierarchy> caches) { caches_ = std::move(caches); }
+	void addPredictor(std::unique_ptr<BranchPredictor> pred) { preds_.emplace_back(std::move(pred)); }
+
+	///@return true if there is nothing to model
+	bool empty() const { return !caches_ && preds_.empty(); }
+
+	template<class State>
+	void before(State &state, const Inst &inst, uint32_t opc_sz)
+	{
+		pc_ = state.getPc();
+		next_pc_ = pc_ + opc_sz;
+		op_type_ = inst.opType();
+		++insts_;
+		if (!caches_)
+			return;
+
+		caches_->fetch(pc_, opc_sz);
+		if (op_type_ < Inst::OT_LOAD || op_type_ > Inst::OT_ATOMIC)
+			return;
+
+		ranges_.clear();
+		inst.memRanges(state, ranges_);
+		for (const Inst::MemRange &r : ranges_)
+			caches_->data(r.va, r.sz);
+	}
+
+	template<class State>
+	void after(State &state, const Inst&)
+	{
+		if (op_type_ != Inst::OT_BCC)
+			return;
+
+		const bool taken = state.getPc() != next_pc_;
+		for (const auto &p : preds_)
+			p->branch(pc_, taken);
+	}
+
+	/// print the cache and predictor statistics
+	void report(std::ostream &os) const;
+
+private:
+	std::unique_ptr<CacheHierarchy> caches_;
+	std::vector<std::unique_ptr<BranchPredictor>> preds_;
+	std::vector<Inst::MemRange> ranges_; ///< (of the instruction in before())
+	uint64_t insts_ = 0;
+	uint64_t pc_ = 0; ///< of the instruction since before()
+	uint64_t next_pc_ = 0; ///< (sequential)
+	Inst::OpType op_type_ = Inst::OT_ALU;
+};
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include "output_buffer.hpp"
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace rvfun
+{
+OutputBuffer::Ring::Ring(int f)
+: fd(f)
+, buf(new uint8_t[RING_SZ])
+{
+}
+
+OutputBuffer::OutputBuffer(Mode mode)
+: mode_(mode)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		stop_ = true;
+	}
+	work_cv_.notify_one();
+
+	if (writer_.joinable())
+		writer_.join();
+}
+
+void OutputBuffer::setMode(Mode mode)
+{
+	flush();
+	mode_ = mode;
+}
+
+OutputBuffer::Ring* OutputBuffer::ring(int fd)
+{
+	for (const auto &r : rings_)
+	{
+		if (r->fd == fd)
+			return r.get();
+	}
+
+	// fail now, rather than on a later write (which may never come)
+	const int fl = fd < 0 ? -1 : ::fcntl(fd, F_GETFL);
+	if (fl < 0 || (fl & O_ACCMODE) == O_RDONLY)
+	{
+		errno = EBADF;
+		return nullptr;
+	}
+
+	if (!writer_.joinable())
+		writer_ = std::thread(&OutputBuffer::writerLoop, this);
+
+	rings_.emplace_back(new Ring(fd));
+	return rings_.back().get();
+}
+
+ssize_t OutputBuffer::write(int fd, const void *buf, size_t len)
+{
+	if (mode_ == Mode::NONE)
+		return ::write(fd, buf, len);
+
+	std::unique_lock<std::mutex> lock(mtx_);
+	Ring *const rp = ring(fd);
+	if (!rp)
+		return -1;
+
+	Ring &r = *rp;
+	if (r.error)
+	{
+		errno = r.error;
+		return -1;
+	}
+
+	if (mode_ == Mode::LINE && len && memchr(buf, '\n', len))
+	{
+		// lines go straight out, after any partial line before them
+		drain(lock, r);
+		lock.unlock();
+		return ::write(fd, buf, len);
+	}
+
+	put(lock, r, buf, len);
+	return len;
+}
+
+ssize_t OutputBuffer::writev(int fd, const struct iovec *iov, int iovct)
+{
+	if (mode_ == Mode::NONE)
+		return ::writev(fd, iov, iovct);
+
+	std::unique_lock<std::mutex> lock(mtx_);
+	Ring *const rp = ring(fd);
+	if (!rp)
+		return -1;
+
+	Ring &r = *rp;
+	if (r.error)
+	{
+		errno = r.error;
+		return -1;
+	}
+
+	bool newline = false;
+	for (int i = 0; i < iovct && mode_ == Mode::LINE; ++i)
+		newline |= iov[i].iov_len && memchr(iov[i].iov_base, '\n', iov[i].iov_len);
+	if (newline)
+	{
+		drain(lock, r);
+		lock.unlock();
+		return ::writev(fd, iov, iovct);
+	}
+
+	ssize_t ct = 0;
+	for (int i = 0; i < iovct; ++i)
+	{
+		put(lock, r, iov[i].iov_base, iov[i].iov_len);
+		ct += iov[i].iov_len;
+	}
+	return ct;
+}
+
+bool OutputBuffer::flush()
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	bool fail = false;
+	for (const auto &r : rings_)
+	{
+		drain(lock, *r);
+		fail |= r->error != 0;
+	}
+	return fail;
+}
+
+bool OutputBuffer::flush(int fd)
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	for (const auto &r : rings_)
+	{
+		if (r->fd == fd)
+		{
+			drain(lock, *r);
+			return r->error != 0;
+		}
+	}
+	return false;
+}
+
+void OutputBuffer::put(std::unique_lock<std::mutex> &lock, Ring &r, const void *buf, size_t len)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(buf);
+	while (len)
+	{
+		const uint64_t space = RING_SZ - (r.head - r.tail);
+		if (space == 0)
+		{
+			work_cv_.notify_one();
+			space_cv_.wait(lock);
+			continue;
+		}
+
+		// up to the end of the ring at a time
+		const uint64_t pos = r.head % RING_SZ;
+		const size_t n = std::min<uint64_t>(std::min<uint64_t>(len, space), RING_SZ - pos);
+		memcpy(r.buf.get() + pos, p, n);
+		r.head += n;
+		p += n;
+		len -= n;
+	}
+	work_cv_.notify_one();
+}
+
+void OutputBuffer::drain(std::unique_lock<std::mutex> &lock, Ring &r)
+{
+	while (r.head != r.tail)
+	{
+		work_cv_.notify_one();
+		space_cv_.wait(lock);
+	}
+}
+
+void OutputBuffer::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	for (;;)
+	{
+		Ring *r = nullptr;
+		for (const auto &p : rings_)
+		{
+			if (p->head != p->tail)
+			{
+				r = p.get();
+				break;
+			}
+		}
+		if (!r)
+		{
+			if (stop_)
+				return;
+			work_cv_.wait(lock);
+			continue;
+		}
+
+		// the data from 'tail' up to the end of the ring (only the space past 'head' changes meanwhile)
+		const uint64_t pos = r->tail % RING_SZ;
+		const size_t n = std::min<uint64_t>(r->head - r->tail, RING_SZ - pos);
+		const bool failed = r->error != 0;
+		lock.unlock();
+
+		ssize_t ret = n;
+		if (!failed)
+		{
+			do
+				ret = ::write(r->fd, r->buf.get() + pos, n);
+			while (ret < 0 && errno == EINTR);
+		}
+		const int err = errno;
+
+		lock.lock();
+		if (ret <= 0)
+		{
+			r->error = ret < 0 ? err : EIO;
+			ret = n; // (dropped)
+		}
+		r->tail += ret;
+		space_cv_.notify_all();
+	}
+}
+
+}
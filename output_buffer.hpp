@@ -0,0 +1,95 @@
+#ifndef RVFUN_OUTPUT_BUFFER_HPP
+#define RVFUN_OUTPUT_BUFFER_HPP
+
+#include <sys/types.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct iovec;
+
+namespace rvfun
+{
+/// Guest writes to host files. Buffered writes are a copy into a ring per file, which a
+/// background thread writes out (in order), so the simulation doesn't wait on the host.
+/// Rings are written out by flush() and, when full, before more is taken.
+class OutputBuffer
+{
+public:
+	enum class Mode
+	{
+		NONE, ///< write through (the guest sees host results)
+		LINE, ///< as ASYNC, but writes with a newline go straight out (for watching output)
+		ASYNC ///< return once copied
+	};
+
+	/// bytes buffered per file
+	static constexpr size_t RING_SZ = 256 * 1024;
+
+	explicit OutputBuffer(Mode mode = Mode::ASYNC);
+	/// writes out everything
+	~OutputBuffer();
+
+	OutputBuffer(const OutputBuffer&) = delete;
+	OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+	Mode mode() const { return mode_; }
+	/// (flushes first)
+	void setMode(Mode mode);
+
+	/// write 'len' bytes to 'fd', after earlier writes to it
+	///@return bytes taken, or -1 (with errno) if 'fd' is not open for writing or an earlier
+	/// buffered write to it failed
+	ssize_t write(int fd, const void *buf, size_t len);
+	ssize_t writev(int fd, const struct iovec *iov, int iovct);
+
+	/// wait for the buffered writes to all files to reach the host
+	///@return true if any of them failed
+	bool flush();
+	/// wait for the buffered writes to 'fd' to reach the host
+	///@return true if any of them failed
+	bool flush(int fd);
+
+private: // types
+	struct Ring
+	{
+		explicit Ring(int f);
+
+		int fd;
+		std::unique_ptr<uint8_t[]> buf; ///< RING_SZ
+		uint64_t head = 0; ///< bytes put in
+		uint64_t tail = 0; ///< bytes written out
+		int error = 0; ///< errno of the first failed write (later data is dropped)
+	};
+
+private: // methods
+	///@return ring of 'fd' (made, and the writer started, on first use),
+	/// or nullptr (with errno) if 'fd' is not open for writing
+	Ring* ring(int fd);
+
+	/// copy to 'r', waiting for space
+	void put(std::unique_lock<std::mutex> &lock, Ring &r, const void *buf, size_t len);
+
+	/// wait until 'r' is empty
+	void drain(std::unique_lock<std::mutex> &lock, Ring &r);
+
+	void writerLoop();
+
+private: // data
+	Mode mode_;
+	std::vector<std::unique_ptr<Ring>> rings_; ///< (few files, so searched in order)
+	std::mutex mtx_;
+	std::condition_variable work_cv_; ///< data to write (or stop)
+	std::condition_variable space_cv_; ///< data written
+	std::thread writer_;
+	bool stop_ = false;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,218 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+
+namespace
+{
+using namespace rvfun;
+
+constexpr size_t INIT_SLOTS = 4096; // power of 2
+
+const char *const SIZE_NAMES[] = {"1", "2", "4", "8", "other"};
+
+/// decode 'opcode' again for its disassembly
+std::string disasmOpcode(uint32_t opcode)
+{
+	std::unique_ptr<Inst> inst((opcode & 3) == 3 ? decode32(opcode) : decode16(opcode));
+	return inst ? inst->disasm() : std::string("(illegal)");
+}
+
+std::string mnemonic(const std::string &disasm)
+{
+	return disasm.substr(0, disasm.find(' '));
+}
+
+void printCount(std::ostream &os, uint64_t n, uint64_t total)
+{
+	os << std::setw(14) << n << ' ' << std::fixed << std::setprecision(2) << std::setw(6)
+	   << (total ? 100.0 * n / total : 0.0) << "% " << std::defaultfloat;
+}
+}
+
+namespace rvfun
+{
+Profiler::Profiler()
+{
+	pcs_.slots.resize(INIT_SLOTS);
+}
+
+Profiler::PcCount& Profiler::insert(Table &t, uint64_t pc)
+{
+	if (2 * (t.used + 1) > t.slots.size())
+	{
+		// keep the load under 1/2
+		std::vector<PcCount> old(t.slots.size() * 2);
+		old.swap(t.slots);
+		for (const PcCount &c : old)
+		{
+			if (!c.used)
+				continue;
+			size_t i = slot(t, c.pc);
+			while (t.slots[i].used)
+				i = (i + 1) & (t.slots.size() - 1);
+			t.slots[i] = c;
+		}
+	}
+
+	size_t i = slot(t, pc);
+	while (t.slots[i].used)
+		i = (i + 1) & (t.slots.size() - 1);
+	++t.used;
+	t.slots[i].used = true;
+	t.slots[i].pc = pc;
+	return t.slots[i];
+}
+
+void Profiler::addTotals(const PcCount &c, uint64_t *by_type, uint64_t (*mem)[NUM_SIZES])
+{
+	const uint64_t n = c.count - c.base;
+	by_type[c.op_type] += n;
+	if (c.op_type >= Inst::OT_LOAD && c.op_type <= Inst::OT_ATOMIC)
+		mem[c.op_type - Inst::OT_LOAD][c.size_idx] += n;
+}
+
+void Profiler::retag(PcCount &c, const Inst &inst, uint32_t opcode, uint32_t opc_sz)
+{
+	// (the PC count carries on, its mnemonic is that of the last opcode)
+	addTotals(c, by_type_, mem_);
+	c.base = c.count;
+	c.opcode = opcode;
+	c.opc_sz = opc_sz;
+	c.op_type = inst.opType();
+	c.size_idx = sizeIdx(inst.opSize());
+}
+
+void Profiler::report(std::ostream &os, uint32_t top)
+{
+	// PCs, hottest first
+	std::vector<const PcCount*> pcs;
+	uint64_t by_type[NUM_OP_TYPES];
+	uint64_t mem[NUM_MEM_TYPES][NUM_SIZES];
+	std::copy(by_type_, by_type_ + NUM_OP_TYPES, by_type);
+	std::copy(&mem_[0][0], &mem_[0][0] + NUM_MEM_TYPES * NUM_SIZES, &mem[0][0]);
+	for (const PcCount &c : pcs_.slots)
+	{
+		if (!c.used)
+			continue;
+		pcs.push_back(&c);
+		addTotals(c, by_type, mem);
+	}
+	auto hotter = [](const PcCount *a, const PcCount *b)
+	{
+		return a->count != b->count ? a->count > b->count : a->pc < b->pc;
+	};
+	std::sort(pcs.begin(), pcs.end(), hotter);
+
+	uint64_t total = illegal_;
+	for (uint64_t n : by_type)
+		total += n;
+	os << "Profile of " << total << " instructions." << std::endl;
+
+	os << "By type:" << std::endl;
+	std::vector<uint32_t> types;
+	for (uint32_t i = 0; i < NUM_OP_TYPES; ++i)
+	{
+		if (by_type[i])
+			types.push_back(i);
+	}
+	std::stable_sort(types.begin(), types.end(),
+	                 [&by_type](uint32_t a, uint32_t b) { return by_type[a] > by_type[b]; });
+	for (uint32_t i : types)
+	{
+		printCount(os, by_type[i], total);
+		os << opTypeName(Inst::OpType(i)) << std::endl;
+	}
+	if (illegal_)
+	{
+		printCount(os, illegal_, total);
+		os << "(illegal)" << std::endl;
+	}
+
+	// mnemonics sum over the PCs (one decode per PC)
+	std::vector<std::string> disasm(pcs.size());
+	std::vector<std::pair<std::string, uint64_t>> mnes;
+	{
+		std::vector<std::pair<std::string, uint64_t>> all;
+		for (size_t i = 0; i < pcs.size(); ++i)
+		{
+			disasm[i] = disasmOpcode(pcs[i]->opcode);
+			all.emplace_back(mnemonic(disasm[i]), pcs[i]->count);
+		}
+		std::sort(all.begin(), all.end());
+		for (const auto &m : all)
+		{
+			if (mnes.empty() || mnes.back().first != m.first)
+				mnes.push_back(m);
+			else
+				mnes.back().second += m.second;
+		}
+		std::stable_sort(mnes.begin(), mnes.end(),
+		                 [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b)
+		                 { return a.second > b.second; });
+	}
+	os << "By mnemonic:" << std::endl;
+	for (const auto &m : mnes)
+	{
+		printCount(os, m.second, total);
+		os << m.first << std::endl;
+	}
+
+	os << "Loads and stores by size:" << std::endl;
+	for (uint32_t t = 0; t < NUM_MEM_TYPES; ++t)
+	{
+		for (uint32_t s = 0; s < NUM_SIZES; ++s)
+		{
+			if (mem[t][s] == 0)
+				continue;
+			printCount(os, mem[t][s], total);
+			os << opTypeName(Inst::OpType(Inst::OT_LOAD + t)) << ' ' << SIZE_NAMES[s] << std::endl;
+		}
+	}
+
+	os << "Hot PCs (" << pcs.size() << " total):" << std::endl;
+	for (size_t i = 0; i < pcs.size() && i < top; ++i)
+	{
+		printCount(os, pcs[i]->count, total);
+		os << std::hex << std::setw(10) << pcs[i]->pc << std::dec << "  " << disasm[i] << std::endl;
+	}
+
+	// blocks run from an entered PC up to the next one (or a gap)
+	struct Block
+	{
+		uint64_t pc;
+		uint64_t entries;
+		uint64_t insts;
+	};
+	std::vector<const PcCount*> by_pc(pcs);
+	std::sort(by_pc.begin(), by_pc.end(), [](const PcCount *a, const PcCount *b) { return a->pc < b->pc; });
+	std::vector<Block> blocks;
+	for (size_t i = 0; i < by_pc.size(); ++i)
+	{
+		const PcCount &c = *by_pc[i];
+		if (c.entries != 0 || blocks.empty() || i == 0 || by_pc[i - 1]->pc + by_pc[i - 1]->opc_sz != c.pc)
+			blocks.push_back(Block{c.pc, c.entries, 0});
+		blocks.back().insts += c.count;
+	}
+	std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b)
+	{
+		return a.insts != b.insts ? a.insts > b.insts : a.pc < b.pc;
+	});
+	os << "Hot blocks (" << blocks.size() << " total):" << std::endl;
+	for (size_t i = 0; i < blocks.size() && i < top; ++i)
+	{
+		const Block &b = blocks[i];
+		printCount(os, b.insts, total);
+		os << std::hex << std::setw(10) << b.pc << std::dec << "  entered " << b.entries << " times";
+		if (b.entries)
+		{
+			os << ", " << std::fixed << std::setprecision(1) << double(b.insts) / b.entries
+			   << std::defaultfloat << " insts/entry";
+		}
+		os << std::endl;
+	}
+}
+
+}
+
@@ -0,0 +1,115 @@
+#ifndef RVFUN_PROFILE_HPP
+#define RVFUN_PROFILE_HPP
+
+#include "arch_state.hpp"
+#include "inst.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+namespace rvfun
+{
+/// Counts retired instructions by op type, PC and block, and loads/stores by size.
+/// Each retired instruction only bumps the counts of its PC in an open addressed table, the
+/// other counters are summed from the PCs (and mnemonics decoded from their opcodes) by report().
+/// Blocks start at the PCs which were entered non sequentially.
+class Profiler
+{
+public:
+	static constexpr uint32_t NUM_OP_TYPES = Inst::OT_SYSTEM + 1;
+
+	Profiler();
+
+	/// count 'inst' at the PC of 'state' (call before executing it)
+	template<class State>
+	void record(State &state, const Inst &inst, uint32_t opcode, uint32_t opc_sz)
+	{
+		const uint64_t pc = state.getPc();
+		PcCount &c = find(pcs_, pc);
+		if (c.opcode != opcode || c.count == c.base)
+			retag(c, inst, opcode, opc_sz);
+		++c.count;
+		c.entries += pc != next_pc_;
+		next_pc_ = pc + opc_sz;
+	}
+
+	/// count an undecodable instruction
+	void recordIllegal() { ++illegal_; }
+
+	/// print the sorted counters, with at most 'top' PCs and blocks
+	void report(std::ostream &os, uint32_t top = 20);
+
+
+private: // types
+	static constexpr uint32_t NUM_MEM_TYPES = Inst::OT_ATOMIC - Inst::OT_LOAD + 1;
+	static constexpr uint32_t NUM_SIZES = 5; ///< 1, 2, 4, 8, other
+
+	struct PcCount
+	{
+		uint64_t pc = 0;
+		uint64_t count = 0; ///< retired instructions
+		uint64_t base = 0; ///< 'count' when it was last tagged
+		uint64_t entries = 0; ///< times reached other than from PC - opc_sz (block entries)
+		uint32_t opcode = 0; ///< last opcode seen
+		uint8_t opc_sz = 0;
+		uint8_t op_type = 0; ///< of 'opcode'
+		uint8_t size_idx = 0; ///< (memory ops) of 'opcode'
+		bool used = false;
+	};
+
+	/// open addressed, by PC
+	struct Table
+	{
+		std::vector<PcCount> slots;
+		size_t used = 0;
+	};
+
+private: // methods
+	static uint32_t sizeIdx(uint32_t sz)
+	{
+		switch (sz)
+		{
+		case 1: return 0;
+		case 2: return 1;
+		case 4: return 2;
+		case 8: return 3;
+		}
+		return 4;
+	}
+
+	static size_t slot(const Table &t, uint64_t pc)
+	{
+		return ((pc >> 1) * 0x9e3779b97f4a7c15ull >> 32) & (t.slots.size() - 1);
+	}
+
+	PcCount& find(Table &t, uint64_t pc)
+	{
+		size_t i = slot(t, pc);
+		while (t.slots[i].used)
+		{
+			if (t.slots[i].pc == pc)
+				return t.slots[i];
+			i = (i + 1) & (t.slots.size() - 1);
+		}
+		return insert(t, pc);
+	}
+
+	PcCount& insert(Table &t, uint64_t pc);
+	/// tag 'c' with 'inst' (after moving its counts under the old tag to the banked totals)
+	void retag(PcCount &c, const Inst &inst, uint32_t opcode, uint32_t opc_sz);
+	/// add the counts of 'c' since it was tagged to 'by_type' and 'mem'
+	static void addTotals(const PcCount &c, uint64_t *by_type, uint64_t (*mem)[NUM_SIZES]);
+
+private: // data
+	Table pcs_;
+	uint64_t next_pc_ = 0; ///< PC of sequential execution
+	uint64_t by_type_[NUM_OP_TYPES] = {0,}; ///< banked from retagged PCs
+	uint64_t mem_[NUM_MEM_TYPES][NUM_SIZES] = {{0,},}; ///< banked from retagged PCs
+	uint64_t illegal_ = 0;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,94 @@
+#ifndef RVFUN_H
+#define RVFUN_H
+
+/* C interface to the library, for script bindings (Tcl, Python ctypes, ...).
+ * A call to rvfun_run() executes up to millions of instructions, so scripts pay for one call
+ * per batch instead of one per instruction. Only fixed width types cross the interface, and
+ * structs only grow at the end (check rvfun_api_version()).
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RVFUN_API_VERSION 1
+
+/* rvfun_create() flags */
+#define RVFUN_QUIET 1u /* drop the loader's and system calls' messages */
+
+/* why rvfun_run() returned */
+enum rvfun_stop
+{
+	RVFUN_STOP_COUNT = 0, /* executed the instructions asked for */
+	RVFUN_STOP_BREAKPOINT = 1, /* the PC reached a breakpoint (it has not executed) */
+	RVFUN_STOP_WATCHPOINT = 2, /* the instruction at the PC accesses a watched address (it has not executed) */
+	RVFUN_STOP_EXIT = 3, /* the program exited (see rvfun_exit_status()) */
+	RVFUN_STOP_RETURN = 4, /* the PC returned to the shell (address 0) */
+	RVFUN_STOP_ERROR = 5 /* nothing loaded, or the simulation failed (e.g. out of memory), the state is as the failure left it */
+};
+
+typedef struct rvfun_result
+{
+	uint32_t reason; /* enum rvfun_stop */
+	uint32_t reserved;
+	uint64_t icount; /* executed by this call */
+	uint64_t pc; /* of the next instruction */
+	uint64_t addr; /* RVFUN_STOP_WATCHPOINT: start of the access (of the element, for strided and indexed vector ops) */
+} rvfun_result;
+
+typedef struct rvfun_sim rvfun_sim;
+
+/* RVFUN_API_VERSION of the library */
+uint32_t rvfun_api_version(void);
+
+/* null on failure */
+rvfun_sim* rvfun_create(uint32_t flags);
+void rvfun_destroy(rvfun_sim *sim);
+
+/* load a static ELF, with 'argc' arguments after the program name (stdin from '<elf>.stdin')
+ * return 0 on success */
+int rvfun_load(rvfun_sim *sim, const char *elf, int argc, const char *const *argv);
+
+/* resume from a checkpoint of the driver (-w)
+ * return 0 on success */
+int rvfun_restore(rvfun_sim *sim, const char *path);
+
+/* execute until 'max_insts' (0 for no limit), a breakpoint or watchpoint, exit or return to the
+ * shell; the first instruction is never stopped at, so a stopped run can simply be called again
+ * with no break or watch points, this runs at the speed of the driver's block engine */
+void rvfun_run(rvfun_sim *sim, uint64_t max_insts, rvfun_result *result);
+
+/* stop before executing the instruction at 'pc'
+ * return 0 on success, 1 if there was one already (remove: 1 if there was none), -1 on failure */
+int rvfun_add_breakpoint(rvfun_sim *sim, uint64_t pc);
+int rvfun_remove_breakpoint(rvfun_sim *sim, uint64_t pc);
+
+/* stop before executing loads, stores or atomics touching [addr, addr+len) (vector ops by all the elements accessed)
+ * return 0 on success, -1 on failure */
+int rvfun_add_watchpoint(rvfun_sim *sim, uint64_t addr, uint64_t len);
+
+/* remove all break and watch points */
+void rvfun_clear_points(rvfun_sim *sim);
+
+/* instructions executed since load (or, after restore, since the start of the program) */
+uint64_t rvfun_icount(const rvfun_sim *sim);
+uint64_t rvfun_exit_status(const rvfun_sim *sim);
+
+/* integer registers 0-31 */
+uint64_t rvfun_get_reg(const rvfun_sim *sim, uint32_t num);
+void rvfun_set_reg(rvfun_sim *sim, uint32_t num, uint64_t val);
+uint64_t rvfun_get_pc(const rvfun_sim *sim);
+void rvfun_set_pc(rvfun_sim *sim, uint64_t pc);
+
+/* copy guest memory (stopping at unallocated addresses)
+ * return bytes copied */
+uint64_t rvfun_read_mem(rvfun_sim *sim, uint64_t va, void *buf, uint64_t len);
+uint64_t rvfun_write_mem(rvfun_sim *sim, uint64_t va, const void *buf, uint64_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,16 +1,11 @@
 #include "simple_arch_state.hpp"
 #include "arch_mem.hpp"
+#include "code_cache.hpp"
 #include <cmath>
+#include <cstring>
 
 namespace
 {
-enum
-{
-	FFLAGS = 1,
-	FRM = 2,
-	FCSR = 3
-};
-
 union IntFloat
 {
 	uint32_t wa[2];
@@ -63,86 +58,122 @@ void SimpleArchState::setDouble(uint32_t num, double val)
 		std::cout << " setFloat " << num << ' ' << val << ' ';
 }
 
-uint16_t SimpleArchState::parentCsr(uint16_t csr) const
+uint64_t SimpleArchState::getCr(const uint32_t csr) const
 {
-	uint16_t actual_csr = csr;
-	if (csr == FFLAGS || csr == FRM) // subfields of fcsr
-		actual_csr = FCSR;
-
-	return actual_csr;
+	return cregs_.get(csr);
 }
 
-uint64_t SimpleArchState::getCr(const uint32_t csr) const
+void SimpleArchState::setCr(const uint32_t csr, uint64_t val)
 {
-	auto i = cregs_.find(parentCsr(csr));
-	if (i == cregs_.end())
-		return 0;
-
-	if (csr == FRM)
-		return (i->second >> 5) & 7; // bits[7:5]
-	else if (csr == FFLAGS)
-		return i->second & 0x1f; // bits[4:0]
+	cregs_.set(csr, val);
+}
 
-	return i->second;
+void SimpleArchState::flushTlb()
+{
+	for (TlbEntry &e : tlb_)
+		e = TlbEntry();
+	itlb_ = TlbEntry();
 }
 
-void SimpleArchState::setCr(const uint32_t csr, uint64_t val)
+uint8_t* SimpleArchState::findPage(uint64_t va) const
 {
-	const uint16_t actual_csr = parentCsr(csr);
-	auto i = cregs_.find(actual_csr);
-	const bool found = i != cregs_.end();
+	return mem_->hostPtr(va & ~(PAGE_SZ - 1), PAGE_SZ);
+}
 
-	bool partial = false;
-	uint64_t mask = ~uint64_t(-1);
-	if (csr == FRM)
-	{
-		val = (val & 7) << 5; // mask and shift
-		partial = true;
-		mask = ~uint64_t(0xe0); // [7:5]
-	}
-	else if (csr == FFLAGS)
+uint64_t SimpleArchState::readImemSlow(uint64_t va, uint32_t sz) const
+{
+	uint8_t *const host = findPage(va);
+	if (host && (mem_->protection(va) & ArchMem::READ))
 	{
-		val &= 0x1f; // bottom bits
-		partial = true;
-		mask = ~uint64_t(0x1f); // [4:0]
+		itlb_.read_page = va >> PAGE_SHIFT;
+		itlb_.host = host;
 	}
+	return mem_->readMem(va, sz);
+}
 
-	if (found && partial)
-	{
-		uint64_t cur_val = i->second;
-		cur_val &= mask; // clear target bits
-		val |= cur_val;
-	}
+uint8_t* SimpleArchState::fillTlb(uint64_t va, uint32_t need) const
+{
+	uint8_t *const host = findPage(va);
+	if (!host)
+		return nullptr;
+
+	// (a page is all in one block, so it has one set of rights)
+	const uint32_t prot = mem_->protection(va);
+	const uint64_t page = va >> PAGE_SHIFT;
+	TlbEntry &e = tlb_[tlbIndex(page)];
+	e.read_page = (prot & ArchMem::READ) ? page : uint64_t(-1);
+	e.write_page = (prot & ArchMem::WRITE) ? page : uint64_t(-1);
+	e.host = host;
+	return (prot & need) == need ? host : nullptr;
+}
 
-	if (!found)
-	{
-		cregs_.insert({actual_csr, val});
-	}
+uint64_t SimpleArchState::readSlow(uint64_t va, uint32_t sz) const
+{
+	const uint64_t offset = va & (PAGE_SZ - 1);
+	const uint8_t *const host = fillTlb(va, ArchMem::READ);
+	if (!host || offset > PAGE_SZ - sz)
+		return mem_->readMem(va, sz); // (crosses pages, or reports the fault)
+
+	uint64_t ret = 0;
+	memcpy(&ret, host + offset, sz);
+	return ret;
+}
+
+void SimpleArchState::writeSlow(uint64_t va, uint32_t sz, uint64_t val)
+{
+	const uint64_t offset = va & (PAGE_SZ - 1);
+	uint8_t *const host = fillTlb(va, ArchMem::WRITE);
+	if (!host || offset > PAGE_SZ - sz)
+		mem_->writeMem(va, sz, val); // (crosses pages, or reports the fault)
 	else
-	{
-		i->second = val;
-	}
+		memcpy(host + offset, &val, sz);
 }
 
-uint64_t SimpleArchState::readImem(uint64_t va, uint32_t sz) const
+uint64_t SimpleArchState::readBlock(uint64_t va, uint64_t sz, void *dst) const
 {
-	return mem_->readMem(va, sz);
+	if (debug_)
+		std::cout << " readBlock " << std::hex << va << ' ' << sz << std::dec;
+	return mem_->readBlock(va, sz, dst);
 }
 
-uint64_t SimpleArchState::readMem(uint64_t va, uint32_t sz) const
+uint64_t SimpleArchState::writeBlock(uint64_t va, uint64_t sz, const void *src)
 {
-	const uint64_t val = mem_->readMem(va, sz);
 	if (debug_)
-		std::cout << " readMem " << std::hex << va << ' ' << sz << ' ' << val << std::dec;
-	return val;
+		std::cout << " writeBlock " << std::hex << va << ' ' << sz << std::dec;
+	const uint64_t ret = mem_->writeBlock(va, sz, src);
+	if (ccache_)
+		ccache_->invalidate(va, sz);
+	return ret;
 }
 
-void SimpleArchState::writeMem(uint64_t va, uint32_t sz, uint64_t val)
+const uint8_t* SimpleArchState::hostPtr(uint64_t va, uint64_t sz) const
 {
+	return mem_->hostPtr(va, sz);
+}
+
+bool SimpleArchState::compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val)
+{
+	const bool ret = mem_->compareExchange(va, sz, expected, val);
 	if (debug_)
-		std::cout << " writeMem " << std::hex << va << ' ' << sz << ' ' << val << std::dec;
-	mem_->writeMem(va, sz, val);
+		std::cout << " compareExchange " << std::hex << va << ' ' << sz << ' ' << expected << ' ' << val << std::dec << ' ' << ret;
+	if (ret && ccache_)
+		ccache_->invalidate(va, sz);
+	return ret;
 }
 
+uint64_t SimpleArchState::loadReserved(uint64_t va, uint32_t sz)
+{
+	resv_val_ = readMem(va, sz);
+	resv_va_ = va;
+	resv_sz_ = sz;
+	return resv_val_;
 }
 
+bool SimpleArchState::storeConditional(uint64_t va, uint32_t sz, uint64_t val)
+{
+	const bool match = resv_va_ == va && resv_sz_ == sz;
+	resv_va_ = uint64_t(-1);
+	return match && compareExchange(va, sz, resv_val_, val);
+}
+
+}
@@ -2,22 +2,38 @@
 #define RVFUN_SIMPLE_ARCH_STATE_HPP
 
 #include "arch_state.hpp"
+#include "code_cache.hpp"
+#include "csr_file.hpp"
+#include <cstring>
 #include <iostream>
-#include <map>
 
 namespace rvfun
 {
 class ArchMem;
 
-/// Simple Implementation of ArchState
+/// Simple Implementation of ArchState.
+/// Loads and stores go through a direct mapped software TLB (guest page to host memory and the
+/// accesses allowed, filled from ArchMem::hostPtr and ArchMem::protection), falling back to ArchMem
+/// on a miss, a disallowed access or an access crossing pages.
 class SimpleArchState : public ArchState
 {
 public:
+	static constexpr uint32_t PAGE_SHIFT = 12; ///< TLB page size
+	static constexpr uint64_t PAGE_SZ = 1ull << PAGE_SHIFT;
+	static constexpr uint32_t TLB_ENTRIES = 64;
+
 	SimpleArchState();
 
-	void setMem(ArchMem *mem) { mem_ = mem; }
+	void setMem(ArchMem *mem)
+	{
+		mem_ = mem;
+		flushTlb();
+	}
 	void setSys(System *sys) { sys_ = sys; }
 
+	/// writes to memory will invalidate stale decodes in 'cc'
+	void setCodeCache(CodeCache *cc) { ccache_ = cc; }
+
 	void setDebug(bool b = true) { debug_ = b; }
 
 	//---from ArchState
@@ -50,12 +66,64 @@ public:
 		freg[num] = val;
 	}
 
+	uint8_t* getVecReg(uint32_t num) override { return vreg + num * VLEN_BYTES; }
+	const uint8_t* getVecReg(uint32_t num) const override { return vreg + num * VLEN_BYTES; }
+
 	uint64_t getCr(uint32_t num) const override;
 	void     setCr(uint32_t num, uint64_t val) override;
 
-	uint64_t readImem(uint64_t va, uint32_t sz) const override;
-	uint64_t readMem(uint64_t va, uint32_t sz) const override;
-	void writeMem(uint64_t va, uint32_t sz, uint64_t val) override;
+	uint64_t readImem(uint64_t va, uint32_t sz) const override
+	{
+		const uint64_t page = va >> PAGE_SHIFT;
+		const uint64_t offset = va & (PAGE_SZ - 1);
+		if (itlb_.read_page == page && offset <= PAGE_SZ - sz)
+		{
+			uint64_t ret = 0;
+			memcpy(&ret, itlb_.host + offset, sz);
+			return ret;
+		}
+		return readImemSlow(va, sz);
+	}
+
+	uint64_t readMem(uint64_t va, uint32_t sz) const override
+	{
+		const uint64_t page = va >> PAGE_SHIFT;
+		const uint64_t offset = va & (PAGE_SZ - 1);
+		const TlbEntry &e = tlb_[tlbIndex(page)];
+		uint64_t val = 0;
+		if (e.read_page == page && offset <= PAGE_SZ - sz)
+			memcpy(&val, e.host + offset, sz);
+		else
+			val = readSlow(va, sz);
+
+		if (debug_)
+			std::cout << " readMem " << std::hex << va << ' ' << sz << ' ' << val << std::dec;
+		return val;
+	}
+
+	void writeMem(uint64_t va, uint32_t sz, uint64_t val) override
+	{
+		if (debug_)
+			std::cout << " writeMem " << std::hex << va << ' ' << sz << ' ' << val << std::dec;
+
+		const uint64_t page = va >> PAGE_SHIFT;
+		const uint64_t offset = va & (PAGE_SZ - 1);
+		const TlbEntry &e = tlb_[tlbIndex(page)];
+		if (e.write_page == page && offset <= PAGE_SZ - sz)
+			memcpy(e.host + offset, &val, sz);
+		else
+			writeSlow(va, sz, val);
+
+		if (ccache_)
+			ccache_->invalidate(va, sz);
+	}
+
+	uint64_t readBlock(uint64_t va, uint64_t sz, void *dst) const override;
+	uint64_t writeBlock(uint64_t va, uint64_t sz, const void *src) override;
+	const uint8_t* hostPtr(uint64_t va, uint64_t sz) const override;
+	bool compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val) override;
+	uint64_t loadReserved(uint64_t va, uint32_t sz) override;
+	bool storeConditional(uint64_t va, uint32_t sz, uint64_t val) override;
 
 	void incPc(int64_t delta) override
 	{
@@ -72,21 +140,60 @@ public:
 		pc_ = pc;
 	}
 
+	void retire(uint64_t n) override
+	{
+		cregs_.retire(n);
+	}
+
 	System* getSys() override { return sys_; }
 	const System* getSys() const override { return sys_; }
 
+	void flushTlb() override;
+
+	void invalidateCode(uint64_t va, uint64_t sz) override
+	{
+		if (ccache_)
+			ccache_->invalidate(va, sz);
+	}
+
+private: // types
+	/// guest page to host memory, the page tags are all ones when not permitted
+	struct TlbEntry
+	{
+		uint64_t read_page = uint64_t(-1);
+		uint64_t write_page = uint64_t(-1);
+		uint8_t *host = nullptr; ///< start of the page
+	};
+
 private: // methods
-	/// remap sub csrs to parent
-	uint16_t parentCsr(uint16_t csr) const;
+	/// (folds in higher bits, so blocks on large power of two strides don't all collide)
+	static uint32_t tlbIndex(uint64_t page) { return (page ^ (page >> 6) ^ (page >> 12)) & (TLB_ENTRIES - 1); }
+
+	///@return host memory of the page at 'va' (or nullptr if it is not all in one block)
+	uint8_t* findPage(uint64_t va) const;
+	/// map the page at 'va' in the TLB (if it is all in one block), for the accesses it allows
+	///@return host memory of the page (or nullptr, also if it does not allow 'need' ArchMem rights)
+	uint8_t* fillTlb(uint64_t va, uint32_t need) const;
+	uint64_t readImemSlow(uint64_t va, uint32_t sz) const;
+	uint64_t readSlow(uint64_t va, uint32_t sz) const;
+	void writeSlow(uint64_t va, uint32_t sz, uint64_t val);
 
 private: // data
 	static constexpr uint32_t NUM_REGS = 32;
 	uint64_t pc_ = 0;
 	uint64_t ireg[NUM_REGS] = {0,};
 	uint64_t freg[NUM_REGS] = {0,}; // store raw bits for NAN boxing
-	std::map<uint16_t, uint64_t> cregs_;
+	alignas(16) uint8_t vreg[NUM_REGS * VLEN_BYTES] = {0,};
+	CsrFile cregs_;
 	ArchMem *mem_ = nullptr;
 	System *sys_ = nullptr;
+	CodeCache *ccache_ = nullptr;
+	mutable TlbEntry tlb_[TLB_ENTRIES]; ///< loads and stores
+	mutable TlbEntry itlb_; ///< fetch (read_page only)
+	// LR/SC reservation (SC compares against the value LR saw)
+	uint64_t resv_va_ = uint64_t(-1); ///< all ones for none
+	uint64_t resv_val_ = 0;
+	uint32_t resv_sz_ = 0;
 	bool debug_ = false;
 };
 
@@ -0,0 +1,74 @@
+#include "simpoint.hpp"
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace rvfun
+{
+BbvWriter::BbvWriter(uint64_t interval)
+: interval_(interval)
+, counts_(1) // (ids start at 1)
+{
+}
+
+bool BbvWriter::open(const char *path)
+{
+	os_.open(path);
+	return !os_;
+}
+
+uint32_t BbvWriter::blockId(uint64_t pc)
+{
+	const auto ins = ids_.emplace(pc, uint32_t(counts_.size()));
+	if (ins.second)
+		counts_.push_back(0);
+	return ins.first->second;
+}
+
+void BbvWriter::endInterval()
+{
+	if (touched_.empty())
+		return;
+
+	std::sort(touched_.begin(), touched_.end());
+	os_ << 'T';
+	for (const uint32_t id : touched_)
+	{
+		os_ << ':' << id << ':' << counts_[id] << ' ';
+		counts_[id] = 0;
+	}
+	os_ << '\n';
+	touched_.clear();
+	++intervals_;
+}
+
+bool BbvWriter::close()
+{
+	endInterval();
+	os_.close();
+	return os_.fail();
+}
+
+bool readSimPoints(const char *path, std::vector<SimPoint> &points)
+{
+	std::ifstream is(path);
+	if (!is)
+		return true;
+
+	std::string line;
+	while (std::getline(is, line))
+	{
+		std::istringstream ls(line);
+		SimPoint p;
+		if (!(ls >> p.interval))
+			continue; // (blank)
+		if (!(ls >> p.cluster))
+			return true;
+		points.push_back(p);
+	}
+
+	std::sort(points.begin(), points.end(), [](const SimPoint &a, const SimPoint &b) { return a.interval < b.interval; });
+	return false;
+}
+
+}
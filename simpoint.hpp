@@ -0,0 +1,72 @@
+#ifndef RVFUN_SIMPOINT_HPP
+#define RVFUN_SIMPOINT_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+namespace rvfun
+{
+/// Writes basic block vectors in SimPoint's format: a line per interval of instructions,
+/// "T:<id>:<count> :<id>:<count> ...", where the count is instructions executed in the block
+/// (its entries times its length). Ids are numbered from 1 in the order blocks are first seen,
+/// by entry PC (blocks are those of BlockCache, which end wherever Inst::opType() is a branch;
+/// the rest of a block cut by an interval is counted to that block, not by its resume PC).
+class BbvWriter
+{
+public:
+	explicit BbvWriter(uint64_t interval);
+
+	BbvWriter(const BbvWriter&) = delete;
+	BbvWriter& operator=(const BbvWriter&) = delete;
+
+	///@return true on error
+	bool open(const char *path);
+
+	uint64_t interval() const { return interval_; }
+
+	///@return id of the block starting at 'pc' (stable for the run, made on first use)
+	uint32_t blockId(uint64_t pc);
+
+	/// count 'insts' executed in block 'id'
+	void add(uint32_t id, uint64_t insts)
+	{
+		if (counts_[id] == 0)
+			touched_.push_back(id);
+		counts_[id] += insts;
+	}
+
+	/// write out the counts since the last interval (if any) and clear them
+	void endInterval();
+
+	/// end the last (partial) interval and close the file
+	///@return true if a write failed
+	bool close();
+
+	uint64_t intervals() const { return intervals_; }
+	uint64_t blocks() const { return ids_.size(); }
+
+private: // data
+	const uint64_t interval_;
+	std::ofstream os_;
+	std::unordered_map<uint64_t, uint32_t> ids_; ///< by entry PC
+	std::vector<uint64_t> counts_; ///< by id, this interval
+	std::vector<uint32_t> touched_; ///< ids with counts this interval
+	uint64_t intervals_ = 0; ///< written
+};
+
+/// One simulation point picked by SimPoint
+struct SimPoint
+{
+	uint64_t interval = 0; ///< index (from 0) of the interval in the BBV file
+	uint64_t cluster = 0; ///< phase it represents
+};
+
+/// read SimPoint's "<interval> <cluster>" lines (the .simpoints output), sorted by interval
+///@return true on error
+bool readSimPoints(const char *path, std::vector<SimPoint> &points);
+
+}
+
+#endif
@@ -1,129 +1,662 @@
 #include "sparse_mem.hpp"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <new>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr uint32_t PAGE_SHIFT = 12;
+
+size_t hostPageSize()
+{
+	static const size_t sz = sysconf(_SC_PAGESIZE);
+	return sz;
+}
+
+///@return 'sz' rounded up to whole host pages (at least one)
+size_t hostPages(uint64_t sz)
+{
+	const size_t page = hostPageSize();
+	return sz ? (sz + page - 1) & ~(page - 1) : page;
+}
+
+/// A host mapping (shared by the pieces of a split block)
+struct HostMap
+{
+	HostMap(void *b, size_t l)
+	: base(b)
+	, len(l)
+	{
+	}
+
+	~HostMap()
+	{
+		munmap(base, len);
+	}
+
+	void *base;
+	size_t len;
+};
+}
 
 namespace rvfun
 {
 struct SparseMem::MemBlock
 {
 	uint64_t va;
-	uint32_t sz;
+	uint64_t sz;
 	uint8_t *mem;
+	std::shared_ptr<HostMap> map; ///< holding 'mem'
+	bool anon; ///< private zero pages (can grow with mremap)
+	uint32_t prot = ALL; ///< access rights
 
-	MemBlock(uint64_t a, uint32_t s, const void *data)
+	/// reserve zero pages (materialized on first touch), copy in 'data' if given
+	MemBlock(uint64_t a, uint64_t s, const void *data)
 	: va(a)
 	, sz(s)
+	, anon(true)
 	{
+		const size_t len = hostPages(s);
+		void *const p = mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+
+		map = std::make_shared<HostMap>(p, len);
+		mem = static_cast<uint8_t*>(p);
 		if (data)
-		{
-			mem = static_cast<uint8_t*>(malloc(sz));
 			memcpy(mem, data, sz);
-		}
-		else
+	}
+
+	MemBlock(uint64_t a, uint64_t s, uint8_t *m, const std::shared_ptr<HostMap> &hm, bool an)
+	: va(a)
+	, sz(s)
+	, mem(m)
+	, map(hm)
+	, anon(an)
+	{
+	}
+
+	///@return false if this can not grow to 'new_sz' (new bytes are zero)
+	bool grow(uint64_t new_sz)
+	{
+		if (!anon || map.use_count() != 1 || mem != map->base)
+			return false;
+
+		const size_t new_len = hostPages(new_sz);
+		if (new_len > map->len)
 		{
-			mem = static_cast<uint8_t*>(calloc(sz, 1));
+			void *const p = mremap(map->base, map->len, new_len, MREMAP_MAYMOVE);
+			if (p == MAP_FAILED)
+				return false;
+
+			map->base = p;
+			map->len = new_len;
+			mem = static_cast<uint8_t*>(p);
 		}
+		sz = new_sz;
+		return true;
+	}
+
+	/// host pages spanned by the block
+	void hostSpan(uint8_t *&first, size_t &len) const
+	{
+		first = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(mem) & ~(hostPageSize() - 1));
+		len = hostPages(mem + sz - first);
+	}
+
+	///@return host pages touched so far
+	uint64_t residentPages() const
+	{
+		uint8_t *first = nullptr;
+		size_t len = 0;
+		hostSpan(first, len);
+		std::vector<unsigned char> vec(len / hostPageSize());
+		if (mincore(first, len, vec.data()) != 0)
+			return 0;
+
+		uint64_t ct = 0;
+		for (const auto v : vec)
+			ct += v & 1;
+		return ct;
+	}
+
+	bool contains(uint64_t a) const { return a - va < sz; } // unsigned wrap handles a < va
+	bool overlaps(uint64_t a, uint64_t s) const { return a < va + sz && va < a + s; }
+};
+
+/// Three level radix tree from page number to block
+struct SparseMem::PageTable
+{
+	static constexpr uint32_t LEVEL_BITS = 12;
+	static constexpr uint32_t FANOUT = 1 << LEVEL_BITS;
+	static constexpr uint64_t LEVEL_MASK = FANOUT - 1;
+	static constexpr uint32_t VA_BITS = PAGE_SHIFT + 3 * LEVEL_BITS; // 48
+
+	/// marks a page holding more than one block (or outside of VA_BITS)
+	static MemBlock* shared() { return reinterpret_cast<MemBlock*>(1); }
+
+	struct Leaf
+	{
+		MemBlock *blocks[FANOUT] = {nullptr,};
+	};
+
+	struct Mid
+	{
+		std::unique_ptr<Leaf> leaves[FANOUT];
+	};
+
+	std::unique_ptr<Mid> root[FANOUT];
+
+	MemBlock* lookup(uint64_t page_num) const
+	{
+		if (page_num >> (VA_BITS - PAGE_SHIFT))
+			return shared();
+
+		const Mid *const m = root[page_num >> (2 * LEVEL_BITS)].get();
+		if (!m)
+			return nullptr;
+
+		const Leaf *const l = m->leaves[(page_num >> LEVEL_BITS) & LEVEL_MASK].get();
+		if (!l)
+			return nullptr;
+
+		return l->blocks[page_num & LEVEL_MASK];
+	}
+
+	void insert(uint64_t page_num, MemBlock *b)
+	{
+		if (page_num >> (VA_BITS - PAGE_SHIFT))
+			return; // always searched
+
+		std::unique_ptr<Mid> &m = root[page_num >> (2 * LEVEL_BITS)];
+		if (!m)
+			m.reset(new Mid);
+
+		std::unique_ptr<Leaf> &l = m->leaves[(page_num >> LEVEL_BITS) & LEVEL_MASK];
+		if (!l)
+			l.reset(new Leaf);
+
+		MemBlock *&e = l->blocks[page_num & LEVEL_MASK];
+		if (e == nullptr || e == b)
+			e = b;
+		else
+			e = shared();
 	}
 
-	~MemBlock()
+	/// replace the entry of 'page_num' (with nullptr, a block or shared())
+	void set(uint64_t page_num, MemBlock *b)
 	{
-		free(mem);
+		if (page_num >> (VA_BITS - PAGE_SHIFT))
+			return;
+
+		Mid *const m = root[page_num >> (2 * LEVEL_BITS)].get();
+		Leaf *const l = m ? m->leaves[(page_num >> LEVEL_BITS) & LEVEL_MASK].get() : nullptr;
+		if (l)
+			l->blocks[page_num & LEVEL_MASK] = b;
+		else if (b)
+			insert(page_num, b);
 	}
 };
 
 SparseMem::SparseMem()
+: pt_(new PageTable)
+, err_(&std::cerr)
 {
 }
 
-void SparseMem::addBlock(uint64_t va, uint32_t sz, const void *data)
+SparseMem::~SparseMem()
+{
+	for (auto &b : blocks_)
+		delete b;
+}
+
+void SparseMem::mapPages(MemBlock *b, uint64_t va, uint64_t sz)
+{
+	if (sz == 0)
+		return;
+
+	const uint64_t first = va >> PAGE_SHIFT;
+	const uint64_t last = (va + sz - 1) >> PAGE_SHIFT;
+	for (uint64_t p = first; p <= last; ++p)
+		pt_->insert(p, b);
+}
+
+SparseMem::MemBlock* SparseMem::scanBlocks(uint64_t va) const
 {
-	// check for overlap
 	for (const auto &b : blocks_)
 	{
-		const uint64_t block_end = b->va + b->sz;
-		if (block_end == va) // grow block
-		{
-			// TODO growing through gap
+		if (b->contains(va))
+			return b;
+	}
+	return nullptr;
+}
+
+SparseMem::MemBlock* SparseMem::findBlock(uint64_t va) const
+{
+	if (last_ && last_->contains(va))
+		return last_;
 
-			// calculate new size
-			sz += b->sz;
+	MemBlock *const b = lookupBlock(va);
+	if (b && !shared_)
+		setLast(b);
+	return b;
+}
 
-			// grow block
-			b->mem = static_cast<uint8_t*>(realloc(b->mem, sz));
+SparseMem::MemBlock* SparseMem::lookupBlock(uint64_t va) const
+{
+	MemBlock *b = pt_->lookup(va >> PAGE_SHIFT);
+	if (b == PageTable::shared())
+		b = scanBlocks(va);
+	else if (b && !b->contains(va)) // page is partially covered
+		b = nullptr;
 
-			// init new mem
-			for (uint32_t a = b->sz; a < sz; ++a)
-				b->mem[a] = 0;
+	return b;
+}
 
+bool SparseMem::findExtent(uint64_t va, Extent &e) const
+{
+	const MemBlock *const b = lookupBlock(va);
+	if (!b)
+		return false;
+
+	e.va = b->va;
+	e.sz = b->sz;
+	e.mem = b->mem;
+	e.anon = b->anon;
+	e.prot = b->prot;
+	return true;
+}
+
+void SparseMem::setShared(bool b)
+{
+	shared_ = b;
+	last_ = nullptr;
+	last_va_ = 0;
+	last_rsz_ = 0;
+	last_wsz_ = 0;
+	last_mem_ = nullptr;
+}
+
+void SparseMem::setLast(MemBlock *b) const
+{
+	last_ = b;
+	last_va_ = b->va;
+	last_rsz_ = (b->prot & READ) ? b->sz : 0;
+	last_wsz_ = (b->prot & WRITE) ? b->sz : 0;
+	last_mem_ = b->mem;
+}
+
+void SparseMem::addBlock(uint64_t va, uint64_t sz, const void *data)
+{
+	// check for overlap
+	for (const auto &b : blocks_)
+	{
+		const uint64_t block_end = b->va + b->sz;
+		// TODO growing through gap
+		const uint64_t old_sz = b->sz;
+		if (block_end == va && b->prot == ALL && b->grow(old_sz + sz)) // grow block (new memory is zero)
+		{
 			if (data)
 			{
 				// copy in new data
-				const uint8_t *bdata = static_cast<const uint8_t*>(data);
-				for (uint32_t i = 0; i < sz; ++i)
-					b->mem[va - b->va + i] = bdata[i];
+				memcpy(b->mem + old_sz, data, sz);
 			}
 
-			// update block size
-			b->sz = sz;
+			mapPages(b, va, sz);
+			if (last_ == b)
+				setLast(b);
 
 			return; // done
 		}
 		// TODO other overlap cases
 	}
-	blocks_.emplace_back(new MemBlock(va, sz, data));
+	MemBlock *const b = new MemBlock(va, sz, data);
+	blocks_.emplace_back(b);
+	mapPages(b, va, sz);
 }
 
-uint64_t SparseMem::readMem(uint64_t va, uint32_t sz) const
+void SparseMem::addMapping(uint64_t va, uint64_t sz, uint8_t *mem, void *map_base, size_t map_len)
 {
-	uint64_t ret = 0;
+	MemBlock *const b = new MemBlock(va, sz, mem, std::make_shared<HostMap>(map_base, map_len), false);
+	blocks_.emplace_back(b);
+	mapPages(b, va, sz);
+}
 
+SparseMem::MemBlock* SparseMem::pageOwner(uint64_t page_num) const
+{
+	MemBlock *ret = nullptr;
 	for (const auto &b : blocks_)
 	{
-		const uint64_t block_end = b->va + b->sz;
-		// if block starts to the left, and ends past the beginning
-		if (b->va <= va && block_end > va)
+		if (!b->overlaps(page_num << PAGE_SHIFT, 1ull << PAGE_SHIFT))
+			continue;
+		if (ret)
+			return PageTable::shared();
+		ret = b;
+	}
+	return ret;
+}
+
+void SparseMem::removeRange(uint64_t va, uint64_t sz)
+{
+	if (sz == 0)
+		return;
+
+	const uint64_t end = va + sz;
+	const uint64_t page_sz = 1ull << PAGE_SHIFT;
+	std::vector<std::pair<MemBlock*, MemBlock*>> pieces; // (block split in two, its tail)
+	for (auto it = blocks_.begin(); it != blocks_.end();)
+	{
+		MemBlock *const b = *it;
+		if (!b->overlaps(va, sz))
+		{
+			++it;
+			continue;
+		}
+
+		// give back host pages wholly inside the range (if the mapping lives on in other pieces)
+		const uint64_t cut = std::max(va, b->va);
+		const uint64_t cut_end = std::min(end, b->va + b->sz);
+		const bool head = b->va < va;
+		const bool tail = b->va + b->sz > end;
+		if (head || tail || b->map.use_count() > 1)
+		{
+			const uintptr_t page = hostPageSize();
+			const uintptr_t first = (reinterpret_cast<uintptr_t>(b->mem + (cut - b->va)) + page - 1) & ~(page - 1);
+			const uintptr_t last = reinterpret_cast<uintptr_t>(b->mem + (cut_end - b->va)) & ~(page - 1);
+			if (last > first)
+				madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+		}
+
+		if (!head && !tail)
+		{
+			// wholly inside the range
+			delete b;
+			it = blocks_.erase(it);
+			continue;
+		}
+
+		if (tail)
+		{
+			const uint64_t off = end - b->va;
+			MemBlock *const t = new MemBlock(end, b->sz - off, b->mem + off, b->map, b->anon);
+			t->prot = b->prot;
+			pieces.emplace_back(b, t);
+		}
+		if (head)
+			b->sz = va - b->va; // (keeps its pages before the range)
+		else
+		{
+			delete b;
+			it = blocks_.erase(it);
+			continue;
+		}
+		++it;
+	}
+
+	// pages of the tails move over (the entries are only compared, 'b' may be gone)
+	for (const auto &bt : pieces)
+	{
+		MemBlock *const t = bt.second;
+		blocks_.emplace_back(t);
+		for (uint64_t p = t->va >> PAGE_SHIFT; p <= (t->va + t->sz - 1) >> PAGE_SHIFT; ++p)
+		{
+			if (pt_->lookup(p) == bt.first)
+				pt_->set(p, t);
+		}
+	}
+
+	// pages of the range (and the partial pages around it) are down to the blocks left
+	for (uint64_t p = va >> PAGE_SHIFT; p <= (end - 1) >> PAGE_SHIFT; ++p)
+	{
+		const bool inside = (p << PAGE_SHIFT) >= va && (p << PAGE_SHIFT) + page_sz <= end;
+		pt_->set(p, inside && pt_->lookup(p) != PageTable::shared() ? nullptr : pageOwner(p));
+	}
+	setShared(shared_); // (forget the last block hit)
+}
+
+void SparseMem::split(uint64_t va)
+{
+	MemBlock *const b = lookupBlock(va);
+	if (!b || b->va == va)
+		return;
+
+	const uint64_t off = va - b->va;
+	MemBlock *const t = new MemBlock(va, b->sz - off, b->mem + off, b->map, b->anon);
+	t->prot = b->prot;
+	b->sz = off;
+	blocks_.emplace_back(t);
+
+	// pages past the split move over, the one split may now hold both
+	for (uint64_t p = va >> PAGE_SHIFT; p <= (t->va + t->sz - 1) >> PAGE_SHIFT; ++p)
+	{
+		if (pt_->lookup(p) == b)
+			pt_->set(p, t);
+	}
+	pt_->set(va >> PAGE_SHIFT, pageOwner(va >> PAGE_SHIFT));
+}
+
+void SparseMem::protect(uint64_t va, uint64_t sz, uint32_t prot)
+{
+	if (sz == 0)
+		return;
+
+	split(va);
+	split(va + sz);
+	for (const auto &b : blocks_)
+	{
+		if (b->va >= va && b->va + b->sz <= va + sz)
+			b->prot = prot & ALL;
+	}
+	setShared(shared_); // (forget the last block hit)
+}
+
+uint32_t SparseMem::protection(uint64_t va) const
+{
+	const MemBlock *const b = lookupBlock(va);
+	return b ? b->prot : 0;
+}
+
+std::vector<SparseMem::Extent> SparseMem::extents() const
+{
+	std::vector<Extent> ret;
+	for (const auto &b : blocks_)
+	{
+		Extent e;
+		e.va = b->va;
+		e.sz = b->sz;
+		e.mem = b->mem;
+		e.anon = b->anon;
+		e.prot = b->prot;
+		ret.push_back(e);
+	}
+	return ret;
+}
+
+SparseMem::Stats SparseMem::stats() const
+{
+	Stats ret;
+	for (const auto &b : blocks_)
+	{
+		uint8_t *first = nullptr;
+		size_t len = 0;
+		b->hostSpan(first, len);
+		ret.reserved += len;
+		ret.resident += b->residentPages() * hostPageSize();
+	}
+	return ret;
+}
+
+uint64_t SparseMem::readSlow(uint64_t va, uint32_t sz) const
+{
+	uint64_t ret = 0;
+
+	const MemBlock *const b = findBlock(va);
+	if (b)
+	{
+		const uint64_t offset = va - b->va;
+		// if block covers all of access
+		if (offset + sz <= b->sz && (b->prot & READ))
+		{
+			memcpy(&ret, b->mem + offset, sz);
+			return ret;
+		}
+		//else cross block (or protected) read, one byte at a time
+		uint8_t *const bytes = reinterpret_cast<uint8_t*>(&ret);
+		for (uint32_t i = 0; i < sz; ++i)
 		{
-			// if block covers all of access
-			if (va + sz <= block_end)
+			const MemBlock *const bi = findBlock(va + i);
+			if (!bi)
 			{
-				const uint64_t offset = va - b->va;
-				memcpy(&ret, b->mem + offset, sz);
+				*err_ << " Access outside of allocated memory: "
+					 << std::hex << va + i << std::dec << ' ' << sz << std::endl;
 				return ret;
 			}
-			//else
-			std::cerr << " Cross block read" << std::endl; // TODO - handle
+			if (!(bi->prot & READ))
+			{
+				*err_ << " Read of protected memory: "
+					 << std::hex << va + i << std::dec << ' ' << sz << std::endl;
+				return ret;
+			}
+			bytes[i] = bi->mem[va + i - bi->va];
 		}
+		return ret;
 	}
 
-	std::cerr << " Access outside of allocated memory: "
+	*err_ << " Access outside of allocated memory: "
 		 << std::hex << va << std::dec << ' ' << sz << std::endl;
 
 	return ret;
 }
 
-void SparseMem::writeMem(const uint64_t va, const uint32_t sz, const uint64_t val)
+void SparseMem::writeSlow(const uint64_t va, const uint32_t sz, const uint64_t val)
 {
-	for (const auto &b : blocks_)
+	MemBlock *const b = findBlock(va);
+	if (b)
 	{
-		const uint64_t block_end = b->va + b->sz;
-		// if block starts to the left, and ends past the beginning
-		if (b->va <= va && block_end > va)
+		const uint64_t offset = va - b->va;
+		// if block covers all of access
+		if (offset + sz <= b->sz && (b->prot & WRITE))
+		{
+			memcpy(b->mem + offset, &val, sz);
+			return;
+		}
+		//else cross block (or protected) write, one byte at a time (none if any is not allowed)
+		for (uint32_t i = 0; i < sz; ++i)
 		{
-			// if block covers all of access
-			if (va + sz <= block_end)
+			const MemBlock *const bi = findBlock(va + i);
+			if (!bi)
 			{
-				const uint64_t offset = va - b->va;
-				memcpy(b->mem + offset, &val, sz);
+				*err_ << " Write access outside of allocated memory: "
+					 << std::hex << va + i << std::dec << ' ' << sz << std::endl;
+				return;
+			}
+			if (!(bi->prot & WRITE))
+			{
+				*err_ << " Write to protected memory: "
+					 << std::hex << va + i << std::dec << ' ' << sz << std::endl;
 				return;
 			}
-			//else
-			std::cerr << " Cross block write" << std::endl; // TODO - handle
 		}
+		const uint8_t *const bytes = reinterpret_cast<const uint8_t*>(&val);
+		for (uint32_t i = 0; i < sz; ++i)
+		{
+			MemBlock *const bi = findBlock(va + i);
+			bi->mem[va + i - bi->va] = bytes[i];
+		}
+		return;
 	}
 
-	std::cerr << " Write access outside of allocated memory: "
+	*err_ << " Write access outside of allocated memory: "
 		 << std::hex << va << std::dec << ' ' << sz << std::endl;
 }
 
+uint64_t SparseMem::readBlock(uint64_t va, uint64_t sz, void *dst) const
+{
+	uint8_t *const bytes = static_cast<uint8_t*>(dst);
+	uint64_t done = 0;
+	while (done < sz)
+	{
+		const MemBlock *const b = findBlock(va + done);
+		if (!b)
+		{
+			*err_ << " Access outside of allocated memory: "
+				 << std::hex << va + done << std::dec << ' ' << sz << std::endl;
+			break;
+		}
+
+		// copy up to the end of this block
+		const uint64_t offset = va + done - b->va;
+		const uint64_t ct = std::min(sz - done, b->sz - offset);
+		memcpy(bytes + done, b->mem + offset, ct);
+		done += ct;
+	}
+	return done;
+}
+
+uint64_t SparseMem::writeBlock(uint64_t va, uint64_t sz, const void *src)
+{
+	const uint8_t *const bytes = static_cast<const uint8_t*>(src);
+	uint64_t done = 0;
+	while (done < sz)
+	{
+		MemBlock *const b = findBlock(va + done);
+		if (!b)
+		{
+			*err_ << " Write access outside of allocated memory: "
+				 << std::hex << va + done << std::dec << ' ' << sz << std::endl;
+			break;
+		}
+
+		// copy up to the end of this block
+		const uint64_t offset = va + done - b->va;
+		const uint64_t ct = std::min(sz - done, b->sz - offset);
+		memcpy(b->mem + offset, bytes + done, ct);
+		done += ct;
+	}
+	return done;
+}
+
+uint8_t* SparseMem::hostPtr(uint64_t va, uint64_t sz)
+{
+	MemBlock *const b = findBlock(va);
+	if (!b)
+		return nullptr;
+
+	const uint64_t offset = va - b->va;
+	if (sz > b->sz - offset)
+		return nullptr; // spans blocks
+
+	return b->mem + offset;
 }
 
+bool SparseMem::compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val)
+{
+	const MemBlock *const b = findBlock(va);
+	if (b && (b->prot & (READ | WRITE)) != (READ | WRITE))
+	{
+		*err_ << " Atomic access to protected memory: "
+			 << std::hex << va << std::dec << ' ' << sz << std::endl;
+		return false;
+	}
+
+	uint8_t *const p = hostPtr(va, sz);
+	const bool aligned = (reinterpret_cast<uintptr_t>(p) & (sz - 1)) == 0;
+	if (p && aligned && sz == 4)
+	{
+		uint32_t e = expected;
+		return __atomic_compare_exchange_n(reinterpret_cast<uint32_t*>(p), &e, uint32_t(val), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	}
+	if (p && aligned && sz == 8)
+	{
+		return __atomic_compare_exchange_n(reinterpret_cast<uint64_t*>(p), &expected, val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	}
+
+	// misaligned (or spans blocks), not atomic
+	return ArchMem::compareExchange(va, sz, expected, val);
+}
+
+}
@@ -2,6 +2,9 @@
 #define RVFUN_SPARSE_MEM_HPP
 
 #include "arch_mem.hpp"
+#include <cstring>
+#include <iosfwd>
+#include <memory>
 #include <vector>
 
 namespace rvfun
@@ -11,16 +14,124 @@ class SparseMem : public ArchMem
 {
 public:
 	SparseMem();
+	~SparseMem();
 
-	void addBlock(uint64_t va, uint32_t sz, const void *data = nullptr);
+	/// reserve [va, va+sz) (zero pages are allocated on first touch), copying in 'data' if given
+	void addBlock(uint64_t va, uint64_t sz, const void *data = nullptr);
 
-	uint64_t readMem(uint64_t va, uint32_t sz) const override;
+	/// add a block at 'mem', inside a host mapping (which is munmap'ed once no block uses it)
+	void addMapping(uint64_t va, uint64_t sz, uint8_t *mem, void *map_base, size_t map_len);
 
-	void writeMem(uint64_t va, uint32_t sz, uint64_t val) override;
+	/// drop [va, va+sz) from all blocks (splitting any which go on past both ends)
+	void removeRange(uint64_t va, uint64_t sz);
 
-private:
+	/// set the access rights (ArchMem::READ...) of the blocks in [va, va+sz), splitting blocks
+	/// at its ends; readMem, writeMem and compareExchange check them (the block copies, for the
+	/// loader and system calls, do not)
+	void protect(uint64_t va, uint64_t sz, uint32_t prot);
+
+	// fast path (inside last block hit) is inline, for callers which bind statically
+	uint64_t readMem(uint64_t va, uint32_t sz) const override
+	{
+		const uint64_t offset = va - last_va_;
+		if (offset < last_rsz_ && sz <= last_rsz_ - offset)
+		{
+			uint64_t ret = 0;
+			memcpy(&ret, last_mem_ + offset, sz);
+			return ret;
+		}
+		return readSlow(va, sz);
+	}
+
+	void writeMem(uint64_t va, uint32_t sz, uint64_t val) override
+	{
+		const uint64_t offset = va - last_va_;
+		if (offset < last_wsz_ && sz <= last_wsz_ - offset)
+		{
+			memcpy(last_mem_ + offset, &val, sz);
+			return;
+		}
+		writeSlow(va, sz, val);
+	}
+
+	/// host memory footprint (bytes)
+	struct Stats
+	{
+		uint64_t reserved = 0; ///< address space held
+		uint64_t resident = 0; ///< pages touched so far
+	};
+	Stats stats() const;
+
+	/// host memory of one block
+	struct Extent
+	{
+		uint64_t va = 0;
+		uint64_t sz = 0;
+		uint8_t *mem = nullptr;
+		bool anon = false; ///< private zero pages (those not resident are still zero)
+		uint32_t prot = ALL; ///< access rights
+	};
+
+	/// find the block holding 'va' (without touching the last block cache)
+	///@return false if 'va' is not allocated
+	bool findExtent(uint64_t va, Extent &e) const;
+
+	///@return every block (in the order added)
+	std::vector<Extent> extents() const;
+
+	/// where messages about bad guest accesses go (default std::cerr)
+	void setErr(std::ostream *err) { err_ = err; }
+
+	/// accessed from several host threads (via SparseMemView), stop caching the last block hit
+	/// (blocks must only be added while no other thread is accessing this)
+	void setShared(bool b = true);
+
+	uint64_t readBlock(uint64_t va, uint64_t sz, void *dst) const override;
+	uint64_t writeBlock(uint64_t va, uint64_t sz, const void *src) override;
+	uint8_t* hostPtr(uint64_t va, uint64_t sz) override;
+	bool compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val) override;
+	uint32_t protection(uint64_t va) const override;
+
+private: // types
 	struct MemBlock;
+	struct PageTable;
+
+private: // methods
+	///@return block holding 'va' (or nullptr)
+	MemBlock* findBlock(uint64_t va) const;
+
+	/// as above, without the last block cache
+	MemBlock* lookupBlock(uint64_t va) const;
+
+	/// linear search (for pages holding more than one block)
+	MemBlock* scanBlocks(uint64_t va) const;
+
+	/// point page table entries for [va, va+sz) at 'b'
+	void mapPages(MemBlock *b, uint64_t va, uint64_t sz);
+
+	///@return page table entry for page 'page_num', from a search of the blocks
+	MemBlock* pageOwner(uint64_t page_num) const;
+
+	/// update last block hit
+	void setLast(MemBlock *b) const;
+
+	/// split the block holding 'va' (if it starts before it) in two at 'va'
+	void split(uint64_t va);
+
+	uint64_t readSlow(uint64_t va, uint32_t sz) const;
+	void writeSlow(uint64_t va, uint32_t sz, uint64_t val);
+
+private: // data
 	std::vector<MemBlock*> blocks_;
+	std::unique_ptr<PageTable> pt_; ///< page number to block
+	mutable MemBlock *last_ = nullptr; ///< last block hit
+	// copy of last_ extents (for inline fast path)
+	mutable uint64_t last_va_ = 0;
+	mutable uint64_t last_rsz_ = 0; ///< (0 if not readable)
+	mutable uint64_t last_wsz_ = 0; ///< (0 if not writable)
+	mutable uint8_t *last_mem_ = nullptr;
+	bool shared_ = false; ///< no last block cache
+	std::ostream *err_; ///< for bad accesses
 };
 
 } // namespace
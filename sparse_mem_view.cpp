@@ -0,0 +1,39 @@
+#include "sparse_mem_view.hpp"
+
+namespace rvfun
+{
+bool SparseMemView::refill(uint64_t va, uint32_t sz) const
+{
+	// (only blocks open to reads and writes are cached, the fast paths don't check)
+	if (!mem_.findExtent(va, cache_) || (cache_.prot & (READ | WRITE)) != (READ | WRITE))
+	{
+		cache_ = SparseMem::Extent();
+		return false;
+	}
+	return va - cache_.va + sz <= cache_.sz;
+}
+
+uint64_t SparseMemView::readSlow(uint64_t va, uint32_t sz) const
+{
+	// refill cache, unless the access spans blocks (or misses, or the block is protected)
+	if (!refill(va, sz))
+		return mem_.readMem(va, sz);
+
+	uint64_t ret = 0;
+	memcpy(&ret, cache_.mem + (va - cache_.va), sz);
+	return ret;
+}
+
+void SparseMemView::writeSlow(uint64_t va, uint32_t sz, uint64_t val)
+{
+	if (!refill(va, sz))
+	{
+		mem_.writeMem(va, sz, val);
+		return;
+	}
+
+	memcpy(cache_.mem + (va - cache_.va), &val, sz);
+}
+
+}
+
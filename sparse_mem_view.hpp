@@ -0,0 +1,75 @@
+#ifndef RVFUN_SPARSE_MEM_VIEW_HPP
+#define RVFUN_SPARSE_MEM_VIEW_HPP
+
+#include "sparse_mem.hpp"
+#include <cstring>
+
+namespace rvfun
+{
+/// One hart's access path to a shared SparseMem.
+/// Each view caches its own last block hit, so harts on different host threads
+/// don't race on the SparseMem cache (which must be disabled with setShared()).
+class SparseMemView : public ArchMem
+{
+public:
+	explicit SparseMemView(SparseMem &mem)
+	: mem_(mem)
+	{
+	}
+
+	/// forget the cached block (required after blocks are added or grow)
+	void flush() { cache_ = SparseMem::Extent(); }
+
+	SparseMem& getMem() { return mem_; }
+
+	//---from ArchMem
+	uint64_t readMem(uint64_t va, uint32_t sz) const override
+	{
+		const uint64_t offset = va - cache_.va;
+		if (offset < cache_.sz && sz <= cache_.sz - offset)
+		{
+			uint64_t ret = 0;
+			memcpy(&ret, cache_.mem + offset, sz);
+			return ret;
+		}
+		return readSlow(va, sz);
+	}
+
+	void writeMem(uint64_t va, uint32_t sz, uint64_t val) override
+	{
+		const uint64_t offset = va - cache_.va;
+		if (offset < cache_.sz && sz <= cache_.sz - offset)
+		{
+			memcpy(cache_.mem + offset, &val, sz);
+			return;
+		}
+		writeSlow(va, sz, val);
+	}
+
+	uint64_t readBlock(uint64_t va, uint64_t sz, void *dst) const override { return mem_.readBlock(va, sz, dst); }
+	uint64_t writeBlock(uint64_t va, uint64_t sz, const void *src) override { return mem_.writeBlock(va, sz, src); }
+	uint8_t* hostPtr(uint64_t va, uint64_t sz) override { return mem_.hostPtr(va, sz); }
+	uint32_t protection(uint64_t va) const override { return mem_.protection(va); }
+
+	bool compareExchange(uint64_t va, uint32_t sz, uint64_t expected, uint64_t val) override
+	{
+		return mem_.compareExchange(va, sz, expected, val);
+	}
+
+private: // methods
+	/// cache the block holding 'va'
+	///@return true if it holds all of the access
+	bool refill(uint64_t va, uint32_t sz) const;
+
+	uint64_t readSlow(uint64_t va, uint32_t sz) const;
+	void writeSlow(uint64_t va, uint32_t sz, uint64_t val);
+
+private: // data
+	SparseMem &mem_;
+	mutable SparseMem::Extent cache_; ///< last block hit
+};
+
+}
+
+#endif
+
@@ -1,6 +1,8 @@
 #ifndef RVFUN_SYSTEM_HPP
 #define RVFUN_SYSTEM_HPP
 
+#include <iosfwd>
+
 namespace rvfun
 {
 class ArchState;
@@ -10,8 +12,11 @@ class System
 {
 public:
 	virtual void exit(ArchState &state) = 0;
+	virtual void exitGroup(ArchState &state) = 0;
 	virtual void fstat(ArchState &state) = 0;
 	virtual void mmap(ArchState &state) = 0;
+	virtual void munmap(ArchState &state) = 0;
+	virtual void mprotect(ArchState &state) = 0;
 	virtual void open(ArchState &state) = 0;
 	virtual void readlinkat(ArchState &state) = 0;
 	virtual void sbrk(ArchState &state) = 0;
@@ -20,6 +25,16 @@ public:
 	virtual void read(ArchState &state) = 0;
 	virtual void write(ArchState &state) = 0;
 	virtual void writev(ArchState &state) = 0;
+	virtual void fsync(ArchState &state) = 0;
+
+	// threads
+	virtual void clone(ArchState &state) = 0;
+	virtual void futex(ArchState &state) = 0;
+	virtual void gettid(ArchState &state) = 0;
+	virtual void setTidAddress(ArchState &state) = 0;
+
+	/// for messages about the guest (unsupported calls, illegal instructions)
+	virtual std::ostream& err() = 0;
 };
 }
 
@@ -0,0 +1,126 @@
+#include "thread_pool.hpp"
+
+namespace rvfun
+{
+ThreadPool::ThreadPool(uint32_t num_threads)
+: ranges_(new Range[num_threads ? num_threads : 1])
+{
+	for (uint32_t i = 1; i < num_threads; ++i)
+		workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		stop_ = true;
+	}
+	start_cv_.notify_all();
+
+	for (auto &t : workers_)
+		t.join();
+}
+
+bool ThreadPool::pop(uint32_t self, uint32_t &i)
+{
+	Range &r = ranges_[self];
+	std::lock_guard<std::mutex> lock(r.mtx);
+	if (r.begin == r.end)
+		return false;
+
+	i = r.begin++;
+	return true;
+}
+
+bool ThreadPool::steal(uint32_t self)
+{
+	const uint32_t ct = size();
+	for (uint32_t k = 1; k < ct; ++k)
+	{
+		Range &victim = ranges_[(self + k) % ct];
+		uint32_t begin = 0;
+		uint32_t end = 0;
+		{
+			std::lock_guard<std::mutex> lock(victim.mtx);
+			if (victim.begin == victim.end)
+				continue;
+
+			// take the back half (all of it, if only one is left)
+			begin = victim.begin + (victim.end - victim.begin) / 2;
+			end = victim.end;
+			victim.end = begin;
+		}
+
+		Range &mine = ranges_[self];
+		std::lock_guard<std::mutex> lock(mine.mtx);
+		mine.begin = begin;
+		mine.end = end;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::runTasks(uint32_t self)
+{
+	uint32_t i = 0;
+	while (pop(self, i) || (steal(self) && pop(self, i)))
+		(*fn_)(i);
+}
+
+void ThreadPool::parallelFor(uint32_t n, const std::function<void(uint32_t)> &fn)
+{
+	if (workers_.empty() || n <= 1)
+	{
+		for (uint32_t i = 0; i < n; ++i)
+			fn(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		fn_ = &fn;
+
+		// even split to start
+		const uint32_t ct = size();
+		for (uint32_t t = 0; t < ct; ++t)
+		{
+			std::lock_guard<std::mutex> rlock(ranges_[t].mtx);
+			ranges_[t].begin = uint64_t(n) * t / ct;
+			ranges_[t].end = uint64_t(n) * (t + 1) / ct;
+		}
+
+		busy_ = workers_.size();
+		++gen_;
+	}
+	start_cv_.notify_all();
+
+	// help out
+	runTasks(0);
+
+	std::unique_lock<std::mutex> lock(mtx_);
+	done_cv_.wait(lock, [this] { return busy_ == 0; });
+	fn_ = nullptr;
+}
+
+void ThreadPool::workerLoop(uint32_t self)
+{
+	uint64_t seen = 0;
+	while (1)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			start_cv_.wait(lock, [&] { return stop_ || gen_ != seen; });
+			if (stop_)
+				return;
+			seen = gen_;
+		}
+
+		runTasks(self);
+
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (--busy_ == 0)
+			done_cv_.notify_one();
+	}
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef RVFUN_THREAD_POOL_HPP
+#define RVFUN_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rvfun
+{
+/// Fixed set of host threads for running parallel loops.
+/// Each thread starts with an even share of the loop, and steals half of
+/// another thread's remaining share when it runs out.
+class ThreadPool
+{
+public:
+	/// 'num_threads' includes the caller of parallelFor
+	explicit ThreadPool(uint32_t num_threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t size() const { return workers_.size() + 1; }
+
+	/// call fn(i) for each i in [0, n) (in any order), return when all are done
+	void parallelFor(uint32_t n, const std::function<void(uint32_t)> &fn);
+
+private: // types
+	/// indices [begin, end) not yet started by one thread
+	struct Range
+	{
+		std::mutex mtx;
+		uint32_t begin = 0;
+		uint32_t end = 0;
+	};
+
+private: // methods
+	void workerLoop(uint32_t self);
+	void runTasks(uint32_t self);
+
+	///@return false if thread 'self' has no work of its own
+	bool pop(uint32_t self, uint32_t &i);
+
+	///@return false if there was nothing to steal
+	bool steal(uint32_t self);
+
+private: // data
+	std::vector<std::thread> workers_;
+	std::unique_ptr<Range[]> ranges_; ///< per thread (caller is 0)
+	std::mutex mtx_;
+	std::condition_variable start_cv_;
+	std::condition_variable done_cv_;
+	const std::function<void(uint32_t)> *fn_ = nullptr;
+	uint32_t busy_ = 0; ///< workers still in this loop
+	uint64_t gen_ = 0; ///< loop count (wakes workers)
+	bool stop_ = false;
+};
+
+}
+
+#endif
+
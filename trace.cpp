@@ -0,0 +1,456 @@
+#include "trace.hpp"
+#include "arch_state.hpp"
+#include "inst.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace
+{
+using namespace rvfun;
+
+const char TRACE_MAGIC[8] = {'R', 'v', 'F', 'u', 'n', 'T', 'r', '3'};
+constexpr size_t HEADER_SZ = 16; // magic, format, padding
+constexpr size_t BUF_SZ = 64 * 1024;
+constexpr size_t RAW_SZ = 32; // unpacked record
+constexpr size_t MAX_PACKED_SZ = 48; // flags, PC, statics, EA
+constexpr size_t RAW_RANGE_SZ = 12; // address, size
+constexpr size_t MAX_VARINT_SZ = 10;
+constexpr uint32_t MAX_RANGES = ArchState::VLEN_BYTES * 8; // (an element each, VLMAX at e8 m8)
+
+enum Format : uint8_t
+{
+	FMT_RAW,
+	FMT_PACKED
+};
+
+// packed record flags
+enum : uint8_t
+{
+	F_SEQ = 1, ///< PC follows the last instruction
+	F_NEW = 2 ///< static fields follow
+};
+
+void putVarint(std::vector<uint8_t> &buf, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		buf.push_back(uint8_t(v) | 0x80);
+		v >>= 7;
+	}
+	buf.push_back(uint8_t(v));
+}
+
+uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+void putLe(std::vector<uint8_t> &buf, uint64_t v, uint32_t sz)
+{
+	for (uint32_t i = 0; i < sz; ++i)
+		buf.push_back(uint8_t(v >> (8 * i)));
+}
+
+uint64_t getLe(const uint8_t *p, uint32_t sz)
+{
+	uint64_t v = 0;
+	for (uint32_t i = 0; i < sz; ++i)
+		v |= uint64_t(p[i]) << (8 * i);
+	return v;
+}
+
+uint8_t regCode(const Inst::RegDep &d)
+{
+	switch (d.rf)
+	{
+	case Inst::RegFile::FLOAT: return uint8_t(d.reg) + TraceRecord::FP_REG;
+	case Inst::RegFile::VECTOR: return uint8_t(d.reg) + TraceRecord::VEC_REG;
+	default: return uint8_t(d.reg);
+	}
+}
+
+/// fields which only depend on the opcode
+void putStatics(std::vector<uint8_t> &buf, const TraceRecord &r)
+{
+	putLe(buf, r.opcode, 4);
+	buf.push_back(r.opc_sz);
+	buf.push_back(r.op_type);
+	buf.push_back(r.mem_sz);
+	buf.push_back(uint8_t(r.num_srcs << 4 | r.num_dsts));
+	buf.insert(buf.end(), r.srcs, r.srcs + r.num_srcs);
+	buf.insert(buf.end(), r.dsts, r.dsts + r.num_dsts);
+}
+}
+
+namespace rvfun
+{
+bool TraceRecord::isMem() const
+{
+	switch (op_type)
+	{
+	case Inst::OT_LOAD:
+	case Inst::OT_STORE:
+	case Inst::OT_LOAD_FP:
+	case Inst::OT_STORE_FP:
+	case Inst::OT_LOAD_VEC:
+	case Inst::OT_STORE_VEC:
+	case Inst::OT_ATOMIC:
+		return true;
+	}
+	return false;
+}
+
+//----------------------------------------------------------------------------
+TraceWriter::TraceWriter()
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+	close();
+}
+
+bool TraceWriter::open(const char *path, bool packed)
+{
+	close();
+
+	fd_ = ::open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd_ < 0)
+		return true;
+
+	packed_ = packed;
+	fail_ = false;
+	seen_.clear();
+	last_pc_ = 0;
+	last_ea_ = 0;
+	count_ = 0;
+
+	buf_.reserve(BUF_SZ + MAX_PACKED_SZ);
+	buf_.assign(TRACE_MAGIC, TRACE_MAGIC + sizeof(TRACE_MAGIC));
+	buf_.push_back(packed ? FMT_PACKED : FMT_RAW);
+	buf_.resize(HEADER_SZ, 0);
+	return false;
+}
+
+void TraceWriter::record(ArchState &state, const Inst &inst, uint32_t opcode, uint32_t opc_sz)
+{
+	TraceRecord r;
+	r.pc = state.getPc();
+	r.opcode = opcode;
+	r.opc_sz = opc_sz;
+	r.op_type = inst.opType();
+	if (r.isMem())
+	{
+		r.ea = inst.calcEa(state);
+		r.mem_sz = inst.opSize();
+		if (r.isVecMem())
+			inst.memRanges(state, r.ranges);
+	}
+
+	for (const Inst::RegDep &d : inst.srcs())
+	{
+		if (d.rf != Inst::RegFile::NONE)
+			r.srcs[r.num_srcs++] = regCode(d);
+	}
+	for (const Inst::RegDep &d : inst.dsts())
+	{
+		if (d.rf != Inst::RegFile::NONE)
+			r.dsts[r.num_dsts++] = regCode(d);
+	}
+
+	write(r);
+}
+
+void TraceWriter::write(const TraceRecord &r)
+{
+	if (fd_ < 0)
+		return;
+
+	if (!packed_)
+	{
+		putLe(buf_, r.pc, 8);
+		putLe(buf_, r.ea, 8);
+		putStatics(buf_, r);
+		buf_.resize(buf_.size() + RAW_SZ - 24 - r.num_srcs - r.num_dsts, 0); // pad to the full register lists
+		if (r.isVecMem())
+		{
+			putLe(buf_, r.ranges.size(), 4);
+			for (const Inst::MemRange &m : r.ranges)
+			{
+				putLe(buf_, m.va, 8);
+				putLe(buf_, m.sz, 4);
+			}
+		}
+	}
+	else
+	{
+		const size_t flags_pos = buf_.size();
+		buf_.push_back(0);
+
+		uint8_t flags = 0;
+		if (r.pc == last_pc_)
+			flags |= F_SEQ;
+		else
+			putVarint(buf_, zigzag(r.pc - last_pc_));
+
+		auto i = seen_.find(r.pc);
+		if (i == seen_.end() || i->second != r.opcode)
+		{
+			flags |= F_NEW;
+			seen_[r.pc] = r.opcode;
+			putStatics(buf_, r);
+		}
+
+		if (r.isMem())
+		{
+			putVarint(buf_, zigzag(r.ea - last_ea_));
+			last_ea_ = r.ea;
+		}
+		if (r.isVecMem())
+		{
+			// (strided and unit ops have small, repeating gaps)
+			putVarint(buf_, r.ranges.size());
+			uint64_t end = r.ea;
+			for (const Inst::MemRange &m : r.ranges)
+			{
+				putVarint(buf_, zigzag(m.va - end));
+				putVarint(buf_, m.sz);
+				end = m.va + m.sz;
+			}
+		}
+		buf_[flags_pos] = flags;
+	}
+	last_pc_ = r.pc + r.opc_sz;
+	++count_;
+
+	if (buf_.size() >= BUF_SZ)
+		flushBuf();
+}
+
+void TraceWriter::flushBuf()
+{
+	const uint8_t *p = buf_.data();
+	size_t len = buf_.size();
+	while (len && !fail_)
+	{
+		const ssize_t ret = ::write(fd_, p, len);
+		if (ret <= 0)
+			fail_ = true;
+		else
+		{
+			p += ret;
+			len -= ret;
+		}
+	}
+	buf_.clear();
+}
+
+void TraceWriter::close()
+{
+	if (fd_ < 0)
+		return;
+
+	flushBuf();
+	::close(fd_);
+	fd_ = -1;
+}
+
+//----------------------------------------------------------------------------
+TraceReader::TraceReader()
+{
+}
+
+TraceReader::~TraceReader()
+{
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+bool TraceReader::open(const char *path)
+{
+	if (fd_ >= 0)
+		::close(fd_);
+
+	buf_.clear();
+	pos_ = 0;
+	statics_.clear();
+	last_pc_ = 0;
+	last_ea_ = 0;
+	eof_ = false;
+	ok_ = true;
+
+	fd_ = ::open(path, O_RDONLY);
+	if (fd_ < 0)
+		return true;
+
+	if (!fill(HEADER_SZ) || memcmp(buf_.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+	    buf_[sizeof(TRACE_MAGIC)] > FMT_PACKED)
+	{
+		ok_ = false;
+		return true;
+	}
+	packed_ = buf_[sizeof(TRACE_MAGIC)] == FMT_PACKED;
+	pos_ = HEADER_SZ;
+	return false;
+}
+
+bool TraceReader::fill(size_t n)
+{
+	if (buf_.size() - pos_ >= n)
+		return true;
+
+	// keep the unread tail
+	buf_.erase(buf_.begin(), buf_.begin() + pos_);
+	pos_ = 0;
+	while (!eof_ && buf_.size() < BUF_SZ)
+	{
+		const size_t old_sz = buf_.size();
+		buf_.resize(BUF_SZ);
+		const ssize_t ret = ::read(fd_, buf_.data() + old_sz, BUF_SZ - old_sz);
+		buf_.resize(old_sz + (ret > 0 ? ret : 0));
+		if (ret <= 0)
+			eof_ = true;
+	}
+	return buf_.size() >= n;
+}
+
+uint64_t TraceReader::getVarint()
+{
+	uint64_t v = 0;
+	for (uint32_t shift = 0; shift < 64 && pos_ < buf_.size(); shift += 7)
+	{
+		const uint8_t b = getByte();
+		v |= uint64_t(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+			return v;
+	}
+	ok_ = false;
+	return v;
+}
+
+bool TraceReader::next(TraceRecord &r)
+{
+	if (!ok_ || fd_ < 0)
+		return false;
+
+	if (!packed_)
+	{
+		if (!fill(RAW_SZ))
+			return false;
+
+		const uint8_t *const p = buf_.data() + pos_;
+		r.pc = getLe(p, 8);
+		r.ea = getLe(p + 8, 8);
+		r.opcode = getLe(p + 16, 4);
+		r.opc_sz = p[20];
+		r.op_type = p[21];
+		r.mem_sz = p[22];
+		r.num_srcs = p[23] >> 4;
+		r.num_dsts = p[23] & 0xf;
+		if (r.num_srcs > TraceRecord::MAX_REGS || r.num_dsts > TraceRecord::MAX_REGS)
+		{
+			ok_ = false;
+			return false;
+		}
+		memcpy(r.srcs, p + 24, r.num_srcs);
+		memcpy(r.dsts, p + 24 + r.num_srcs, r.num_dsts);
+		pos_ += RAW_SZ;
+
+		r.ranges.clear();
+		if (r.isVecMem())
+		{
+			if (!fill(4))
+			{
+				ok_ = false;
+				return false;
+			}
+			const uint32_t ct = getLe(buf_.data() + pos_, 4);
+			if (ct > MAX_RANGES || !fill(4 + ct * RAW_RANGE_SZ))
+			{
+				ok_ = false;
+				return false;
+			}
+			const uint8_t *q = buf_.data() + pos_ + 4;
+			for (uint32_t i = 0; i < ct; ++i, q += RAW_RANGE_SZ)
+				r.ranges.push_back(Inst::MemRange{getLe(q, 8), getLe(q + 8, 4)});
+			pos_ += 4 + ct * RAW_RANGE_SZ;
+		}
+		return true;
+	}
+
+	// (the last record may be short)
+	fill(MAX_PACKED_SZ);
+	if (pos_ == buf_.size())
+		return false;
+
+	const uint8_t flags = getByte();
+	const uint64_t pc = (flags & F_SEQ) ? last_pc_ : last_pc_ + unzigzag(getVarint());
+
+	if (flags & F_NEW)
+	{
+		if (buf_.size() - pos_ < 8)
+		{
+			ok_ = false;
+			return false;
+		}
+		TraceRecord s;
+		s.opcode = getLe(buf_.data() + pos_, 4);
+		pos_ += 4;
+		s.opc_sz = getByte();
+		s.op_type = getByte();
+		s.mem_sz = getByte();
+		const uint8_t cts = getByte();
+		s.num_srcs = cts >> 4;
+		s.num_dsts = cts & 0xf;
+		if (s.num_srcs > TraceRecord::MAX_REGS || s.num_dsts > TraceRecord::MAX_REGS ||
+		    buf_.size() - pos_ < size_t(s.num_srcs + s.num_dsts))
+		{
+			ok_ = false;
+			return false;
+		}
+		memcpy(s.srcs, buf_.data() + pos_, s.num_srcs);
+		pos_ += s.num_srcs;
+		memcpy(s.dsts, buf_.data() + pos_, s.num_dsts);
+		pos_ += s.num_dsts;
+		statics_[pc] = s;
+		r = s;
+	}
+	else
+	{
+		auto i = statics_.find(pc);
+		if (i == statics_.end())
+		{
+			ok_ = false;
+			return false;
+		}
+		r = i->second;
+	}
+	r.pc = pc;
+
+	r.ea = 0;
+	if (r.isMem())
+	{
+		last_ea_ += unzigzag(getVarint());
+		r.ea = last_ea_;
+	}
+	if (r.isVecMem())
+	{
+		fill(MAX_VARINT_SZ);
+		const uint64_t ct = getVarint();
+		if (ct > MAX_RANGES)
+			ok_ = false;
+		uint64_t end = r.ea;
+		for (uint64_t i = 0; i < ct && ok_; ++i)
+		{
+			fill(2 * MAX_VARINT_SZ);
+			const uint64_t va = end + unzigzag(getVarint());
+			const uint64_t sz = getVarint();
+			r.ranges.push_back(Inst::MemRange{va, sz});
+			end = va + sz;
+		}
+	}
+	last_pc_ = pc + r.opc_sz;
+	return ok_;
+}
+
+}
+
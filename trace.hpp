@@ -0,0 +1,122 @@
+#ifndef RVFUN_TRACE_HPP
+#define RVFUN_TRACE_HPP
+
+#include "inst.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace rvfun
+{
+class ArchState;
+
+/// One retired instruction
+struct TraceRecord
+{
+	static constexpr uint8_t MAX_REGS = 4; ///< (RegDeps::MAX_DEPS)
+	static constexpr uint8_t FP_REG = 32; ///< added to FP register numbers
+	static constexpr uint8_t VEC_REG = 64; ///< added to vector register numbers
+
+	uint64_t pc = 0;
+	uint64_t ea = 0; ///< effective address (memory ops only)
+	uint32_t opcode = 0; ///< raw instruction bits
+	uint8_t opc_sz = 0; ///< 2 or 4 bytes
+	uint8_t op_type = 0; ///< Inst::OpType
+	uint8_t mem_sz = 0; ///< bytes accessed (memory ops only)
+	uint8_t num_srcs = 0;
+	uint8_t num_dsts = 0;
+	uint8_t srcs[MAX_REGS] = {0,};
+	uint8_t dsts[MAX_REGS] = {0,};
+	/// vector memory ops only: the bytes accessed (Inst::memRanges(), 'ea' is the base address)
+	std::vector<Inst::MemRange> ranges;
+
+	///@return true if 'op_type' accesses memory (and 'ea' is valid)
+	bool isMem() const;
+	///@return true if 'op_type' is a vector load or store (with 'ranges')
+	bool isVecMem() const { return op_type == Inst::OT_LOAD_VEC || op_type == Inst::OT_STORE_VEC; }
+};
+
+/// Writes a stream of TraceRecord to a file.
+/// Packed format: the static fields of each PC are written once (and again if the opcode
+/// changes), PC and EA are varint deltas. Typical code takes one to three bytes per instruction.
+/// Vector memory ops add a count and their ranges (varint gaps from the last one and sizes).
+/// Unpacked format: fixed size TraceRecord images (vector memory ops followed by a 4 byte
+/// count and 12 bytes per range: address and size).
+class TraceWriter
+{
+public:
+	TraceWriter();
+	~TraceWriter();
+
+	TraceWriter(const TraceWriter&) = delete;
+	TraceWriter& operator=(const TraceWriter&) = delete;
+
+	///@return true on error
+	bool open(const char *path, bool packed = true);
+
+	/// record 'inst' at the PC of 'state' (call before executing it, so the EA is right)
+	void record(ArchState &state, const Inst &inst, uint32_t opcode, uint32_t opc_sz);
+
+	void write(const TraceRecord &r);
+
+	/// write out buffered records and close the file
+	void close();
+
+	uint64_t count() const { return count_; }
+
+private: // methods
+	void flushBuf();
+
+private: // data
+	std::vector<uint8_t> buf_;
+	std::unordered_map<uint64_t, uint32_t> seen_; ///< PC to opcode (packed)
+	uint64_t last_pc_ = 0; ///< next sequential PC
+	uint64_t last_ea_ = 0;
+	uint64_t count_ = 0;
+	int fd_ = -1;
+	bool packed_ = true;
+	bool fail_ = false;
+};
+
+/// Reads files from TraceWriter
+class TraceReader
+{
+public:
+	TraceReader();
+	~TraceReader();
+
+	TraceReader(const TraceReader&) = delete;
+	TraceReader& operator=(const TraceReader&) = delete;
+
+	///@return true on error
+	bool open(const char *path);
+
+	///@return false at the end of the trace (or on a bad record, see ok())
+	bool next(TraceRecord &r);
+
+	bool ok() const { return ok_; }
+
+private: // methods
+	///@return false if fewer than 'n' bytes are left in the file
+	bool fill(size_t n);
+
+	uint8_t getByte() { return buf_[pos_++]; }
+	uint64_t getVarint();
+
+private: // data
+	std::vector<uint8_t> buf_;
+	size_t pos_ = 0;
+	std::unordered_map<uint64_t, TraceRecord> statics_; ///< by PC (packed)
+	uint64_t last_pc_ = 0;
+	uint64_t last_ea_ = 0;
+	int fd_ = -1;
+	bool packed_ = true;
+	bool eof_ = false;
+	bool ok_ = true;
+};
+
+}
+
+#endif
+
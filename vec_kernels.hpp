@@ -0,0 +1,780 @@
+#ifndef RVFUN_VEC_KERNELS_HPP
+#define RVFUN_VEC_KERNELS_HPP
+
+#include "arch_state.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace rvfun
+{
+/// vtype fields (vill is also set for the configurations which are reserved)
+struct Vtype
+{
+	static constexpr uint64_t VILL = 1ull << 63;
+	static constexpr uint32_t ELEN_BYTES = 8;
+
+	explicit Vtype(uint64_t v)
+	: vsew((v >> 3) & 7)
+	, vlmul(v & 7)
+	, vill((v & ~uint64_t(0xff)) != 0 || vsew > 3 || vlmul == 4 ||
+	       (vlmul > 4 && (1u << vsew) > ELEN_BYTES >> (8 - vlmul))) // (SEW > LMUL * ELEN)
+	{
+	}
+
+	uint32_t sewBytes() const { return 1u << vsew; }
+
+	///@return log2 of LMUL (-3 to 3)
+	int32_t lmulLog2() const { return vlmul < 4 ? int32_t(vlmul) : int32_t(vlmul) - 8; }
+
+	/// registers in a group (1 for fractional LMUL)
+	uint32_t groupRegs() const { return vlmul < 4 ? 1u << vlmul : 1; }
+
+	/// elements in a group
+	uint32_t vlmax() const
+	{
+		return vlmul < 4 ? (ArchState::VLEN_BYTES << vlmul) >> vsew : (ArchState::VLEN_BYTES >> (8 - vlmul)) >> vsew;
+	}
+
+	uint32_t vsew; ///< log2 of SEW in bytes
+	uint32_t vlmul;
+	bool vill;
+};
+
+/// Operands of a vector kernel, for elements [0, vl)
+struct VecArgs
+{
+	uint8_t *vd = nullptr;
+	const uint8_t *vs2 = nullptr;
+	const uint8_t *vs1 = nullptr; ///< nullptr for a scalar operand
+	const uint8_t *mask = nullptr; ///< v0, or nullptr if unmasked
+	uint64_t scalar = 0; ///< (.vx .vi .vf) scalar operand bits (the low SEW bits are used)
+	uint32_t vl = 0;
+	uint32_t vlmax = 0;
+};
+
+/// run a vector instruction at one SEW
+///@return scalar result (for the ops which write an x or f register)
+typedef uint64_t (*VecKernel)(const VecArgs &a);
+
+//---mask registers (one bit per element)
+inline bool maskBit(const uint8_t *m, uint32_t i)
+{
+	return (m[i >> 3] >> (i & 7)) & 1;
+}
+
+/// 'n' (up to 64) mask bits from bit 'i' (which must not cross a 64 bit word)
+inline uint64_t getMaskBits(const uint8_t *m, uint32_t i, uint32_t n)
+{
+	uint64_t w;
+	memcpy(&w, m + (i >> 6) * 8, sizeof(w));
+	w >>= i & 63;
+	return n < 64 ? w & ((1ull << n) - 1) : w;
+}
+
+/// replace the bits selected by 'sel' from bit 'i' with 'bits' (which must not cross a 64 bit word)
+inline void putMaskBits(uint8_t *m, uint32_t i, uint64_t bits, uint64_t sel)
+{
+	uint8_t *const p = m + (i >> 6) * 8;
+	const uint32_t sh = i & 63;
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	w = (w & ~(sel << sh)) | ((bits & sel) << sh);
+	memcpy(p, &w, sizeof(w));
+}
+
+/// of the 'n' elements from 'i', those below 'vl' and (if there is a 'mask') set in it
+inline uint64_t activeBits(const uint8_t *mask, uint32_t i, uint32_t n, uint32_t vl)
+{
+	if (vl - i < n)
+		n = vl - i;
+	uint64_t sel = n < 64 ? (1ull << n) - 1 : ~0ull;
+	if (mask)
+		sel &= getMaskBits(mask, i, 64);
+	return sel;
+}
+
+//---element types
+/// signed integer the size of T (the lane type of comparison results)
+template<uint32_t SZ> struct IntOfSize;
+template<> struct IntOfSize<1> { typedef int8_t type; };
+template<> struct IntOfSize<2> { typedef int16_t type; };
+template<> struct IntOfSize<4> { typedef int32_t type; };
+template<> struct IntOfSize<8> { typedef int64_t type; };
+
+/// float type the size of integer T
+template<class T> struct FloatOf;
+template<> struct FloatOf<uint32_t> { typedef float type; };
+template<> struct FloatOf<uint64_t> { typedef double type; };
+
+/// element type of SIMD vector V
+template<class V>
+struct LaneOf
+{
+	typedef typename std::remove_reference<decltype(std::declval<V&>()[0])>::type type;
+};
+
+/// One vector register of T as a host SIMD register (with the GCC vector extensions, which compile
+/// to SSE2 or NEON), so an element loop costs one host op per register of the group.
+template<class T>
+struct VecChunk
+{
+	typedef T V __attribute__((vector_size(ArchState::VLEN_BYTES)));
+	typedef typename IntOfSize<sizeof(T)>::type I;
+	typedef I M __attribute__((vector_size(ArchState::VLEN_BYTES))); ///< lanes all ones or zero
+	static constexpr uint32_t N = ArchState::VLEN_BYTES / sizeof(T); ///< lanes
+
+	static V load(const uint8_t *p)
+	{
+		V v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	/// every lane 'x' (by lane, as V{} + x would make -0 into +0)
+	static V broadcast(T x)
+	{
+		V v;
+		for (uint32_t j = 0; j < N; ++j)
+			v[j] = x;
+		return v;
+	}
+
+	static V splat(uint64_t bits)
+	{
+		T x;
+		memcpy(&x, &bits, sizeof(x)); // (low bits)
+		return broadcast(x);
+	}
+
+	/// lanes of the chunk at element 'i' which are below 'vl' and (if there is a 'mask') set in it
+	static M active(const uint8_t *mask, uint32_t i, uint32_t vl)
+	{
+		const uint64_t bits = activeBits(mask, i, N, vl);
+
+		// each lane tests its bit of a splat (byte lanes 8 to 15 of the next byte), so this folds to SIMD ops
+		M upper, bit;
+		for (uint32_t j = 0; j < N; ++j)
+		{
+			upper[j] = -I(j >= 8);
+			bit[j] = I(1u << (j & 7));
+		}
+		const M x = ((M{} + I(bits)) & ~upper) | ((M{} + I(bits >> 8)) & upper);
+		return (x & bit) != 0;
+	}
+
+	/// write the active lanes of 'r' to the chunk at element 'i' of 'vd' (the others are undisturbed)
+	static void put(uint8_t *vd, uint32_t i, V r, const uint8_t *mask, uint32_t vl)
+	{
+		uint8_t *const p = vd + i * sizeof(T);
+		if (!mask && i + N <= vl)
+		{
+			memcpy(p, &r, sizeof(r)); // (the whole chunk)
+			return;
+		}
+
+		const M m = active(mask, i, vl);
+		M old, res;
+		memcpy(&old, p, sizeof(old));
+		memcpy(&res, &r, sizeof(res));
+		res = (res & m) | (old & ~m);
+		memcpy(p, &res, sizeof(res));
+	}
+
+	static void put(const VecArgs &a, uint32_t i, V r) { put(a.vd, i, r, a.mask, a.vl); }
+};
+
+//---kernels, each for elements of type T (the signedness picks the form of the op)
+/// vd[i] = op(vs2[i], vs1[i] or the scalar)
+template<class T, class Op>
+struct VecBinary
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		const typename C::V s = C::splat(a.scalar);
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+		{
+			const typename C::V x = C::load(a.vs2 + i * sizeof(T));
+			C::put(a, i, Op()(x, a.vs1 ? C::load(a.vs1 + i * sizeof(T)) : s));
+		}
+		return 0;
+	}
+};
+
+/// vd[i] = op(vd[i], vs2[i], vs1[i] or the scalar) (multiply-add)
+template<class T, class Op>
+struct VecTernary
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		const typename C::V s = C::splat(a.scalar);
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+		{
+			const typename C::V d = C::load(a.vd + i * sizeof(T));
+			const typename C::V x = C::load(a.vs2 + i * sizeof(T));
+			C::put(a, i, Op()(d, x, a.vs1 ? C::load(a.vs1 + i * sizeof(T)) : s));
+		}
+		return 0;
+	}
+};
+
+/// vd[i] = op(vs2[i]), one lane at a time (conversions and square roots)
+template<class T, class Op>
+struct VecUnary
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+		{
+			const typename C::V x = C::load(a.vs2 + i * sizeof(T));
+			typename C::V r;
+			for (uint32_t j = 0; j < C::N; ++j)
+				r[j] = Op()(x[j]);
+			C::put(a, i, r);
+		}
+		return 0;
+	}
+};
+
+/// mask vd[i] = op(vs2[i], vs1[i] or the scalar)
+template<class T, class Op>
+struct VecCompare
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		const typename C::V s = C::splat(a.scalar);
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+		{
+			const auto c = Op()(C::load(a.vs2 + i * sizeof(T)), a.vs1 ? C::load(a.vs1 + i * sizeof(T)) : s);
+			uint64_t bits = 0;
+			for (uint32_t j = 0; j < C::N; ++j)
+				bits |= uint64_t(c[j] & 1) << j;
+			putMaskBits(a.vd, i, bits, activeBits(a.mask, i, C::N, a.vl));
+		}
+		return 0;
+	}
+};
+
+/// vd[0] = op(vs1[0], vs2[i]...) over the active elements, in any order
+template<class T, class Op>
+struct VecReduce
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		typedef typename C::V V;
+		if (a.vl == 0)
+			return 0; // (vd is not written)
+
+		const V ident = C::broadcast(Op::template identity<T>());
+		V acc = ident;
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+		{
+			V x = C::load(a.vs2 + i * sizeof(T));
+			if (a.mask || i + C::N > a.vl)
+				x = C::active(a.mask, i, a.vl) ? x : ident;
+			acc = Op()(acc, x);
+		}
+
+		V r = C::load(a.vs1);
+		for (uint32_t j = 0; j < C::N; ++j)
+			r = Op()(r, C::broadcast(acc[j]));
+		memcpy(a.vd, &r, sizeof(T));
+		return 0;
+	}
+};
+
+/// vd[0] = vs1[0] + vs2[0] + ... over the active elements, in element order (vfredosum)
+template<class T, class Op>
+struct VecReduceOrdered
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		if (a.vl == 0)
+			return 0;
+
+		T r;
+		memcpy(&r, a.vs1, sizeof(r));
+		for (uint32_t i = 0; i < a.vl; ++i)
+		{
+			T x;
+			memcpy(&x, a.vs2 + i * sizeof(T), sizeof(x));
+			if (!a.mask || maskBit(a.mask, i))
+				r += x;
+		}
+		memcpy(a.vd, &r, sizeof(r));
+		return 0;
+	}
+};
+
+/// vd[i] = (vs1[i] or the scalar) where v0 is set (or unmasked), else vs2[i] (vmerge, vmv.v)
+template<class T, class Op>
+struct VecMerge
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		const typename C::V s = C::splat(a.scalar);
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+		{
+			typename C::V y = a.vs1 ? C::load(a.vs1 + i * sizeof(T)) : s;
+			if (a.mask)
+				y = C::active(a.mask, i, ~0u) ? y : C::load(a.vs2 + i * sizeof(T));
+			C::put(a.vd, i, y, nullptr, a.vl); // (v0 selects, it doesn't mask)
+		}
+		return 0;
+	}
+};
+
+/// vd[i] = i
+template<class T, class Op>
+struct VecId
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		typedef VecChunk<T> C;
+		typename C::V idx;
+		for (uint32_t j = 0; j < C::N; ++j)
+			idx[j] = T(j);
+		for (uint32_t i = 0; i < a.vl; i += C::N)
+			C::put(a, i, idx + T(i));
+		return 0;
+	}
+};
+
+/// vd[i + scalar] = vs2[i] (vslideup)
+template<class T, class Op>
+struct VecSlideUp
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		for (uint64_t i = a.scalar; i < a.vl; ++i)
+		{
+			if (!a.mask || maskBit(a.mask, i))
+				memcpy(a.vd + i * sizeof(T), a.vs2 + (i - a.scalar) * sizeof(T), sizeof(T));
+		}
+		return 0;
+	}
+};
+
+/// vd[i] = vs2[i + scalar] (0 past vlmax) (vslidedown)
+template<class T, class Op>
+struct VecSlideDown
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		// (in element order, since vd may be vs2)
+		for (uint32_t i = 0; i < a.vl; ++i)
+		{
+			if (a.mask && !maskBit(a.mask, i))
+				continue;
+			T x = 0;
+			if (a.scalar < a.vlmax - i)
+				memcpy(&x, a.vs2 + (i + a.scalar) * sizeof(T), sizeof(T));
+			memcpy(a.vd + i * sizeof(T), &x, sizeof(T));
+		}
+		return 0;
+	}
+};
+
+/// vd[0] = scalar, vd[i + 1] = vs2[i] (vslide1up)
+template<class T, class Op>
+struct VecSlide1Up
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		for (uint32_t i = 0; i < a.vl; ++i)
+		{
+			if (!a.mask || maskBit(a.mask, i))
+				memcpy(a.vd + i * sizeof(T), i == 0 ? reinterpret_cast<const uint8_t*>(&a.scalar) : a.vs2 + (i - 1) * sizeof(T), sizeof(T));
+		}
+		return 0;
+	}
+};
+
+/// vd[i] = vs2[i + 1], vd[vl - 1] = scalar (vslide1down)
+template<class T, class Op>
+struct VecSlide1Down
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		for (uint32_t i = 0; i < a.vl; ++i)
+		{
+			if (!a.mask || maskBit(a.mask, i))
+				memcpy(a.vd + i * sizeof(T), i + 1 == a.vl ? reinterpret_cast<const uint8_t*>(&a.scalar) : a.vs2 + (i + 1) * sizeof(T), sizeof(T));
+		}
+		return 0;
+	}
+};
+
+/// vs2[0] (sign extended for signed T) (vmv.x.s, vfmv.f.s)
+template<class T, class Op>
+struct VecMvXS
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		T x;
+		memcpy(&x, a.vs2, sizeof(x));
+		return uint64_t(x);
+	}
+};
+
+/// vd[0] = scalar (vmv.s.x, vfmv.s.f)
+template<class T, class Op>
+struct VecMvSX
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		if (a.vl != 0)
+			memcpy(a.vd, &a.scalar, sizeof(T));
+		return 0;
+	}
+};
+
+/// mask vd = op(vs2, vs1), a 64 bit word at a time
+template<class T, class Op>
+struct VecMaskLogic
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		for (uint32_t i = 0; i < a.vl; i += 64)
+			putMaskBits(a.vd, i, Op()(getMaskBits(a.vs2, i, 64), getMaskBits(a.vs1, i, 64)), activeBits(nullptr, i, 64, a.vl));
+		return 0;
+	}
+};
+
+/// active elements set in mask vs2 (vcpop.m)
+template<class T, class Op>
+struct VecCpop
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		uint64_t ct = 0;
+		for (uint32_t i = 0; i < a.vl; i += 64)
+			ct += __builtin_popcountll(getMaskBits(a.vs2, i, 64) & activeBits(a.mask, i, 64, a.vl));
+		return ct;
+	}
+};
+
+/// first active element set in mask vs2, or -1 (vfirst.m)
+template<class T, class Op>
+struct VecFirst
+{
+	static uint64_t run(const VecArgs &a)
+	{
+		for (uint32_t i = 0; i < a.vl; i += 64)
+		{
+			const uint64_t bits = getMaskBits(a.vs2, i, 64) & activeBits(a.mask, i, 64, a.vl);
+			if (bits)
+				return i + __builtin_ctzll(bits);
+		}
+		return ~0ull;
+	}
+};
+
+//---kernel tables by vsew
+template<template<class, class> class K, class Op>
+struct UintKernels
+{
+	static constexpr VecKernel k[4] = {&K<uint8_t, Op>::run, &K<uint16_t, Op>::run, &K<uint32_t, Op>::run, &K<uint64_t, Op>::run};
+};
+template<template<class, class> class K, class Op>
+constexpr VecKernel UintKernels<K, Op>::k[4];
+
+template<template<class, class> class K, class Op>
+struct IntKernels
+{
+	static constexpr VecKernel k[4] = {&K<int8_t, Op>::run, &K<int16_t, Op>::run, &K<int32_t, Op>::run, &K<int64_t, Op>::run};
+};
+template<template<class, class> class K, class Op>
+constexpr VecKernel IntKernels<K, Op>::k[4];
+
+/// (no half precision)
+template<template<class, class> class K, class Op>
+struct FpKernels
+{
+	static constexpr VecKernel k[4] = {nullptr, nullptr, &K<float, Op>::run, &K<double, Op>::run};
+};
+template<template<class, class> class K, class Op>
+constexpr VecKernel FpKernels<K, Op>::k[4];
+
+/// FP ops on the raw bits
+template<template<class, class> class K, class Op>
+struct FpBitsKernels
+{
+	static constexpr VecKernel k[4] = {nullptr, nullptr, &K<uint32_t, Op>::run, &K<uint64_t, Op>::run};
+};
+template<template<class, class> class K, class Op>
+constexpr VecKernel FpBitsKernels<K, Op>::k[4];
+
+//---ops (on SIMD vectors, or scalars where noted)
+struct OpNone {};
+
+/// (the FP identity is -0)
+struct OpAdd
+{
+	template<class T> static T identity() { return T(-T(0)); }
+	template<class V> V operator()(V a, V b) const { return a + b; }
+};
+
+struct OpSub { template<class V> V operator()(V a, V b) const { return a - b; } };
+struct OpRsub { template<class V> V operator()(V a, V b) const { return b - a; } };
+struct OpMul { template<class V> V operator()(V a, V b) const { return a * b; } };
+struct OpFdiv { template<class V> V operator()(V a, V b) const { return a / b; } };
+struct OpFrdiv { template<class V> V operator()(V a, V b) const { return b / a; } };
+
+/// (also on mask words)
+struct OpAnd
+{
+	template<class T> static T identity() { return T(~T(0)); }
+	template<class V> V operator()(V a, V b) const { return a & b; }
+};
+
+struct OpOr
+{
+	template<class T> static T identity() { return T(0); }
+	template<class V> V operator()(V a, V b) const { return a | b; }
+};
+
+struct OpXor
+{
+	template<class T> static T identity() { return T(0); }
+	template<class V> V operator()(V a, V b) const { return a ^ b; }
+};
+
+// (mask words)
+struct OpAndn { template<class V> V operator()(V a, V b) const { return a & ~b; } };
+struct OpOrn { template<class V> V operator()(V a, V b) const { return a | ~b; } };
+struct OpNand { template<class V> V operator()(V a, V b) const { return ~(a & b); } };
+struct OpNor { template<class V> V operator()(V a, V b) const { return ~(a | b); } };
+struct OpXnor { template<class V> V operator()(V a, V b) const { return ~(a ^ b); } };
+
+/// (integers)
+struct OpMin
+{
+	template<class T> static T identity() { return std::numeric_limits<T>::max(); }
+	template<class V> V operator()(V a, V b) const { return a < b ? a : b; }
+};
+
+struct OpMax
+{
+	template<class T> static T identity() { return std::numeric_limits<T>::min(); }
+	template<class V> V operator()(V a, V b) const { return a > b ? a : b; }
+};
+
+/// bits of FP vector V as integer lanes
+template<class V>
+struct BitsOf
+{
+	typedef typename IntOfSize<sizeof(typename LaneOf<V>::type)>::type I;
+	typedef I type __attribute__((vector_size(sizeof(V))));
+};
+
+/// (a NaN operand gives the other one, and -0 is below +0)
+struct OpFmin
+{
+	template<class T> static T identity() { return std::numeric_limits<T>::quiet_NaN(); }
+	template<class V> V operator()(V a, V b) const
+	{
+		typedef typename BitsOf<V>::type M;
+		const V r = a < b ? a : a == b ? V(M(a) | M(b)) : b; // (equal bits, but for the sign of zeros)
+		return b != b ? a : a != a ? b : r;
+	}
+};
+
+struct OpFmax
+{
+	template<class T> static T identity() { return std::numeric_limits<T>::quiet_NaN(); }
+	template<class V> V operator()(V a, V b) const
+	{
+		typedef typename BitsOf<V>::type M;
+		const V r = a > b ? a : a == b ? V(M(a) & M(b)) : b;
+		return b != b ? a : a != a ? b : r;
+	}
+};
+
+/// (shift count is the low log2(SEW) bits, arithmetic for signed lanes)
+struct OpShl
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		return a << (b & typename LaneOf<V>::type(sizeof(a[0]) * 8 - 1));
+	}
+};
+
+struct OpShr
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		return a >> (b & typename LaneOf<V>::type(sizeof(a[0]) * 8 - 1));
+	}
+};
+
+/// (by zero gives all ones, overflow gives the dividend)
+struct OpDiv
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		typedef typename LaneOf<V>::type T;
+		V r;
+		for (uint32_t j = 0; j < sizeof(V) / sizeof(T); ++j)
+		{
+			if (b[j] == 0)
+				r[j] = T(~T(0));
+			else if (std::is_signed<T>::value && a[j] == std::numeric_limits<T>::min() && b[j] == T(-1))
+				r[j] = a[j];
+			else
+				r[j] = a[j] / b[j];
+		}
+		return r;
+	}
+};
+
+/// (by zero gives the dividend, overflow gives 0)
+struct OpRem
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		typedef typename LaneOf<V>::type T;
+		V r;
+		for (uint32_t j = 0; j < sizeof(V) / sizeof(T); ++j)
+		{
+			if (b[j] == 0)
+				r[j] = a[j];
+			else if (std::is_signed<T>::value && a[j] == std::numeric_limits<T>::min() && b[j] == T(-1))
+				r[j] = 0;
+			else
+				r[j] = a[j] % b[j];
+		}
+		return r;
+	}
+};
+
+/// high half of the product (signed or unsigned by the lanes)
+struct OpMulh
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		typedef typename LaneOf<V>::type T;
+		V r;
+		for (uint32_t j = 0; j < sizeof(V) / sizeof(T); ++j)
+			r[j] = T((__int128(a[j]) * __int128(b[j])) >> (8 * sizeof(T)));
+		return r;
+	}
+};
+
+/// high half of signed 'a' times unsigned 'b'
+struct OpMulhsu
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		typedef typename LaneOf<V>::type T;
+		typedef typename std::make_unsigned<T>::type U;
+		V r;
+		for (uint32_t j = 0; j < sizeof(V) / sizeof(T); ++j)
+			r[j] = T((__int128(a[j]) * __int128(U(b[j]))) >> (8 * sizeof(T)));
+		return r;
+	}
+};
+
+// multiply-add (d is vd, s2 is vs2, s1 is vs1 or the scalar)
+struct OpMacc { template<class V> V operator()(V d, V s2, V s1) const { return s1 * s2 + d; } };
+struct OpNmsac { template<class V> V operator()(V d, V s2, V s1) const { return -(s1 * s2) + d; } };
+struct OpMadd { template<class V> V operator()(V d, V s2, V s1) const { return s1 * d + s2; } };
+struct OpNmsub { template<class V> V operator()(V d, V s2, V s1) const { return -(s1 * d) + s2; } };
+struct OpFnmacc { template<class V> V operator()(V d, V s2, V s1) const { return -(s1 * s2) - d; } };
+struct OpFmsac { template<class V> V operator()(V d, V s2, V s1) const { return s1 * s2 - d; } };
+struct OpFnmadd { template<class V> V operator()(V d, V s2, V s1) const { return -(s1 * d) - s2; } };
+struct OpFmsub { template<class V> V operator()(V d, V s2, V s1) const { return s1 * d - s2; } };
+
+// comparisons (all ones lanes where true)
+struct OpEq { template<class V> auto operator()(V a, V b) const -> decltype(a == b) { return a == b; } };
+struct OpNe { template<class V> auto operator()(V a, V b) const -> decltype(a != b) { return a != b; } };
+struct OpLt { template<class V> auto operator()(V a, V b) const -> decltype(a < b) { return a < b; } };
+struct OpLe { template<class V> auto operator()(V a, V b) const -> decltype(a <= b) { return a <= b; } };
+struct OpGt { template<class V> auto operator()(V a, V b) const -> decltype(a > b) { return a > b; } };
+struct OpGe { template<class V> auto operator()(V a, V b) const -> decltype(a >= b) { return a >= b; } };
+
+// sign injection (on FP bits)
+struct OpSgnj
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		const typename LaneOf<V>::type sign = typename LaneOf<V>::type(1) << (sizeof(a[0]) * 8 - 1);
+		return (a & ~sign) | (b & sign);
+	}
+};
+
+struct OpSgnjn
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		const typename LaneOf<V>::type sign = typename LaneOf<V>::type(1) << (sizeof(a[0]) * 8 - 1);
+		return (a & ~sign) | (~b & sign);
+	}
+};
+
+struct OpSgnjx
+{
+	template<class V> V operator()(V a, V b) const
+	{
+		const typename LaneOf<V>::type sign = typename LaneOf<V>::type(1) << (sizeof(a[0]) * 8 - 1);
+		return a ^ (b & sign);
+	}
+};
+
+// lane ops on FP bits (for VecUnary)
+struct OpFsqrt
+{
+	template<class U> U operator()(U bits) const
+	{
+		typename FloatOf<U>::type f;
+		memcpy(&f, &bits, sizeof(f));
+		f = std::sqrt(f);
+		memcpy(&bits, &f, sizeof(f));
+		return bits;
+	}
+};
+
+/// FP to integer, saturated (NaN gives the largest), truncated if RTZ (else rounded in the host mode)
+template<bool SIGNED, bool RTZ>
+struct OpCvtToInt
+{
+	template<class U> U operator()(U bits) const
+	{
+		typedef typename FloatOf<U>::type F;
+		typedef typename std::conditional<SIGNED, typename std::make_signed<U>::type, U>::type I;
+		F f;
+		memcpy(&f, &bits, sizeof(f));
+		f = RTZ ? std::trunc(f) : std::nearbyint(f);
+		if (std::isnan(f) || f >= F(std::numeric_limits<I>::max()))
+			return U(std::numeric_limits<I>::max());
+		if (f <= F(std::numeric_limits<I>::min()))
+			return U(std::numeric_limits<I>::min());
+		return U(I(f));
+	}
+};
+
+/// integer to FP
+template<bool SIGNED>
+struct OpCvtFromInt
+{
+	template<class U> U operator()(U bits) const
+	{
+		typedef typename std::conditional<SIGNED, typename std::make_signed<U>::type, U>::type I;
+		const typename FloatOf<U>::type f = I(bits);
+		memcpy(&bits, &f, sizeof(f));
+		return bits;
+	}
+};
+
+}
+
+#endif